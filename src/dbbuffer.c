@@ -39,182 +39,1202 @@
 #include "dbbuffer.h"
 #include "vmtree.h"
 
+/**
+@brief     	Allocates buffer structures and divides storage into data, FTL table, delta, sorted run, write-ahead log, and checkpoint pages. Does not change storage.
+@param     	state
+                DBbuffer state structure
+*/
+void dbbufferSetup(dbbuffer *state)
+{
+	printf("Initializing buffer.\n");
+	printf("Buffer size: %d  Page size: %d\n", state->numPages, state->pageSize);			
+	
+	/* Set during recovery if database already exists. */
+	state->nextPageId = 0;
+	state->nextPageWriteId = 0;
+	
+	state->numReads = 0;
+	state->numWrites = 0;
+	state->numOverWrites = 0;
+	state->numMultiWrites = 0;
+	state->numMoves = 0;
+	state->bufferHits = 0;
+	state->lastHit = 0;
+	state->nextBufferPage = 1;
+	// state->endDataPage = state->storage->size;	
+	/* Ensure end data page is a multiple of the block size */
+	state->endDataPage = (state->storage->size / state->eraseSizeInPages) * state->eraseSizeInPages;
+	state->endDataPage--;
+
+	/* Reserve two checkpoint slots of whole erase blocks at end of physical storage */
+	state->checkpointStart = 0;
+	if (state->checkpointPages > 0)
+	{
+		state->checkpointPages = (state->checkpointPages + state->eraseSizeInPages - 1) / state->eraseSizeInPages * state->eraseSizeInPages;
+		if (2*state->checkpointPages >= state->endDataPage)
+		{
+			printf("Storage too small for checkpoints.\n");
+			state->checkpointPages = 0;
+		}
+		else
+		{
+			state->endDataPage -= 2*state->checkpointPages;
+			state->checkpointStart = state->endDataPage+1;
+			printf("Checkpoint pages: %lu  Start: %lu\n", 2*state->checkpointPages, state->checkpointStart);
+		}
+	}
+
+	/* Reserve write-ahead log of whole erase blocks before checkpoint slots. Log is only recovered using a checkpoint. */
+	state->walStart = 0;
+	if (state->walPages > 0)
+	{
+		state->walPages = (state->walPages + state->eraseSizeInPages - 1) / state->eraseSizeInPages * state->eraseSizeInPages;
+		if (state->checkpointPages == 0 || state->walPages >= state->endDataPage)
+		{
+			printf("Write-ahead log requires checkpoints and space for log.\n");
+			state->walPages = 0;
+		}
+		else
+		{
+			state->endDataPage -= state->walPages;
+			state->walStart = state->endDataPage+1;
+			printf("Write-ahead log pages: %lu  Start: %lu\n", state->walPages, state->walStart);
+		}
+	}
+
+	/* Reserve whole erase blocks for sorted runs of log buffer records. Runs are rewritten from the start after they are compacted. */
+	state->runStart = 0;
+	if (state->runPages > 0)
+	{
+		state->runPages = (state->runPages + state->eraseSizeInPages - 1) / state->eraseSizeInPages * state->eraseSizeInPages;
+		if (state->runPages >= state->endDataPage)
+		{
+			printf("Storage too small for sorted runs.\n");
+			state->runPages = 0;
+		}
+		else
+		{
+			state->endDataPage -= state->runPages;
+			state->runStart = state->endDataPage+1;
+			printf("Sorted run pages: %lu  Start: %lu\n", state->runPages, state->runStart);
+		}
+	}
+
+	/* Reserve whole erase blocks for delta pages. Delta pages are written in a circle and an erase block is erased before it is reused. */
+	state->deltaStart = 0;
+	if (state->deltaPages > 0)
+	{
+		state->deltaPages = (state->deltaPages + state->eraseSizeInPages - 1) / state->eraseSizeInPages * state->eraseSizeInPages;
+		if (state->deltaPages >= state->endDataPage)
+		{
+			printf("Storage too small for delta pages.\n");
+			state->deltaPages = 0;
+		}
+		else
+		{
+			state->endDataPage -= state->deltaPages;
+			state->deltaStart = state->endDataPage+1;
+			printf("Delta pages: %lu  Start: %lu\n", state->deltaPages, state->deltaStart);
+		}
+	}
+
+	/* FTL: page ids are logical. Reserve physical pages for indirection table and for writing a page before its old copy is released. */
+	state->ftlDirectory = NULL;
+	state->ftlCache = NULL;
+	state->ftlCacheTablePage = NULL;
+	state->ftlCacheDirty = NULL;
+	state->ftlCacheTick = NULL;
+	state->ftlFreePhysical = NULL;
+	state->ftlReleased = NULL;
+	state->ftlAccessTick = 0;
+	state->ftlNextPhysicalPage = 0;
+	state->numTableReads = 0;
+	state->numTableWrites = 0;
+	if (state->ftlCachePages > 0)
+	{
+		state->ftlEndPhysicalPage = state->endDataPage;
+		state->ftlEntriesPerPage = state->pageSize / sizeof(id_t);
+		state->ftlNumTablePages = (state->ftlEndPhysicalPage + state->ftlEntriesPerPage) / state->ftlEntriesPerPage;
+		state->endDataPage = ((state->ftlEndPhysicalPage + 1 - state->ftlNumTablePages - state->eraseSizeInPages) / state->eraseSizeInPages) * state->eraseSizeInPages - 1;
+
+		state->ftlDirectory = malloc(sizeof(id_t)*state->ftlNumTablePages);
+		state->ftlCache = malloc((size_t) state->ftlCachePages * state->pageSize);
+		state->ftlCacheTablePage = malloc(sizeof(id_t)*state->ftlCachePages);
+		state->ftlCacheDirty = malloc(sizeof(uint8_t)*state->ftlCachePages);
+		state->ftlCacheTick = malloc(sizeof(id_t)*state->ftlCachePages);
+		state->ftlFreePhysical = malloc(sizeof(uint8_t)*(state->ftlEndPhysicalPage/8+1));
+		if (state->checkpointPages > 0)
+			state->ftlReleased = malloc(sizeof(uint8_t)*(state->ftlEndPhysicalPage/8+1));
+		if (state->ftlDirectory == NULL || state->ftlCache == NULL || state->ftlCacheTablePage == NULL || state->ftlCacheDirty == NULL
+			|| state->ftlCacheTick == NULL || state->ftlFreePhysical == NULL || (state->checkpointPages > 0 && state->ftlReleased == NULL))
+		{
+			printf("Failed to allocate FTL indirection table.\n");
+			free(state->ftlDirectory);
+			free(state->ftlCache);
+			free(state->ftlCacheTablePage);
+			free(state->ftlCacheDirty);
+			free(state->ftlCacheTick);
+			free(state->ftlFreePhysical);
+			free(state->ftlReleased);
+			state->ftlReleased = NULL;
+			state->ftlCachePages = 0;
+			state->endDataPage = state->ftlEndPhysicalPage;
+		}
+	}
+	if (state->ftlCachePages > 0)
+	{
+		memset(state->ftlDirectory, 0xFF, sizeof(id_t)*state->ftlNumTablePages);
+		memset(state->ftlCacheTablePage, 0xFF, sizeof(id_t)*state->ftlCachePages);
+		memset(state->ftlCacheDirty, 0, sizeof(uint8_t)*state->ftlCachePages);
+		memset(state->ftlCacheTick, 0, sizeof(id_t)*state->ftlCachePages);
+		memset(state->ftlFreePhysical, 0xFF, sizeof(uint8_t)*(state->ftlEndPhysicalPage/8+1));
+		if (state->ftlReleased != NULL)
+			memset(state->ftlReleased, 0, sizeof(uint8_t)*(state->ftlEndPhysicalPage/8+1));
+		printf("FTL logical pages: %lu  Physical pages: %lu  Table pages: %lu\n", state->endDataPage+1, state->ftlEndPhysicalPage+1, state->ftlNumTablePages);
+	}
+	state->storage->size = state->endDataPage;
+
+	/* Zero copy reads pages in place. Requires mapped storage and physical page ids. */
+	state->numMapReads = 0;
+	if (state->zeroCopy && (state->storage->mapPage == NULL || state->ftlCachePages > 0))
+	{
+		printf("Zero copy requires memory mapped storage and no FTL.\n");
+		state->zeroCopy = 0;
+	}
+
+	/* Free space flags are set by dbbufferFormat() or restored from a checkpoint */		
+	state->freePages = malloc(sizeof(uint8_t)*(state->storage->size/8+1));
+	printf("Allocated free space bitarray. Size in bytes: %d\n",sizeof(uint8_t)*(state->storage->size/8+1));
+
+	state->erasedStartPage = 0;
+	state->erasedEndPage = 0;
+
+	for (count_t l=0; l < state->numPages; l++)
+		state->status[l] = 0;	
+	state->numEmptyFrames = state->numPages > 2 ? state->numPages-2 : 0;
+
+	/* Allocate page id to buffer id hash table with at least twice as many slots as buffer pages */
+	id_t slots = 4;
+	while (slots < 2*(id_t) state->numPages)
+		slots *= 2;
+	state->frameTableMask = slots-1;
+	state->frameTable = malloc(sizeof(count_t)*slots);
+	if (state->frameTable == NULL)
+		printf("Failed to allocate buffer frame table. Size in bytes: %lu\n", sizeof(count_t)*slots);
+	else
+		memset(state->frameTable, 0, sizeof(count_t)*slots);
+
+	state->pinCount = malloc(sizeof(uint8_t)*state->numPages);
+	if (state->pinCount == NULL)
+		printf("Failed to allocate buffer pin counts.\n");
+	else
+		memset(state->pinCount, 0, sizeof(uint8_t)*state->numPages);
+
+	state->numDirty = 0;
+	state->dirty = malloc(sizeof(uint8_t)*state->numPages);
+	if (state->dirty == NULL)
+	{	printf("Failed to allocate buffer dirty flags.\n");
+		state->maxDirtyPages = 0;
+	}
+	else
+		memset(state->dirty, 0, sizeof(uint8_t)*state->numPages);
+
+	/* Pages read ahead go in spare buffers so buffers 2 and higher must not all be in use */
+	state->prefetching = NULL;
+	state->numPrefetching = 0;
+	state->numPrefetches = 0;
+	if (state->prefetchPages > 0)
+	{
+		if (state->numPages > 3)
+			state->prefetching = malloc(sizeof(uint8_t)*state->numPages);
+		if (state->prefetching == NULL)
+		{	printf("Read ahead requires more than 3 buffers.\n");
+			state->prefetchPages = 0;
+		}
+		else
+			memset(state->prefetching, 0, sizeof(uint8_t)*state->numPages);
+	}
+
+	/* Allocate per buffer information for replacement policy */
+	uint8_t policy = state->replacementPolicy & BUFFER_POLICY_MASK;
+	state->frameTick = NULL;
+	state->frameQueue = NULL;
+	state->ghostPages = NULL;
+	state->numGhostPages = 0;
+	state->nextGhostPage = 0;
+	state->accessTick = 0;
+	if (policy != BUFFER_ROUND_ROBIN)
+	{
+		state->frameTick = malloc(sizeof(id_t)*state->numPages);
+		if (state->frameTick == NULL)
+		{	printf("Failed to allocate buffer replacement information.\n");
+			state->replacementPolicy = BUFFER_ROUND_ROBIN;
+			return;
+		}
+		memset(state->frameTick, 0, sizeof(id_t)*state->numPages);
+	}
+	if (policy == BUFFER_2Q)
+	{
+		state->numGhostPages = state->numPages/2 > 0 ? state->numPages/2 : 1;
+		state->frameQueue = malloc(sizeof(uint8_t)*state->numPages);
+		state->ghostPages = malloc(sizeof(id_t)*state->numGhostPages);
+		if (state->frameQueue == NULL || state->ghostPages == NULL)
+		{	printf("Failed to allocate 2Q buffer queues.\n");
+			state->replacementPolicy = BUFFER_LRU | (state->replacementPolicy & BUFFER_LEVEL_AWARE);
+			return;
+		}
+		memset(state->frameQueue, 0, sizeof(uint8_t)*state->numPages);
+		memset(state->ghostPages, 0, sizeof(id_t)*state->numGhostPages);
+	}
+}
+
+
 /**
 @brief     	Initializes buffer given page size and number of pages.
 @param     	state
                 DBbuffer state structure
 */
-void dbbufferInit(dbbuffer *state)
+void dbbufferInit(dbbuffer *state)
+{
+	dbbufferSetup(state);
+	dbbufferFormat(state);
+}
+
+/**
+@brief     	Marks all pages free and erases first two blocks so writing starts at beginning of storage.
+@param     	state
+                DBbuffer state structure
+*/
+void dbbufferFormat(dbbuffer *state)
+{
+	state->nextPageId = 0;
+	state->nextPageWriteId = 0;
+	for (id_t l=0; l < state->storage->size; l++)		
+		dbbufferSetFree(state, l);	
+
+	/* Erase first two blocks. */
+	erasePages(state, 0, state->eraseSizeInPages*2-1);		
+	state->erasedStartPage = 0;
+	state->erasedEndPage = state->eraseSizeInPages*2-1;
+}
+
+
+/**
+@brief     	Marks physical pages released since the last checkpoint as free. Called when a checkpoint is written. FTL only.
+@param     	state
+                DBbuffer state structure
+@return		Number of pages made free.
+*/
+id_t dbbufferFtlReuseReleased(dbbuffer *state)
+{
+	id_t num = 0;
+
+	if (state->ftlReleased == NULL)
+		return 0;
+
+	for (id_t page=0; page <= state->ftlEndPhysicalPage; page++)
+	{
+		if (bitarrGet(state->ftlReleased, page))
+		{
+			bitarrSet(state->ftlReleased, page, 0);
+			bitarrSet(state->ftlFreePhysical, page, 1);
+			num++;
+		}
+	}
+	return num;
+}
+
+/**
+@brief     	Allocates a free physical page. FTL only.
+			With checkpoints, released pages are erased when allocated so the pages of the last checkpoint stay readable.
+@param     	state
+                DBbuffer state structure
+@return		Physical page id or FTL_UNMAPPED if storage is full.
+*/
+id_t dbbufferFtlAllocate(dbbuffer *state)
+{
+	for (id_t n=0; n <= state->ftlEndPhysicalPage; n++)
+	{
+		id_t page = state->ftlNextPhysicalPage;
+		state->ftlNextPhysicalPage = page >= state->ftlEndPhysicalPage ? 0 : page+1;
+		if (bitarrGet(state->ftlFreePhysical, page))
+		{
+			bitarrSet(state->ftlFreePhysical, page, 0);
+			if (state->ftlReleased != NULL)
+				state->storage->erasePages(state->storage, page, page);
+			return page;
+		}
+	}
+
+	/* Storage is full. Reuse pages released since the last checkpoint. Tree can no longer be recovered to that checkpoint. */
+	if (dbbufferFtlReuseReleased(state) > 0)
+		return dbbufferFtlAllocate(state);
+
+	printf("ERROR: No free physical page.\n");
+	return FTL_UNMAPPED;
+}
+
+/**
+@brief     	Erases a physical page that no longer contains a current page and marks it free. FTL only.
+			With checkpoints, the page is not reused until the next checkpoint as the last checkpoint may refer to it.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+*/
+void dbbufferFtlRelease(dbbuffer *state, id_t pageNum)
+{
+	if (state->ftlReleased != NULL)
+	{
+		bitarrSet(state->ftlReleased, pageNum, 1);
+		return;
+	}
+	state->storage->erasePages(state->storage, pageNum, pageNum);
+	bitarrSet(state->ftlFreePhysical, pageNum, 1);
+}
+
+/**
+@brief     	Writes a cached indirection table page to a new physical page if it is dirty. FTL only.
+@param     	state
+                DBbuffer state structure
+@param     	cacheNum
+                Table cache page id
+@return		Return 0 if success, -1 if failure.
+*/
+int8_t dbbufferFtlWriteTablePage(dbbuffer *state, count_t cacheNum)
+{
+	if (!state->ftlCacheDirty[cacheNum])
+		return 0;
+
+	id_t tablePage = state->ftlCacheTablePage[cacheNum];
+	id_t pageNum = dbbufferFtlAllocate(state);
+	if (pageNum == FTL_UNMAPPED)
+		return -1;
+
+	state->storage->writePage(state->storage, pageNum, state->pageSize, state->ftlCache + cacheNum*state->pageSize);
+	state->numTableWrites++;
+	if (state->ftlDirectory[tablePage] != FTL_UNMAPPED)
+		dbbufferFtlRelease(state, state->ftlDirectory[tablePage]);
+	state->ftlDirectory[tablePage] = pageNum;
+	state->ftlCacheDirty[cacheNum] = 0;
+	return 0;
+}
+
+/**
+@brief     	Returns indirection table entry for a logical page. Table page is read into cache if required,
+			replacing the least recently used table page. FTL only.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Logical page id (number)
+@param		cacheNum
+				Returns table cache page id containing entry
+@return		Pointer to physical page id of logical page (FTL_UNMAPPED if never written) or NULL if error.
+*/
+id_t* dbbufferFtlEntry(dbbuffer *state, id_t pageNum, count_t *cacheNum)
+{
+	id_t tablePage = pageNum / state->ftlEntriesPerPage;
+	count_t i, victim = 0;
+	void *buf;
+
+	for (i=0; i < state->ftlCachePages; i++)
+	{
+		if (state->ftlCacheTablePage[i] == tablePage)
+			break;
+		if (state->ftlCacheTick[i] < state->ftlCacheTick[victim])
+			victim = i;
+	}
+
+	if (i == state->ftlCachePages)
+	{	/* Replace least recently used table page */
+		i = victim;
+		if (dbbufferFtlWriteTablePage(state, i) != 0)
+			return NULL;
+
+		buf = state->ftlCache + i*state->pageSize;
+		state->ftlCacheTablePage[i] = FTL_UNMAPPED;
+		if (state->ftlDirectory[tablePage] == FTL_UNMAPPED)
+			memset(buf, 0xFF, state->pageSize);		/* No page in table page has been written */
+		else
+		{
+			if (state->storage->readPage(state->storage, state->ftlDirectory[tablePage], state->pageSize, buf) != 0)
+			{
+				printf("Read table page error: %lu\n", tablePage);
+				return NULL;
+			}
+			state->numTableReads++;
+		}
+		state->ftlCacheTablePage[i] = tablePage;
+	}
+
+	state->ftlCacheTick[i] = ++state->ftlAccessTick;
+	*cacheNum = i;
+	return (id_t*) (state->ftlCache + i*state->pageSize) + pageNum % state->ftlEntriesPerPage;
+}
+
+/**
+@brief     	Writes all dirty indirection table pages to storage. FTL only.
+@param     	state
+                DBbuffer state structure
+*/
+void dbbufferFtlFlush(dbbuffer *state)
+{
+	for (count_t i=0; i < state->ftlCachePages; i++)
+		dbbufferFtlWriteTablePage(state, i);
+}
+
+/**
+@brief      Reads page from storage. With FTL, logical page is read from its current physical page.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Page id (number)
+@param		buf
+				Pointer to buffer to copy data into
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t dbbufferStorageRead(dbbuffer *state, id_t pageNum, void *buf)
+{
+	/* Pages reserved after FTL physical pages (e.g. sorted runs) are not mapped */
+	if (state->ftlCachePages == 0 || pageNum > state->ftlEndPhysicalPage)
+		return state->storage->readPage(state->storage, pageNum, state->pageSize, buf);
+
+	count_t cacheNum;
+	id_t *entry = dbbufferFtlEntry(state, pageNum, &cacheNum);
+	if (entry == NULL || *entry == FTL_UNMAPPED)
+		return -1;
+	return state->storage->readPage(state->storage, *entry, state->pageSize, buf);
+}
+
+/**
+@brief      Writes page to storage. With FTL, logical page is written to a new physical page
+			and only its indirection table entry changes.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Page id (number)
+@param		buf
+				Pointer to buffer containing page
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t dbbufferStorageWrite(dbbuffer *state, id_t pageNum, void *buf)
+{
+	if (state->ftlCachePages == 0)
+		return state->storage->writePage(state->storage, pageNum, state->pageSize, buf);
+
+	count_t cacheNum;
+	id_t *entry = dbbufferFtlEntry(state, pageNum, &cacheNum);
+	if (entry == NULL)
+		return -1;
+
+	id_t physicalPage = dbbufferFtlAllocate(state);
+	if (physicalPage == FTL_UNMAPPED)
+		return -1;
+
+	int8_t result = state->storage->writePage(state->storage, physicalPage, state->pageSize, buf);
+	if (*entry != FTL_UNMAPPED)
+		dbbufferFtlRelease(state, *entry);
+	*entry = physicalPage;
+	state->ftlCacheDirty[cacheNum] = 1;
+	return result;
+}
+
+/**
+@brief      Writes consecutive pages to storage with one storage call. With FTL, each logical page
+			is written to a new physical page so pages are written one at a time.
+@param     	state
+                DBbuffer state structure
+@param     	startPage
+                Page id (number) of first page
+@param		numPages
+				Number of pages
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t dbbufferStorageWritePages(dbbuffer *state, id_t startPage, count_t numPages, void **buffers)
+{
+	if (numPages == 1 || state->ftlCachePages > 0)
+	{
+		int8_t result = 0;
+		for (count_t i=0; i < numPages; i++)
+		{
+			if (dbbufferStorageWrite(state, startPage+i, buffers[i]) != 0)
+				result = -1;
+		}
+		return result;
+	}
+
+	state->numMultiWrites++;
+	return state->storage->writePages(state->storage, startPage, numPages, state->pageSize, buffers);
+}
+
+/**
+@brief      Erases pages start to end inclusive. With FTL, physical pages of the logical pages are released.
+@param     	state
+                DBbuffer state structure
+@param     	startPage
+                Page id of first page
+@param     	endPage
+				Page id of last page
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t dbbufferStorageErase(dbbuffer *state, id_t startPage, id_t endPage)
+{
+	if (state->ftlCachePages == 0)
+		return state->storage->erasePages(state->storage, startPage, endPage);
+
+	count_t cacheNum;
+	for (id_t l=startPage; l <= endPage; l++)
+	{
+		id_t *entry = dbbufferFtlEntry(state, l, &cacheNum);
+		if (entry == NULL)
+			return -1;
+		if (*entry != FTL_UNMAPPED)
+		{
+			dbbufferFtlRelease(state, *entry);
+			*entry = FTL_UNMAPPED;
+			state->ftlCacheDirty[cacheNum] = 1;
+		}
+	}
+	return 0;
+}
+
+/**
+@brief     	Initializes buffer and recovers previous state from storage.
+@param     	state
+                DBbuffer state structure
+*/
+void dbbufferRecover(dbbuffer *state)
+{
+	dbbufferSetup(state);
+
+	printf("Recovering from storage.\n");
+	/* Free space, next write location, and page ids are restored from checkpoint by tree. */
+}
+
+
+/**
+@brief      Returns 1 if buffer contains an interior page on the active path, 0 otherwise.
+@param     	state
+                DBbuffer state structure
+@param		bufferNum
+				Buffer id
+*/
+int8_t dbbufferIsActivePath(dbbuffer *state, count_t bufferNum)
+{
+	vmtreeState *tree = (vmtreeState*) state->state;
+	if (tree == NULL || state->status[bufferNum] == 0)
+		return 0;
+	
+	for (int8_t l=0; l < tree->levels-1; l++)
+	{
+		if (state->activePath[l] == state->status[bufferNum])
+			return 1;
+	}
+	return 0;
+}
+
+/**
+@brief      Returns replacement class of buffer. Lower classes are replaced first.
+			Without BUFFER_LEVEL_AWARE all buffers are class 0. Otherwise leaves are class 0, 
+			interior nodes are class 1, and interior nodes on the active path are class 2.
+@param     	state
+                DBbuffer state structure
+@param		bufferNum
+				Buffer id
+*/
+uint8_t dbbufferFrameClass(dbbuffer *state, count_t bufferNum)
+{
+	if (!(state->replacementPolicy & BUFFER_LEVEL_AWARE))
+		return 0;
+	if (dbbufferIsActivePath(state, bufferNum))
+		return 2;
+	if (VMTREE_IS_INTERIOR(state->buffer + bufferNum*state->pageSize))
+		return 1;
+	return 0;
+}
+
+/**
+@brief      Updates replacement information after a buffer page is accessed by readPage().
+@param     	state
+                DBbuffer state structure
+@param		bufferNum
+				Buffer id
+@param		hit
+				1 if page was already in buffer, 0 if just read from storage
+*/
+void dbbufferTouch(dbbuffer *state, count_t bufferNum, int8_t hit)
+{
+	uint8_t policy = state->replacementPolicy & BUFFER_POLICY_MASK;
+	
+	/* Policy only manages buffers 2 and higher when have more than the minimum buffers */
+	if (policy == BUFFER_ROUND_ROBIN || bufferNum < 2 || state->numPages <= 3)
+		return;
+
+	if (policy == BUFFER_CLOCK)
+	{	/* Interior nodes survive an extra sweep of clock hand if level aware */
+		state->frameTick[bufferNum] = dbbufferFrameClass(state, bufferNum) > 0 ? 2 : 1;
+		return;
+	}
+
+	state->accessTick++;
+	if (policy == BUFFER_2Q)
+	{
+		if (!hit)
+		{	/* Page goes in used again queue if it was recently replaced from used once queue */
+			state->frameQueue[bufferNum] = 0;
+			for (count_t g=0; g < state->numGhostPages; g++)
+			{
+				if (state->ghostPages[g] == state->status[bufferNum] && state->ghostPages[g] != 0)
+				{
+					state->frameQueue[bufferNum] = 1;
+					state->ghostPages[g] = 0;
+					break;
+				}
+			}
+			state->frameTick[bufferNum] = state->accessTick;
+		}
+		else if (state->frameQueue[bufferNum] == 1)
+			state->frameTick[bufferNum] = state->accessTick;	/* Pages used once stay in FIFO order */
+		return;
+	}
+	
+	state->frameTick[bufferNum] = state->accessTick;
+}
+
+/**
+@brief      Chooses a buffer to replace using replacement policy. Only used when have more than 3 buffers and all are assigned.
+@param     	state
+                DBbuffer state structure
+@return		Buffer id to replace or 0 if all buffers are pinned
+*/
+count_t dbbufferChooseVictim(dbbuffer *state)
+{
+	uint8_t policy = state->replacementPolicy & BUFFER_POLICY_MASK;
+	id_t numFrames = state->numPages - 2;
+	count_t i = 2, victim = 2;
+
+	if (policy == BUFFER_CLOCK)
+	{	/* Sweep clock hand decrementing reference counts until find unreferenced buffer. */
+		/* Interior nodes on active path are skipped unless every buffer contains one. */		
+		for (id_t n=0; n < 4*numFrames; n++)
+		{
+			i = state->nextBufferPage;
+			if (i < 2 || i >= state->numPages)
+				i = 2;
+			state->nextBufferPage = i+1;
+			
+			if (state->pinCount[i] > 0)
+				continue;
+			if (n < 3*numFrames && (state->replacementPolicy & BUFFER_LEVEL_AWARE) && dbbufferIsActivePath(state, i))
+				continue;
+			if (state->frameTick[i] == 0)
+				return i;
+			state->frameTick[i]--;
+		}
+		return state->pinCount[i] > 0 ? 0 : i;
+	}
+
+	/* 2Q replaces from used once queue when it has more than a quarter of buffers, otherwise from used again queue */
+	uint8_t replaceQueue = 0;
+	if (policy == BUFFER_2Q)
+	{
+		id_t numOnce = 0;
+		for (i=2; i < state->numPages; i++)
+			numOnce += state->frameQueue[i] == 0;
+		if (numOnce <= numFrames/4)
+			replaceQueue = 1;
+	}
+
+	/* Replace buffer with lowest class and oldest access time */
+	uint8_t cls, bestCls = UINT8_MAX;
+	id_t bestTick = 0;
+	victim = 0;
+	for (i=2; i < state->numPages; i++)
+	{
+		if (state->pinCount[i] > 0)
+			continue;
+		cls = dbbufferFrameClass(state, i);
+		if (policy == BUFFER_2Q)
+			cls = state->frameTick[i] == 0 ? 0 : cls*2 + (state->frameQueue[i] != replaceQueue);
+		
+		if (cls < bestCls || (cls == bestCls && state->frameTick[i] < bestTick))
+		{
+			bestCls = cls;
+			bestTick = state->frameTick[i];
+			victim = i;
+		}
+	}
+
+	if (victim == 0)
+		return 0;		/* All buffers pinned */
+
+	if (policy == BUFFER_2Q && state->frameQueue[victim] == 0)
+	{	/* Remember page replaced from used once queue */
+		state->ghostPages[state->nextGhostPage] = state->status[victim];
+		state->nextGhostPage = (state->nextGhostPage+1) % state->numGhostPages;
+	}
+	return victim;
+}
+
+/**
+@brief      Chooses buffer 2 or higher to read a page into. Only used when have more than 3 buffers.
+			Empty buffer is used first, otherwise a buffer is replaced using replacement policy.
+@param     	state
+                DBbuffer state structure
+@return		Buffer id or 0 if all buffers are pinned
+*/
+count_t dbbufferChooseFrame(dbbuffer *state)
+{
+	count_t i;
+
+	/* Determine buffer location for page */
+	/* TODO: This needs to be improved and may also consider locking pages */
+	for (i=2; state->numEmptyFrames > 0 && i < state->numPages; i++)
+	{
+		if (state->status[i] == 0 && state->pinCount[i] == 0)	/* Empty page */
+			return i;
+	}
+
+	/* Pick the next page */
+	if ((state->replacementPolicy & BUFFER_POLICY_MASK) != BUFFER_ROUND_ROBIN)
+		return dbbufferChooseVictim(state);
+
+	i = state->nextBufferPage;
+	state->nextBufferPage++;
+	
+	for (count_t n=0; n < 2*state->numPages; n++)
+	{
+		if (i > state->numPages-1)
+		{	i = 2;
+			state->nextBufferPage = 2;
+		}
+
+		if (state->status[i] != state->lastHit && state->pinCount[i] == 0)						
+			break;					
+
+		i++;					
+	}	
+	if (state->pinCount[i] > 0)
+		i = 0;	
+	return i;
+}
+
+/**
+@brief      Reads page either from buffer or from storage. Returns pointer to buffer if success.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Returns pointer to buffer page or NULL if error.
+*/
+void* readPage(dbbuffer *state, id_t pageNum)
+{    
+	void *buf;
+	count_t i;
+
+	/* Check to see if page is currently in buffer */
+	i = dbbufferFindFrame(state, pageNum);
+	if (i != 0 && state->prefetching != NULL && state->prefetching[i])
+	{	/* Page is being read ahead. Only wait for its read. Frame is cleared if the read failed. */
+		dbbufferPrefetchWaitFrame(state, i);
+		i = dbbufferFindFrame(state, pageNum);
+	}
+	if (i != 0)
+	{
+		state->bufferHits++;
+		buf = state->buffer + state->pageSize*i;
+		state->lastHit = state->status[i];
+		dbbufferTouch(state, i, 1);
+		// printf("Buffer hit: %d\n", pageNum);
+		return buf;
+	}
+
+	if (state->numPages == 2)
+	{	buf = state->buffer + state->pageSize;
+		i = 1;
+	}
+	else
+	{	
+		/* Reserve page #1 for root if have at least 3 buffers. */
+		if (state->activePath[0] == pageNum)
+		{	/* Request for root. */			
+			i = 1;
+		}
+		else if (state->numPages == 3)
+		{
+			buf = state->buffer + state->pageSize*2;
+			i = 2;
+		}
+		else
+		{
+			/* More than minimum pages. Some basic memory management using round robin buffer. */		
+			i = dbbufferChooseFrame(state);
+		}
+	}
+
+	if (i == 0 || state->pinCount[i] > 0)
+	{
+		printf("ERROR: No unpinned buffer to read page: %lu\n", pageNum);
+		return NULL;
+	}
+	    
+	dbbufferSetFrame(state, i, pageNum);
+	buf = readPageBuffer(state, pageNum, i);
+	if (buf != NULL)
+		dbbufferTouch(state, i, 0);
+	return buf;
+}
+
+/**
+@brief      Reads page for read-only use. With zero copy, a page not in buffer is returned directly from mapped storage.
+			Page must not be modified and is only valid until storage is next written.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Returns pointer to page or NULL if error.
+*/
+void* readPageMapped(dbbuffer *state, id_t pageNum)
+{
+	/* Buffer may have a newer version of page. Pages updated by loadPage() must be copied. */
+	if (!state->zeroCopy || state->loadPage != NULL || dbbufferFindFrame(state, pageNum) != 0)
+		return readPage(state, pageNum);
+
+	void *buf = state->storage->mapPage(state->storage, pageNum, state->pageSize);
+	if (buf == NULL)
+	{
+		printf("Read page error: %lu\n", pageNum);
+		return NULL;
+	}
+	state->numMapReads++;
+	return buf;
+}
+
+/**
+@brief      Called when asynchronous read started by dbbufferPrefetch() completes.
+@param     	arg
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@param		result
+				0 if read succeeded
+*/
+void dbbufferPrefetchDone(void *arg, id_t pageNum, int8_t result)
+{
+	dbbuffer *state = (dbbuffer*) arg;
+	count_t i = dbbufferFindFrame(state, pageNum);
+
+	if (i == 0 || !state->prefetching[i])
+		return;
+
+	state->prefetching[i] = 0;
+	state->numPrefetching--;
+	state->pinCount[i]--;
+	if (result != 0)
+	{
+		dbbufferSetFrame(state, i, 0);
+		return;
+	}
+	state->numReads++;
+}
+
+/**
+@brief      Hints that a page will be read soon. Page is read into a spare buffer, asynchronously if storage supports it.
+			Does nothing if page is already in buffer or read ahead is not used.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Returns 0 if success, -1 if no buffer is available or read failed.
+*/
+int8_t dbbufferPrefetch(dbbuffer *state, id_t pageNum)
+{
+	/* Mapped pages are read in place */
+	if (state->prefetchPages == 0 || state->zeroCopy || pageNum == 0 || dbbufferFindFrame(state, pageNum) != 0)
+		return 0;
+
+	count_t i = dbbufferChooseFrame(state);
+	if (i == 0)
+		return -1;
+
+	dbbufferSetFrame(state, i, pageNum);
+	dbbufferTouch(state, i, 0);
+	state->numPrefetches++;
+
+	/* Logical pages (FTL) and pages updated when loaded are read now */
+	if (state->ftlCachePages > 0 || state->loadPage != NULL)
+		return readPageBuffer(state, pageNum, i) == NULL ? -1 : 0;
+
+	/* Buffer is pinned until read completes. Synchronous storage completes read before returning. */
+	state->prefetching[i] = 1;
+	state->numPrefetching++;
+	state->pinCount[i]++;
+	if (state->storage->submitRead(state->storage, pageNum, state->pageSize, state->buffer + i*state->pageSize, dbbufferPrefetchDone, state) != 0)
+	{
+		if (state->prefetching[i])
+			dbbufferPrefetchDone(state, pageNum, -1);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+@brief      Waits for all asynchronous page reads started by dbbufferPrefetch() to complete.
+@param     	state
+                DBbuffer state structure
+*/
+void dbbufferPrefetchWait(dbbuffer *state)
+{
+	if (state->numPrefetching > 0)
+		state->storage->poll(state->storage, STORAGE_POLL_ALL);
+}
+
+/**
+@brief      Waits for the asynchronous read into a buffer to complete. Other reads may still be in progress.
+@param     	state
+                DBbuffer state structure
+@param     	bufferNum
+                Buffer index (0 if page is not buffered)
+*/
+void dbbufferPrefetchWaitFrame(dbbuffer *state, count_t bufferNum)
+{
+	while (bufferNum != 0 && state->prefetching != NULL && state->prefetching[bufferNum])
+		state->storage->poll(state->storage, STORAGE_POLL_ANY);
+}
+
+/**
+@brief      Hints that a page will not be used again soon (e.g. leaf page finished by a scan).
+			Buffer containing the page is replaced first. Only used with BUFFER_LEVEL_AWARE.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+*/
+void dbbufferRecycleFirst(dbbuffer *state, id_t pageNum)
+{
+	if (!(state->replacementPolicy & BUFFER_LEVEL_AWARE) || (state->replacementPolicy & BUFFER_POLICY_MASK) == BUFFER_ROUND_ROBIN)
+		return;
+
+	count_t i = dbbufferFindFrame(state, pageNum);
+	if (i >= 2 && state->numPages > 3)
+		state->frameTick[i] = 0;
+}
+
+/**
+@brief      Returns hash table slot to start search for a physical page id.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Slot index in frame table
+*/
+id_t dbbufferFrameHash(dbbuffer *state, id_t pageNum)
 {
-	printf("Initializing buffer.\n");
-	printf("Buffer size: %d  Page size: %d\n", state->numPages, state->pageSize);			
-	
-	/* TODO: These values would be set during recovery if database already exists. */
-	state->nextPageId = 0;
-	state->nextPageWriteId = 0;
-	
-	state->numReads = 0;
-	state->numWrites = 0;
-	state->numOverWrites = 0;
-	state->numMoves = 0;
-	state->bufferHits = 0;
-	state->lastHit = 0;
-	state->nextBufferPage = 1;
-	// state->endDataPage = state->storage->size;	
-	/* Ensure end data page is a multiple of the block size */
-	state->endDataPage = (state->storage->size / state->eraseSizeInPages) * state->eraseSizeInPages;
-	state->endDataPage--;
-	state->storage->size = state->endDataPage;
-
-	/* Set free space flags */		
-	state->freePages = malloc(sizeof(uint8_t)*(state->storage->size/8+1));
-	for (id_t l=0; l < state->storage->size; l++)		
-		dbbufferSetFree(state, l);	
-	printf("Allocated free space bitarray. Size in bytes: %d\n",sizeof(uint8_t)*(state->storage->size/8+1));
-
+	pageNum *= 2654435761u;
+	return (pageNum ^ (pageNum >> 16)) & state->frameTableMask;
+}
 
-	/* Erase first two blocks. */
-	erasePages(state, 0, state->eraseSizeInPages*2-1);		
-	state->erasedStartPage = 0;
-	state->erasedEndPage = state->eraseSizeInPages*2-1;
+/**
+@brief      Returns buffer id containing physical page or 0 if page is not in buffer.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Buffer id or 0 if not in buffer.
+*/
+count_t dbbufferFindFrame(dbbuffer *state, id_t pageNum)
+{
+	if (pageNum == 0)
+		return 0;		/* Status of 0 indicates unassigned buffer */
 
-	for (count_t l=0; l < state->numPages; l++)
-		state->status[l] = 0;	
+	id_t i = dbbufferFrameHash(state, pageNum);
+	count_t frame;
+	while ((frame = state->frameTable[i]) != 0)
+	{
+		if (state->status[frame] == pageNum)
+			return frame;
+		i = (i+1) & state->frameTableMask;
+	}
+	return 0;
 }
 
-
 /**
-@brief     	Initializes buffer and recovers previous state from storage.
+@brief      Removes buffer from frame table. Entries after it are shifted back to keep probe sequences intact.
 @param     	state
                 DBbuffer state structure
+@param		bufferNum
+				Buffer id
 */
-void dbbufferRecover(dbbuffer *state)
+void dbbufferFrameRemove(dbbuffer *state, count_t bufferNum)
 {
-	dbbufferInit(state);
-
-	printf("Recovering from storage.\n");	
+	id_t mask = state->frameTableMask;
+	id_t i = dbbufferFrameHash(state, state->status[bufferNum]);
 	
-	/* Scan file from end to determine the page with root */	
-	FILE* fp = NULL; // state->file;
-      
-	fseek(fp, 0, SEEK_END); 
-
-	uint32_t loc = ftell(fp);
+	while (state->frameTable[i] != bufferNum)
+	{
+		if (state->frameTable[i] == 0)
+			return;		/* Not in table */
+		i = (i+1) & mask;
+	}
+	state->frameTable[i] = 0;
 
-	/* Set next buffer page to write */
-	state->nextPageWriteId = loc / state->pageSize;	
-	state->nextPageId = state->nextPageWriteId;
-	
-	for (id_t p = state->nextPageWriteId-1; p >= 0; p--)
-	{		
-		void *buf = readPage(state, p);
-		if (buf == NULL)
+	/* Move back any later entry in the probe run whose home slot is at or before the hole */
+	id_t j = i;
+	count_t frame;
+	while (1)
+	{
+		j = (j+1) & mask;
+		frame = state->frameTable[j];
+		if (frame == 0)
 			break;
 		
-		if (VMTREE_IS_ROOT(buf))
+		id_t home = dbbufferFrameHash(state, state->status[frame]);
+		if (((j - home) & mask) >= ((j - i) & mask))
 		{
-			printf("Found root at: %lu\n", p);
-			state->activePath[0] = p;
-			return;
+			state->frameTable[i] = frame;
+			state->frameTable[j] = 0;
+			i = j;
 		}
 	}
+}
 
-	printf("Creating new file.\n");
+/**
+@brief      Clears dirty flag of buffer without writing it.
+@param     	state
+                DBbuffer state structure
+@param		bufferNum
+				Buffer id
+*/
+void dbbufferClearDirty(dbbuffer *state, count_t bufferNum)
+{
+	if (state->dirty != NULL && state->dirty[bufferNum])
+	{
+		state->dirty[bufferNum] = 0;
+		state->numDirty--;
+	}
+}
 
-	/* Otherwise assume no root. Create new file. */
-	state->nextPageId = 0;
-	state->nextPageWriteId = 0;	
+/**
+@brief      Writes buffer to storage if it is dirty. Page is not written if it was freed after being updated.
+@param     	state
+                DBbuffer state structure
+@param		bufferNum
+				Buffer id
+*/
+void dbbufferWriteBack(dbbuffer *state, count_t bufferNum)
+{
+	if (state->dirty == NULL || !state->dirty[bufferNum])
+		return;
+	
+	dbbufferClearDirty(state, bufferNum);
+	if (dbbufferIsFree(state, state->status[bufferNum]))
+		return;
 
-	/* Create and write empty root node */	
-	void *buf = initBufferPage(state->buffer, 0);	
-	VMTREE_SET_ROOT(buf);		
-	state->activePath[0] = writePage(state->buffer, buf);		/* Store root location */				
+	dbbufferStorageWrite(state, state->status[bufferNum], state->buffer + bufferNum*state->pageSize);
+	state->numOverWrites++;
 }
 
-
 /**
-@brief      Reads page either from buffer or from storage. Returns pointer to buffer if success.
+@brief      Assigns a buffer page to contain a physical page. Use pageNum 0 to mark buffer as unassigned.
+			Keeps status and frame table in sync.
 @param     	state
                 DBbuffer state structure
+@param		bufferNum
+				Buffer id
 @param     	pageNum
                 Physical page id (number)
-@return		Returns pointer to buffer page or NULL if error.
 */
-void* readPage(dbbuffer *state, id_t pageNum)
-{    
-	void *buf;
-	count_t i;
+void dbbufferSetFrame(dbbuffer *state, count_t bufferNum, id_t pageNum)
+{
+	id_t prev = state->status[bufferNum];
+	if (prev == pageNum)
+		return;
 
-	/* Check to see if page is currently in buffer */
-	for (i=1; i < state->numPages; i++)
+	/* Read into buffer must complete before buffer is reused */
+	dbbufferPrefetchWaitFrame(state, bufferNum);
+
+	/* Buffer will no longer contain page. Write it if updated. */
+	dbbufferWriteBack(state, bufferNum);
+
+	/* Buffer 0 is a scratch buffer and is never returned by readPage() */
+	if (bufferNum != 0)
 	{
-		// printf("(%d, %d)  ", i, state->status[i]);
-		if (state->status[i] == pageNum && pageNum != 0)
+		if (prev != 0)
+			dbbufferFrameRemove(state, bufferNum);
+
+		if (bufferNum >= 2)
 		{
-			state->bufferHits++;
-			buf = state->buffer + state->pageSize*i;
-			state->lastHit = state->status[i];
-			// printf("Buffer hit: %d\n", pageNum);
-			return buf;
+			if (prev == 0)
+				state->numEmptyFrames--;
+			else if (pageNum == 0)
+				state->numEmptyFrames++;
 		}
 	}
-	// printf("\n");
+	
+	state->status[bufferNum] = pageNum;
 
-	if (state->numPages == 2)
-	{	buf = state->buffer + state->pageSize;
-		i = 1;
+	if (bufferNum != 0 && pageNum != 0)
+	{	/* Insert in first empty slot of probe sequence. Table has more slots than buffers so always has space. */
+		id_t i = dbbufferFrameHash(state, pageNum);
+		while (state->frameTable[i] != 0)
+			i = (i+1) & state->frameTableMask;
+		state->frameTable[i] = bufferNum;
 	}
-	else
-	{	
-		/* Reserve page #1 for root if have at least 3 buffers. */
-		if (state->activePath[0] == pageNum)
-		{	/* Request for root. */			
-			i = 1;
-		}
-		else if (state->numPages == 3)
-		{
-			buf = state->buffer + state->pageSize*2;
-			i = 2;
-		}
-		else
-		{
-			/* More than minimum pages. Some basic memory management using round robin buffer. */		
-			buf = NULL;
-		
-			/* Determine buffer location for page */
-			/* TODO: This needs to be improved and may also consider locking pages */
-			for (i=2; i < state->numPages; i++)
-			{
-				if (state->status[i] == 0)	/* Empty page */
-				{	buf = state->buffer + state->pageSize*i;			
-					break;
-				}
-			}
+}
 
-			/* Pick the next page */
-			if (buf == NULL)
-			{
-				i = state->nextBufferPage;
-				state->nextBufferPage++;
-				
-				while (1)
-				{
-					if (i > state->numPages-1)
-					{	i = 2;
-						state->nextBufferPage = 2;
-					}
+/**
+@brief      Returns buffer id of a pointer to a buffer page or numPages if pointer is not a buffer page.
+@param     	state
+                DBbuffer state structure
+@param     	buf
+                Pointer to buffer page
+*/
+count_t dbbufferGetBufferNum(dbbuffer *state, void *buf)
+{
+	if (buf < state->buffer || buf >= state->buffer + (size_t) state->numPages * state->pageSize)
+		return state->numPages;
+	return (count_t) ((buf - state->buffer) / state->pageSize);
+}
 
-					if (state->status[i] != state->lastHit)						
-						break;					
+/**
+@brief      Reads page and pins it in buffer so readPage() does not replace it until unpinned.
+			A pinned buffer may be modified and written. It then contains the page at its new location.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Returns pointer to buffer page or NULL if error.
+*/
+void* dbbufferPinPage(dbbuffer *state, id_t pageNum)
+{
+	void *buf = readPage(state, pageNum);
+	if (buf == NULL)
+		return NULL;
 
-					i++;					
-				}		
-			}
-		}
+	count_t i = dbbufferGetBufferNum(state, buf);
+	if (state->pinCount[i] == UINT8_MAX)
+	{
+		printf("ERROR: Too many pins on page: %lu\n", pageNum);
+		return NULL;
 	}
-	    
-	state->status[i] = pageNum;
-	return readPageBuffer(state, pageNum, i);
+	state->pinCount[i]++;
+	return buf;
+}
+
+/**
+@brief      Unpins a buffer page pinned by dbbufferPinPage().
+@param     	state
+                DBbuffer state structure
+@param     	buf
+                Pointer to buffer page
+*/
+void dbbufferUnpinPage(dbbuffer *state, void *buf)
+{
+	count_t i = dbbufferGetBufferNum(state, buf);
+	if (i < state->numPages && state->pinCount[i] > 0)
+		state->pinCount[i]--;
 }
 
 /**
@@ -230,12 +1250,30 @@ void* readPage(dbbuffer *state, id_t pageNum)
 void* readPageBuffer(dbbuffer *state, id_t pageNum, count_t bufferNum)
 {
 	void *buf = state->buffer + bufferNum * state->pageSize;		
-	int8_t result = state->storage->readPage(state->storage, pageNum, state->pageSize, buf);	
+
+	/* Buffer will no longer contain the page it was assigned to */
+	if (state->status[bufferNum] != pageNum)
+		dbbufferSetFrame(state, bufferNum, 0);
+
+	/* Storage has an older version of a dirty page. Copy page from its buffer. */
+	count_t i = dbbufferFindFrame(state, pageNum);
+	if (i != 0 && state->dirty != NULL && state->dirty[i])
+	{
+		if (i != bufferNum)
+			memcpy(buf, state->buffer + i*state->pageSize, state->pageSize);
+		state->bufferHits++;
+		return buf;
+	}
+
+	int8_t result = dbbufferStorageRead(state, pageNum, buf);	
 	if (result != 0)
 	{
 		printf("Read page error: %d\n", pageNum);
+		dbbufferSetFrame(state, bufferNum, 0);
 		return NULL;
 	}
+	if (state->loadPage != NULL)
+		state->loadPage(state->state, pageNum, buf);
 	
 	// printf("Read page: %d Result: %d Buffer: %d\n", pageNum, result, bufferNum);
     state->numReads++;	   
@@ -257,7 +1295,8 @@ int8_t erasePages(dbbuffer *state, id_t startPage, id_t endPage)
 {
 	// printf("Erasing pages. Start: %d  End: %d\n", startPage, endPage);
 	
-	state->storage->erasePages(state->storage, startPage, endPage);
+	dbbufferPrefetchWait(state);
+	dbbufferStorageErase(state, startPage, endPage);
 
 	for (id_t l=startPage; l <= endPage; l++)
 		dbbufferSetFree(state, l);
@@ -294,6 +1333,38 @@ id_t dbbufferNextValidPage(dbbuffer *state)
 	}	
 }
 
+/**
+@brief      Updates page status and buffers after page is written to a new location.
+@param     	state
+               	DBbuffer state structure
+@param     	buffer
+                In memory buffer containing page
+@param		pageNum
+				Location page was written at
+*/
+void dbbufferPageWritten(dbbuffer *state, void* buffer, id_t pageNum)
+{
+	state->numWrites++;
+	dbbufferSetValid(state, pageNum);
+
+	/* Pinned buffer now contains page at its new location */
+	count_t i = dbbufferFindFrame(state, pageNum);
+	if (i != 0)
+		dbbufferClearDirty(state, i);		/* Buffer is replaced by page just written */
+	count_t pinned = dbbufferGetBufferNum(state, buffer);
+	if (pinned != 0 && pinned < state->numPages && state->pinCount[pinned] > 0)
+	{	
+		if (i != 0 && i != pinned)
+			dbbufferSetFrame(state, i, 0);
+		dbbufferSetFrame(state, pinned, pageNum);
+		return;
+	}
+
+	/* Free pages are reused so buffer may contain an old version of this page */
+	if (i != 0 && state->buffer + i*state->pageSize != buffer)
+		memcpy(state->buffer + i*state->pageSize, buffer, state->pageSize);
+}
+
 /**
 @brief      Writes page to storage. Returns physical page id if success. -1 if failure.
 			This version does not check for wrap around.
@@ -307,15 +1378,17 @@ id_t dbbufferNextValidPage(dbbuffer *state)
 */
 int32_t writePageDirect(dbbuffer *state, void* buffer, int32_t pageNum)
 {
+	/* Buffer containing page may be updated below */
+	dbbufferPrefetchWaitFrame(state, dbbufferFindFrame(state, pageNum));
+
 	/* Setup page number in header */	
 	memcpy(buffer, &(state->nextPageId), sizeof(id_t));
 	state->nextPageId++;
 
 	/* Save page in storage */
-	state->storage->writePage(state->storage, pageNum, state->pageSize, buffer);
+	dbbufferStorageWrite(state, pageNum, buffer);
 	
-	state->numWrites++;
-	dbbufferSetValid(state, pageNum);
+	dbbufferPageWritten(state, buffer, pageNum);
 	return pageNum;	
 }
 
@@ -336,9 +1409,12 @@ int8_t dbbufferEnsureSpace(dbbuffer *state, count_t pages)
 	id_t totalPagesLookedAt = 0;
 
 	/* Count how many pages free there are from current write location up to end erase point */
-	count_t num=0;
+	count_t num;
 	count_t numCheck;
 	id_t page;
+
+checkspace:
+	num = 0;
 	if (state->erasedEndPage >= state->nextPageWriteId)
 		numCheck = state->erasedEndPage - state->nextPageWriteId;
 	else
@@ -453,8 +1529,13 @@ finderase:
 	state->erasedEndPage = endErase;
 	state->numMoves += numMove;
 
+	/* Storage is full if looked at every block and still do not have enough space */
+	totalPagesLookedAt += state->eraseSizeInPages;
+	if (totalPagesLookedAt > state->endDataPage)
+		return 0;
+
 	/* Verify have enough space */
-	return dbbufferEnsureSpace(state, pages);
+	goto checkspace;
 }
 
 /**
@@ -471,6 +1552,46 @@ int32_t writePage(dbbuffer *state, void* buffer)
 	return writePageDirect(state, buffer, pageNum);	
 }
 
+/**
+@brief      Writes pages to storage at next valid physical pages. Pages given consecutive physical
+			pages are written with one storage call. Returns 0 if success. -1 if failure.
+@param     	state
+                DBbuffer state structure
+@param     	buffers
+                In memory buffers containing pages (written in order)
+@param		numPages
+				Number of pages
+@param		pageNums
+				Returns physical page id of each page
+@return		Returns 0 if success. -1 if failure.
+*/
+int8_t writePages(dbbuffer *state, void **buffers, count_t numPages, id_t *pageNums)
+{
+	int8_t result = 0;
+
+	/* Allocate locations and setup page number in headers in write order */
+	for (count_t i=0; i < numPages; i++)
+	{
+		pageNums[i] = dbbufferNextValidPage(state);
+		dbbufferPrefetchWaitFrame(state, dbbufferFindFrame(state, pageNums[i]));
+		memcpy(buffers[i], &(state->nextPageId), sizeof(id_t));
+		state->nextPageId++;
+	}
+
+	/* Save each run of consecutive pages with one storage write */
+	for (count_t i=0, n; i < numPages; i += n)
+	{
+		for (n=1; i+n < numPages && pageNums[i+n] == pageNums[i]+n; n++)
+			;
+		if (dbbufferStorageWritePages(state, pageNums[i], n, buffers+i) != 0)
+			result = -1;
+	}
+
+	for (count_t i=0; i < numPages; i++)
+		dbbufferPageWritten(state, buffers[i], pageNums[i]);
+	return result;
+}
+
 /**
 @brief      Overwrites page to storage at same physical address. -1 if failure.
 			Caller is responsible for knowing that overwrite is possible given page contents.
@@ -482,28 +1603,162 @@ int32_t writePage(dbbuffer *state, void* buffer)
 */
 int32_t overWritePage(dbbuffer *state, void* buffer, int32_t pageNum)
 {			
-	state->storage->writePage(state->storage, pageNum, state->pageSize, buffer);
+	dbbufferPrefetchWaitFrame(state, dbbufferFindFrame(state, pageNum));
+	dbbufferStorageWrite(state, pageNum, buffer);
 		
 	state->numOverWrites++;		
+	dbbufferSetValid(state, pageNum);
 	
 	/* Check if buffer contains this page */
-	for (count_t i=1; i < state->numPages; i++)
-	{				
-		if (state->status[i] == pageNum && pageNum != 0)
-		{	/* Copy over page */
-			if (state->buffer + i*state->pageSize == buffer)
-				break;
-			
-			memcpy(state->buffer + i*state->pageSize, buffer, state->pageSize);
-			/* Other choice is to clear the buffer: state->status[i] = 0; */
-			break;
-		}
+	count_t i = dbbufferFindFrame(state, pageNum);
+	if (i != 0)
+		dbbufferClearDirty(state, i);		/* Buffer is replaced by page just written */
+	if (i != 0 && state->buffer + i*state->pageSize != buffer)
+	{	/* Copy over page */		
+		memcpy(state->buffer + i*state->pageSize, buffer, state->pageSize);
+		/* Other choice is to clear the buffer: dbbufferSetFrame(state, i, 0); */
 	}
 
 	// printf("\nWrite page: %d Id: %d Key: %d\n", pageNum, (state->nextPageId-1), *((int32_t*) (buffer+10)));
 	return pageNum;
 }
 
+/**
+@brief      Overwrites page at same physical address. If write-back is enabled (maxDirtyPages > 0) and
+			buffer is the buffer page containing the page, the write is delayed until the buffer is
+			replaced or flushed. Otherwise same as overWritePage().
+@param     	state
+                DBbuffer state structure
+@param     	buffer
+                In memory buffer containing page
+@param		pageNum
+				Physical page id (number)
+@return		Physical page id
+*/
+int32_t overWritePageDeferred(dbbuffer *state, void* buffer, int32_t pageNum)
+{
+	count_t i = dbbufferGetBufferNum(state, buffer);
+	/* Page 0 is never kept in buffer as status of 0 indicates unassigned buffer */
+	if (state->maxDirtyPages == 0 || pageNum == 0 || i == 0 || i >= state->numPages || state->status[i] != pageNum)
+		return overWritePage(state, buffer, pageNum);
+
+	if (!state->dirty[i])
+	{
+		state->dirty[i] = 1;
+		state->numDirty++;
+	}
+	dbbufferSetValid(state, pageNum);
+
+	if (state->numDirty > state->maxDirtyPages)
+		dbbufferFlush(state);
+	return pageNum;
+}
+
+/**
+@brief     	Returns flush pass that writes buffer: 0 for leaves, 1 for interior nodes, 2 for root.
+@param     	state
+                DBbuffer state structure
+@param		bufferNum
+				Buffer id
+*/
+int8_t dbbufferFlushPass(dbbuffer *state, count_t bufferNum)
+{
+	void *buf = state->buffer + bufferNum*state->pageSize;
+	if (VMTREE_IS_ROOT(buf))
+		return 2;
+	if (VMTREE_IS_INTERIOR(buf))
+		return 1;
+	return 0;
+}
+
+/**
+@brief     	Returns 1 if buffer is dirty, its page is valid, and it is written in the given flush pass. 0 otherwise.
+@param     	state
+                DBbuffer state structure
+@param		bufferNum
+				Buffer id (0 if page is not buffered)
+@param		pass
+				Flush pass
+*/
+int8_t dbbufferFlushable(dbbuffer *state, count_t bufferNum, int8_t pass)
+{
+	return bufferNum != 0 && state->dirty[bufferNum] && !dbbufferIsFree(state, state->status[bufferNum])
+			&& dbbufferFlushPass(state, bufferNum) == pass;
+}
+
+/**
+@brief     	Writes dirty buffer and the dirty buffers containing the pages after it with one storage call.
+@param     	state
+                DBbuffer state structure
+@param		bufferNum
+				Buffer id of first page
+@param		pass
+				Flush pass
+*/
+void dbbufferFlushRun(dbbuffer *state, count_t bufferNum, int8_t pass)
+{
+	void *bufs[DBBUFFER_WRITE_RUN];
+	id_t startPage = state->status[bufferNum];
+	count_t n = 0;
+
+	while (1)
+	{
+		dbbufferClearDirty(state, bufferNum);
+		bufs[n++] = state->buffer + bufferNum*state->pageSize;
+		state->numOverWrites++;
+		if (n == DBBUFFER_WRITE_RUN)
+			break;
+		bufferNum = dbbufferFindFrame(state, startPage+n);
+		if (!dbbufferFlushable(state, bufferNum, pass))
+			break;
+	}
+	dbbufferStorageWritePages(state, startPage, n, bufs);
+}
+
+/**
+@brief     	Writes all dirty buffer pages to storage. Leaves are written first then interior nodes and root last.
+			Dirty pages at consecutive physical pages are written with one storage call.
+@param     	state
+                DBbuffer state structure
+*/
+void dbbufferFlush(dbbuffer *state)
+{
+	int8_t skipped;
+
+	dbbufferPrefetchWait(state);
+
+	/* Pass 0 writes leaves, pass 1 writes interior nodes, pass 2 writes root */
+	for (int8_t pass=0; pass < 3 && state->numDirty > 0; pass++)
+	{
+		do
+		{
+			skipped = 0;
+			for (count_t i=1; i < state->numPages; i++)
+			{
+				if (!state->dirty[i] || dbbufferFlushPass(state, i) != pass)
+					continue;
+
+				if (dbbufferIsFree(state, state->status[i]))
+				{	/* Page was freed after being updated */
+					dbbufferClearDirty(state, i);
+					continue;
+				}
+
+				/* Page is written with the run starting at a previous page */
+				if (dbbufferFlushable(state, dbbufferFindFrame(state, state->status[i]-1), pass))
+				{
+					skipped = 1;
+					continue;
+				}
+				dbbufferFlushRun(state, i, pass);
+			}
+		} while (skipped);
+	}
+
+	if (state->ftlCachePages > 0)
+		dbbufferFtlFlush(state);
+}
+
 
 /**
 @brief     	Initialize in-memory buffer page.
@@ -518,11 +1773,11 @@ void* initBufferPage(dbbuffer *state, int pageNum)
 	/* Insure all values are 1 in page. */	
 	/* NOR_OVERWRITE requires everything initialized to 1. */	
 	void *buf = state->buffer + pageNum * state->pageSize;
+	dbbufferSetFrame(state, pageNum, 0);		/* Indicate buffer is unassigned to any current page */
 	for (uint16_t i = 0; i < state->pageSize/sizeof(uint32_t); i++)
     {
         ((uint32_t*) buf)[i] = UINT32_MAX;
     }
-	state->status[pageNum] = 0;		/* Indicate buffer is unassigned to any current page */
 	return buf;			
 }
 
@@ -533,10 +1788,38 @@ void* initBufferPage(dbbuffer *state, int pageNum)
 */
 void closeBuffer(dbbuffer *state)
 {
+	dbbufferPrefetchWait(state);
+	if (state->dirty != NULL)
+		dbbufferFlush(state);
 	printStats(state);	
 	state->storage->close(state->storage);	
 	if (state->freePages != NULL)
 		free(state->freePages);
+	if (state->frameTable != NULL)
+		free(state->frameTable);
+	if (state->pinCount != NULL)
+		free(state->pinCount);
+	if (state->dirty != NULL)
+		free(state->dirty);
+	if (state->prefetching != NULL)
+		free(state->prefetching);
+	if (state->frameTick != NULL)
+		free(state->frameTick);
+	if (state->frameQueue != NULL)
+		free(state->frameQueue);
+	if (state->ghostPages != NULL)
+		free(state->ghostPages);
+	if (state->ftlCachePages > 0)
+	{
+		free(state->ftlDirectory);
+		free(state->ftlCache);
+		free(state->ftlCacheTablePage);
+		free(state->ftlCacheDirty);
+		free(state->ftlCacheTick);
+		free(state->ftlFreePhysical);
+		if (state->ftlReleased != NULL)
+			free(state->ftlReleased);
+	}
 }
 
 
@@ -551,7 +1834,14 @@ void printStats(dbbuffer *state)
 	printf("Buffer hits: %lu\n", state->bufferHits);
 	printf("Num writes: %lu\n", state->numWrites);
 	printf("Num overwrites: %lu\n", state->numOverWrites);	
+	printf("Num multiple page writes: %lu\n", state->numMultiWrites);
 	printf("Num moves: %d\n", state->numMoves);
+	if (state->zeroCopy)
+		printf("Num mapped reads: %lu\n", state->numMapReads);
+	if (state->prefetchPages > 0)
+		printf("Num pages read ahead: %lu\n", state->numPrefetches);
+	if (state->ftlCachePages > 0)
+		printf("Num table reads: %lu  Num table writes: %lu\n", state->numTableReads, state->numTableWrites);
 }
 
 
@@ -566,7 +1856,12 @@ void dbbufferClearStats(dbbuffer *state)
 	state->numWrites = 0;
 	state->bufferHits = 0;
 	state->numOverWrites = 0;
+	state->numMultiWrites = 0;
 	state->numMoves = 0;	
+	state->numMapReads = 0;
+	state->numPrefetches = 0;
+	state->numTableReads = 0;
+	state->numTableWrites = 0;
 }
 
 /**
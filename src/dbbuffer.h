@@ -42,6 +42,18 @@
 #include "bitarr.h"
 #include "storage.h"
 
+/* Buffer replacement policies */
+#define BUFFER_ROUND_ROBIN		0		/* Round robin over buffers skipping the last hit (default) */
+#define BUFFER_CLOCK			1		/* Clock sweep giving referenced buffers a second chance */
+#define BUFFER_LRU				2		/* Replace least recently used buffer */
+#define BUFFER_2Q				3		/* FIFO queue for pages used once and LRU queue for pages used again */
+#define BUFFER_POLICY_MASK		7
+#define BUFFER_LEVEL_AWARE		8		/* Combine with policy. Replaces leaves before interior nodes and active path last. Scanned leaves replaced first. */
+
+#define FTL_UNMAPPED			UINT32_MAX		/* Indirection table entry of logical page that has not been written */
+
+#define DBBUFFER_WRITE_RUN		8		/* Maximum consecutive pages written by one storage writePages() call when flushing */
+
 /* Define type for page ids (physical and logical). */
 typedef uint32_t id_t;
 
@@ -72,8 +84,53 @@ typedef struct {
 	void	*state;					/* Tree state */
 	int8_t (*isValid)(void *state, id_t pageNum, id_t *parentId, void **parentBuffer);	/* Function to determine if page is valid */	
 	int8_t 	(*movePage)(void *state, id_t prev, id_t curr, void* buf);					/* Function called when buffer moves a page location */
+	void	(*loadPage)(void *state, id_t pageNum, void* buf);							/* Function called when page is read from storage (NULL if none) */
 	bitarr 	freePages;				/* Bit vector to determine free pages in memory */
+	count_t* frameTable;			/* Open addressing hash table from physical page id to buffer id. 0 is empty slot. */
+	id_t	frameTableMask;			/* Number of slots in frame table minus one. Number of slots is a power of 2. */
+	count_t numEmptyFrames;			/* Number of unassigned buffer pages (status 0) in buffers 2 to numPages-1 */
+	uint8_t replacementPolicy;		/* Buffer replacement policy (e.g. BUFFER_LRU) optionally combined with BUFFER_LEVEL_AWARE */
+	id_t*	frameTick;				/* Per buffer: last access time (LRU, 2Q) or reference count (CLOCK). 0 means replace first. */
+	uint8_t* frameQueue;			/* Per buffer 2Q queue: 0 if page used once, 1 if used again */
+	id_t*	ghostPages;				/* 2Q: ring of page ids recently replaced after being used once */
+	count_t numGhostPages;			/* 2Q: number of entries in ghost ring */
+	count_t nextGhostPage;			/* 2Q: next entry in ghost ring to overwrite */
+	id_t	accessTick;				/* Incremented on each buffer access */
+	uint8_t* pinCount;				/* Per buffer number of pins. Pinned buffers are not replaced by readPage(). */
+	uint8_t* dirty;					/* Per buffer 1 if page was updated in buffer but not written to storage */
+	count_t numDirty;				/* Number of dirty buffers */
+	count_t maxDirtyPages;			/* Write-back: dirty buffers allowed before all are written. 0 writes through. */
+	count_t	ftlCachePages;			/* FTL: indirection table pages cached in memory. Page ids are logical and mapped to physical pages. 0 if page ids are physical. */
+	count_t	ftlEntriesPerPage;		/* FTL: number of entries per indirection table page */
+	id_t	ftlNumTablePages;		/* FTL: number of indirection table pages */
+	id_t	ftlEndPhysicalPage;		/* FTL: last physical page of storage. endDataPage is last logical page. */
+	id_t	ftlNextPhysicalPage;	/* FTL: next physical page to check for writing */
+	id_t*	ftlDirectory;			/* FTL: physical page of each indirection table page. FTL_UNMAPPED if never written. */
+	void*	ftlCache;				/* FTL: cached indirection table pages */
+	id_t*	ftlCacheTablePage;		/* FTL: indirection table page in each cache page. FTL_UNMAPPED if empty. */
+	uint8_t* ftlCacheDirty;			/* FTL: 1 if cache page was updated but not written */
+	id_t*	ftlCacheTick;			/* FTL: last access time of each cache page */
+	id_t	ftlAccessTick;			/* FTL: incremented on each indirection table access */
+	bitarr	ftlFreePhysical;		/* FTL: bit vector of free physical pages */
+	bitarr	ftlReleased;			/* FTL: bit vector of physical pages released since last checkpoint. NULL if no checkpoints. */
+	id_t	numTableReads;			/* FTL: number of indirection table page reads */
+	id_t	numTableWrites;			/* FTL: number of indirection table page writes */
+	id_t	checkpointPages;		/* Pages in each of two checkpoint slots at end of storage. Rounded to erase size. 0 if no checkpoints. */
+	id_t	checkpointStart;		/* Physical page of first checkpoint slot */
+	id_t	walPages;				/* Pages reserved for write-ahead log before checkpoint slots. Rounded to erase size. 0 if no log. */
+	id_t	walStart;				/* Physical page of first write-ahead log page */
+	id_t	runPages;				/* Pages reserved for sorted runs before write-ahead log. Rounded to erase size. 0 if no runs. */
+	id_t	runStart;				/* Physical page of first sorted run page */
+	id_t	deltaPages;				/* Pages reserved for leaf delta records before sorted runs. Rounded to erase size. 0 if not used. */
+	id_t	deltaStart;				/* Physical page of first delta page */
 	void*	blockBuffer;			/* Buffer a block of pages when erasing */	
+	int8_t	zeroCopy;				/* 1 to return pages in memory mapped storage without copying (readPageMapped). Set to 0 by setup if not supported. */
+	id_t	numMapReads;			/* Number of pages returned from mapped storage without copying */
+	count_t	prefetchPages;			/* Pages read ahead by iterators and batch inserts (e.g. 1 or 2). 0 for no read ahead. Requires more than 3 buffers. */
+	uint8_t* prefetching;			/* Per buffer 1 if asynchronous read of page is in progress. NULL if no read ahead. */
+	count_t	numPrefetching;			/* Number of buffers with asynchronous read in progress */
+	id_t	numPrefetches;			/* Number of pages read ahead */
+	id_t	numMultiWrites;			/* Number of storage writes of two or more consecutive pages */
 } dbbuffer;
 
 /**
@@ -84,7 +141,22 @@ typedef struct {
 void dbbufferInit(dbbuffer *state);
 
 /**
-@brief     	Initializes buffer and recovers previous state from storage.
+@brief     	Marks all pages free and erases first two blocks so writing starts at beginning of storage.
+@param     	state
+                DBbuffer state structure
+*/
+void dbbufferFormat(dbbuffer *state);
+
+/**
+@brief     	Marks physical pages released since the last checkpoint as free. Called when a checkpoint is written. FTL only.
+@param     	state
+                DBbuffer state structure
+@return		Number of pages made free.
+*/
+id_t dbbufferFtlReuseReleased(dbbuffer *state);
+
+/**
+@brief     	Initializes buffer for recovery without changing storage. Free space, write location, and page ids must be restored from a checkpoint.
 @param     	state
                 DBbuffer state structure
 */
@@ -100,6 +172,96 @@ void dbbufferRecover(dbbuffer *state);
 */
 void* readPage(dbbuffer *state, id_t pageNum);
 
+/**
+@brief      Reads page for read-only use. With zero copy, a page not in buffer is returned directly from mapped storage.
+			Page must not be modified and is only valid until storage is next written.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Returns pointer to page or NULL if error.
+*/
+void* readPageMapped(dbbuffer *state, id_t pageNum);
+
+/**
+@brief      Hints that a page will be read soon. Page is read into a spare buffer, asynchronously if storage supports it.
+			Does nothing if page is already in buffer or read ahead is not used.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Returns 0 if success, -1 if no buffer is available or read failed.
+*/
+int8_t dbbufferPrefetch(dbbuffer *state, id_t pageNum);
+
+/**
+@brief      Waits for all asynchronous page reads started by dbbufferPrefetch() to complete.
+@param     	state
+                DBbuffer state structure
+*/
+void dbbufferPrefetchWait(dbbuffer *state);
+
+/**
+@brief      Waits for the asynchronous read into a buffer to complete. Other reads may still be in progress.
+@param     	state
+                DBbuffer state structure
+@param     	bufferNum
+                Buffer index (0 if page is not buffered)
+*/
+void dbbufferPrefetchWaitFrame(dbbuffer *state, count_t bufferNum);
+
+/**
+@brief      Returns buffer id containing physical page or 0 if page is not in buffer.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Buffer id or 0 if not in buffer.
+*/
+count_t dbbufferFindFrame(dbbuffer *state, id_t pageNum);
+
+/**
+@brief      Assigns a buffer page to contain a physical page. Use pageNum 0 to mark buffer as unassigned.
+			Keeps status and frame table in sync.
+@param     	state
+                DBbuffer state structure
+@param		bufferNum
+				Buffer id
+@param     	pageNum
+                Physical page id (number)
+*/
+void dbbufferSetFrame(dbbuffer *state, count_t bufferNum, id_t pageNum);
+
+/**
+@brief      Reads page and pins it in buffer so readPage() does not replace it until unpinned.
+			A pinned buffer may be modified and written. It then contains the page at its new location.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Returns pointer to buffer page or NULL if error.
+*/
+void* dbbufferPinPage(dbbuffer *state, id_t pageNum);
+
+/**
+@brief      Unpins a buffer page pinned by dbbufferPinPage().
+@param     	state
+                DBbuffer state structure
+@param     	buf
+                Pointer to buffer page
+*/
+void dbbufferUnpinPage(dbbuffer *state, void *buf);
+
+/**
+@brief      Hints that a page will not be used again soon (e.g. leaf page finished by a scan).
+			Buffer containing the page is replaced first. Only used with BUFFER_LEVEL_AWARE.
+@param     	state
+                DBbuffer state structure
+@param     	pageNum
+                Physical page id (number)
+*/
+void dbbufferRecycleFirst(dbbuffer *state, id_t pageNum);
+
 /**
 @brief      Reads page to a particular buffer number. Returns pointer to buffer if success.
 @param     	state
@@ -122,6 +284,13 @@ void* readPageBuffer(dbbuffer *state, id_t pageNum, count_t bufferNum);
 */
 int32_t writePage(dbbuffer *state, void* buffer);
 
+/**
+@brief     	Returns next valid physical page to write.
+@param     	state
+                DBbuffer state structure		
+*/
+id_t dbbufferNextValidPage(dbbuffer *state);
+
 /**
 @brief      Writes page to storage. Returns physical page id if success. -1 if failure.
 			This version does not check for wrap around.
@@ -135,6 +304,21 @@ int32_t writePage(dbbuffer *state, void* buffer);
 */
 int32_t writePageDirect(dbbuffer *state, void* buffer, int32_t pageNum);
 
+/**
+@brief      Writes pages to storage at next valid physical pages. Pages given consecutive physical
+			pages are written with one storage call. Returns 0 if success. -1 if failure.
+@param     	state
+                DBbuffer state structure
+@param     	buffers
+                In memory buffers containing pages (written in order)
+@param		numPages
+				Number of pages
+@param		pageNums
+				Returns physical page id of each page
+@return		Returns 0 if success. -1 if failure.
+*/
+int8_t writePages(dbbuffer *state, void **buffers, count_t numPages, id_t *pageNums);
+
 /**
 @brief      Overwrites page to storage at same physical address. -1 if failure.
 			Caller is responsible for knowing that overwrite is possible given page contents.
@@ -146,6 +330,27 @@ int32_t writePageDirect(dbbuffer *state, void* buffer, int32_t pageNum);
 */
 int32_t overWritePage(dbbuffer *state, void* buffer, int32_t pageNum);
 
+/**
+@brief      Overwrites page at same physical address. If write-back is enabled (maxDirtyPages > 0) and
+			buffer is the buffer page containing the page, the write is delayed until the buffer is
+			replaced or flushed. Otherwise same as overWritePage().
+@param     	state
+                DBbuffer state structure
+@param     	buffer
+                In memory buffer containing page
+@param		pageNum
+				Physical page id (number)
+@return		Physical page id
+*/
+int32_t overWritePageDeferred(dbbuffer *state, void* buffer, int32_t pageNum);
+
+/**
+@brief     	Writes all dirty buffer pages to storage. Leaves are written first then interior nodes and root last.
+@param     	state
+                DBbuffer state structure
+*/
+void dbbufferFlush(dbbuffer *state);
+
 /**
 @brief     	Initialize in-memory buffer page.
 @param     	state
@@ -59,6 +59,11 @@ int8_t dfStorageInit(storageState *storage)
 	mem->storage.writePage = dfStorageWritePage;
 	mem->storage.erasePages = dfStorageErasePages;
 	mem->storage.flush = dfStorageFlush;
+	mem->storage.mapPage = NULL;
+	mem->storage.submitRead = storageSubmitReadSync;
+	mem->storage.submitWrite = storageSubmitWriteSync;
+	mem->storage.poll = storagePollSync;
+	mem->storage.writePages = dfStorageWritePages;
 	mem->maxPageWrite = 0;
 
 	/*
@@ -140,6 +145,46 @@ int8_t dfStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize,
 	return 0;   
 }
 
+
+/**
+@brief      Writes consecutive pages from buffers into storage.
+@param     	state
+                Dataflash Memory storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t dfStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers)
+{
+	dfStorageState *mem = (dfStorageState*) storage;
+
+	if ((startPage+numPages)*pageSize > mem->size)
+		return -1;		/* Invalid page requested */
+
+	/* Pages written before must be erased unless using overwrite. Pages after the largest page written are erased. */
+	count_t num = 0;
+	if (startPage <= mem->maxPageWrite)
+	{
+		num = numPages;
+		if (mem->maxPageWrite - startPage + 1 < numPages)
+			num = mem->maxPageWrite - startPage + 1;
+		dfwritePages(startPage+mem->pageOffset, buffers, num, pageSize, !mem->useOverwrite);
+	}
+	if (num < numPages)
+	{
+		dfwritePages(startPage+num+mem->pageOffset, buffers+num, numPages-num, pageSize, 0);
+		mem->maxPageWrite = startPage+numPages-1;
+	}
+	return 0;
+}
+
+
 /**
 @brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
 @param     	state
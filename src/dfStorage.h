@@ -98,6 +98,23 @@ int8_t dfStorageReadPage(storageState *storage, id_t pageNum, count_t pageSize,
 int8_t dfStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer);
 
 
+/**
+@brief      Writes consecutive pages from buffers into storage.
+@param     	state
+                Dataflash Memory storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t dfStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers);
+
+
 /**
 @brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
 @param     	state
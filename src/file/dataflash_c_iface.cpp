@@ -111,6 +111,57 @@ int32_t dfwriteErase(int32_t pagenum, void *ptr, int32_t size)
 	return size;	
 }
 
+/**
+@brief		Write consecutive data pages to data flash. The two SRAM buffers are used in turn so
+			the next page is transferred while the previous page is programmed.
+@param		pagenum
+				Page number of first page
+@param		ptrs
+				Pointers to the memory containing data to be written for each page
+@param		count
+				Number of pages
+@param		size
+				The number of bytes to be written per page
+@param		erase
+				1 to erase each page before write, 0 if pages are erased
+@returns	The number of bytes written
+*/
+int32_t dfwritePages(int32_t pagenum, void **ptrs, int32_t count, int32_t size, int8_t erase)
+{
+	for (int32_t i=0; i < count; i++)
+	{
+		/* Buffer may be written while the other buffer is being programmed */
+		if (i % 2 == 0)
+			df_buffer_1_write(dflash, 0, (uint8_t*) ptrs[i], size);
+		else
+			df_buffer_2_write(dflash, 0, (uint8_t*) ptrs[i], size);
+
+		while (DATAFLASH_BUSY == get_ready_status(dflash))
+		{
+		};
+
+		if (i % 2 == 0)
+		{
+			if (erase)
+				df_buffer_1_to_MM_erase(dflash, pagenum+i);
+			else
+				df_buffer_1_to_MM_no_erase(dflash, pagenum+i);
+		}
+		else
+		{
+			if (erase)
+				df_buffer_2_to_MM_erase(dflash, pagenum+i);
+			else
+				df_buffer_2_to_MM_no_erase(dflash, pagenum+i);
+		}
+	}
+
+	while (DATAFLASH_BUSY == get_ready_status(dflash))
+	{
+	};
+	return size*count;
+}
+
 /**
 @brief		Erases data page.
 @param		pagenum
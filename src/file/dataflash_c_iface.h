@@ -88,6 +88,23 @@ int32_t dfwrite(int32_t pagenum, void *ptr, int32_t size);
 */
 int32_t dfwriteErase(int32_t pagenum, void *ptr, int32_t size);
 
+/**
+@brief		Write consecutive data pages to data flash. The two SRAM buffers are used in turn so
+			the next page is transferred while the previous page is programmed.
+@param		pagenum
+				Page number of first page
+@param		ptrs
+				Pointers to the memory containing data to be written for each page
+@param		count
+				Number of pages
+@param		size
+				The number of bytes to be written per page
+@param		erase
+				1 to erase each page before write, 0 if pages are erased
+@returns	The number of bytes written
+*/
+int32_t dfwritePages(int32_t pagenum, void **ptrs, int32_t count, int32_t size, int8_t erase);
+
 /**
 @brief		Erases data page.
 @param		pagenum
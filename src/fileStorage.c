@@ -51,7 +51,11 @@ int8_t fileStorageInit(storageState *storage)
 	// Single-file implementation
 	char str[20];
 	sprintf(str, "%s.bin", fs->fileName);
-	fs->file = fopen(str, "w+b");
+	fs->file = NULL;
+	if (fs->openExisting)
+		fs->file = fopen(str, "r+b");
+	if (NULL == fs->file)
+		fs->file = fopen(str, "w+b");
     if (NULL == fs->file) 
 		return -1;
 	#else
@@ -62,7 +66,11 @@ int8_t fileStorageInit(storageState *storage)
 	{
 		sprintf(str, "%s%d.bin", fs->fileName, i);		
 		// printf("%s\n", str);		
-		fs->files[i] = fopen(str, "w+b");				
+		fs->files[i] = NULL;
+		if (fs->openExisting)
+			fs->files[i] = fopen(str, "r+b");
+		if (NULL == fs->files[i])
+			fs->files[i] = fopen(str, "w+b");				
     	if (NULL == fs->files[i]) 
 			return -1;
 	}
@@ -74,6 +82,11 @@ int8_t fileStorageInit(storageState *storage)
 	fs->storage.writePage = fileStorageWritePage;
 	fs->storage.erasePages = fileStorageErasePages;
 	fs->storage.flush = fileStorageFlush;
+	fs->storage.mapPage = NULL;
+	fs->storage.submitRead = storageSubmitReadSync;
+	fs->storage.submitWrite = storageSubmitWriteSync;
+	fs->storage.poll = storagePollSync;
+	fs->storage.writePages = fileStorageWritePages;
 
 	return 0;	
 }
@@ -168,12 +181,60 @@ int8_t fileStorageWritePage(storageState *storage, id_t pageNum, count_t pageSiz
 
 	int16_t result = fwrite(buffer, pageSize, 1, fp);
 	// printf("Write page: %d size: %d\n", pageNum, result);
-	if (result != 0)
+	if (result != 1)
 		return -1;
 
 	return 0;
 }
 
+/**
+@brief      Writes consecutive pages from buffers into storage. Pages in the same file are written after one seek.
+@param     	state
+                File storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t fileStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers)
+{
+	fileStorageState *fs = (fileStorageState*) storage;
+	count_t i = 0;
+
+	while (i < numPages)
+	{
+		id_t pageNum = startPage+i;
+		#if defined(ARDUINO)
+		SD_FILE* fp = getFile(fs, &pageNum);
+		SD_FILE* next;
+		#else
+		FILE* fp = getFile(fs, &pageNum);
+		FILE* next;
+		#endif
+
+		/* Seek to location of first page in file then write pages one after another */
+		if (fseek(fp, pageNum*pageSize, SEEK_SET) == -1)
+			return -1;
+
+		id_t offset = pageNum;
+		do
+		{
+			if (fwrite(buffers[i], pageSize, 1, fp) != 1)
+				return -1;
+			i++;
+			offset++;
+			pageNum = startPage+i;
+			next = getFile(fs, &pageNum);
+		} while (i < numPages && next == fp && pageNum == offset);
+	}
+	return 0;
+}
+
 /**
 @brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
 @param     	state
@@ -187,6 +248,9 @@ int8_t fileStorageWritePage(storageState *storage, id_t pageNum, count_t pageSiz
 int8_t fileStorageErasePages(storageState *storage, id_t startPage, id_t endPage)
 {
 	/* Nothing to do */
+	(void) storage;
+	(void) startPage;
+	(void) endPage;
 	return 0;
 }
 
@@ -66,6 +66,7 @@ typedef struct {
 	#endif
 	char			*fileName;			/* File name for storage */
 	uint32_t		fileSize;			/* Maximum size in records for each file */
+	int8_t			openExisting;		/* 1 to open existing files without truncating (e.g. for recovery), 0 to create new files */
 } fileStorageState;
 
 
@@ -108,6 +109,23 @@ int8_t fileStorageReadPage(storageState *storage, id_t pageNum, count_t pageSize
 int8_t fileStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer);
 
 
+/**
+@brief      Writes consecutive pages from buffers into storage. Pages in the same file are written after one seek.
+@param     	state
+                File storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t fileStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers);
+
+
 /**
 @brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
 @param     	state
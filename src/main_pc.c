@@ -42,9 +42,9 @@
 void main()
 {
   int16_t M = 3, logBufferPages = 0, numRuns = 3;
-  int8_t type = VMTREE;         // VMTREE, BTREE, OVERWRITE
+  int8_t type = VMTREE;         // VMTREE, BTREE, OVERWRITE, FTL
   int8_t testType = 0;          // 0 - random, 1 - SeaTac, 2 - UWA, 3 - health, 4 - health (text)
-                                // 5 - storage performance test
+                                // 5 - storage performance test, 6 - feature tests
   uint32_t storageSize = 20000; // Storage size in pages
 
   recordIteratorState* it  = NULL;
@@ -79,6 +79,11 @@ void main()
     case 5:
       testRawPerformanceFileStorage();
       break;
+
+    case 6:
+      it = randomIterator(10000);
+      runFeatureTests(it, 16, 4, 12, uint32Compare, storageSize);
+      break;
   } 
 
   if (it != NULL)  
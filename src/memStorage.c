@@ -56,7 +56,13 @@ int8_t memStorageInit(storageState *storage)
 	mem->storage.close = memStorageClose;
 	mem->storage.readPage = memStorageReadPage;
 	mem->storage.writePage = memStorageWritePage;
+	mem->storage.erasePages = memStorageErasePages;
 	mem->storage.flush = memStorageFlush;
+	mem->storage.mapPage = memStorageMapPage;
+	mem->storage.submitRead = storageSubmitReadSync;
+	mem->storage.submitWrite = storageSubmitWriteSync;
+	mem->storage.poll = storagePollSync;
+	mem->storage.writePages = memStorageWritePages;
 
 	return 0;
 }
@@ -112,6 +118,75 @@ int8_t memStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize
 }
 
 
+/**
+@brief      Writes consecutive pages from buffers into storage.
+@param     	state
+                Memory storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t memStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers)
+{
+	memStorageState *mem = (memStorageState*) storage;
+
+	if ((startPage+numPages)*pageSize > mem->size)
+		return -1;		/* Invalid page requested */
+
+	/* Copy buffers to consecutive locations in memory storage */
+	void *ptr = mem->buffer+startPage*pageSize;
+	for (count_t i=0; i < numPages; i++, ptr += pageSize)
+		memcpy(ptr, buffers[i], pageSize);
+	return 0;
+}
+
+
+/**
+@brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
+@param     	state
+               	Memory storage state structure
+@param     	startPage
+                Physical index of start page
+@param     	endPage
+				Physical index of start page
+@return		Return 0 if success, -1 if failure.
+*/
+int8_t memStorageErasePages(storageState *storage, id_t startPage, id_t endPage)
+{
+	/* Nothing to do */
+	(void) storage;
+	(void) startPage;
+	(void) endPage;
+	return 0;
+}
+
+
+/**
+@brief      Returns pointer to page in memory storage. Page is accessed without copying.
+@param     	state
+                Memory storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page in bytes
+@return		Returns pointer to page or NULL if invalid page.
+*/
+void* memStorageMapPage(storageState *storage, id_t pageNum, count_t pageSize)
+{
+	memStorageState *mem = (memStorageState*) storage;
+
+	if ((pageNum+1)*pageSize > mem->size)
+		return NULL;
+	return mem->buffer+pageNum*pageSize;
+}
+
+
 /**
 @brief     	Flush storage and ensure all data is written.
 @param     	state
@@ -120,6 +195,7 @@ int8_t memStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize
 void memStorageFlush(storageState *storage)
 {
 	/* Nothing required to do */
+	(void) storage;
 }
 
 
@@ -87,6 +87,49 @@ int8_t memStorageReadPage(storageState *storage, id_t pageNum, count_t pageSize,
 int8_t memStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer);
 
 
+/**
+@brief      Writes consecutive pages from buffers into storage.
+@param     	state
+                Memory storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t memStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers);
+
+
+/**
+@brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
+@param     	state
+               	Memory storage state structure
+@param     	startPage
+                Physical index of start page
+@param     	endPage
+				Physical index of start page
+@return		Return 0 if success, -1 if failure.
+*/
+int8_t memStorageErasePages(storageState *storage, id_t startPage, id_t endPage);
+
+
+/**
+@brief      Returns pointer to page in memory storage. Page is accessed without copying.
+@param     	state
+                Memory storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page in bytes
+@return		Returns pointer to page or NULL if invalid page.
+*/
+void* memStorageMapPage(storageState *storage, id_t pageNum, count_t pageSize);
+
+
 /**
 @brief     	Flush storage and ensure all data is written.
 @param     	state
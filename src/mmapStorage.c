@@ -0,0 +1,239 @@
+/******************************************************************************/
+/**
+@file		mmapStorage.c
+@author		Ramon Lawrence
+@brief		Memory-mapped file storage implementation for reading and writing pages of data.
+@copyright	Copyright 2024
+			The University of British Columbia,
+			Ramon Lawrence		
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if !defined(ARDUINO)
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mmapStorage.h"
+
+/**
+@brief     	Initializes storage. Opens, sizes, and maps file.
+@param		state
+                Memory-mapped storage state structure
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t mmapStorageInit(storageState *storage)
+{
+	mmapStorageState *ms = (mmapStorageState*) storage;
+	int flags = O_RDWR | O_CREAT;
+
+	if (!ms->openExisting)
+		flags |= O_TRUNC;
+
+	ms->map = NULL;
+	ms->fd = open(ms->fileName, flags, 0644);
+	if (ms->fd == -1)
+		return -1;
+
+	/* File must cover entire mapping. Accessing a mapped page past end of file faults. */
+	ms->mapSize = (size_t) ms->storage.size * ms->pageSize;
+	if (posix_fallocate(ms->fd, 0, (off_t) ms->mapSize) != 0 && ftruncate(ms->fd, (off_t) ms->mapSize) != 0)
+	{
+		printf("Unable to size storage file: %s\n", ms->fileName);
+		close(ms->fd);
+		ms->fd = -1;
+		return -1;
+	}
+
+	ms->map = (uint8_t*) mmap(NULL, ms->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, ms->fd, 0);
+	if (ms->map == MAP_FAILED)
+	{
+		printf("Unable to map storage file: %s\n", ms->fileName);
+		ms->map = NULL;
+		close(ms->fd);
+		ms->fd = -1;
+		return -1;
+	}
+
+	ms->storage.init = mmapStorageInit;
+	ms->storage.close = mmapStorageClose;
+	ms->storage.readPage = mmapStorageReadPage;
+	ms->storage.writePage = mmapStorageWritePage;
+	ms->storage.erasePages = mmapStorageErasePages;
+	ms->storage.flush = mmapStorageFlush;
+	ms->storage.mapPage = mmapStorageMapPage;
+	ms->storage.submitRead = storageSubmitReadSync;
+	ms->storage.submitWrite = storageSubmitWriteSync;
+	ms->storage.poll = storagePollSync;
+	ms->storage.writePages = mmapStorageWritePages;
+
+	return 0;
+}
+
+/**
+@brief      Reads page from storage into buffer. Returns 0 if success, non-zero if failure.
+@param     	state
+                Memory-mapped storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to read in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t mmapStorageReadPage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer)
+{
+	mmapStorageState *ms = (mmapStorageState*) storage;
+
+	if (((size_t) pageNum+1)*pageSize > ms->mapSize)
+		return -1;		/* Invalid page requested */
+
+	memcpy(buffer, ms->map + (size_t) pageNum*pageSize, pageSize);
+	return 0;
+}
+
+/**
+@brief      Writes page from buffer into storage. Returns 0 if success, non-zero if failure.
+@param     	state
+                Memory-mapped storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to write in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t mmapStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer)
+{
+	mmapStorageState *ms = (mmapStorageState*) storage;
+
+	if (((size_t) pageNum+1)*pageSize > ms->mapSize)
+		return -1;		/* Invalid page requested */
+
+	memcpy(ms->map + (size_t) pageNum*pageSize, buffer, pageSize);
+	return 0;
+}
+
+/**
+@brief      Writes consecutive pages from buffers into storage.
+@param     	state
+                Memory-mapped storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t mmapStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers)
+{
+	mmapStorageState *ms = (mmapStorageState*) storage;
+
+	if (((size_t) startPage+numPages)*pageSize > ms->mapSize)
+		return -1;		/* Invalid page requested */
+
+	for (count_t i=0; i < numPages; i++)
+		memcpy(ms->map + ((size_t) startPage+i)*pageSize, buffers[i], pageSize);
+	return 0;
+}
+
+/**
+@brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
+@param     	state
+               	Memory-mapped storage state structure
+@param     	startPage
+                Physical index of start page
+@param     	endPage
+				Physical index of start page
+@return		Return 0 if success, -1 if failure.
+*/
+int8_t mmapStorageErasePages(storageState *storage, id_t startPage, id_t endPage)
+{
+	/* Nothing to do */
+	(void) storage;
+	(void) startPage;
+	(void) endPage;
+	return 0;
+}
+
+/**
+@brief      Returns pointer to page in file mapping. Page is accessed without copying.
+@param     	state
+                Memory-mapped storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page in bytes
+@return		Returns pointer to page or NULL if invalid page.
+*/
+void* mmapStorageMapPage(storageState *storage, id_t pageNum, count_t pageSize)
+{
+	mmapStorageState *ms = (mmapStorageState*) storage;
+
+	if (((size_t) pageNum+1)*pageSize > ms->mapSize)
+		return NULL;
+	return ms->map + (size_t) pageNum*pageSize;
+}
+
+/**
+@brief     	Flush storage and ensure all data is written (msync).
+@param     	state
+                Memory-mapped storage state structure
+*/
+void mmapStorageFlush(storageState *storage)
+{
+	mmapStorageState *ms = (mmapStorageState*) storage;
+	if (ms->map != NULL)
+		msync(ms->map, ms->mapSize, MS_SYNC);
+}
+
+/**
+@brief     	Closes storage and performs any needed cleanup.
+@param     	state
+                Memory-mapped storage state structure
+*/
+void mmapStorageClose(storageState *storage)
+{
+	mmapStorageState *ms = (mmapStorageState*) storage;
+
+	if (ms->map != NULL)
+		munmap(ms->map, ms->mapSize);
+	ms->map = NULL;
+	if (ms->fd != -1)
+		close(ms->fd);
+	ms->fd = -1;
+}
+
+#endif
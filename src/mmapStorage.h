@@ -0,0 +1,159 @@
+/******************************************************************************/
+/**
+@file		mmapStorage.h
+@author		Ramon Lawrence
+@brief		Memory-mapped file storage for reading and writing pages of data. Pages can be accessed in place without copying.
+@copyright	Copyright 2024
+			The University of British Columbia,
+			Ramon Lawrence		
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#ifndef MMAPSTORAGE_H
+#define MMAPSTORAGE_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+#include "storage.h"
+
+typedef struct {
+	storageState 	storage;			/* Base struct defining read/write page functions */
+	char			*fileName;			/* File name for storage */
+	count_t			pageSize;			/* Size of page in bytes. File is sized and mapped for storage size pages. */
+	int8_t			openExisting;		/* 1 to open existing file without truncating (e.g. for recovery), 0 to create new file */
+	int				fd;					/* File descriptor */
+	uint8_t			*map;				/* Start of file mapping */
+	size_t			mapSize;			/* Size of file mapping in bytes */
+} mmapStorageState;
+
+
+/**
+@brief     	Initializes storage. Opens, sizes, and maps file.
+@param		state
+                Memory-mapped storage state structure
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t mmapStorageInit(storageState *storage);
+
+
+/**
+@brief      Reads page from storage into buffer. Returns 0 if success, non-zero if failure.
+@param     	state
+                Memory-mapped storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to read in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t mmapStorageReadPage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer);
+
+
+/**
+@brief      Writes page from buffer into storage. Returns 0 if success, non-zero if failure.
+@param     	state
+                Memory-mapped storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to write in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t mmapStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer);
+
+
+/**
+@brief      Writes consecutive pages from buffers into storage.
+@param     	state
+                Memory-mapped storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t mmapStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers);
+
+
+/**
+@brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
+@param     	state
+               	Memory-mapped storage state structure
+@param     	startPage
+                Physical index of start page
+@param     	endPage
+				Physical index of start page
+@return		Return 0 if success, -1 if failure.
+*/
+int8_t mmapStorageErasePages(storageState *storage, id_t startPage, id_t endPage);
+
+
+/**
+@brief      Returns pointer to page in file mapping. Page is accessed without copying.
+@param     	state
+                Memory-mapped storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page in bytes
+@return		Returns pointer to page or NULL if invalid page.
+*/
+void* mmapStorageMapPage(storageState *storage, id_t pageNum, count_t pageSize);
+
+
+/**
+@brief     	Flush storage and ensure all data is written (msync).
+@param     	state
+                Memory-mapped storage state structure
+*/
+void mmapStorageFlush(storageState *storage);
+
+
+/**
+@brief     	Closes storage and performs any needed cleanup.
+@param     	state
+                Memory-mapped storage state structure
+*/
+void mmapStorageClose(storageState *storage);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,627 @@
+/******************************************************************************/
+/**
+@file		posixStorage.c
+@author		Ramon Lawrence
+@brief		Single file storage implementation using pread/pwrite for reading and writing pages of data (Linux/POSIX).
+@copyright	Copyright 2024
+			The University of British Columbia,
+			Ramon Lawrence		
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if !defined(ARDUINO)
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE			/* O_DIRECT and fallocate() */
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "posixStorage.h"
+
+/* Asynchronous request status */
+#define POSIX_REQUEST_FREE		0
+#define POSIX_REQUEST_QUEUED	1
+#define POSIX_REQUEST_RUNNING	2
+#define POSIX_REQUEST_DONE		3
+
+typedef struct {
+	id_t			pageNum;			/* Physical page id (number) */
+	count_t			pageSize;			/* Size of page in bytes */
+	void			*buffer;			/* Page buffer */
+	storageCallback	done;				/* Callback when complete (NULL if none) */
+	void			*arg;				/* Argument passed to callback */
+	uint32_t		seq;				/* Submission order. Oldest queued request is started first. */
+	int8_t			write;				/* 1 if write, 0 if read */
+	int8_t			status;				/* POSIX_REQUEST_FREE, QUEUED, RUNNING, or DONE */
+	int8_t			result;				/* Result of read or write. 0 if success. */
+} posixStorageRequest;
+
+typedef struct {
+	pthread_mutex_t	lock;				/* Protects requests and counters */
+	pthread_cond_t	queued;				/* Signalled when request is submitted or threads must stop */
+	pthread_cond_t	completed;			/* Signalled when request is done */
+	pthread_t		*threads;			/* I/O threads */
+	uint8_t			numThreads;			/* Number of I/O threads started */
+	int8_t			stop;				/* 1 if I/O threads must exit */
+	uint32_t		nextSeq;			/* Sequence number of next request */
+	count_t			numActive;			/* Requests submitted but not yet returned by poll */
+	posixStorageRequest	requests[POSIX_STORAGE_QUEUE];
+} posixStorageAsync;
+
+void* posixStorageWorker(void *arg);
+void posixStorageStopThreads(posixStorageState *ps);
+
+/**
+@brief     	Initializes storage. Opens and preallocates file.
+@param		state
+                POSIX file storage state structure
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageInit(storageState *storage)
+{
+	posixStorageState *ps = (posixStorageState*) storage;
+	int flags = O_RDWR | O_CREAT;
+
+	if (!ps->openExisting)
+		flags |= O_TRUNC;
+
+	ps->fd = -1;
+	ps->alignBuffer = NULL;
+	ps->async = NULL;
+	#ifdef O_DIRECT
+	if (ps->useDirect && ps->pageSize > 0 && ps->pageSize % POSIX_STORAGE_BLOCK == 0)
+		ps->fd = open(ps->fileName, flags | O_DIRECT, 0644);
+	#endif
+	if (ps->fd == -1)
+	{	/* File system may not support O_DIRECT */
+		if (ps->useDirect)
+			printf("O_DIRECT not used for storage file: %s\n", ps->fileName);
+		ps->useDirect = 0;
+		ps->fd = open(ps->fileName, flags, 0644);
+	}
+	if (ps->fd == -1)
+		return -1;
+
+	if (ps->useDirect)
+	{
+		ps->alignBuffer = posixStorageAlloc(ps->pageSize);
+		if (ps->alignBuffer == NULL)
+		{
+			close(ps->fd);
+			ps->fd = -1;
+			return -1;
+		}
+	}
+
+	/* Allocate all file blocks now so writes do not extend file or change its metadata */
+	if (ps->pageSize > 0)
+	{
+		off_t len = (off_t) ps->storage.size * ps->pageSize;
+		#if defined(__linux__)
+		if (fallocate(ps->fd, 0, 0, len) != 0 && posix_fallocate(ps->fd, 0, len) != 0)
+		#else
+		if (posix_fallocate(ps->fd, 0, len) != 0)
+		#endif
+			printf("Unable to preallocate storage file: %s\n", ps->fileName);
+	}
+
+	ps->storage.init = posixStorageInit;
+	ps->storage.close = posixStorageClose;
+	ps->storage.readPage = posixStorageReadPage;
+	ps->storage.writePage = posixStorageWritePage;
+	ps->storage.erasePages = posixStorageErasePages;
+	ps->storage.flush = posixStorageFlush;
+	ps->storage.mapPage = NULL;
+	ps->storage.submitRead = posixStorageSubmitRead;
+	ps->storage.submitWrite = posixStorageSubmitWrite;
+	ps->storage.poll = posixStoragePoll;
+	ps->storage.writePages = posixStorageWritePages;
+
+	/* Start I/O threads. Requests are synchronous if no thread can be started. */
+	if (ps->ioThreads > 0)
+	{
+		posixStorageAsync *as = (posixStorageAsync*) calloc(1, sizeof(posixStorageAsync));
+		if (as != NULL)
+			as->threads = (pthread_t*) malloc(sizeof(pthread_t) * ps->ioThreads);
+		if (as == NULL || as->threads == NULL)
+		{
+			printf("Failed to allocate I/O threads.\n");
+			free(as);
+			free(ps->alignBuffer);
+			ps->alignBuffer = NULL;
+			close(ps->fd);
+			ps->fd = -1;
+			return -1;
+		}
+		pthread_mutex_init(&as->lock, NULL);
+		pthread_cond_init(&as->queued, NULL);
+		pthread_cond_init(&as->completed, NULL);
+		ps->async = as;
+		for (uint8_t i=0; i < ps->ioThreads; i++)
+		{
+			if (pthread_create(&as->threads[i], NULL, posixStorageWorker, ps) != 0)
+				break;
+			as->numThreads++;
+		}
+		if (as->numThreads == 0)
+		{
+			printf("Unable to start I/O threads. Using synchronous requests.\n");
+			posixStorageStopThreads(ps);
+		}
+		ps->ioThreads = as->numThreads;
+	}
+
+	return 0;
+}
+
+/**
+@brief     	Allocates memory aligned for O_DIRECT. Use for dbbuffer page buffers so pages are read and written without copying.
+@param		size
+				Size in bytes
+@return		Returns pointer to memory (release with free()) or NULL if failure.
+*/
+void* posixStorageAlloc(size_t size)
+{
+	void *ptr;
+	if (posix_memalign(&ptr, POSIX_STORAGE_ALIGN, size) != 0)
+		return NULL;
+	return ptr;
+}
+
+/**
+@brief      Returns 1 if buffer must be copied through aligned buffer for O_DIRECT, 0 otherwise.
+@param     	state
+                POSIX file storage state structure
+@param		buffer
+				Pointer to page buffer
+*/
+int8_t posixStorageUnaligned(posixStorageState *ps, void *buffer)
+{
+	return ps->useDirect && (uintptr_t) buffer % POSIX_STORAGE_ALIGN != 0;
+}
+
+/**
+@brief      Reads or writes a page. Returns 0 if success, non-zero if failure.
+@param     	state
+                POSIX file storage state structure
+@param		write
+				1 to write page, 0 to read page
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page in bytes
+@param		buffer
+				Pointer to page buffer
+@param		alignBuffer
+				O_DIRECT: aligned page used if buffer is not aligned. Each thread uses its own.
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageTransfer(posixStorageState *ps, int8_t write, id_t pageNum, count_t pageSize, void *buffer, void *alignBuffer)
+{
+	int8_t copy = posixStorageUnaligned(ps, buffer);
+	void *buf = copy ? alignBuffer : buffer;
+
+	/* O_DIRECT transfers whole storage pages. Aligned buffer has space for one storage page. */
+	if (buf == NULL || (ps->useDirect && pageSize != ps->pageSize))
+		return -1;
+
+	if (write)
+	{
+		if (copy)
+			memcpy(buf, buffer, pageSize);
+		if (pwrite(ps->fd, buf, pageSize, (off_t) pageNum * pageSize) != pageSize)
+			return -1;
+		return 0;
+	}
+
+	if (pread(ps->fd, buf, pageSize, (off_t) pageNum * pageSize) != pageSize)
+		return -1;
+	if (copy)
+		memcpy(buffer, buf, pageSize);
+	return 0;
+}
+
+/**
+@brief      Reads page from storage into buffer. Returns 0 if success, non-zero if failure.
+@param     	state
+                POSIX file storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to read in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageReadPage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer)
+{
+	posixStorageState *ps = (posixStorageState*) storage;
+	return posixStorageTransfer(ps, 0, pageNum, pageSize, buffer, ps->alignBuffer);
+}
+
+/**
+@brief      Writes page from buffer into storage. Returns 0 if success, non-zero if failure.
+@param     	state
+                POSIX file storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to write in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer)
+{
+	posixStorageState *ps = (posixStorageState*) storage;
+	return posixStorageTransfer(ps, 1, pageNum, pageSize, buffer, ps->alignBuffer);
+}
+
+/**
+@brief      Writes consecutive pages from buffers into storage with one pwritev() call per POSIX_STORAGE_IOV pages.
+			With O_DIRECT, pages in unaligned buffers are written separately.
+@param     	state
+                POSIX file storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers)
+{
+	posixStorageState *ps = (posixStorageState*) storage;
+	struct iovec iov[POSIX_STORAGE_IOV];
+	count_t i = 0;
+
+	/* O_DIRECT transfers whole storage pages */
+	if (ps->useDirect && pageSize != ps->pageSize)
+		return -1;
+
+	while (i < numPages)
+	{
+		if (posixStorageUnaligned(ps, buffers[i]))
+		{	/* Page is copied to aligned buffer */
+			if (posixStorageTransfer(ps, 1, startPage+i, pageSize, buffers[i], ps->alignBuffer) != 0)
+				return -1;
+			i++;
+			continue;
+		}
+
+		/* Gather aligned pages into one write */
+		int n = 0;
+		while (i+n < numPages && n < POSIX_STORAGE_IOV && !posixStorageUnaligned(ps, buffers[i+n]))
+		{
+			iov[n].iov_base = buffers[i+n];
+			iov[n].iov_len = pageSize;
+			n++;
+		}
+		if (pwritev(ps->fd, iov, n, (off_t) (startPage+i) * pageSize) != (ssize_t) n * pageSize)
+			return -1;
+		i += n;
+	}
+	return 0;
+}
+
+/**
+@brief      I/O thread. Performs queued requests oldest first until threads are stopped.
+@param		arg
+				POSIX file storage state structure
+*/
+void* posixStorageWorker(void *arg)
+{
+	posixStorageState *ps = (posixStorageState*) arg;
+	posixStorageAsync *as = (posixStorageAsync*) ps->async;
+	void *alignBuffer = ps->useDirect ? posixStorageAlloc(ps->pageSize) : NULL;
+
+	pthread_mutex_lock(&as->lock);
+	while (!as->stop)
+	{
+		posixStorageRequest *r = NULL;
+		for (count_t i=0; i < POSIX_STORAGE_QUEUE; i++)
+		{
+			posixStorageRequest *q = &as->requests[i];
+			if (q->status == POSIX_REQUEST_QUEUED && (r == NULL || (int32_t) (q->seq - r->seq) < 0))
+				r = q;
+		}
+		if (r == NULL)
+		{
+			pthread_cond_wait(&as->queued, &as->lock);
+			continue;
+		}
+
+		/* Request is not changed by other threads while running */
+		r->status = POSIX_REQUEST_RUNNING;
+		pthread_mutex_unlock(&as->lock);
+		int8_t result = posixStorageTransfer(ps, r->write, r->pageNum, r->pageSize, r->buffer, alignBuffer);
+		pthread_mutex_lock(&as->lock);
+
+		r->result = result;
+		r->status = POSIX_REQUEST_DONE;
+		pthread_cond_broadcast(&as->completed);
+	}
+	pthread_mutex_unlock(&as->lock);
+	free(alignBuffer);
+	return NULL;
+}
+
+/**
+@brief      Calls callbacks of completed requests. Lock is released while a callback runs so it may submit requests.
+@param     	state
+                POSIX file storage state structure
+@param		wait
+				STORAGE_POLL_NOWAIT, STORAGE_POLL_ALL, or STORAGE_POLL_ANY
+@return		Returns number of requests completed.
+*/
+int16_t posixStorageComplete(posixStorageState *ps, int8_t wait)
+{
+	posixStorageAsync *as = (posixStorageAsync*) ps->async;
+	int16_t count = 0;
+
+	pthread_mutex_lock(&as->lock);
+	while (1)
+	{
+		int16_t n = 0;
+		for (count_t i=0; i < POSIX_STORAGE_QUEUE; i++)
+		{
+			posixStorageRequest *r = &as->requests[i];
+			if (r->status != POSIX_REQUEST_DONE)
+				continue;
+
+			posixStorageRequest req = *r;
+			r->status = POSIX_REQUEST_FREE;
+			as->numActive--;
+			n++;
+			pthread_mutex_unlock(&as->lock);
+			if (req.done != NULL)
+				req.done(req.arg, req.pageNum, req.result);
+			pthread_mutex_lock(&as->lock);
+		}
+		count += n;
+
+		/* Requests may have completed while lock was released for callbacks */
+		if (n > 0)
+			continue;
+		if (wait == STORAGE_POLL_NOWAIT || as->numActive == 0 || (wait == STORAGE_POLL_ANY && count > 0))
+			break;
+		pthread_cond_wait(&as->completed, &as->lock);
+	}
+	pthread_mutex_unlock(&as->lock);
+	return count;
+}
+
+/**
+@brief      Queues a read or write for the I/O threads. Waits for a request to complete if queue is full.
+@param     	state
+                POSIX file storage state structure
+@param		write
+				1 to write page, 0 to read page
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page in bytes
+@param		buffer
+				Pointer to page buffer
+@param		done
+				Callback when request is complete (NULL if none)
+@param		arg
+				Argument passed to callback
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageSubmit(posixStorageState *ps, int8_t write, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg)
+{
+	posixStorageAsync *as = (posixStorageAsync*) ps->async;
+
+	if (as == NULL)
+	{
+		if (write)
+			return storageSubmitWriteSync((storageState*) ps, pageNum, pageSize, buffer, done, arg);
+		return storageSubmitReadSync((storageState*) ps, pageNum, pageSize, buffer, done, arg);
+	}
+
+	while (1)
+	{
+		pthread_mutex_lock(&as->lock);
+		for (count_t i=0; i < POSIX_STORAGE_QUEUE; i++)
+		{
+			posixStorageRequest *r = &as->requests[i];
+			if (r->status != POSIX_REQUEST_FREE)
+				continue;
+
+			r->pageNum = pageNum;
+			r->pageSize = pageSize;
+			r->buffer = buffer;
+			r->done = done;
+			r->arg = arg;
+			r->write = write;
+			r->seq = as->nextSeq++;
+			r->status = POSIX_REQUEST_QUEUED;
+			as->numActive++;
+			pthread_cond_signal(&as->queued);
+			pthread_mutex_unlock(&as->lock);
+			return 0;
+		}
+		pthread_mutex_unlock(&as->lock);
+
+		/* Queue is full */
+		posixStorageComplete(ps, STORAGE_POLL_ANY);
+	}
+}
+
+/**
+@brief      Starts reading a page. An I/O thread performs the read and poll() calls the callback.
+@param     	state
+                POSIX file storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to read in bytes
+@param		buffer
+				Pointer to buffer to copy data into. Must not be used until callback.
+@param		done
+				Callback when read is complete (NULL if none)
+@param		arg
+				Argument passed to callback
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageSubmitRead(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg)
+{
+	return posixStorageSubmit((posixStorageState*) storage, 0, pageNum, pageSize, buffer, done, arg);
+}
+
+/**
+@brief      Starts writing a page. An I/O thread performs the write and poll() calls the callback.
+@param     	state
+                POSIX file storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to write in bytes
+@param		buffer
+				Pointer to buffer to copy data from. Must not change until callback.
+@param		done
+				Callback when write is complete (NULL if none)
+@param		arg
+				Argument passed to callback
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageSubmitWrite(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg)
+{
+	return posixStorageSubmit((posixStorageState*) storage, 1, pageNum, pageSize, buffer, done, arg);
+}
+
+/**
+@brief      Calls callbacks of completed asynchronous requests. Requests may complete in any order.
+@param     	state
+                POSIX file storage state structure
+@param		wait
+				STORAGE_POLL_NOWAIT, STORAGE_POLL_ALL, or STORAGE_POLL_ANY
+@return		Returns number of requests completed.
+*/
+int16_t posixStoragePoll(storageState *storage, int8_t wait)
+{
+	posixStorageState *ps = (posixStorageState*) storage;
+
+	if (ps->async == NULL)
+		return 0;
+	return posixStorageComplete(ps, wait);
+}
+
+/**
+@brief      Waits for outstanding requests, then stops I/O threads and frees request queue.
+@param     	state
+                POSIX file storage state structure
+*/
+void posixStorageStopThreads(posixStorageState *ps)
+{
+	posixStorageAsync *as = (posixStorageAsync*) ps->async;
+
+	if (as == NULL)
+		return;
+	if (as->numThreads > 0)
+		posixStorageComplete(ps, STORAGE_POLL_ALL);
+
+	pthread_mutex_lock(&as->lock);
+	as->stop = 1;
+	pthread_cond_broadcast(&as->queued);
+	pthread_mutex_unlock(&as->lock);
+	for (uint8_t i=0; i < as->numThreads; i++)
+		pthread_join(as->threads[i], NULL);
+
+	pthread_mutex_destroy(&as->lock);
+	pthread_cond_destroy(&as->queued);
+	pthread_cond_destroy(&as->completed);
+	free(as->threads);
+	free(as);
+	ps->async = NULL;
+}
+
+/**
+@brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
+@param     	state
+               	POSIX file storage state structure
+@param     	startPage
+                Physical index of start page
+@param     	endPage
+				Physical index of start page
+@return		Return 0 if success, -1 if failure.
+*/
+int8_t posixStorageErasePages(storageState *storage, id_t startPage, id_t endPage)
+{
+	/* Nothing to do */
+	(void) storage;
+	(void) startPage;
+	(void) endPage;
+	return 0;
+}
+
+/**
+@brief     	Flush storage and ensure all data is written. Only place that waits for data to reach the device (fdatasync).
+@param     	state
+                POSIX file storage state structure
+*/
+void posixStorageFlush(storageState *storage)
+{
+	posixStorageState *ps = (posixStorageState*) storage;
+
+	/* Writes that are submitted must be complete before sync */
+	posixStoragePoll(storage, STORAGE_POLL_ALL);
+	#if defined(__APPLE__)
+	fsync(ps->fd);
+	#else
+	fdatasync(ps->fd);
+	#endif
+}
+
+/**
+@brief     	Closes storage and performs any needed cleanup.
+@param     	state
+                POSIX file storage state structure
+*/
+void posixStorageClose(storageState *storage)
+{
+	posixStorageState *ps = (posixStorageState*) storage;
+
+	posixStorageStopThreads(ps);
+	if (ps->fd != -1)
+		close(ps->fd);
+	ps->fd = -1;
+	free(ps->alignBuffer);
+	ps->alignBuffer = NULL;
+}
+
+#endif
@@ -0,0 +1,214 @@
+/******************************************************************************/
+/**
+@file		posixStorage.h
+@author		Ramon Lawrence
+@brief		Single file storage using pread/pwrite for reading and writing pages of data (Linux/POSIX).
+@copyright	Copyright 2024
+			The University of British Columbia,
+			Ramon Lawrence		
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#ifndef POSIXSTORAGE_H
+#define POSIXSTORAGE_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+#include "storage.h"
+
+/* O_DIRECT requires buffers, file offsets, and transfer sizes aligned to the device block size. */
+#define POSIX_STORAGE_ALIGN		4096	/* Alignment of page buffers in memory */
+#define POSIX_STORAGE_BLOCK		512		/* Page size must be a multiple of this for O_DIRECT */
+
+#define POSIX_STORAGE_QUEUE		16		/* Maximum asynchronous requests submitted but not yet returned by poll */
+#define POSIX_STORAGE_IOV		16		/* Maximum pages written by one pwritev() */
+
+typedef struct {
+	storageState 	storage;			/* Base struct defining read/write page functions */
+	char			*fileName;			/* File name for storage */
+	count_t			pageSize;			/* Size of page in bytes. File is preallocated for storage size pages. 0 for no preallocation. */
+	int8_t			openExisting;		/* 1 to open existing file without truncating (e.g. for recovery), 0 to create new file */
+	int8_t			useDirect;			/* 1 to bypass operating system cache (O_DIRECT). Set to 0 by init if not supported. */
+	int				fd;					/* File descriptor */
+	void			*alignBuffer;		/* O_DIRECT: aligned page for reading and writing pages that are not in aligned buffers */
+	uint8_t			ioThreads;			/* Number of I/O threads performing asynchronous requests. 0 for synchronous requests. */
+	void			*async;				/* I/O threads and request queue. NULL if requests are synchronous. */
+} posixStorageState;
+
+
+/**
+@brief     	Initializes storage. Opens and preallocates file.
+@param		state
+                POSIX file storage state structure
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageInit(storageState *storage);
+
+
+/**
+@brief     	Allocates memory aligned for O_DIRECT. Use for dbbuffer page buffers so pages are read and written without copying.
+@param		size
+				Size in bytes
+@return		Returns pointer to memory (release with free()) or NULL if failure.
+*/
+void* posixStorageAlloc(size_t size);
+
+
+/**
+@brief      Reads page from storage into buffer. Returns 0 if success, non-zero if failure.
+@param     	state
+                 POSIX file storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to read in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageReadPage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer);
+
+
+/**
+@brief      Writes page from buffer into storage. Returns 0 if success, non-zero if failure.
+@param     	state
+                POSIX file storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to write in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@return		 Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageWritePage(storageState *storage, id_t pageNum, count_t pageSize, void *buffer);
+
+
+/**
+@brief      Writes consecutive pages from buffers into storage with one pwritev() call per POSIX_STORAGE_IOV pages.
+			With O_DIRECT, pages in unaligned buffers are written separately.
+@param     	state
+                POSIX file storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageWritePages(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers);
+
+
+/**
+@brief      Erases physical pages start to end inclusive. Assumes that start and end are aligned according to erase block.
+@param     	state
+               	POSIX file storage state structure
+@param     	startPage
+                Physical index of start page
+@param     	endPage
+				Physical index of start page
+@return		Return 0 if success, -1 if failure.
+*/
+int8_t posixStorageErasePages(storageState *storage, id_t startPage, id_t endPage);
+
+
+/**
+@brief      Starts reading a page. An I/O thread performs the read and poll() calls the callback.
+@param     	state
+                POSIX file storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to read in bytes
+@param		buffer
+				Pointer to buffer to copy data into. Must not be used until callback.
+@param		done
+				Callback when read is complete (NULL if none)
+@param		arg
+				Argument passed to callback
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageSubmitRead(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg);
+
+
+/**
+@brief      Starts writing a page. An I/O thread performs the write and poll() calls the callback.
+@param     	state
+                POSIX file storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to write in bytes
+@param		buffer
+				Pointer to buffer to copy data from. Must not change until callback.
+@param		done
+				Callback when write is complete (NULL if none)
+@param		arg
+				Argument passed to callback
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t posixStorageSubmitWrite(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg);
+
+
+/**
+@brief      Calls callbacks of completed asynchronous requests. Requests may complete in any order.
+@param     	state
+                POSIX file storage state structure
+@param		wait
+				STORAGE_POLL_NOWAIT, STORAGE_POLL_ALL, or STORAGE_POLL_ANY
+@return		Returns number of requests completed.
+*/
+int16_t posixStoragePoll(storageState *storage, int8_t wait);
+
+
+/**
+@brief     	Flush storage and ensure all data is written. Only place that waits for data to reach the device (fdatasync).
+@param     	state
+                POSIX file storage state structure
+*/
+void posixStorageFlush(storageState *storage);
+
+
+/**
+@brief     	Closes storage and performs any needed cleanup.
+@param     	state
+                POSIX file storage state structure
+*/
+void posixStorageClose(storageState *storage);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/******************************************************************************/
+/**
+@file		storage.c
+@author		Ramon Lawrence
+@brief		Generic storage functions shared by storage implementations.
+@copyright	Copyright 2022
+			The University of British Columbia,
+			Ramon Lawrence		
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stddef.h>
+
+#include "storage.h"
+
+/**
+@brief      Synchronous submitRead() for storage without asynchronous I/O. Reads page then calls callback before returning.
+@param     	storage
+                Storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to read in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@param		done
+				Callback when read is complete (NULL if none)
+@param		arg
+				Argument passed to callback
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t storageSubmitReadSync(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg)
+{
+	int8_t result = storage->readPage(storage, pageNum, pageSize, buffer);
+	if (done != NULL)
+		done(arg, pageNum, result);
+	return result;
+}
+
+/**
+@brief      Synchronous submitWrite() for storage without asynchronous I/O. Writes page then calls callback before returning.
+@param     	storage
+                Storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to write in bytes
+@param		buffer
+				Pointer to buffer to copy data from
+@param		done
+				Callback when write is complete (NULL if none)
+@param		arg
+				Argument passed to callback
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t storageSubmitWriteSync(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg)
+{
+	int8_t result = storage->writePage(storage, pageNum, pageSize, buffer);
+	if (done != NULL)
+		done(arg, pageNum, result);
+	return result;
+}
+
+/**
+@brief      Synchronous poll() for storage without asynchronous I/O. No requests are ever outstanding.
+@param     	storage
+                Storage state structure
+@param		wait
+				STORAGE_POLL_NOWAIT, STORAGE_POLL_ALL, or STORAGE_POLL_ANY
+@return		Returns number of requests completed (always 0).
+*/
+int16_t storagePollSync(storageState *storage, int8_t wait)
+{
+	(void) storage;
+	(void) wait;
+	return 0;
+}
+
+/**
+@brief      Default writePages() for storage without a multiple page write. Writes each page with writePage().
+@param     	storage
+                Storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of consecutive pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t storageWritePagesLoop(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers)
+{
+	for (count_t i=0; i < numPages; i++)
+	{
+		if (storage->writePage(storage, startPage+i, pageSize, buffers[i]) != 0)
+			return -1;
+	}
+	return 0;
+}
+
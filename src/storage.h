@@ -36,6 +36,10 @@
 #ifndef STORAGE_H
 #define STORAGE_H
 
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
 #include <stdint.h>
 
 /* Define type for page ids (physical and logical). */
@@ -47,6 +51,14 @@ typedef uint16_t count_t;
 struct storageState;
 typedef struct storageState storageState;
 
+/* Wait options for poll() */
+#define STORAGE_POLL_NOWAIT		0		/* Return immediately */
+#define STORAGE_POLL_ALL		1		/* Wait until all requests complete */
+#define STORAGE_POLL_ANY		2		/* Wait until at least one request completes */
+
+/* Called when an asynchronous read or write completes. Result is 0 if success, non-zero if failure. */
+typedef void (*storageCallback)(void *arg, id_t pageNum, int8_t result);
+
 struct storageState 
 {
 	int32_t	size;																					/* Size in pages */
@@ -56,6 +68,81 @@ struct storageState
 	int8_t  (*erasePages)(storageState *storage, id_t startPage, id_t endPage);						/* Erases a sequence of pages from start to end (inclusive) */
 	void	(*flush)(storageState *storage);														/* Flush storage (ensure all updates are written) */
 	void	(*close)(storageState *storage);														/* Close storage */
+	void*	(*mapPage)(storageState *storage, id_t pageNum, count_t pageSize);						/* Returns pointer to page in memory mapped storage (NULL if storage is not mapped) */
+	int8_t	(*submitRead)(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg);	/* Start reading a page. Callback is called by poll (or before return if synchronous). */
+	int8_t	(*submitWrite)(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg);	/* Start writing a page. Buffer must not change until callback. */
+	int16_t	(*poll)(storageState *storage, int8_t wait);											/* Call callbacks of completed requests. Wait is STORAGE_POLL_NOWAIT, ALL, or ANY. Returns number completed. */
+	int8_t	(*writePages)(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers);	/* Write consecutive pages starting at startPage. Page i is in buffers[i]. */
 };
 
+
+/**
+@brief      Synchronous submitRead() for storage without asynchronous I/O. Reads page then calls callback before returning.
+@param     	storage
+                Storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to read in bytes
+@param		buffer
+				Pointer to buffer to copy data into
+@param		done
+				Callback when read is complete (NULL if none)
+@param		arg
+				Argument passed to callback
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t storageSubmitReadSync(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg);
+
+
+/**
+@brief      Synchronous submitWrite() for storage without asynchronous I/O. Writes page then calls callback before returning.
+@param     	storage
+                Storage state structure
+@param     	pageNum
+                Physical page id (number)
+@param		pageSize
+				Size of page to write in bytes
+@param		buffer
+				Pointer to buffer to copy data from
+@param		done
+				Callback when write is complete (NULL if none)
+@param		arg
+				Argument passed to callback
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t storageSubmitWriteSync(storageState *storage, id_t pageNum, count_t pageSize, void *buffer, storageCallback done, void *arg);
+
+
+/**
+@brief      Synchronous poll() for storage without asynchronous I/O. No requests are ever outstanding.
+@param     	storage
+                Storage state structure
+@param		wait
+				STORAGE_POLL_NOWAIT, STORAGE_POLL_ALL, or STORAGE_POLL_ANY
+@return		Returns number of requests completed (always 0).
+*/
+int16_t storagePollSync(storageState *storage, int8_t wait);
+
+
+/**
+@brief      Default writePages() for storage without a multiple page write. Writes each page with writePage().
+@param     	storage
+                Storage state structure
+@param     	startPage
+                Physical page id of first page
+@param		numPages
+				Number of consecutive pages to write
+@param		pageSize
+				Size of page to write in bytes
+@param		buffers
+				Pointers to buffers containing pages (buffers[i] is written to startPage+i)
+@return		Returns 0 if success, non-zero if failure.
+*/
+int8_t storageWritePagesLoop(storageState *storage, id_t startPage, count_t numPages, count_t pageSize, void **buffers);
+
+#if defined(__cplusplus)
+}
+#endif
+
 #endif
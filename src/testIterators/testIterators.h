@@ -37,6 +37,7 @@
 #define TESTITERATORS_H
 
 #include "randomIterator.h"
+#include "sequentialIterator.h"
 #include "fileIterator.h"
 #include "textIterator.h"
 
@@ -52,6 +53,18 @@ recordIteratorState* randomIterator(int32_t numRecords)
     return (recordIteratorState*) iter;
 }
 
+/**
+ * Sequential iterator with keys 0 to numRecords-1 in increasing order.
+*/
+recordIteratorState* sequentialIterator(int32_t numRecords)
+{
+    sequentialIteratorState* iter = (sequentialIteratorState*) malloc(sizeof(sequentialIteratorState));
+    sequentialIteratorInit((recordIteratorState*) iter);
+
+    iter->state.size = numRecords;
+    return (recordIteratorState*) iter;
+}
+
 /*
 Iterates through a binary file of records on storage.
 */
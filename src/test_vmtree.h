@@ -40,6 +40,10 @@
 #include "fileStorage.h"
 #include "dfStorage.h"
 // #include "memStorage.h"
+#if !defined(ARDUINO)
+#include "posixStorage.h"
+#include "mmapStorage.h"
+#endif
 
 #include "testIterators/testIterators.h"
 
@@ -302,6 +306,7 @@ void runtest(void* storageInfo, int16_t M, int16_t logBufferPages, int8_t numRun
         storage->fileName = (char*) "dfile";
         storage->storage.size = storageSize;
         storage->fileSize = storage->storage.size / NUM_FILES;
+        storage->openExisting = 0;
         printf("Num files: %d  File size: %d\n", NUM_FILES, storage->fileSize);
         if (fileStorageInit((storageState*) storage) != 0)
         {
@@ -324,6 +329,36 @@ void runtest(void* storageInfo, int16_t M, int16_t logBufferPages, int8_t numRun
             return;
         }        
         */
+        /* Configure single file storage using pread/pwrite (Linux/POSIX) */
+        /*
+        printf("Using single file storage\n");
+        posixStorageState *storage = (posixStorageState*) malloc(sizeof(posixStorageState));
+        storage->fileName = (char*) "dfile.bin";
+        storage->storage.size = storageSize;
+        storage->pageSize = 512;
+        storage->openExisting = 0;
+        storage->useDirect = 0;
+        storage->ioThreads = 0;                             // I/O threads for asynchronous submitRead/submitWrite. 0 for synchronous. Link with -lpthread.
+        if (posixStorageInit((storageState*) storage) != 0)
+        {
+            printf("Error: Cannot initialize storage!\n");
+            return;
+        }
+        */
+        /* Configure memory-mapped file storage (Linux/POSIX). Set buffer->zeroCopy = 1 to read pages in place. */
+        /*
+        printf("Using memory-mapped file storage\n");
+        mmapStorageState *storage = (mmapStorageState*) malloc(sizeof(mmapStorageState));
+        storage->fileName = (char*) "dfile.bin";
+        storage->storage.size = storageSize;
+        storage->pageSize = 512;
+        storage->openExisting = 0;
+        if (mmapStorageInit((storageState*) storage) != 0)
+        {
+            printf("Error: Cannot initialize storage!\n");
+            return;
+        }
+        */
         /* Configure memory storage */
         /*
         memStorageState *storage = malloc(sizeof(memStorageState));        
@@ -363,6 +398,11 @@ void runtest(void* storageInfo, int16_t M, int16_t logBufferPages, int8_t numRun
             return;
         }
         buffer->storage = (storageState*) storage;         
+        buffer->maxDirtyPages = 0;                          /* BTREE write-back: number of updated pages held in buffer before writing. 0 writes immediately. */
+        buffer->ftlCachePages = 2;                          /* FTL: number of indirection table pages cached in memory. */
+        buffer->replacementPolicy = BUFFER_ROUND_ROBIN;    /* BUFFER_CLOCK, BUFFER_LRU, BUFFER_2Q. Add BUFFER_LEVEL_AWARE to prioritize interior nodes. */
+        buffer->zeroCopy = 0;                               /* 1 to read pages in place from memory-mapped storage (mmapStorage or memStorage). */
+        buffer->prefetchPages = 0;                          /* Leaves read ahead by iterators and batch inserts. Asynchronous with posixStorage ioThreads > 0. */
 
         /* Configure btree state */
         vmtreeState* state = (vmtreeState*) malloc(sizeof(vmtreeState));
@@ -406,6 +446,44 @@ void runtest(void* storageInfo, int16_t M, int16_t logBufferPages, int8_t numRun
         if (state->logBufferSize > 0)
             state->logBuffer  = malloc(state->logBufferSize);  
 
+        /* Optional Bloom filter to avoid searching for keys not in tree. Set to NULL for no Bloom filter. */
+        state->bloomFilter = NULL;
+        state->bloomFilterSize = 0;
+
+        /* Optional page buffer to spill mappings to storage when mapping table is full (VMTREE only). Set to NULL to rewrite nodes instead. */
+        state->spillBuffer = NULL;
+
+        /* Set to 1 to reserve storage for checkpoints written by vmtreeFlush() and used by vmtreeRecover() */
+        state->useCheckpoint = 0;
+
+        /* Pages for write-ahead log of log buffer inserts. Requires log buffer and checkpoints. 0 for no log. */
+        state->walPages = 0;
+
+        /* Pages for sorted runs of full log buffers that are compacted into tree later. Requires log buffer. 0 for no runs. */
+        state->runPages = 0;
+        state->maxRuns = 4;
+        state->runFence = NULL;
+        if (state->runPages > 0)
+            state->runFence = malloc(state->runPages * state->keySize);
+
+        /* Insert messages buffered in each parent of leaves (BTREE or FTL). Requires log buffer. 0 for no buffering. */
+        state->msgRecords = 0;
+        state->msgBuffer = NULL;
+        if (state->msgRecords > 0)
+            state->msgBuffer = malloc(state->msgRecords * state->recordSize);
+
+        /* Pages for delta records of leaves (VMTREE). 0 for no delta records. */
+        state->deltaPages = 0;
+        state->maxDeltas = 4;
+        state->deltaLeaves = 256;
+        state->deltaBuffer = NULL;
+        state->deltaIndex = NULL;
+        if (state->deltaPages > 0)
+        {
+            state->deltaBuffer = malloc(2 * buffer->pageSize);
+            state->deltaIndex = malloc(state->deltaLeaves * sizeof(vmtreeDeltaEntry));
+        }
+
         /* Connections between buffer and VMTree */
         buffer->activePath = state->activePath;
         buffer->state = state;
@@ -418,6 +496,8 @@ void runtest(void* storageInfo, int16_t M, int16_t logBufferPages, int8_t numRun
             printf("BTREE with update-in-place writes.\n");
         else if (state->parameters == OVERWRITE)
             printf("VMTREE with memory-supported overwriting.\n");
+        else if (state->parameters == FTL)
+            printf("BTREE with logical page ids mapped by indirection table.\n");
         printf("Storage size: %lu  Memory size: %lu\n", storage->storage.size, M);
 
         /* Initialize VMTree structure with parameters */
@@ -498,7 +578,7 @@ void runtest(void* storageInfo, int16_t M, int16_t logBufferPages, int8_t numRun
 
         printf("Elapsed Time: %lu s\n", (end - start));
         printf("Records inserted: %lu\n", n);
-        printf("Mapping comparisons: %lu  Extra writes: %d \n", state->numMappingCompare, state->numMappingWrite);
+        printf("Mapping comparisons: %lu  Extra writes: %d  Mapping pages written: %lu\n", state->numMappingCompare, state->numMappingWrite, state->numMappingSpill);
 
         /* Re-write tree to remove all mappings */
         // printf("Before clear mappings\n");
@@ -578,6 +658,12 @@ void runtest(void* storageInfo, int16_t M, int16_t logBufferPages, int8_t numRun
         free(state->tempData);
         free(recordBuffer);
         free(state->logBuffer);
+        free(state->bloomFilter);
+        free(state->spillBuffer);
+        free(state->runFence);
+        free(state->msgBuffer);
+        free(state->deltaBuffer);
+        free(state->deltaIndex);
         free(state->buffer->blockBuffer);
         free(buffer->status);
         free(state->buffer->buffer);
@@ -674,6 +760,725 @@ void runtest(void* storageInfo, int16_t M, int16_t logBufferPages, int8_t numRun
     }
 }
 
+/* Storage used by a feature test */
+#define TEST_STORAGE_FILE   0       /* fileStorage with NUM_FILES files */
+#define TEST_STORAGE_POSIX  1       /* posixStorage single file using pread/pwrite */
+#define TEST_STORAGE_MMAP   2       /* mmapStorage memory-mapped single file */
+
+/* Keys looked up with each call of vmtreeGetBatch() */
+#define TEST_BATCH_KEYS     64
+
+/**
+ * Optional features used by a feature test. Records are checked with lookups of all keys and an iterator scan of all records.
+ */
+typedef struct {
+    const char* name;               /* Name printed with result */
+    uint8_t     type;               /* VMTREE, BTREE, OVERWRITE, FTL */
+    uint8_t     storageType;        /* TEST_STORAGE_FILE, TEST_STORAGE_POSIX, or TEST_STORAGE_MMAP */
+    int16_t     M;                  /* Number of buffer pages */
+    uint16_t    pageSize;           /* Page size in bytes. 0 for 512. */
+    uint32_t    storagePages;       /* Storage size in pages. 0 for storage size of test. */
+    int16_t     logBufferPages;     /* Log buffer pages. 0 for no log buffer. */
+    int8_t      bulkLoad;           /* 1 to bulk load records in key order instead of inserting them */
+    uint8_t     deleteEvery;        /* Keys that are a multiple of deleteEvery are deleted after insert. 0 for no deletes. */
+    int8_t      sequential;         /* 1 to insert keys in increasing order instead of random order */
+    uint8_t     retentionMode;      /* RETAIN_MAX_RECORDS (use with sequential) or RETAIN_MIN_KEY (applied after insert) */
+    id_t        retentionLimit;     /* Maximum records for RETAIN_MAX_RECORDS or smallest key retained for RETAIN_MIN_KEY */
+    int8_t      getBatch;           /* 1 to also look up all keys with vmtreeGetBatch() */
+    id_t        bloomFilterSize;    /* Bloom filter size in bytes. 0 for no Bloom filter. */
+    uint8_t     replacementPolicy;  /* Buffer replacement policy. 0 for BUFFER_ROUND_ROBIN. */
+    count_t     maxDirtyPages;      /* BTREE write-back: dirty buffers allowed before all are written. Requires M > 3. */
+    count_t     mappingBufferSize;  /* Mapping table size in bytes (VMTREE). 0 for 1024. */
+    uint8_t     cycles;             /* Times all records are inserted, deleted, and flushed before records of test are inserted */
+    int8_t      spill;              /* 1 to spill mappings that do not fit in mapping table to mapping pages (VMTREE) */
+    int8_t      useCheckpoint;      /* 1 to reserve storage for checkpoints */
+    id_t        walPages;           /* Write-ahead log pages. Requires log buffer and checkpoints. */
+    int8_t      walCommit;          /* WAL_COMMIT_PAGE, WAL_COMMIT_RECORD, or WAL_COMMIT_TIME */
+    int8_t      recover;            /* 1 to checkpoint after half of the records, reopen storage after last insert without a flush, and recover tree */
+    id_t        runPages;           /* Pages for sorted runs of log buffers. Requires log buffer. */
+    uint8_t     maxRuns;            /* Runs written before they are compacted into tree */
+    count_t     msgRecords;         /* Insert messages buffered in each parent of leaves (BTREE or FTL). Requires log buffer. */
+    id_t        deltaPages;         /* Pages for delta records of leaves (VMTREE). Used without log buffer and checkpoints. */
+    int8_t      zeroCopy;           /* 1 to read pages in place from memory-mapped storage. Not used with FTL or delta records. */
+    uint8_t     ioThreads;          /* I/O threads for asynchronous requests of POSIX file storage. 0 for synchronous requests. */
+    count_t     prefetchPages;      /* Pages read ahead by iterators and log buffer inserts. Requires M > 3. */
+} vmtreeTestConfig;
+
+/**
+ * Sets feature test configuration num. Returns 0 if success, -1 if there is no configuration num.
+ */
+int8_t testFeatureConfig(vmtreeTestConfig *config, int16_t num)
+{
+    memset(config, 0, sizeof(vmtreeTestConfig));
+    config->M = 4;
+    switch (num)
+    {
+        case 0:     /* Small pages give four levels so upper levels share the last buffer page */
+            config->name = "Bulk load of records in key order";
+            config->type = VMTREE;
+            config->M = 3;
+            config->pageSize = 128;
+            config->bulkLoad = 1;
+            break;
+
+        case 1:
+            config->name = "Delete records with merges of underfull nodes";
+            config->type = VMTREE;
+            config->deleteEvery = 3;
+            break;
+
+        case 2:
+            config->name = "Delete records with log buffer";
+            config->type = BTREE;
+            config->logBufferPages = 2;
+            config->deleteEvery = 2;
+            break;
+
+        case 3:
+            config->name = "Retention of newest records";
+            config->type = VMTREE;
+            config->sequential = 1;
+            config->retentionMode = RETAIN_MAX_RECORDS;
+            config->retentionLimit = 4000;
+            break;
+
+        case 4:
+            config->name = "Retention of records from minimum key";
+            config->type = BTREE;
+            config->retentionMode = RETAIN_MIN_KEY;
+            config->retentionLimit = 5000;
+            break;
+
+        case 5:
+            config->name = "Append of increasing keys";
+            config->type = BTREE;
+            config->sequential = 1;
+            config->deleteEvery = 5;
+            break;
+
+        case 6:
+            config->name = "Batch lookups";
+            config->type = VMTREE;
+            config->deleteEvery = 4;
+            config->getBatch = 1;
+            break;
+
+        case 7:     /* Deleted keys stay in filter so their lookups search tree */
+            config->name = "Bloom filter on keys";
+            config->type = BTREE;
+            config->deleteEvery = 5;
+            config->bloomFilterSize = 1250;
+            break;
+
+        case 8:
+            config->name = "Buffer page lookups with large buffer";
+            config->type = VMTREE;
+            config->M = 32;
+            config->deleteEvery = 7;
+            break;
+
+        case 9:
+            config->name = "Level-aware LRU buffer replacement";
+            config->type = BTREE;
+            config->M = 8;
+            config->replacementPolicy = BUFFER_LRU | BUFFER_LEVEL_AWARE;
+            config->deleteEvery = 3;
+            break;
+
+        case 10:
+            config->name = "2Q buffer replacement";
+            config->type = VMTREE;
+            config->M = 8;
+            config->replacementPolicy = BUFFER_2Q;
+            break;
+
+        case 11:    /* Updated leaf stays pinned in buffer between inserts */
+            config->name = "Pinned leaves with more than 3 buffers";
+            config->type = VMTREE;
+            config->M = 6;
+            config->sequential = 1;
+            config->deleteEvery = 4;
+            break;
+
+        case 12:
+            config->name = "Write-back of dirty leaves";
+            config->type = BTREE;
+            config->M = 8;
+            config->maxDirtyPages = 4;
+            config->deleteEvery = 3;
+            break;
+
+        case 13:    /* Small mapping table is kept nearly full */
+            config->name = "Robin Hood hashing of mappings";
+            config->type = VMTREE;
+            config->mappingBufferSize = 128;
+            config->deleteEvery = 3;
+            break;
+
+        case 14:    /* Page ids past 65535 need 3 byte mappings */
+            config->name = "Mapping page id width of large storage";
+            config->type = VMTREE;
+            config->storagePages = 70000;
+            config->cycles = 3;
+            break;
+
+        case 15:
+            config->name = "Spill of mappings to mapping pages";
+            config->type = VMTREE;
+            config->mappingBufferSize = 64;
+            config->spill = 1;
+            config->deleteEvery = 3;
+            break;
+
+        case 16:
+            config->name = "FTL page indirection table";
+            config->type = FTL;
+            config->deleteEvery = 3;
+            break;
+
+        case 17:
+            config->name = "Recover VMTREE from checkpoint";
+            config->type = VMTREE;
+            config->useCheckpoint = 1;
+            config->recover = 1;
+            break;
+
+        case 18:
+            config->name = "Recover BTREE from checkpoint";
+            config->type = BTREE;
+            config->useCheckpoint = 1;
+            config->recover = 1;
+            break;
+
+        case 19:    /* Pages written after last checkpoint wrap around small storage */
+            config->name = "Recover VMTREE after writer passes checkpoint";
+            config->type = VMTREE;
+            config->M = 3;
+            config->storagePages = 1500;
+            config->cycles = 8;
+            config->useCheckpoint = 1;
+            config->recover = 1;
+            break;
+
+        case 20:    /* Recovered log records are in log buffer so lookups and iterator also search log buffer */
+            config->name = "Recover log buffer from write-ahead log";
+            config->type = BTREE;
+            config->logBufferPages = 2;
+            config->useCheckpoint = 1;
+            config->walPages = 64;
+            config->walCommit = WAL_COMMIT_RECORD;
+            config->recover = 1;
+            break;
+
+        case 21:    /* Verify before flush finds records still in log buffer */
+            config->name = "Lookups and scans of log buffer";
+            config->type = VMTREE;
+            config->logBufferPages = 4;
+            config->deleteEvery = 3;
+            break;
+
+        case 22:
+            config->name = "Sorted runs of log buffers";
+            config->type = VMTREE;
+            config->logBufferPages = 2;
+            config->runPages = 16;
+            config->maxRuns = 5;
+            break;
+
+        case 23:
+            config->name = "Insert messages buffered in parents of leaves";
+            config->type = BTREE;
+            config->logBufferPages = 2;
+            config->msgRecords = 16;
+            config->deleteEvery = 3;
+            break;
+
+        case 24:
+            config->name = "Delta records of leaves";
+            config->type = VMTREE;
+            config->deltaPages = 16;
+            config->deleteEvery = 3;
+            break;
+
+        case 25:
+            config->name = "Recover BTREE from checkpoint on POSIX file storage";
+            config->type = BTREE;
+            config->storageType = TEST_STORAGE_POSIX;
+            config->useCheckpoint = 1;
+            config->recover = 1;
+            break;
+
+        case 26:
+            config->name = "Zero copy reads from memory-mapped storage";
+            config->type = VMTREE;
+            config->storageType = TEST_STORAGE_MMAP;
+            config->zeroCopy = 1;
+            break;
+
+        case 27:    /* Page reads and writes of tree stay synchronous while I/O threads are running */
+            config->name = "Asynchronous I/O threads on POSIX file storage";
+            config->type = VMTREE;
+            config->storageType = TEST_STORAGE_POSIX;
+            config->logBufferPages = 2;
+            config->ioThreads = 2;
+            break;
+
+        case 28:
+            config->name = "Asynchronous read ahead of children";
+            config->type = BTREE;
+            config->M = 8;
+            config->storageType = TEST_STORAGE_POSIX;
+            config->logBufferPages = 2;
+            config->ioThreads = 2;
+            config->prefetchPages = 2;
+            break;
+
+        case 29:    /* Dirty leaves at consecutive locations are written with one storage call */
+            config->name = "Write-back of dirty pages with multiple page writes";
+            config->type = BTREE;
+            config->M = 8;
+            config->storageType = TEST_STORAGE_POSIX;
+            config->maxDirtyPages = 4;
+            break;
+
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Initializes storage for a feature test. Existing storage is opened without erasing it if openExisting is 1.
+ */
+storageState* testStorageInit(vmtreeTestConfig *config, uint32_t storageSize, int8_t openExisting)
+{
+    #if !defined(ARDUINO)
+    if (config->storageType == TEST_STORAGE_POSIX)
+    {
+        posixStorageState *storage = (posixStorageState*) calloc(1, sizeof(posixStorageState));
+        storage->fileName = (char*) "dfile.bin";
+        storage->storage.size = storageSize;
+        storage->pageSize = 512;
+        storage->openExisting = openExisting;
+        storage->useDirect = 0;
+        storage->ioThreads = config->ioThreads;
+        if (posixStorageInit((storageState*) storage) != 0)
+        {
+            printf("Error: Cannot initialize storage!\n");
+            free(storage);
+            return NULL;
+        }
+        return (storageState*) storage;
+    }
+    if (config->storageType == TEST_STORAGE_MMAP)
+    {
+        mmapStorageState *storage = (mmapStorageState*) calloc(1, sizeof(mmapStorageState));
+        storage->fileName = (char*) "dfile.bin";
+        storage->storage.size = storageSize;
+        storage->pageSize = 512;
+        storage->openExisting = openExisting;
+        if (mmapStorageInit((storageState*) storage) != 0)
+        {
+            printf("Error: Cannot initialize storage!\n");
+            free(storage);
+            return NULL;
+        }
+        return (storageState*) storage;
+    }
+    #endif
+
+    fileStorageState *storage = (fileStorageState*) malloc(sizeof(fileStorageState));
+    storage->fileName = (char*) "dfile";
+    storage->storage.size = storageSize;
+    storage->fileSize = storage->storage.size / NUM_FILES;
+    storage->openExisting = openExisting;
+    if (fileStorageInit((storageState*) storage) != 0)
+    {
+        printf("Error: Cannot initialize storage!\n");
+        free(storage);
+        return NULL;
+    }
+    return (storageState*) storage;
+}
+
+/**
+ * Allocates buffer and tree for a feature test. Initializes a new tree or, if recover is 1, recovers tree and log records from storage.
+ */
+vmtreeState* testTreeInit(vmtreeTestConfig *config, storageState *storage, uint8_t recordSize, uint8_t keySize, uint8_t dataSize, int8_t (*compareKey)(void *a, void *b), int8_t recover)
+{
+    dbbuffer* buffer = (dbbuffer*) calloc(1, sizeof(dbbuffer));
+    vmtreeState* state = (vmtreeState*) calloc(1, sizeof(vmtreeState));
+    if (buffer == NULL || state == NULL)
+    {   printf("Failed to allocate buffer or VMTree state struct.\n");
+        return NULL;
+    }
+
+    buffer->pageSize = config->pageSize > 0 ? config->pageSize : 512;
+    buffer->numPages = config->M;
+    buffer->eraseSizeInPages = 8;
+    buffer->status = (id_t*) malloc(sizeof(id_t) * buffer->numPages);
+    buffer->buffer = malloc((size_t) buffer->numPages * buffer->pageSize);
+    buffer->blockBuffer = malloc((size_t) buffer->eraseSizeInPages * buffer->pageSize);
+    buffer->storage = storage;
+    buffer->ftlCachePages = 2;
+    buffer->replacementPolicy = config->replacementPolicy;
+    buffer->zeroCopy = config->zeroCopy;
+    buffer->prefetchPages = config->prefetchPages;
+    buffer->maxDirtyPages = config->maxDirtyPages;
+
+    state->recordSize = recordSize;
+    state->keySize = keySize;
+    state->dataSize = dataSize;
+    state->buffer = buffer;
+    state->tempKey = malloc(state->keySize);
+    state->tempKey2 = malloc(state->keySize);
+    state->tempData = malloc(state->dataSize > state->keySize ? state->dataSize : state->keySize);
+    state->parameters = config->type;
+    if (state->parameters == VMTREE)
+    {
+        state->mappingBufferSize = config->mappingBufferSize > 0 ? config->mappingBufferSize : 1024;
+        state->mappingBuffer = malloc(state->mappingBufferSize);
+        if (config->spill)
+            state->spillBuffer = malloc(buffer->pageSize);
+    }
+    state->logBufferSize = config->logBufferPages * buffer->pageSize;
+    if (state->logBufferSize > 0)
+        state->logBuffer = malloc(state->logBufferSize);
+    state->bloomFilterSize = config->bloomFilterSize;
+    if (state->bloomFilterSize > 0)
+        state->bloomFilter = malloc(state->bloomFilterSize);
+    state->useCheckpoint = config->useCheckpoint;
+    state->walPages = config->walPages;
+    state->runPages = config->runPages;
+    state->maxRuns = config->maxRuns;
+    if (state->runPages > 0)
+        state->runFence = malloc(state->runPages * state->keySize);
+    state->msgRecords = config->msgRecords;
+    if (state->msgRecords > 0)
+        state->msgBuffer = malloc(state->msgRecords * state->recordSize);
+    state->deltaPages = config->deltaPages;
+    if (state->deltaPages > 0)
+    {
+        state->maxDeltas = 4;
+        state->deltaLeaves = 256;
+        state->deltaBuffer = malloc(2 * buffer->pageSize);
+        state->deltaIndex = (vmtreeDeltaEntry*) malloc(state->deltaLeaves * sizeof(vmtreeDeltaEntry));
+    }
+
+    buffer->activePath = state->activePath;
+    buffer->state = state;
+    buffer->isValid = vmtreeIsValid;
+    buffer->movePage = vmtreeMovePage;
+
+    if (recover)
+    {
+        if (vmtreeRecover(state) != 0)
+            printf("No checkpoint found. Created new tree.\n");
+    }
+    else
+        vmtreeInit(state);
+    state->compareKey = compareKey;
+    if (config->retentionMode == RETAIN_MAX_RECORDS)
+    {
+        state->retentionMode = RETAIN_MAX_RECORDS;
+        state->retentionLimit = config->retentionLimit;
+    }
+    else if (config->retentionMode == RETAIN_MIN_KEY)
+        state->retentionFence = malloc(state->keySize);
+    state->walCommit = config->walCommit;
+    if (recover)
+        printf("Records recovered from write-ahead log: %lu\n", vmtreeRecoverLog(state));
+    return state;
+}
+
+/**
+ * Closes storage and frees buffer and tree of a feature test.
+ */
+void testTreeClose(vmtreeState *state)
+{
+    dbbuffer *buffer = state->buffer;
+
+    closeBuffer(buffer);
+    free(buffer->storage);
+    free(buffer->status);
+    free(buffer->buffer);
+    free(buffer->blockBuffer);
+    free(buffer);
+    free(state->mappingBuffer);
+    free(state->spillBuffer);
+    free(state->tempKey);
+    free(state->tempKey2);
+    free(state->tempData);
+    free(state->logBuffer);
+    free(state->retentionFence);
+    free(state->bloomFilter);
+    free(state->runFence);
+    free(state->msgBuffer);
+    free(state->deltaBuffer);
+    free(state->deltaIndex);
+    free(state);
+}
+
+/**
+ * Returns 1 if key should be in tree after a feature test inserts keys 0 to size-1, 0 otherwise.
+ * Records with keys smaller than firstKey are dropped by retention.
+ */
+int8_t testKeyExpected(vmtreeTestConfig *config, uint32_t key, uint32_t size, uint32_t firstKey)
+{
+    if (key >= size)
+        return 0;
+    if (key < firstKey)
+        return 0;
+    if (config->deleteEvery > 0 && key % config->deleteEvery == 0)
+        return 0;
+    return 1;
+}
+
+/**
+ * Inserts or bulk loads records of iterator into a tree of a feature test. Returns number of errors.
+ */
+int32_t testInsert(vmtreeTestConfig *config, vmtreeState *state, recordIteratorState *it, int8_t *recordBuffer)
+{
+    id_t recid;
+
+    if (config->bulkLoad)
+    {
+        if (vmtreeBulkLoad(state, it) != 0)
+        {   printf("BULK LOAD ERROR\n");
+            return 1;
+        }
+        printf("Bulk loaded levels: %d\n", state->levels);
+        return 0;
+    }
+
+    srand(1);
+    it->init(it);
+    for (uint32_t i = 1; i <= it->size; i++)
+    {
+        it->next(it, recordBuffer, (void*) (recordBuffer+state->keySize), &recid);
+        if (vmtreePut(state, recordBuffer, (void*) (recordBuffer+state->keySize)) != 0)
+        {   printf("INSERT ERROR: %u\n", *((uint32_t*) recordBuffer));
+            it->close(it);
+            return 1;
+        }
+        if (config->recover && i == it->size/2)
+            vmtreeFlush(state);         /* Writes checkpoint */
+    }
+    it->close(it);
+    return 0;
+}
+
+/**
+ * Deletes keys 0 to size-1 that are a multiple of every. Returns number of errors.
+ */
+int32_t testDelete(vmtreeState *state, uint32_t size, uint32_t every)
+{
+    int32_t errors = 0;
+
+    for (uint32_t key = 0; key < size; key += every)
+    {
+        if (vmtreeDelete(state, &key) != 0)
+        {   printf("DELETE ERROR: %u\n", key);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+/**
+ * Verifies records of a feature test. All records in tree must be returned in order by an iterator scan and found by lookups.
+ * Keys deleted or never inserted must not be found. Returns number of errors.
+ */
+int32_t testVerify(vmtreeTestConfig *config, vmtreeState *state, uint32_t size, int8_t *recordBuffer)
+{
+    int32_t errors = 0;
+    uint32_t key = 0, minKey = 0, maxKey = size + 100, count = 0, expected = 0;
+    uint32_t firstKey = 0;
+    uint32_t *itKey, *itData;
+    vmtreeIterator it;
+
+    /* Retention drops records with the smallest keys so retained records start at first key of scan */
+    it.minKey = &minKey;
+    it.maxKey = &maxKey;
+    vmtreeInitIterator(state, &it);
+    while (vmtreeNext(state, &it, (void**) &itKey, (void**) &itData))
+    {
+        if (count == 0 && config->retentionMode != RETAIN_NONE)
+            firstKey = *itKey;
+        if (!testKeyExpected(config, *itKey, size, firstKey) || (count > 0 && *itKey <= key) || *itData != *itKey)
+        {   errors++;
+            printf("ERROR: Iterator returned key: %u  Data: %u\n", *itKey, *itData);
+        }
+        key = *itKey;
+        count++;
+    }
+    for (key = 0; key < size; key++)
+        expected += testKeyExpected(config, key, size, firstKey);
+    if (count != expected)
+    {   errors++;
+        printf("ERROR: Iterator records: %u  Expected: %u\n", count, expected);
+    }
+    if (config->retentionMode != RETAIN_NONE)
+    {
+        printf("Records retained from key: %u\n", firstKey);
+        if (firstKey == 0 || (config->retentionMode == RETAIN_MAX_RECORDS && count > config->retentionLimit)
+            || (config->retentionMode == RETAIN_MIN_KEY && firstKey > config->retentionLimit))
+        {   errors++;
+            printf("ERROR: Retention limit not applied\n");
+        }
+    }
+
+    /* Keys past the last key inserted must not be found by lookups */
+    for (key = 0; key < maxKey; key++)
+    {
+        int8_t result = vmtreeGet(state, &key, recordBuffer);
+        if (!testKeyExpected(config, key, size, firstKey))
+        {
+            if (result == 0)
+            {   errors++;
+                printf("ERROR: Found key not in tree: %u\n", key);
+            }
+        }
+        else if (result != 0)
+        {   errors++;
+            printf("ERROR: Failed to find: %u\n", key);
+        }
+        else if (*((uint32_t*) recordBuffer) != key)
+        {   errors++;
+            printf("ERROR: Wrong data for: %u\n", key);
+        }
+    }
+
+    if (config->getBatch)
+    {   /* Keys of each batch are in decreasing order */
+        uint32_t keys[TEST_BATCH_KEYS];
+        int8_t found[TEST_BATCH_KEYS];
+        int8_t *batchData = (int8_t*) malloc(TEST_BATCH_KEYS * state->dataSize);
+
+        for (key = 0; key < maxKey; key += TEST_BATCH_KEYS)
+        {
+            int32_t numFound = 0;
+            uint32_t i;
+            for (i = 0; i < TEST_BATCH_KEYS; i++)
+                keys[i] = key + TEST_BATCH_KEYS - 1 - i;
+            int32_t result = vmtreeGetBatch(state, keys, TEST_BATCH_KEYS, batchData, found);
+            for (i = 0; i < TEST_BATCH_KEYS; i++)
+            {
+                numFound += found[i];
+                if (found[i] != testKeyExpected(config, keys[i], size, firstKey)
+                    || (found[i] && *((uint32_t*) (batchData + i * state->dataSize)) != keys[i]))
+                {   errors++;
+                    printf("ERROR: Batch lookup of: %u  Found: %d\n", keys[i], found[i]);
+                }
+            }
+            if (result != numFound)
+            {   errors++;
+                printf("ERROR: Batch lookup found: %d  Expected: %d\n", result, numFound);
+            }
+        }
+        free(batchData);
+    }
+    return errors;
+}
+
+/**
+ * Inserts records of iterator into a tree with the features of a configuration and verifies them. Returns number of errors.
+ */
+int32_t runFeatureTest(vmtreeTestConfig *config, recordIteratorState *it, uint8_t recordSize, uint8_t keySize, uint8_t dataSize, int8_t (*compareKey)(void *a, void *b), uint32_t storageSize)
+{
+    int32_t errors = 0;
+    uint32_t size = it->size;
+
+    printf("\nFeature test: %s\n", config->name);
+    if (config->storagePages > 0)
+        storageSize = config->storagePages;
+    storageState *storage = testStorageInit(config, storageSize, 0);
+    if (storage == NULL)
+        return 1;
+    vmtreeState *state = testTreeInit(config, storage, recordSize, keySize, dataSize, compareKey, 0);
+    if (state == NULL)
+        return 1;
+
+    /* Bulk load and sequential inserts use records in key order */
+    if (config->bulkLoad || config->sequential)
+        it = sequentialIterator(size);
+
+    int8_t* recordBuffer = (int8_t*) calloc(1, state->recordSize);
+    for (uint8_t c = 0; c < config->cycles; c++)
+    {   /* Pages freed by deletes are reused so page ids wrap around storage */
+        errors += testInsert(config, state, it, recordBuffer);
+        errors += testDelete(state, size, 1);
+        vmtreeFlush(state);
+    }
+    errors += testInsert(config, state, it, recordBuffer);
+    if (config->deleteEvery > 0)
+        errors += testDelete(state, size, config->deleteEvery);
+    if (config->retentionMode == RETAIN_MIN_KEY)
+    {   /* Minimum key is advanced after insert so smaller keys are not inserted into subtrees that are retained */
+        state->retentionMode = RETAIN_MIN_KEY;
+        state->retentionMinKey = &config->retentionLimit;
+        if (vmtreeApplyRetention(state) != 0)
+        {   printf("RETENTION ERROR\n");
+            errors++;
+        }
+    }
+    if (config->cycles > 0)
+        printf("Pages written: %lu  Mapping page id size: %d\n", state->buffer->numWrites, state->mappingIdSize);
+    if (state->spillBuffer != NULL)
+        printf("Mapping pages written: %lu  Mapping pages in use: %d\n", state->numMappingSpill, state->numSpillPages);
+    if (state->runPages > 0)
+        printf("Run pages written: %lu  Compactions: %lu  Runs: %d\n", state->numRunWrites, state->numCompactions, state->numRuns);
+    if (state->msgRecords > 0)
+        printf("Message node writes: %lu  Message flushes: %lu\n", state->numMsgWrites, state->numMsgFlushes);
+    if (state->deltaPages > 0)
+        printf("Delta records: %lu  Delta pages written: %lu  Leaves merged: %lu\n", state->numDeltaRecords, state->numDeltaWrites, state->numDeltaMerges);
+
+    if (config->recover)
+    {   /* Restart without flushing tree. Pages written after checkpoint are replayed and logged records inserted again. */
+        testTreeClose(state);
+        storage = testStorageInit(config, storageSize, 1);
+        if (storage == NULL)
+            return errors+1;
+        state = testTreeInit(config, storage, recordSize, keySize, dataSize, compareKey, 1);
+        if (state == NULL)
+            return errors+1;
+    }
+    else
+    {
+        /* Verify before flush so lookups and iterator also search records not yet in leaves */
+        errors += testVerify(config, state, size, recordBuffer);
+        vmtreeFlush(state);
+    }
+
+    errors += testVerify(config, state, size, recordBuffer);
+    if (errors > 0)
+        printf("FAILURE: %s  Errors: %lu\n", config->name, errors);
+    else
+        printf("SUCCESS: %s\n", config->name);
+
+    if (config->bulkLoad || config->sequential)
+        free(it);
+    free(recordBuffer);
+    testTreeClose(state);
+    return errors;
+}
+
+/**
+ * Runs feature test for every configuration of testFeatureConfig().
+ */
+void runFeatureTests(recordIteratorState *it, uint8_t recordSize, uint8_t keySize, uint8_t dataSize, int8_t (*compareKey)(void *a, void *b), uint32_t storageSize)
+{
+    vmtreeTestConfig config;
+    int16_t num, failed = 0;
+
+    for (num = 0; testFeatureConfig(&config, num) == 0; num++)
+    {
+        if (runFeatureTest(&config, it, recordSize, keySize, dataSize, compareKey, storageSize) != 0)
+            failed++;
+    }
+    printf("\nFeature tests: %d  Failed: %d\n", num, failed);
+}
+
 /**
  * Runs test with given parameters (PC version).
  */ 
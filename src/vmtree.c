@@ -41,23 +41,172 @@
 
 #include "vmtree.h"
 #include "in_memory_sort.h"
+#include "testIterators/recordIterator.h"
 
 /**
-@brief     	Initialize a VMTree structure.
+@brief     	Returns a page id stored in a mapping table slot. Page ids are stored in mappingIdSize bytes (little endian).
+@param     	state
+                VMTree algorithm state structure
+@param		loc
+				mapping table slot
+@param		curr
+				0 for previous page id, 1 for current page id
+@return		Return page id or EMPTY_MAPPING if slot is empty.
+*/
+id_t vmtreeMappingGet(vmtreeState *state, int16_t loc, int8_t curr)
+{
+	uint8_t *ptr = (uint8_t*) state->mappingBuffer + ((id_t) loc*2 + curr) * state->mappingIdSize;
+	id_t val = 0;
+	for (int8_t i=state->mappingIdSize-1; i >= 0; i--)
+		val = (val << 8) | ptr[i];
+	
+	if (state->mappingIdSize < 4 && val == ((id_t) 1 << (8*state->mappingIdSize)) - 1)
+		return EMPTY_MAPPING;
+	return val;
+}
+
+/**
+@brief     	Stores a page id in a mapping table slot. EMPTY_MAPPING stores all bits set.
+@param     	state
+                VMTree algorithm state structure
+@param		loc
+				mapping table slot
+@param		curr
+				0 for previous page id, 1 for current page id
+@param		pageId
+				page id to store
+*/
+void vmtreeMappingSet(vmtreeState *state, int16_t loc, int8_t curr, id_t pageId)
+{
+	uint8_t *ptr = (uint8_t*) state->mappingBuffer + ((id_t) loc*2 + curr) * state->mappingIdSize;
+	for (int8_t i=0; i < state->mappingIdSize; i++)
+	{
+		ptr[i] = (uint8_t) pageId;
+		pageId >>= 8;
+	}
+}
+
+/**
+@brief     	Copies a mapping from one mapping table slot to another.
+@param     	state
+                VMTree algorithm state structure
+@param		to
+				destination slot
+@param		from
+				source slot
+*/
+void vmtreeMappingCopy(vmtreeState *state, int16_t to, int16_t from)
+{
+	count_t size = 2*state->mappingIdSize;
+	memcpy((uint8_t*) state->mappingBuffer + (id_t) to*size, (uint8_t*) state->mappingBuffer + (id_t) from*size, size);
+}
+
+/**
+@brief     	Returns bytes needed to store a checkpoint. Computed from storage size before dbbufferInit() reserves pages so it is an upper bound.
+@param     	state
+                VMTree algorithm state structure
+*/
+id_t vmtreeCheckpointSize(vmtreeState *state)
+{
+	dbbuffer *buffer = state->buffer;
+	id_t size = sizeof(vmtreeCheckpointHeader) + sizeof(state->spillPages) + sizeof(state->spillLive) + sizeof(state->spillSummary) + sizeof(uint32_t);
+
+	if (state->mappingBuffer != NULL)
+		size += state->mappingBufferSize;
+	size += buffer->storage->size/8+1;
+	if (buffer->ftlCachePages > 0)
+	{	/* Indirection table directory and physical free space */
+		id_t entries = buffer->pageSize / sizeof(id_t);
+		size += sizeof(id_t) * ((buffer->storage->size + entries) / entries) + buffer->storage->size/8+1;
+	}
+	return size;
+}
+
+/**
+@brief     	Empties delta page being built.
+@param     	state
+                VMTree algorithm state structure
+*/
+void vmtreeDeltaReset(vmtreeState *state)
+{
+	memset(state->deltaBuffer, 0xFF, state->buffer->pageSize);
+	VMTREE_SET_PREV(state->deltaBuffer, 0);
+	VMTREE_SET_COUNT(state->deltaBuffer, VMTREE_DELTA_PAGE);
+	state->deltaUsed = state->headerSize;
+}
+
+/**
+@brief     	Configures VMTree structure and buffer. Storage is only changed if not recovering.
 @param     	state
                 vmTree algorithm state structure
+@param		recover
+				1 if state will be recovered from storage, 0 for new tree
 */
-void vmtreeInit(vmtreeState *state)
+void vmtreeSetup(vmtreeState *state, int8_t recover)
 {
 	printf("Initializing VMTree.\n");
 	printf("Buffer size: %d  Page size: %d\n", state->buffer->numPages, state->buffer->pageSize);	
 	state->recordSize = state->keySize + state->dataSize;
 	printf("Record size: %d\n", state->recordSize);	
 	
-	dbbufferInit(state->buffer);
+	/* Indirection table is only used by FTL */
+	if (state->parameters != FTL)
+		state->buffer->ftlCachePages = 0;
+	else if (state->buffer->ftlCachePages == 0)
+		state->buffer->ftlCachePages = 1;
+
+	/* Reserve pages for two checkpoint slots */
+	state->buffer->checkpointPages = 0;
+	if (state->useCheckpoint)
+		state->buffer->checkpointPages = (vmtreeCheckpointSize(state) + state->buffer->pageSize - 1) / state->buffer->pageSize;
+	state->checkpointSequence = 0;
+
+	/* Reserve pages for write-ahead log of log buffer */
+	state->buffer->walPages = 0;
+	if (state->logBuffer != NULL && state->useCheckpoint)
+		state->buffer->walPages = state->walPages;
+
+	/* Reserve pages for sorted runs of log buffer records. A run of a full log buffer must fit. */
+	state->buffer->runPages = 0;
+	state->runRecordsPerPage = (state->buffer->pageSize - VMTREE_RUN_HEADER_SIZE) / state->recordSize;
+	if (state->logBuffer != NULL && state->runFence != NULL && state->runPages > 0)
+	{
+		id_t logPages = (state->logBufferSize / state->recordSize + state->runRecordsPerPage - 1) / state->runRecordsPerPage;
+		if (state->runPages < logPages)
+			printf("Sorted runs require pages for a full log buffer.\n");
+		else
+			state->buffer->runPages = state->runPages;
+	}
+
+	/* Reserve pages for delta records of leaves. A leaf section of maximum size must fit in a delta page. */
+	/* Delta index is only in memory and recovery replays leaf pages so delta records are not used with checkpoints or write-ahead log. */
+	state->buffer->deltaPages = 0;
+	state->buffer->loadPage = NULL;
+	if (state->deltaPages > 0)
+	{
+		if (state->parameters != VMTREE || state->deltaBuffer == NULL || state->deltaIndex == NULL || state->deltaLeaves == 0 || state->maxDeltas == 0
+			|| 10 + VMTREE_DELTA_HEADER_SIZE + (id_t) state->maxDeltas * state->recordSize > state->buffer->pageSize)
+			printf("Delta records require VMTREE mode, delta buffers, and space for maximum delta records of a leaf in a page.\n");
+		else if (state->useCheckpoint || state->buffer->walPages > 0)
+			printf("Delta records are not recovered so cannot be used with checkpoints or write-ahead log.\n");
+		else
+			state->buffer->deltaPages = state->deltaPages;
+	}
+
+	if (recover)
+		dbbufferRecover(state->buffer);
+	else
+		dbbufferInit(state->buffer);
 
 	state->compareKey = uint32Compare;
 
+	/* Buffered interior nodes are updated in place and receive records in batches from the log buffer */
+	if (state->msgRecords > 0 && ((state->parameters != BTREE && state->parameters != FTL) || state->logBuffer == NULL || state->msgBuffer == NULL))
+	{
+		printf("Buffered interior nodes require BTREE or FTL mode and a log buffer.\n");
+		state->msgRecords = 0;
+	}
+
 	/* Calculate block header size */
 	if (state->parameters != OVERWRITE)
 	{
@@ -67,10 +216,20 @@ void vmtreeInit(vmtreeState *state)
 
 		/* Calculate number of records per page */
 		state->maxRecordsPerPage = (state->buffer->pageSize - state->headerSize) / state->recordSize;
+		/* Buffered messages (count then records) are stored at end of interior page. Space is reserved in all interior nodes but only parents of leaves use it. */
+		id_t msgSize = state->msgRecords > 0 ? sizeof(count_t) + state->recordSize * state->msgRecords : 0;
+		if (state->headerSize + sizeof(id_t) + 4*(state->keySize+sizeof(id_t)) + msgSize > state->buffer->pageSize)
+		{
+			printf("Buffered messages leave too little space in interior nodes.\n");
+			state->msgRecords = 0;
+			msgSize = 0;
+		}
 		/* Interior records consist of key and id reference. Note: One extra id reference (child pointer). If N keys, have N+1 id references (pointers). */
-		state->maxInteriorRecordsPerPage = (state->buffer->pageSize - state->headerSize - sizeof(id_t)) / (state->keySize+sizeof(id_t));
+		state->maxInteriorRecordsPerPage = (state->buffer->pageSize - state->headerSize - sizeof(id_t) - msgSize) / (state->keySize+sizeof(id_t));
 
 		printf("Max records per page: %d Interior: %d\n", state->maxRecordsPerPage, state->maxInteriorRecordsPerPage);
+		if (state->msgRecords > 0)
+			printf("Buffered messages per interior node: %d\n", state->msgRecords);
 	}
 	else
 	{	/* OVERWRITE has different page structure to allow in-page overwrites. Keys are NOT sorted. */
@@ -99,6 +258,46 @@ void vmtreeInit(vmtreeState *state)
 		printf("Log buffer size in records: %lu\n", state->maxLogRecords);
 	}
 
+	/* Write-ahead log */
+	state->walPages = state->buffer->walPages;
+	state->walCommit = WAL_COMMIT_PAGE;
+	state->walCommitInterval = 0;
+	state->walTime = NULL;
+	state->walLastCommit = 0;
+	state->walRecordsPerPage = (state->buffer->pageSize - VMTREE_WAL_HEADER_SIZE) / state->recordSize;
+	state->walCommitted = 0;
+	state->walBatch = 0;
+	state->walFirst = 0;
+	state->walNext = 0;
+	state->numWalWrites = 0;
+
+	/* Sorted runs. Only run pages with a fence key are used. */
+	if (state->buffer->runPages == 0)
+		state->runPages = 0;
+	if (state->maxRuns == 0 || state->maxRuns > VMTREE_MAX_RUNS)
+		state->maxRuns = VMTREE_MAX_RUNS;
+	state->numRuns = 0;
+	state->runNext = 0;
+	state->numRunWrites = 0;
+	state->numCompactions = 0;
+	state->numMsgWrites = 0;
+	state->numMsgFlushes = 0;
+
+	/* Delta records. Delta page being built is in first page of delta buffer. */
+	state->deltaPages = state->buffer->deltaPages;
+	state->numDeltaLeaves = 0;
+	state->deltaNext = 0;
+	state->deltaReadPage = EMPTY_MAPPING;
+	state->numDeltaRecords = 0;
+	state->numDeltaWrites = 0;
+	state->numDeltaMerges = 0;
+	if (state->deltaPages > 0)
+	{
+		vmtreeDeltaReset(state);
+		state->buffer->loadPage = vmtreeDeltaLoad;
+		printf("Delta records per leaf: %d  Leaves with delta records: %d\n", state->maxDeltas, state->deltaLeaves);
+	}
+
 	/* Hard-code for testing */
 	// state->maxRecordsPerPage = 5;	
 	// state->maxInteriorRecordsPerPage = 4;	
@@ -106,32 +305,93 @@ void vmtreeInit(vmtreeState *state)
 	state->levels = 1;
 	state->numMappings = 0;
 	state->maxMappings = 0;
+	state->mappingIdSize = 0;
 	state->numNodes = 1;
 	state->numMappingCompare = 0;
 	state->numMappingWrite = 0;
-	state->maxTries = 5;	
+	state->maxTries = 16;	
 	state->savedMappingPrev = EMPTY_MAPPING;
+	state->spillBufferPage = EMPTY_MAPPING;
+	state->numSpillPages = 0;
+	state->numMappingSpill = 0;
+	for (int8_t i=0; i < MAX_SPILL_PAGES; i++)
+		state->spillPages[i] = EMPTY_MAPPING;
+	state->fillFactor = 100;
+	state->appendPath = 0;
+	state->numRecords = 0;
+	state->retentionMode = RETAIN_NONE;
+	state->retentionLimit = 0;
+	state->retentionMinKey = NULL;
+	state->retentionFence = NULL;
+	state->retentionFenceValid = 0;
+	state->bloomNumHashes = 3;
+	if (state->bloomFilter != NULL)
+		memset(state->bloomFilter, 0, state->bloomFilterSize);
 
 
 	if (state->mappingBuffer != NULL && state->mappingBufferSize > 0)
 	{
+		/* Use smallest page id size that can store all page ids of storage and still mark empty slots */
+		if (state->buffer->storage->size < 0xFFFF)
+			state->mappingIdSize = 2;
+		else if (state->buffer->storage->size < 0xFFFFFF)
+			state->mappingIdSize = 3;
+		else
+			state->mappingIdSize = 4;
+
 		/* Calculate maximum number of mappings */
-		state->maxMappings = state->mappingBufferSize / MAPPING_SIZE;		
+		id_t max = state->mappingBufferSize / (2*state->mappingIdSize);
+		state->maxMappings = max > 32767 ? 32767 : max;
 			
 		/* Initialize mapping table */
-		vmtreemapping *mappings = (vmtreemapping*) state->mappingBuffer;
 		for (int16_t i=0; i < state->maxMappings; i++)
-			mappings[i].prevPage = EMPTY_MAPPING;
+			vmtreeMappingSet(state, i, 0, EMPTY_MAPPING);
 	}
 		
-	printf("Max mappings: %d  Number of hash probes: %d\n", state->maxMappings, state->maxTries);
+	printf("Max mappings: %d  Mapping page id size: %d  Number of hash probes: %d\n", state->maxMappings, state->mappingIdSize, state->maxTries);
+}
+
+/**
+@brief     	Creates an empty tree on formatted storage. Writes empty root node and, if enabled, the first checkpoint.
+@param     	state
+                vmTree algorithm state structure
+*/
+void vmtreeFormat(vmtreeState *state)
+{
+	dbbuffer *buffer = state->buffer;
 
 	/* Create and write empty root node */
-	void *buf = initBufferPage(state->buffer, 0);
+	void *buf = initBufferPage(buffer, 0);
 	VMTREE_SET_ROOT(buf);
 	if (state->parameters != OVERWRITE)
 		VMTREE_SET_COUNT(buf, 0);		
-	state->activePath[0] = writePageDirect(state->buffer, buf, 0);		/* Store root location */	
+	state->activePath[0] = writePageDirect(buffer, buf, 0);		/* Store root location */	
+
+	if (buffer->checkpointPages > 0)
+	{	/* Invalidate checkpoints of any previous tree so recovery starts from this one */
+		for (id_t s=0; s < 2; s++)
+		{
+			id_t pageNum = buffer->checkpointStart + s*buffer->checkpointPages;
+			buffer->storage->erasePages(buffer->storage, pageNum, pageNum + buffer->checkpointPages - 1);
+			buffer->storage->writePage(buffer->storage, pageNum, buffer->pageSize, initBufferPage(buffer, 0));
+		}
+
+		/* Log pages of a previous tree may have same checkpoint sequence as pages of this tree */
+		if (buffer->walPages > 0)
+			buffer->storage->erasePages(buffer->storage, buffer->walStart, buffer->walStart + buffer->walPages - 1);
+		vmtreeCheckpoint(state);
+	}
+}
+
+/**
+@brief     	Initialize a VMTree structure.
+@param     	state
+                vmTree algorithm state structure
+*/
+void vmtreeInit(vmtreeState *state)
+{
+	vmtreeSetup(state, 0);
+	vmtreeFormat(state);
 }
 
 /**
@@ -177,8 +437,35 @@ void* vmtreeGetMaxKey(vmtreeState *state, void *buffer)
 	}
 }
 
+/**
+@brief     	Returns home slot of a page in mapping table.
+@param     	state
+                VMTree algorithm state structure
+@param		pageId
+				physical page index
+*/
+int16_t vmtreeMappingHome(vmtreeState *state, id_t pageId)
+{
+	return (int16_t) ((pageId * 2654435761u) % state->maxMappings);
+}
+
+/**
+@brief     	Returns number of slots a mapping is stored past its home slot.
+@param     	state
+                VMTree algorithm state structure
+@param		loc
+				mapping table slot containing a mapping
+*/
+int16_t vmtreeMappingDistance(vmtreeState *state, int16_t loc)
+{
+	int16_t home = vmtreeMappingHome(state, vmtreeMappingGet(state, loc, 0));
+	return (loc - home + state->maxMappings) % state->maxMappings;
+}
+
 /**
 @brief     	Gets a page mapping index or returns -1 if no mapping. 
+			Mapping table uses Robin Hood hashing with linear probing. A mapping is never stored
+			more than maxTries-1 slots past its home slot.
 @param     	state
                 VMTree algorithm state structure
 @param		pageId
@@ -189,79 +476,236 @@ int16_t vmtreeGetMappingIndex(vmtreeState *state, id_t pageId)
 	if (state->numMappings == 0)
 		return -1;
 
-	// Code for fixed sized hash
-	vmtreemapping *mappings = (vmtreemapping*) state->mappingBuffer;	
-	int16_t loc = pageId % state->maxMappings;
-	int8_t i=0, offset = HASH_TABLE_PRIME - (pageId % HASH_TABLE_PRIME);
+	int16_t loc = vmtreeMappingHome(state, pageId);
 
-	while (1)
+	for (int16_t dist=0; dist < state->maxTries && dist < state->maxMappings; dist++)
 	{	
 		state->numMappingCompare++;
-		if (mappings[loc].prevPage == pageId)
+		id_t prev = vmtreeMappingGet(state, loc, 0);
+		if (prev == pageId)
 			return loc;	 	
 
-		i++;
-		if (i >= state->maxTries)
+		/* Mapping would have been stored before an empty slot or a mapping closer to its home slot */
+		if (prev == EMPTY_MAPPING || vmtreeMappingDistance(state, loc) < dist)
 			break;
-		loc += offset;
-		loc = loc % state->maxMappings;	
+		loc = (loc+1) % state->maxMappings;	
 	}
 	
 	return -1;
 }
 
+/**
+@brief     	Returns bit in mapping page summary (Bloom filter) for a page id.
+@param		pageId
+				physical page index
+@param		i
+				hash function number
+*/
+uint16_t vmtreeSpillSummaryBit(id_t pageId, uint8_t i)
+{
+	uint32_t h = pageId;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return (uint16_t) ((h + i * ((h >> 16) | 1)) % (SPILL_SUMMARY_SIZE*8));
+}
+
+/**
+@brief     	Returns maximum number of mappings stored in a mapping page.
+@param     	state
+                VMTree algorithm state structure
+*/
+count_t vmtreeSpillEntries(vmtreeState *state)
+{
+	count_t num = (state->buffer->pageSize - VMTREE_COUNT_OFFSET - sizeof(count_t)) / (2*sizeof(id_t));
+	return num > MAX_SPILL_ENTRIES ? MAX_SPILL_ENTRIES : num;
+}
+
+/**
+@brief     	Returns pointer to a mapping in mapping page buffer.
+@param     	state
+                VMTree algorithm state structure
+@param		entry
+				mapping number in page
+*/
+void* vmtreeSpillEntry(vmtreeState *state, count_t entry)
+{
+	return state->spillBuffer + VMTREE_COUNT_OFFSET + sizeof(count_t) + entry * 2 * sizeof(id_t);
+}
+
+/**
+@brief     	Finds an active mapping in the mapping pages on storage. Only pages whose summary may
+			contain the page id are read. The page containing the mapping is left in spillBuffer.
+@param     	state
+                VMTree algorithm state structure
+@param		pageId
+				previous physical page index
+@param		slot
+				Returns mapping page slot containing mapping
+@param		entry
+				Returns mapping number in page
+@return		Return 0 if found, -1 otherwise.
+*/
+int8_t vmtreeSpillFind(vmtreeState *state, id_t pageId, int8_t *slot, count_t *entry)
+{
+	id_t prev;
+
+	for (int8_t s=0; s < MAX_SPILL_PAGES; s++)
+	{
+		if (state->spillPages[s] == EMPTY_MAPPING)
+			continue;
+
+		uint8_t i;
+		for (i=0; i < 3; i++)
+		{
+			if (bitarrGet(state->spillSummary[s], vmtreeSpillSummaryBit(pageId, i)) == 0)
+				break;
+		}
+		if (i < 3)
+			continue;		/* Page id is not in this mapping page */
+
+		if (state->spillBufferPage != state->spillPages[s])
+		{
+			if (state->buffer->storage->readPage(state->buffer->storage, state->spillPages[s], state->buffer->pageSize, state->spillBuffer) != 0)
+			{
+				printf("ERROR reading mapping page: %lu\n", state->spillPages[s]);
+				state->spillBufferPage = EMPTY_MAPPING;
+				continue;
+			}
+			state->buffer->numReads++;
+			state->spillBufferPage = state->spillPages[s];
+		}
+
+		count_t count = VMTREE_GET_COUNT(state->spillBuffer);
+		for (count_t e=0; e < count; e++)
+		{
+			state->numMappingCompare++;
+			memcpy(&prev, vmtreeSpillEntry(state, e), sizeof(id_t));
+			if (prev == pageId && (state->spillLive[s] >> e) & 1)
+			{
+				*slot = s;
+				*entry = e;
+				return 0;
+			}
+		}
+	}
+	return -1;
+}
+
+/**
+@brief     	Deletes a mapping from the mapping pages on storage. A mapping page is freed when none of its mappings are active.
+@param     	state
+                VMTree algorithm state structure
+@param		pageId
+				previous physical page index
+*/
+void vmtreeSpillDelete(vmtreeState *state, id_t pageId)
+{
+	int8_t slot;
+	count_t entry;
+
+	if (state->numSpillPages == 0 || vmtreeSpillFind(state, pageId, &slot, &entry) != 0)
+		return;
+
+	state->spillLive[slot] &= ~((uint64_t) 1 << entry);
+	if (state->spillLive[slot] == 0)
+	{	/* All mappings drained. Page may be reused. */
+		dbbufferSetFree(state->buffer, state->spillPages[slot]);
+		if (state->spillBufferPage == state->spillPages[slot])
+			state->spillBufferPage = EMPTY_MAPPING;
+		state->spillPages[slot] = EMPTY_MAPPING;
+		state->numSpillPages--;
+	}
+}
+
 /**
 @brief     	Adds a page mapping.
+			Robin Hood insert: new mapping takes the first slot holding a mapping closer to its home slot
+			and the mappings from there to the next empty slot move forward one slot.
 @param     	state
                 VMTree algorithm state structure
 @param		prevPage
 				previous physical page index
 @param		currPage
 				current physical page index
+@return		Return 0 if success. -1 if no space for mapping.
 */
 int8_t vmtreeAddMapping(vmtreeState *state, id_t prevPage, id_t currPage)
 {
-	/* Check for capacity */
-	//if (state->numMappings >= state->maxMappings)
-	//	return -1;		/* No space for another mapping */
-
-	vmtreemapping *mappings = (vmtreemapping*) state->mappingBuffer;
-	
-	int16_t loc = prevPage % state->maxMappings;
-	int8_t i=0, offset = HASH_TABLE_PRIME - (prevPage % HASH_TABLE_PRIME);
+	int16_t loc = vmtreeMappingHome(state, prevPage), dist;
 	
-	while (1)
+	for (dist=0; dist < state->maxTries && dist < state->maxMappings; dist++)
 	{
 		state->numMappingCompare++;
-		// printf("Key (prev page): %d  Probe: %d  Loc: %d  PrevPage: %d  CurPage: %d\n", prevPage, i, loc, mappings[loc].prevPage, mappings[loc].currPage);
-		if (mappings[loc].prevPage == prevPage)
+		id_t prev = vmtreeMappingGet(state, loc, 0);
+		// printf("Key (prev page): %d  Probe: %d  Loc: %d  PrevPage: %d  CurPage: %d\n", prevPage, dist, loc, prev, vmtreeMappingGet(state, loc, 1));
+		if (prev == prevPage)
 		{	/* Update current mapping */
-			mappings[loc].currPage = currPage;
+			vmtreeMappingSet(state, loc, 1, currPage);
 			return 0;	
 		}			
 
- 		if (mappings[loc].prevPage == EMPTY_MAPPING)
-		{	/* Add new mapping */
-			state->numMappings++;
-			mappings[loc].prevPage = prevPage;
-			mappings[loc].currPage = currPage;
-			return 0;	
-		}		 	
+ 		if (prev == EMPTY_MAPPING || vmtreeMappingDistance(state, loc) < dist)
+			break;		/* Insert location */
 
-		i++;
-		if (i >= state->maxTries)
-			break;
+		loc = (loc+1) % state->maxMappings;	
+	}
+
+	if (dist >= state->maxTries || dist >= state->maxMappings || state->numMappings >= state->maxMappings)
+		return -1;		/* No space for mapping within maximum probe distance */
 
-		loc += offset;
-		loc = loc % state->maxMappings;	
+	/* Find end of run of mappings that must move forward. Check none would move too far from its home slot. */
+	int16_t end = loc, prev;
+	while (vmtreeMappingGet(state, end, 0) != EMPTY_MAPPING)
+	{
+		if (vmtreeMappingDistance(state, end) + 1 >= state->maxTries)
+			return -1;
+		end = (end+1) % state->maxMappings;
+	}
+
+	/* Mapping replaces any spilled mapping for the page */
+	vmtreeSpillDelete(state, prevPage);
+
+	/* Move mappings forward one slot */
+	while (end != loc)
+	{
+		prev = (end - 1 + state->maxMappings) % state->maxMappings;
+		vmtreeMappingCopy(state, end, prev);
+		end = prev;
 	}
 
-	/* No space for mapping in mapping chain */
-	return -1;	
+	/* Add new mapping */
+	state->numMappings++;
+	vmtreeMappingSet(state, loc, 0, prevPage);
+	vmtreeMappingSet(state, loc, 1, currPage);
+	return 0;	
+}
+
+/**
+@brief     	Deletes mapping at a mapping table slot.
+			Following mappings that are not in their home slot move back one slot so lookups stay correct.
+@param     	state
+                VMTree algorithm state structure
+@param		loc
+				mapping table slot containing mapping
+*/
+void vmtreeDeleteMappingIndex(vmtreeState *state, int16_t loc)
+{
+	int16_t next = (loc+1) % state->maxMappings, start = loc;
+	while (next != start && vmtreeMappingGet(state, next, 0) != EMPTY_MAPPING && vmtreeMappingDistance(state, next) > 0)
+	{
+		vmtreeMappingCopy(state, loc, next);
+		loc = next;
+		next = (next+1) % state->maxMappings;
+	}
+	vmtreeMappingSet(state, loc, 0, EMPTY_MAPPING);
+	state->numMappings--;
 }
 
 /**
-@brief     	Deletes a page mapping.
+@brief     	Deletes a page mapping from mapping table or mapping pages on storage.
 @param     	state
                 VMTree algorithm state structure
 @param		prevPage
@@ -269,28 +713,14 @@ int8_t vmtreeAddMapping(vmtreeState *state, id_t prevPage, id_t currPage)
 */
 int8_t vmtreeDeleteMapping(vmtreeState *state, id_t prevPage)
 {	
-	if (state->numMappings == 0)
+	int16_t loc = vmtreeGetMappingIndex(state, prevPage);
+	if (loc == -1)
+	{
+		vmtreeSpillDelete(state, prevPage);
 		return 0;
-
-	vmtreemapping *mappings = (vmtreemapping*) state->mappingBuffer;
-			
-	int16_t loc = prevPage % state->maxMappings;	
-	int8_t i=0, offset = HASH_TABLE_PRIME - (prevPage % HASH_TABLE_PRIME);
-
-	for (i=0; i < state->maxTries; i++)	
-	{	
-		state->numMappingCompare++;
-		if (mappings[loc].prevPage == prevPage)
-		{
-			mappings[loc].prevPage = EMPTY_MAPPING;	
-			state->numMappings--;
-			return 0;
-		}
-
-		loc += offset;
-		loc = loc % state->maxMappings;	
 	}
-
+	
+	vmtreeDeleteMappingIndex(state, loc);
 	return 0;
 }
 
@@ -303,63 +733,264 @@ int8_t vmtreeDeleteMapping(vmtreeState *state, id_t prevPage)
 */
 id_t vmtreeGetMapping(vmtreeState *state, id_t pageId)
 {	
-	vmtreemapping *mappings = (vmtreemapping*) state->mappingBuffer;
-
 	int16_t mappingIdx = vmtreeGetMappingIndex(state, pageId);	
 	if (mappingIdx != -1)
-		return mappings[mappingIdx].currPage;	
+		return vmtreeMappingGet(state, mappingIdx, 1);	
+
+	/* Check mappings spilled to storage */
+	int8_t slot;
+	count_t entry;
+	if (state->numSpillPages > 0 && vmtreeSpillFind(state, pageId, &slot, &entry) == 0)
+	{
+		memcpy(&pageId, vmtreeSpillEntry(state, entry) + sizeof(id_t), sizeof(id_t));
+		return pageId;
+	}
 	
 	/* Return original page if no mapping */
 	return pageId;
 }
 
-void printSpaces(int num)
+/**
+@brief     	Records the mapping page in spillBuffer as a mapping page slot with all its mappings active and builds its summary.
+@param     	state
+                VMTree algorithm state structure
+@param		slot
+				mapping page slot
+@param		pageNum
+				physical page id of mapping page
+*/
+void vmtreeSpillAddPage(vmtreeState *state, int8_t slot, id_t pageNum)
 {
-	for (int i=0; i < num; i++)
-		printf(" ");
+	count_t count = VMTREE_GET_COUNT(state->spillBuffer);
+	id_t prev;
+
+	state->spillPages[slot] = pageNum;
+	state->spillBufferPage = pageNum;
+	state->spillLive[slot] = count == MAX_SPILL_ENTRIES ? ~((uint64_t) 0) : ((uint64_t) 1 << count) - 1;
+	state->numSpillPages++;
+	memset(state->spillSummary[slot], 0, SPILL_SUMMARY_SIZE);
+	for (count_t e=0; e < count; e++)
+	{
+		memcpy(&prev, vmtreeSpillEntry(state, e), sizeof(id_t));
+		for (uint8_t i=0; i < 3; i++)
+			bitarrSet(state->spillSummary[slot], vmtreeSpillSummaryBit(prev, i), 1);
+	}
 }
 
 /**
-@brief     	Print a node in an in-memory buffer.
+@brief     	Spills mappings from the mapping table to a mapping page on storage.
+			Mappings are taken starting at the home slot of the page id that did not fit so it can then be added.
+			If all mapping pages are used, the page with fewest active mappings is rewritten with its active
+			mappings and mappings from the table. Spilled mappings are removed when parent nodes are next rewritten.
 @param     	state
                 VMTree algorithm state structure
-@param     	pageNum
-                Physical page id (number)	
-@param     	depth
-                Used for nesting print out
-@param     	buffer
-                In memory page buffer with node data
+@param		pageId
+				previous physical page index of mapping that did not fit in table
+@return		Return 0 if mappings were spilled, -1 if not possible.
 */
-void vmtreePrintNodeBuffer(vmtreeState *state, id_t pageNum, int depth, void *buffer)
+int8_t vmtreeSpillMappings(vmtreeState *state, id_t pageId)
 {
-	uint32_t key, val, key2;	
+	int8_t s, slot = -1;
+	count_t count = 0, num, maxEntries = vmtreeSpillEntries(state);
+	uint64_t live;
+	id_t prev, curr;
 
-	if (state->parameters != OVERWRITE)
-	{	
-		int16_t c, count =  VMTREE_GET_COUNT(buffer); 
-		if (VMTREE_IS_INTERIOR(buffer) && state->levels != 1)
-		{	
-			printSpaces(depth*3);
-			printf("Id: %d Loc: %d Prev: %d Cnt: %d [%u, %u]\n", VMTREE_GET_ID(buffer), pageNum, VMTREE_GET_PREV(buffer), count, (VMTREE_IS_ROOT(buffer)), VMTREE_IS_INTERIOR(buffer));		
-			/* Print data records (optional) */	
-			printSpaces(depth*3);
-					
-			for (c=0; c < count && c < state->maxInteriorRecordsPerPage; c++)
-			{			
-				memcpy(&key, (int32_t*) (buffer+state->keySize * c + state->headerSize), sizeof(uint32_t));
-				memcpy(&val, (int32_t*) (buffer+state->keySize * state->maxInteriorRecordsPerPage + state->headerSize + c*sizeof(id_t)), sizeof(uint32_t));
-				if (state->keySize == 8)
-				{
-					memcpy(&key2, (int32_t*) (buffer + state->headerSize + state->recordSize * c + sizeof(uint32_t)), sizeof(uint32_t));
-					printf(" (%u - %u, %u)", key, key2, val);											
-				}
-				else
-					printf(" (%u, %u)", key, val);						
-			}
-			
-			/* Print last pointer */
-			memcpy(&val, (int32_t*) (buffer+state->keySize * state->maxInteriorRecordsPerPage + state->headerSize + c*sizeof(id_t)), sizeof(uint32_t));
-			id_t mapVal = vmtreeGetMapping(state, val);	
+	if (state->spillBuffer == NULL || state->numMappings == 0)
+		return -1;
+
+	/* Find unused mapping page or page with fewest active mappings to merge */
+	for (s=0; s < MAX_SPILL_PAGES; s++)
+	{
+		if (state->spillPages[s] == EMPTY_MAPPING)
+		{
+			slot = s;
+			break;
+		}
+		for (live = state->spillLive[s], num=0; live != 0; live &= live-1)
+			num++;
+		if (num <= maxEntries / 2 && (slot == -1 || num < count))
+		{
+			slot = s;
+			count = num;
+		}
+	}
+	if (slot == -1)
+		return -1;		/* Mapping pages are too full to be worth rewriting */
+
+	/* Determine page location before filling buffer as checking for mappings on a page may read a mapping page */
+	id_t pageNum = dbbufferNextValidPage(state->buffer);
+
+	count = 0;
+	if (state->spillPages[slot] != EMPTY_MAPPING)
+	{	/* Keep active mappings of page being merged */
+		if (state->spillBufferPage != state->spillPages[slot])
+		{
+			if (state->buffer->storage->readPage(state->buffer->storage, state->spillPages[slot], state->buffer->pageSize, state->spillBuffer) != 0)
+			{
+				printf("ERROR reading mapping page: %lu\n", state->spillPages[slot]);
+				state->spillBufferPage = EMPTY_MAPPING;
+				return -1;
+			}
+			state->buffer->numReads++;
+		}
+		for (count_t e=0; e < VMTREE_GET_COUNT(state->spillBuffer); e++)
+		{
+			if ((state->spillLive[slot] >> e) & 1)
+			{
+				memmove(vmtreeSpillEntry(state, count), vmtreeSpillEntry(state, e), 2*sizeof(id_t));
+				count++;
+			}
+		}
+		dbbufferSetFree(state->buffer, state->spillPages[slot]);
+		state->numSpillPages--;
+	}
+	state->spillBufferPage = EMPTY_MAPPING;
+
+	/* Move mappings from table starting at home slot. Deleting a mapping may shift the next mapping into the slot. */
+	int16_t loc = vmtreeMappingHome(state, pageId);
+	while (count < maxEntries && state->numMappings > 0)
+	{
+		prev = vmtreeMappingGet(state, loc, 0);
+		if (prev == EMPTY_MAPPING)
+		{
+			loc = (loc+1) % state->maxMappings;
+			continue;
+		}
+		curr = vmtreeMappingGet(state, loc, 1);
+		memcpy(vmtreeSpillEntry(state, count), &prev, sizeof(id_t));
+		memcpy(vmtreeSpillEntry(state, count) + sizeof(id_t), &curr, sizeof(id_t));
+		vmtreeDeleteMappingIndex(state, loc);
+		count++;
+	}
+
+	/* Write mapping page and build its summary */
+	VMTREE_SET_PREV(state->spillBuffer, 0);
+	VMTREE_SET_COUNT(state->spillBuffer, VMTREE_MAPPING_PAGE + count);
+	writePageDirect(state->buffer, state->spillBuffer, pageNum);
+	state->numMappingSpill++;
+	vmtreeSpillAddPage(state, slot, pageNum);
+	return 0;
+}
+
+/**
+@brief     	Computes the two hash values of a key used for double hashing in the Bloom filter.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key to hash
+@param		h1
+				Returns first hash value
+@param		h2
+				Returns second hash value (odd)
+*/
+void vmtreeBloomHash(vmtreeState *state, void *key, uint32_t *h1, uint32_t *h2)
+{
+	/* FNV-1a hash of key bytes */
+	uint32_t h = 2166136261u;
+	for (uint8_t i=0; i < state->keySize; i++)
+	{
+		h ^= ((uint8_t*) key)[i];
+		h *= 16777619u;
+	}
+	*h1 = h;
+
+	/* Second hash derived by mixing bits of first hash */
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	*h2 = h | 1;
+}
+
+/**
+@brief     	Adds a key to the Bloom filter (if enabled).
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key to add
+*/
+void vmtreeBloomAdd(vmtreeState *state, void *key)
+{
+	uint32_t h1, h2, numBits = state->bloomFilterSize * 8;
+
+	if (state->bloomFilter == NULL || numBits == 0)
+		return;
+
+	vmtreeBloomHash(state, key, &h1, &h2);
+	for (uint8_t i=0; i < state->bloomNumHashes; i++)
+		bitarrSet(state->bloomFilter, (h1 + i * h2) % numBits, 1);
+}
+
+/**
+@brief     	Checks the Bloom filter to determine if a key may be in the tree.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key to check
+@return		Return 0 if key is definitely not in tree, 1 if key may be in tree or no Bloom filter.
+*/
+int8_t vmtreeBloomMayContain(vmtreeState *state, void *key)
+{
+	uint32_t h1, h2, numBits = state->bloomFilterSize * 8;
+
+	if (state->bloomFilter == NULL || numBits == 0)
+		return 1;
+
+	vmtreeBloomHash(state, key, &h1, &h2);
+	for (uint8_t i=0; i < state->bloomNumHashes; i++)
+	{
+		if (bitarrGet(state->bloomFilter, (h1 + i * h2) % numBits) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+void printSpaces(int num)
+{
+	for (int i=0; i < num; i++)
+		printf(" ");
+}
+
+/**
+@brief     	Print a node in an in-memory buffer.
+@param     	state
+                VMTree algorithm state structure
+@param     	pageNum
+                Physical page id (number)	
+@param     	depth
+                Used for nesting print out
+@param     	buffer
+                In memory page buffer with node data
+*/
+void vmtreePrintNodeBuffer(vmtreeState *state, id_t pageNum, int depth, void *buffer)
+{
+	uint32_t key, val, key2;	
+
+	if (state->parameters != OVERWRITE)
+	{	
+		int16_t c, count =  VMTREE_GET_COUNT(buffer); 
+		if (VMTREE_IS_INTERIOR(buffer) && state->levels != 1)
+		{	
+			printSpaces(depth*3);
+			printf("Id: %d Loc: %d Prev: %d Cnt: %d [%u, %u]\n", VMTREE_GET_ID(buffer), pageNum, VMTREE_GET_PREV(buffer), count, (VMTREE_IS_ROOT(buffer)), VMTREE_IS_INTERIOR(buffer));		
+			/* Print data records (optional) */	
+			printSpaces(depth*3);
+					
+			for (c=0; c < count && c < state->maxInteriorRecordsPerPage; c++)
+			{			
+				memcpy(&key, (int32_t*) (buffer+state->keySize * c + state->headerSize), sizeof(uint32_t));
+				memcpy(&val, (int32_t*) (buffer+state->keySize * state->maxInteriorRecordsPerPage + state->headerSize + c*sizeof(id_t)), sizeof(uint32_t));
+				if (state->keySize == 8)
+				{
+					memcpy(&key2, (int32_t*) (buffer + state->headerSize + state->recordSize * c + sizeof(uint32_t)), sizeof(uint32_t));
+					printf(" (%u - %u, %u)", key, key2, val);											
+				}
+				else
+					printf(" (%u, %u)", key, val);						
+			}
+			
+			/* Print last pointer */
+			memcpy(&val, (int32_t*) (buffer+state->keySize * state->maxInteriorRecordsPerPage + state->headerSize + c*sizeof(id_t)), sizeof(uint32_t));
+			id_t mapVal = vmtreeGetMapping(state, val);	
 			printf(" (, %u", val);
 			if (mapVal != val)
 				printf(" [%u]", mapVal);
@@ -591,17 +1222,15 @@ void vmtreePrint(vmtreeState *state)
 void vmtreePrintMappings(vmtreeState *state)
 {
 	/* Prints all active mappings */
-	vmtreemapping *mappings = (vmtreemapping*) state->mappingBuffer;
-
 	printf("Mappings:\n");
 	
-	for (int i=0; i < state->maxMappings; i++)
+	for (int16_t i=0; i < state->maxMappings; i++)
 	{		
-		if (mappings[i].prevPage != EMPTY_MAPPING)	
-			printf("%lu --> %lu\n", mappings[i].prevPage, mappings[i].currPage);		
+		if (vmtreeMappingGet(state, i, 0) != EMPTY_MAPPING)	
+			printf("%lu --> %lu\n", vmtreeMappingGet(state, i, 0), vmtreeMappingGet(state, i, 1));		
 	}	
 	
-	printf("Mapping count: %d  Max: %d\n", state->numMappings, state->maxMappings);	
+	printf("Mapping count: %d  Max: %d  Mapping pages: %d\n", state->numMappings, state->maxMappings, state->numSpillPages);	
 	printf("Node count: %lu\n", state->numNodes);
 }
 
@@ -720,6 +1349,137 @@ id_t vmtreeUpdatePrev(vmtreeState *state, void *buf, id_t currId)
 	return prevId;
 }
 
+/**
+@brief     	Reads a page that will be modified and written.
+			With more than 3 buffers, the page is read through the buffer and pinned so
+			repeated updates of the same page do not read it again. Otherwise it is read into buffer 0.
+@param     	state
+                VMTree algorithm state structure
+@param     	pageNum
+                Physical page id (number)
+@return		Returns pointer to buffer page or NULL if error.
+*/
+void* vmtreePinPage(vmtreeState *state, id_t pageNum)
+{
+	if (state->buffer->numPages > 3)
+		return dbbufferPinPage(state->buffer, pageNum);
+	return readPageBuffer(state->buffer, pageNum, 0);
+}
+
+/**
+@brief     	Releases a page read by vmtreePinPage().
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Pointer to buffer page
+*/
+void vmtreeUnpinPage(vmtreeState *state, void *buf)
+{
+	if (buf != state->buffer->buffer)
+		dbbufferUnpinPage(state->buffer, buf);
+}
+
+/**
+@brief     	Moves a page read by vmtreePinPage() to buffer 0 before it is split into several pages.
+			The pinned buffer is released and cleared as it may have been modified without being written.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Pointer to buffer page
+@return		Returns pointer to buffer 0.
+*/
+void* vmtreeUnpinToBuffer0(vmtreeState *state, void *buf)
+{
+	void *buf0 = state->buffer->buffer;
+	if (buf == buf0)
+		return buf;
+
+	memcpy(buf0, buf, state->buffer->pageSize);
+	dbbufferUnpinPage(state->buffer, buf);
+	dbbufferSetFrame(state->buffer, (count_t) ((buf - buf0) / state->buffer->pageSize), 0);
+	return buf0;
+}
+
+/**
+@brief     	Reads ahead the children of an interior node that follow the child currently used (buffer->prefetchPages children).
+			Children whose smallest key is larger than the maximum key are not read.
+@param     	state
+                VMTree algorithm state structure
+@param     	pageNum
+                Physical page id of interior node
+@param		l
+				Level of interior node
+@param     	childNum
+                Index of child currently used
+@param		maxKey
+				Largest key that will be used (NULL if no maximum)
+*/
+void vmtreePrefetchChildren(vmtreeState *state, id_t pageNum, int8_t l, int32_t childNum, void *maxKey)
+{
+	/* Children of nodes with bitmaps are not in key order */
+	if (state->buffer->prefetchPages == 0 || state->buffer->zeroCopy || state->parameters == OVERWRITE)
+		return;
+
+	/* Node is pinned so reading ahead does not replace it */
+	void *buf = dbbufferPinPage(state->buffer, pageNum);
+	if (buf == NULL)
+		return;
+
+	count_t count = VMTREE_GET_COUNT(buf);
+	for (count_t c=1; c <= state->buffer->prefetchPages && childNum+c <= count; c++)
+	{	/* Child has keys greater than or equal to separator before its pointer */
+		if (maxKey != NULL && state->compareKey(buf + state->headerSize + state->keySize*(childNum+c-1), maxKey) > 0)
+			break;
+		id_t childId = getChildPageId(state, buf, pageNum, l, childNum+c);
+		if (childId == -1 || dbbufferPrefetch(state->buffer, childId) != 0)
+			break;
+	}
+	dbbufferUnpinPage(state->buffer, buf);
+}
+
+/**
+@brief     	Reads ahead the children of an interior node that the next sorted log records will be inserted into (buffer->prefetchPages children).
+@param     	state
+                VMTree algorithm state structure
+@param     	pageNum
+                Physical page id of interior node
+@param		l
+				Level of interior node
+@param     	childNum
+                Index of child currently used
+@param		logidx
+				Index of next log record
+*/
+void vmtreePrefetchLog(vmtreeState *state, id_t pageNum, int8_t l, int32_t childNum, uint32_t logidx)
+{
+	if (state->buffer->prefetchPages == 0 || state->buffer->zeroCopy || state->parameters == OVERWRITE)
+		return;
+
+	/* Node is pinned so reading ahead does not replace it */
+	void *buf = dbbufferPinPage(state->buffer, pageNum);
+	if (buf == NULL)
+		return;
+
+	count_t count = VMTREE_GET_COUNT(buf);
+	for (count_t n=0; n < state->buffer->prefetchPages && childNum < count; n++)
+	{	/* Skip records of current child. Child has keys smaller than separator after its pointer. */
+		void *sep = buf + state->headerSize + state->keySize*childNum;
+		while (logidx < state->numLogRecords && state->compareKey(state->logBuffer+state->recordSize*logidx, sep) < 0)
+			logidx++;
+		if (logidx == state->numLogRecords)
+			break;
+
+		/* Records past separator of last child may belong to the next node unless node is root */
+		childNum = vmtreeSearchNode(state, buf, state->logBuffer+state->recordSize*logidx, pageNum, 1);
+		if (childNum == count && l > 0)
+			break;
+		id_t childId = getChildPageId(state, buf, pageNum, l, childNum);
+		if (childId == -1 || dbbufferPrefetch(state->buffer, childId) != 0)
+			break;
+	}
+	dbbufferUnpinPage(state->buffer, buf);
+}
+
 /**
 @brief     	Updates and fixes mapping after node has been written.
 			Note: If mappings are full, may have to write more nodes (recursively to the root)
@@ -734,12 +1494,19 @@ id_t vmtreeUpdatePrev(vmtreeState *state, void *buf, id_t currId)
 void vmtreeFixMappings(vmtreeState *state, id_t prevId, id_t currId, int16_t l)
 {
 	void *buf;
+	int8_t spilled = 0;
 	
 	while (vmtreeAddMapping(state, prevId, currId) == -1 && l >= 0)
-	{	/* No more space for mappings. Write all nodes to root until have space for a mapping. */			
+	{	/* No more space for mappings. Spill mappings to storage once. Otherwise, write all nodes to root until have space for a mapping. */			
 		// printf("No more space for mappings. Page: %d Num: %d Max: %d\n", prevId, state->numMappings, state->maxMappings);		
+		if (!spilled)
+		{
+			spilled = 1;
+			if (vmtreeSpillMappings(state, prevId) == 0)
+				continue;
+		}
 		state->numMappingWrite++;
-		buf = readPageBuffer(state->buffer, state->activePath[l], 0);	
+		buf = vmtreePinPage(state, state->activePath[l]);	
 		if (buf == NULL)
 			return;
 
@@ -754,6 +1521,8 @@ void vmtreeFixMappings(vmtreeState *state, id_t prevId, id_t currId, int16_t l)
 		vmtreeUpdatePointers(state, buf, 0, VMTREE_GET_COUNT(buf));	
 		state->savedMappingPrev = EMPTY_MAPPING;
 		currId = writePage(state->buffer, buf);
+		vmtreeUnpinPage(state, buf);
+		state->activePath[l] = currId;
 		l--;
 
 		if (l == -1)
@@ -1180,6 +1949,29 @@ void vmtreeResetBlockInterior(vmtreeState* state, void *buf, int16_t count)
 	memset(buf+state->interiorHeaderSize+state->maxInteriorRecordsPerPage*state->keySize + count * sizeof(id_t), -1, sizeof(id_t)*(state->maxInteriorRecordsPerPage-count));
 }
 
+/**
+@brief     	Writes the two pages of a node split. Pages given consecutive locations are written with one storage call.
+@param     	state
+                VMTree algorithm state structure
+@param     	left
+                In memory buffer containing left page
+@param     	right
+                In memory buffer containing right page
+@param     	leftId
+                Returns physical page id of left page
+@param     	rightId
+                Returns physical page id of right page
+*/
+void vmtreeWriteSplit(vmtreeState* state, void *left, void *right, id_t *leftId, id_t *rightId)
+{
+	void *bufs[2] = {left, right};
+	id_t pageNums[2];
+
+	writePages(state->buffer, bufs, 2, pageNums);
+	*leftId = pageNums[0];
+	*rightId = pageNums[1];
+}
+
 /**
 @brief     	Puts a given key, data pair into structure.
 			Support for NOR overwriting. Different page structure.
@@ -1198,7 +1990,7 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 	int8_t 	l;
 	void 	*buf, *ptr;	
 	id_t  	parent, nextId = state->activePath[0];	
-	int32_t pageNum, childNum;
+	int32_t childNum;
 
 	for (l=0; l < state->levels-1; l++)
 	{			
@@ -1219,8 +2011,8 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 		state->activePath[l+1] = nextId;
 	}
 
-	/* Read the leaf node */	
-	buf = readPageBuffer(state->buffer, nextId, 0);	/* Note: May want to use readPageBuffer in buffer 0 to prevent any concurrency issues instead of readPage. */
+	/* Read the leaf node. Pinned so it is not replaced while modified. */	
+	buf = vmtreePinPage(state, nextId);
 	if (buf == NULL)
 	{
 		vmtreePrint(state);
@@ -1244,13 +2036,20 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 			memcpy(ptr + state->maxRecordsPerPage*state->keySize + i * state->dataSize, data, state->dataSize);
 			
 			/* Write page */
-			pageNum = overWritePage(state->buffer, buf, nextId);	
+			overWritePage(state->buffer, buf, nextId);	
+			vmtreeUnpinPage(state, buf);
 			return 0;
 		}
 	}	
 
-	/* Current leaf page is full. Perform split. */
+	/* Current leaf page is full. Compact it if enough records were deleted. Otherwise perform split. */
+	buf = vmtreeUnpinToBuffer0(state, buf);
 	count = vmtreeSortBlockNorOverwrite(state, buf);
+	if (count <= state->maxRecordsPerPage*3/4)
+	{
+		vmtreeInsertLeaf(state, buf, count, key, data);
+		return vmtreeUpdateNodeNorOverwrite(state, buf, count+1, state->levels-1);
+	}
 	int8_t mid = count/2;
 	id_t left, right;
 	state->numNodes++;
@@ -1285,9 +2084,6 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 		/* Reset rest of block to 1s */
 		vmtreeResetBlock(state, buf, mid+1);
 
-		left = writePage(state->buffer, buf);	
-		// vmtreePrintNodeBuffer(state, left, 0, buf);
-
 		/* Copy buffered record to start of block */
 		memcpy(buf2 + state->headerSize, state->tempKey, state->keySize);
 		memcpy(buf2 + state->headerSize + state->keySize * state->maxRecordsPerPage, state->tempData, state->dataSize);
@@ -1301,7 +2097,7 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 		/* Reset rest of block to 1s */
 		vmtreeResetBlock(state, buf2, count-mid);
 
-		right = writePage(state->buffer, buf2);
+		vmtreeWriteSplit(state, buf, buf2, &left, &right);
 		// vmtreePrintNodeBuffer(state, right, 0, buf2);
 	}
 	else
@@ -1324,9 +2120,6 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 		/* Reset rest of block to 1s */
 		vmtreeResetBlock(state, buf, mid+1);
 
-		left = writePage(state->buffer, buf);	
-		// vmtreePrintNodeBuffer(state, left, 0, buf);
-		
 		/* New split page starts off with original page in buffer. Copy records around as required. */
 		/* Copy all records to start of buffer */
 		memmove(buf2 + state->headerSize, buf2 + state->headerSize + state->keySize*(mid+1), state->keySize*(count-mid-1));		
@@ -1339,7 +2132,7 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 		/* Reset rest of block to 1s */
 		vmtreeResetBlock(state, buf2, count-mid);
 
-		right = writePage(state->buffer, buf2);
+		vmtreeWriteSplit(state, buf, buf2, &left, &right);
 		// vmtreePrintNodeBuffer(state, right, 0, buf2);
 	}		
 
@@ -1365,7 +2158,7 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 		/* Insert new key/pointer pair in node and update pointer of key just larger than this one */
 		if (vmtreeInsertInterior(state, buf, state->tempKey, left, right))
 		{			
-			pageNum = overWritePage(state->buffer, buf, parent);
+			overWritePage(state->buffer, buf, parent);
 			return 0;		
 		}
 	
@@ -1419,9 +2212,6 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 			/* Reset rest of block to 1s */
 			vmtreeResetBlockInterior(state, buf, mid+2);
 
-			left = writePage(state->buffer, buf);				
-			// vmtreePrintNodeBuffer(state, left, 0, buf);
-
 			vmtreeSetCountBitsInterior(state, buf2, count-mid); // +1?
 					
 			/* Copy buffered pointer to start of block */			
@@ -1437,7 +2227,7 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 			vmtreeResetBlockInterior(state, buf2, count-mid);
 
 			// vmtreeUpdatePointers(state, buf, 0, count-mid-1);
-			right = writePage(state->buffer, buf2);			
+			vmtreeWriteSplit(state, buf, buf2, &left, &right);
 			// vmtreePrintNodeBuffer(state, right, 0, buf2);
 
 			/* Keep temporary key (move from temp data) */
@@ -1465,8 +2255,7 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 			/* Reset rest of block to 1s */
 			vmtreeResetBlockInterior(state, buf, mid+1);
 
-			id_t tmpLeft = writePage(state->buffer, buf);	
-			// vmtreePrintNodeBuffer(state, tmpLeft, 0, buf);
+			id_t tmpLeft;
 
 			ptr = buf2 + state->interiorHeaderSize + state->keySize * state->maxInteriorRecordsPerPage;						
 			if (compareKeyMid2 >= 0)
@@ -1495,7 +2284,7 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 			vmtreeResetBlockInterior(state, buf2, count-mid+1);
 
 			// vmtreeUpdatePointers(state, buf, 0, count-mid);
-			right = writePage(state->buffer, buf2);
+			vmtreeWriteSplit(state, buf, buf2, &tmpLeft, &right);
 			// vmtreePrintNodeBuffer(state, right, 0, buf);
 
 			/* Keep temporary key (move from temp data) */
@@ -1527,6 +2316,23 @@ int8_t vmtreePutNorOverwrite(vmtreeState *state, void* key, void *data)
 	return 0;
 }
 
+/**
+@brief     	Sorts records in log buffer by key unless they are already sorted (e.g. batches of a compaction).
+@param     	state
+                VMTree algorithm state structure
+*/
+void vmtreeLogSort(vmtreeState *state)
+{
+	for (count_t i=1; i < state->numLogRecords; i++)
+	{
+		if (state->compareKey(state->logBuffer + state->recordSize * (i-1), state->logBuffer + state->recordSize * i) > 0)
+		{
+			in_memory_sort(state->logBuffer, (uint32_t) state->numLogRecords, state->recordSize, state->compareKey, 1);
+			return;
+		}
+	}
+}
+
 /**
 @brief     	Puts a batch of buffered log records into tree.
 			More efficient than using vmtreePutRecord() individually for each record.
@@ -1544,12 +2350,12 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 	int8_t 	l, mustSearch = 1, mustWrite = 1;
 	void 	*buf, *ptr, *key, *data, *nextkey;	
 	id_t  	parent, nextId = state->activePath[0];	
-	int32_t pageNum, childNum;
+	int32_t childNum;
 	int16_t count;
 	void*   bufferedParentKey = state->tempKey2;
 
 	/* Sort log records */ 
-	in_memory_sort(state->logBuffer, (uint32_t) state->numLogRecords, state->recordSize, state->compareKey, 1);
+	vmtreeLogSort(state);
 
 	for (uint32_t logidx=0; logidx < state->numLogRecords; logidx++)
 	{			
@@ -1638,7 +2444,7 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 				
 				/* Write page */
 				if (mustWrite)
-					pageNum = overWritePage(state->buffer, buf, nextId);	
+					overWritePage(state->buffer, buf, nextId);	
 				
 				inserted = 1;
 				break;
@@ -1649,8 +2455,15 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 			continue;
 
 		mustSearch = 1;
-		/* Current leaf page is full. Perform split. */
+		/* Current leaf page is full. Compact it if enough records were deleted. Otherwise perform split. */
 		count = vmtreeSortBlockNorOverwrite(state, buf);
+		if (count <= state->maxRecordsPerPage*3/4)
+		{
+			vmtreeInsertLeaf(state, buf, count, key, data);
+			if (vmtreeUpdateNodeNorOverwrite(state, buf, count+1, state->levels-1) != 0)
+				return -1;
+			continue;
+		}
 		int8_t mid = count/2;
 		id_t left, right;
 		state->numNodes++;		
@@ -1690,9 +2503,6 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 			/* Reset rest of block to 1s */
 			vmtreeResetBlock(state, buf, mid+1);
 
-			left = writePage(state->buffer, buf);	
-			// vmtreePrintNodeBuffer(state, left, 0, buf);
-
 			/* Copy buffered record to start of block */
 			memcpy(buf2 + state->headerSize, state->tempKey, state->keySize);
 			memcpy(buf2 + state->headerSize + state->keySize * state->maxRecordsPerPage, state->tempData, state->dataSize);
@@ -1706,7 +2516,7 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 			/* Reset rest of block to 1s */
 			vmtreeResetBlock(state, buf2, count-mid);
 
-			right = writePage(state->buffer, buf2);
+			vmtreeWriteSplit(state, buf, buf2, &left, &right);
 			// vmtreePrintNodeBuffer(state, right, 0, buf2);
 		}
 		else
@@ -1728,9 +2538,6 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 			/* Reset rest of block to 1s */
 			vmtreeResetBlock(state, buf, mid+1);
 
-			left = writePage(state->buffer, buf);	
-			// vmtreePrintNodeBuffer(state, left, 0, buf);
-			
 			/* New split page starts off with original page in buffer. Copy records around as required. */
 			/* Copy all records to start of buffer */
 			memmove(buf2 + state->headerSize, buf2 + state->headerSize + state->keySize*(mid+1), state->keySize*(count-mid-1));		
@@ -1743,7 +2550,7 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 			/* Reset rest of block to 1s */
 			vmtreeResetBlock(state, buf2, count-mid);
 
-			right = writePage(state->buffer, buf2);
+			vmtreeWriteSplit(state, buf, buf2, &left, &right);
 			// vmtreePrintNodeBuffer(state, right, 0, buf2);
 		}		
 
@@ -1769,7 +2576,7 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 			/* Insert new key/pointer pair in node and update pointer of key just larger than this one */
 			if (vmtreeInsertInterior(state, buf, state->tempKey, left, right))
 			{			
-				pageNum = overWritePage(state->buffer, buf, parent);
+				overWritePage(state->buffer, buf, parent);
 				goto donerec;		
 			}
 		
@@ -1823,9 +2630,6 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 				/* Reset rest of block to 1s */
 				vmtreeResetBlockInterior(state, buf, mid+2);
 
-				left = writePage(state->buffer, buf);				
-				// vmtreePrintNodeBuffer(state, left, 0, buf);
-
 				vmtreeSetCountBitsInterior(state, buf2, count-mid); // +1?
 						
 				/* Copy buffered pointer to start of block */			
@@ -1841,7 +2645,7 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 				vmtreeResetBlockInterior(state, buf2, count-mid);
 
 				// vmtreeUpdatePointers(state, buf, 0, count-mid-1);
-				right = writePage(state->buffer, buf2);			
+				vmtreeWriteSplit(state, buf, buf2, &left, &right);
 				// vmtreePrintNodeBuffer(state, right, 0, buf2);
 
 				/* Keep temporary key (move from temp data) */
@@ -1869,8 +2673,7 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 				/* Reset rest of block to 1s */
 				vmtreeResetBlockInterior(state, buf, mid+1);
 
-				id_t tmpLeft = writePage(state->buffer, buf);	
-				// vmtreePrintNodeBuffer(state, tmpLeft, 0, buf);
+				id_t tmpLeft;
 
 				ptr = buf2 + state->interiorHeaderSize + state->keySize * state->maxInteriorRecordsPerPage;						
 				if (compareKeyMid2 >= 0)
@@ -1899,7 +2702,7 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 				vmtreeResetBlockInterior(state, buf2, count-mid+1);
 
 				// vmtreeUpdatePointers(state, buf, 0, count-mid);
-				right = writePage(state->buffer, buf2);
+				vmtreeWriteSplit(state, buf, buf2, &tmpLeft, &right);
 				// vmtreePrintNodeBuffer(state, right, 0, buf);
 
 				/* Keep temporary key (move from temp data) */
@@ -1928,64 +2731,468 @@ int8_t vmtreePutNorOverwriteBatch(vmtreeState *state)
 		state->activePath[0] = writePage(state->buffer, buf);	
 		// vmtreePrintNodeBuffer(state, state->activePath[0], 0, buf);
 
-		int8_t i;
 donerec:
-		// TODO: Figure out goto without useless statement
-		i = 0;		
+		;
 	}
 	return 0;
 }
 
 
 /**
-@brief     	Puts a given key, data pair into structure.
+@brief     	Returns index of first delta entry with physical page id not less than pageNum. Delta entries are sorted by physical page id.
 @param     	state
                 VMTree algorithm state structure
-@param     	key
-                Key for record
-@param     	data
-                Data for record
-@return		Return 0 if success. Non-zero value if error.
+@param		pageNum
+				Physical page id of leaf
 */
-int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
-{	
-	/* Find insert leaf */
-	/* Starting at root search for key */
-	int8_t 	l;
-	void 	*buf, *ptr;	
-	id_t  	prevId, parent, nextId = state->activePath[0];	
-	int32_t pageNum, childNum;
-
-	for (l=0; l < state->levels-1; l++)
-	{	
-		buf = readPage(state->buffer, nextId);			
-		if (buf == NULL)
-		{
-			printf("ERROR reading page: %lu\n", nextId);
-			return -1;
-		}		
+int16_t vmtreeDeltaSearch(vmtreeState *state, id_t pageNum)
+{
+	int16_t lo = 0, hi = state->numDeltaLeaves;
 
-		// Find the key within the node. Sorted by key. Use binary search. 
-		childNum = vmtreeSearchNode(state, buf, key, nextId, 1);
-		if (childNum < 0 || childNum > 10000000)
-			childNum = vmtreeSearchNode(state, buf, key, nextId, 1);
-		nextId = getChildPageId(state, buf, nextId, l, childNum);		
-		if (nextId == -1)
-			return -1;					
-		state->activePath[l+1] = nextId;
+	while (lo < hi)
+	{
+		int16_t mid = lo + (hi - lo) / 2;
+		if (state->deltaIndex[mid].pageNum < pageNum)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	return lo;
+}
+
+/**
+@brief     	Returns index of delta entry of a leaf or -1 if leaf has no delta records.
+			Called for every page read so entries are binary searched.
+@param     	state
+                VMTree algorithm state structure
+@param		pageNum
+				Physical page id of leaf
+*/
+int16_t vmtreeDeltaFind(vmtreeState *state, id_t pageNum)
+{
+	int16_t i = vmtreeDeltaSearch(state, pageNum);
+	if (i < state->numDeltaLeaves && state->deltaIndex[i].pageNum == pageNum)
+		return i;
+	return -1;
+}
+
+/**
+@brief     	Removes delta entry of a leaf. Its delta records are no longer used. Entries after it keep their order.
+@param     	state
+                VMTree algorithm state structure
+@param		i
+				Index of delta entry
+*/
+void vmtreeDeltaRemove(vmtreeState *state, int16_t i)
+{
+	state->numDeltaLeaves--;
+	memmove(&state->deltaIndex[i], &state->deltaIndex[i+1], sizeof(vmtreeDeltaEntry) * (state->numDeltaLeaves - i));
+}
+
+/**
+@brief     	Returns leaf section of delta page containing delta records of a leaf.
+			A delta page on storage is read into second page of delta buffer.
+@param     	state
+                VMTree algorithm state structure
+@param		entry
+				Delta entry of leaf
+@return		Returns pointer to section or NULL if not found or error.
+*/
+void* vmtreeDeltaSection(vmtreeState *state, vmtreeDeltaEntry *entry)
+{
+	dbbuffer *buffer = state->buffer;
+	void *buf = state->deltaBuffer;
+	id_t pageNum;
+	count_t n;
+
+	if (entry->deltaPage != state->deltaNext)
+	{	/* Delta page was written */
+		buf += buffer->pageSize;
+		if (state->deltaReadPage != entry->deltaPage)
+		{
+			state->deltaReadPage = EMPTY_MAPPING;
+			if (buffer->storage->readPage(buffer->storage, buffer->deltaStart + entry->deltaPage % state->deltaPages, buffer->pageSize, buf) != 0)
+				return NULL;
+			buffer->numReads++;
+			state->deltaReadPage = entry->deltaPage;
+		}
+	}
+
+	void *ptr = buf + state->headerSize;
+	for (count_t i=0; i < VMTREE_GET_COUNT(buf); i++)
+	{
+		memcpy(&pageNum, ptr, sizeof(id_t));
+		if (pageNum == entry->pageNum)
+			return ptr;
+		memcpy(&n, ptr + sizeof(id_t), sizeof(count_t));
+		ptr += VMTREE_DELTA_HEADER_SIZE + state->recordSize * n;
+	}
+	return NULL;
+}
+
+/**
+@brief     	Inserts delta records of a leaf section into leaf page in the order they were inserted.
+			Leaf is the same as if each record had been inserted into it.
+@param     	state
+                VMTree algorithm state structure
+@param		buf
+				Buffer containing leaf page
+@param		pageNum
+				Physical page id of leaf
+@param		section
+				Leaf section of delta page
+*/
+void vmtreeDeltaApply(vmtreeState *state, void *buf, id_t pageNum, void *section)
+{
+	count_t n;
+	memcpy(&n, section + sizeof(id_t), sizeof(count_t));
+	void *rec = section + VMTREE_DELTA_HEADER_SIZE;
+
+	for (count_t i=0; i < n; i++, rec += state->recordSize)
+	{
+		int16_t count = VMTREE_GET_COUNT(buf);
+		int32_t childNum = -1;
+		if (count > 0)
+			childNum = vmtreeSearchNode(state, buf, rec, pageNum, 1);
+
+		void *ptr = buf + state->headerSize + state->recordSize * (childNum+1);
+		if (count-childNum-1 > 0)
+			memmove(ptr + state->recordSize, ptr, state->recordSize*(count-childNum-1));
+		memcpy(ptr, rec, state->recordSize);
+		VMTREE_INC_COUNT(buf);
+	}
+}
+
+/**
+@brief     	Informs the VMTree that the buffer read a page from storage. Delta records of a leaf are added to the page.
+			Delta records are discarded if the page was rewritten after they were stored.
+@param     	state
+                VMTree algorithm state structure
+@param		pageNum
+				Physical page number
+@param		buf
+				Buffer containing the page
+*/
+void vmtreeDeltaLoad(void *statePtr, id_t pageNum, void *buf)
+{
+	vmtreeState *state = statePtr;
+
+	if (state->numDeltaLeaves == 0)
+		return;
+	int16_t i = vmtreeDeltaFind(state, pageNum);
+	if (i < 0)
+		return;
+
+	if (VMTREE_GET_ID(buf) != state->deltaIndex[i].pageId || VMTREE_IS_INTERIOR(buf))
+	{
+		vmtreeDeltaRemove(state, i);
+		return;
+	}
+
+	void *section = vmtreeDeltaSection(state, &state->deltaIndex[i]);
+	if (section == NULL)
+	{
+		printf("ERROR: Unable to read delta records of page: %lu\n", pageNum);
+		return;
+	}
+	vmtreeDeltaApply(state, buf, pageNum, section);
+}
+
+/**
+@brief     	Stores a record inserted into a leaf as a delta record instead of writing the leaf.
+			A leaf section in the delta page being built contains all delta records of the leaf so only one delta page is read.
+@param     	state
+                VMTree algorithm state structure
+@param		buf
+				Buffer containing leaf page. Record is already inserted. Leaf page is not written.
+@param		pageNum
+				Physical page id of leaf
+@param		record
+				Record inserted
+@return		Return 0 if record is stored as delta record, -1 if leaf must be written.
+*/
+int8_t vmtreeDeltaAdd(vmtreeState *state, void *buf, id_t pageNum, void *record)
+{
+	vmtreeDeltaEntry *entry;
+	void *page = state->deltaBuffer, *section;
+
+	if (state->deltaPages == 0 || state->levels == 1)
+		return -1;
+
+	int16_t i = vmtreeDeltaFind(state, pageNum);
+	if (i < 0)
+	{
+		if (state->numDeltaLeaves >= state->deltaLeaves)
+		{	/* Remove entries of leaves that were written since they received delta records */
+			for (i=state->numDeltaLeaves-1; i >= 0; i--)
+			{
+				if (dbbufferIsFree(state->buffer, state->deltaIndex[i].pageNum))
+					vmtreeDeltaRemove(state, i);
+			}
+			if (state->numDeltaLeaves >= state->deltaLeaves)
+				return -1;
+		}
+		i = vmtreeDeltaSearch(state, pageNum);
+		memmove(&state->deltaIndex[i+1], &state->deltaIndex[i], sizeof(vmtreeDeltaEntry) * (state->numDeltaLeaves - i));
+		state->numDeltaLeaves++;
+		entry = &state->deltaIndex[i];
+		entry->pageNum = pageNum;
+		entry->pageId = VMTREE_GET_ID(buf);
+		entry->deltaPage = state->deltaNext;
+		entry->count = 0;
+	}
+	entry = &state->deltaIndex[i];
+
+	if (entry->count >= state->maxDeltas)
+	{	/* Leaf is consolidated by writing it with its delta records */
+		vmtreeDeltaRemove(state, i);
+		return -1;
+	}
+
+	if (entry->count > 0 && entry->deltaPage == state->deltaNext)
+	{	/* Append record to leaf section in delta page being built */
+		section = vmtreeDeltaSection(state, entry);
+		if (section == NULL || state->deltaUsed + state->recordSize > state->buffer->pageSize)
+		{
+			vmtreeDeltaRemove(state, i);
+			return -1;
+		}
+		void *end = section + VMTREE_DELTA_HEADER_SIZE + state->recordSize * entry->count;
+		memmove(end + state->recordSize, end, state->deltaUsed - (end - page));
+		memcpy(end, record, state->recordSize);
+		state->deltaUsed += state->recordSize;
+	}
+	else
+	{	/* Start leaf section. Earlier delta records of leaf are copied from its last delta page. */
+		id_t size = VMTREE_DELTA_HEADER_SIZE + state->recordSize * (entry->count+1);
+		void *prev = NULL;
+		if (entry->count > 0)
+			prev = vmtreeDeltaSection(state, entry);
+		if ((entry->count > 0 && prev == NULL) || state->deltaUsed + size > state->buffer->pageSize)
+		{
+			vmtreeDeltaRemove(state, i);
+			return -1;
+		}
+		section = page + state->deltaUsed;
+		memcpy(section, &pageNum, sizeof(id_t));
+		if (entry->count > 0)
+			memcpy(section + VMTREE_DELTA_HEADER_SIZE, prev + VMTREE_DELTA_HEADER_SIZE, state->recordSize * entry->count);
+		memcpy(section + size - state->recordSize, record, state->recordSize);
+		VMTREE_INC_COUNT(page);
+		state->deltaUsed += size;
+		entry->deltaPage = state->deltaNext;
+	}
+
+	entry->count++;
+	memcpy(section + sizeof(id_t), &entry->count, sizeof(count_t));
+	state->numDeltaRecords++;
+
+	/* Leaf may have been updated in buffer 0 while another buffer contains it */
+	count_t frame = dbbufferFindFrame(state->buffer, pageNum);
+	if (frame != 0 && state->buffer->buffer + frame*state->buffer->pageSize != buf)
+		memcpy(state->buffer->buffer + frame*state->buffer->pageSize, buf, state->buffer->pageSize);
+	return 0;
+}
+
+/**
+@brief     	Writes a leaf with its delta records to a new page so its delta records are no longer needed.
+@param     	state
+                VMTree algorithm state structure
+@param		i
+				Index of delta entry of leaf
+@return		Return 0 if success, -1 if error.
+*/
+int8_t vmtreeDeltaMerge(vmtreeState *state, int16_t i)
+{
+	id_t pageNum = state->deltaIndex[i].pageNum;
 
-	/* Read the leaf node */
-	/* Note: Use readPageBuffer in buffer 0 to prevent any concurrency issues instead of readPage. */
-	/* Also results in improved buffer performance. */
-	buf = readPageBuffer(state->buffer, nextId, 0);	
+	if (dbbufferIsFree(state->buffer, pageNum))
+	{	/* Leaf was written after it received delta records */
+		vmtreeDeltaRemove(state, i);
+		return 0;
+	}
+
+	/* Read leaf into buffer 0. Delta records are added by vmtreeDeltaLoad() unless leaf was rewritten. */
+	void *buf = readPageBuffer(state->buffer, pageNum, 0);
 	if (buf == NULL)
+		return -1;
+	i = vmtreeDeltaFind(state, pageNum);
+	if (i < 0)
+		return 0;
+	vmtreeDeltaRemove(state, i);
+
+	/* Find path to leaf using its smallest key so mappings are updated as for an insert */
+	int8_t l;
+	id_t nextId = state->activePath[0];
+	memcpy(state->tempKey, buf + state->headerSize, state->keySize);
+	for (l=0; l < state->levels-1 && nextId != -1; l++)
 	{
-		printf("ERROR reading page: %lu\n", nextId);
+		void *parent = readPage(state->buffer, nextId);
+		if (parent == NULL)
+			return -1;
+		nextId = getChildPageId(state, parent, nextId, l, vmtreeSearchNode(state, parent, state->tempKey, nextId, 1));
+		state->activePath[l+1] = nextId;
+	}
+	state->appendPath = 0;
+
+	dbbufferSetFree(state->buffer, pageNum);
+	id_t prevId = vmtreeUpdatePrev(state, buf, pageNum);
+	id_t currId = writePage(state->buffer, buf);
+	state->numDeltaMerges++;
+
+	if (nextId == pageNum)
+	{
+		state->activePath[state->levels-1] = currId;
+		vmtreeFixMappings(state, prevId, currId, state->levels-2);
+	}
+	else if (vmtreeAddMapping(state, prevId, currId) == -1)
+	{	/* Leaf not on search path (equal keys in several leaves). Mapping is updated as for a moved page. */
+		printf("ERROR: Ran out of mapping space.\n");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+@brief     	Writes delta page being built to delta pages on storage.
+			Before an erase block of delta pages is reused, leaves with delta records in it are written.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success, -1 if error.
+*/
+int8_t vmtreeDeltaWrite(vmtreeState *state)
+{
+	dbbuffer *buffer = state->buffer;
+	id_t slot = state->deltaNext % state->deltaPages;
+
+	if (slot % buffer->eraseSizeInPages == 0)
+	{	/* Merging a leaf may remove other entries so search again after each merge */
+		int16_t i = 0;
+		while (i < state->numDeltaLeaves)
+		{
+			if (state->deltaIndex[i].deltaPage + state->deltaPages < state->deltaNext + buffer->eraseSizeInPages)
+			{
+				if (vmtreeDeltaMerge(state, i) != 0)
+					return -1;
+				i = 0;
+			}
+			else
+				i++;
+		}
+		state->deltaReadPage = EMPTY_MAPPING;
+		if (buffer->storage->erasePages(buffer->storage, buffer->deltaStart + slot, buffer->deltaStart + slot + buffer->eraseSizeInPages - 1) != 0)
+			return -1;
+	}
+
+	VMTREE_SET_ID(state->deltaBuffer, state->deltaNext);
+	if (buffer->storage->writePage(buffer->storage, buffer->deltaStart + slot, buffer->pageSize, state->deltaBuffer) != 0)
+	{
+		printf("ERROR: Unable to write delta page: %lu\n", buffer->deltaStart + slot);
 		return -1;
-	} 
+	}
+	state->numDeltaWrites++;
+	state->deltaNext++;
+	vmtreeDeltaReset(state);
+	return 0;
+}
+
+/**
+@brief     	Writes every leaf that has delta records so delta records are included in leaf pages and delta pages are empty.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeDeltaMergeAll(vmtreeState *state)
+{
+	if (state->deltaPages == 0)
+		return 0;
+
+	while (state->numDeltaLeaves > 0)
+	{
+		if (vmtreeDeltaMerge(state, 0) != 0)
+			return -1;
+	}
+	vmtreeDeltaReset(state);
+	return 0;
+}
+
+/**
+@brief     	Puts a given key, data pair into structure.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key for record
+@param     	data
+                Data for record
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
+{	
+	/* Find insert leaf */
+	/* Starting at root search for key */
+	int8_t 	l;
+	void 	*buf, *ptr;	
+	id_t  	prevId, parent, nextId = state->activePath[0];	
+	int32_t pageNum, childNum;
+	int8_t	rightmost = 0;		/* 1 if inserting into rightmost leaf */
+	int16_t count;
+
+	if (state->appendPath)
+	{	/* Append fast path for increasing keys. Active path is path to rightmost leaf so no search required if key is not smaller than largest key. */
+		nextId = state->activePath[state->levels-1];
+		buf = vmtreePinPage(state, nextId);
+		if (buf == NULL)
+		{
+			printf("ERROR reading page: %lu\n", nextId);
+			return -1;
+		}
+		count = VMTREE_GET_COUNT(buf);
+		if (count > 0 && state->compareKey(key, buf + state->headerSize + state->recordSize * (count-1)) >= 0)
+			rightmost = 1;
+		else
+		{	vmtreeUnpinPage(state, buf);
+			nextId = state->activePath[0];
+		}
+	}
+
+	if (!rightmost)
+	{
+		rightmost = 1;
+		for (l=0; l < state->levels-1; l++)
+		{	
+			buf = readPage(state->buffer, nextId);			
+			if (buf == NULL)
+			{
+				printf("ERROR reading page: %lu\n", nextId);
+				return -1;
+			}		
+
+			// Find the key within the node. Sorted by key. Use binary search. 
+			childNum = vmtreeSearchNode(state, buf, key, nextId, 1);
+			if (childNum < 0 || childNum > 10000000)
+				childNum = vmtreeSearchNode(state, buf, key, nextId, 1);
+			if (childNum != VMTREE_GET_COUNT(buf))
+				rightmost = 0;
+			nextId = getChildPageId(state, buf, nextId, l, childNum);		
+			if (nextId == -1)
+				return -1;					
+			state->activePath[l+1] = nextId;
+		}
+		/* Root leaf is not cached as its splits must clear the root flag */
+		if (state->levels == 1)
+			rightmost = 0;
+		state->appendPath = rightmost;
+
+		/* Read the leaf node. Pinned so it is not replaced while modified. */
+		buf = vmtreePinPage(state, nextId);	
+		if (buf == NULL)
+		{
+			printf("ERROR reading page: %lu\n", nextId);
+			return -1;
+		} 
+	}
 	
-	int16_t count =  VMTREE_GET_COUNT(buf); 
+	count =  VMTREE_GET_COUNT(buf); 
 	state->nodeSplitId = nextId;
 
 	childNum = -1;
@@ -2012,6 +3219,13 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 		/* Write updated page */		
 		if (state->parameters == VMTREE)
 		{
+			/* Small update is stored in delta page instead of writing leaf */
+			if (vmtreeDeltaAdd(state, buf, nextId, ptr) == 0)
+			{
+				vmtreeUnpinPage(state, buf);
+				return 0;
+			}
+
 			// Invalidate page
 			dbbufferSetFree(state->buffer, nextId);
 
@@ -2019,6 +3233,7 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 			if (state->levels == 1)
 			{	/* Wrote to root */
 				state->activePath[0] = writePage(state->buffer, buf);						
+				vmtreeUnpinPage(state, buf);
 			}
 			else
 			{	
@@ -2026,6 +3241,8 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 				prevId = vmtreeUpdatePrev(state, buf, nextId);			
 
 				pageNum = writePage(state->buffer, buf);
+				vmtreeUnpinPage(state, buf);
+				state->activePath[state->levels-1] = pageNum;
 
 				/* Add/update mapping */	
 				l=state->levels-2;	
@@ -2033,93 +3250,112 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 			}
 		}
 		else
-		{	/* Overwrite */
+		{	/* Overwrite. Delayed until buffer is replaced if write-back is enabled. */
 			/* Write updated page */	
-			pageNum = overWritePage(state->buffer, buf, nextId);				
+			pageNum = overWritePageDeferred(state->buffer, buf, nextId);				
+			vmtreeUnpinPage(state, buf);
 		}
 		return 0;
 	}
 	
 	/* Current leaf page is full. Perform split. */
+	buf = vmtreeUnpinToBuffer0(state, buf);
 	int8_t mid = count/2;
 	id_t left, right;
 	state->numNodes++;
 
-	/* After split, reset previous node index to unused. */
+	/* After split, reset previous node index to unused. Left node keeps id parent uses for split node so recovery can release its mapping. */
+	id_t splitPrev = vmtreeUpdatePrev(state, buf, nextId);
 	VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 	
-	// Invalidate page
-	dbbufferSetFree(state->buffer, nextId);
+	if (rightmost && childNum == count-1 && state->compareKey(key, buf + state->headerSize + state->recordSize * childNum) > 0)
+	{	/* Appending to rightmost leaf. Keep full leaf as is and start a new leaf with the record. */
+		left = nextId;
+		memcpy(state->tempKey, key, state->keySize);
+		memcpy(buf + state->headerSize, key, state->keySize);
+		memcpy(buf + state->headerSize + state->keySize, data, state->dataSize);
+		VMTREE_SET_COUNT(buf, 1);
+		right = writePage(state->buffer, buf);
+	}
+	else
+	{
+		// Invalidate page
+		dbbufferSetFree(state->buffer, nextId);
 
-	if (childNum < mid)
-	{	/* Insert key in page with smaller values */
-		/* Update count on page then write */
-		VMTREE_SET_COUNT(buf, mid+1);	
+		if (childNum < mid)
+		{	/* Insert key in page with smaller values */
+			/* Update count on page then write */
+			VMTREE_SET_COUNT(buf, mid+1);	
 		
-		/* Buffer key/data record at mid point so do not lose it */
-		ptr = buf + state->headerSize + state->recordSize * mid;
-		memcpy(state->tempKey, ptr, state->keySize);
-		memcpy(state->tempData, ptr + state->keySize, state->dataSize);
+			/* Buffer key/data record at mid point so do not lose it */
+			ptr = buf + state->headerSize + state->recordSize * mid;
+			memcpy(state->tempKey, ptr, state->keySize);
+			memcpy(state->tempData, ptr + state->keySize, state->dataSize);
 
-		/* Shift records at and after insert point down one record */
-		ptr =  buf + state->headerSize + state->recordSize * (childNum+1);
-		if ((mid-childNum-1) > 0)
-			memmove(ptr + state->recordSize, ptr, state->recordSize*(mid-childNum-1));		
+			/* Shift records at and after insert point down one record */
+			ptr =  buf + state->headerSize + state->recordSize * (childNum+1);
+			if ((mid-childNum-1) > 0)
+				memmove(ptr + state->recordSize, ptr, state->recordSize*(mid-childNum-1));		
 
-		/* Copy record onto page */
-		memcpy(ptr, key, state->keySize);
-		memcpy(ptr + state->keySize, data, state->dataSize);
+			/* Copy record onto page */
+			memcpy(ptr, key, state->keySize);
+			memcpy(ptr + state->keySize, data, state->dataSize);
 
-		left = writePage(state->buffer, buf);	
-		// vmtreePrintNodeBuffer(state, left, 0, buf);
+			VMTREE_SET_PREV(buf, splitPrev);
+			left = writePage(state->buffer, buf);	
+			// vmtreePrintNodeBuffer(state, left, 0, buf);
 
-		/* Copy buffered record to start of block */
-		memcpy(buf + state->headerSize, state->tempKey, state->keySize);
-		memcpy(buf + state->headerSize + state->keySize, state->tempData, state->dataSize);
+			/* Copy buffered record to start of block */
+			memcpy(buf + state->headerSize, state->tempKey, state->keySize);
+			memcpy(buf + state->headerSize + state->keySize, state->tempData, state->dataSize);
 
-		/* Copy records after mid to start of page */	
-		memcpy(buf + state->headerSize + state->recordSize, buf + state->headerSize + state->recordSize * (mid+1), state->recordSize*(count-mid));		
+			/* Copy records after mid to start of page */	
+			memcpy(buf + state->headerSize + state->recordSize, buf + state->headerSize + state->recordSize * (mid+1), state->recordSize*(count-mid));		
 		
-		VMTREE_SET_COUNT(buf, count-mid);
-		right = writePage(state->buffer, buf);
-		// vmtreePrintNodeBuffer(state, right, 0, buf);
-	}
-	else
-	{	/* Insert key in page with larger values */
-		/* Update count on page then write */
-		VMTREE_SET_COUNT(buf, mid+1);
-
-		left = writePage(state->buffer, buf);	
-		// vmtreePrintNodeBuffer(state, left, 0, buf);
-
-		/* Buffer key/data record at mid point so do not lose it */
-		if (childNum == mid)
-		{	/* Middle key to promote is this key. */
-			memcpy(state->tempKey, key, state->keySize);
+			VMTREE_SET_COUNT(buf, count-mid);
+			VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
+			right = writePage(state->buffer, buf);
+			// vmtreePrintNodeBuffer(state, right, 0, buf);
 		}
 		else
-		{
-			ptr =  buf + state->headerSize + state->recordSize * (mid+1);
-			memcpy(state->tempKey, ptr, state->keySize);
-		}
+		{	/* Insert key in page with larger values */
+			/* Update count on page then write */
+			VMTREE_SET_COUNT(buf, mid+1);
+
+			VMTREE_SET_PREV(buf, splitPrev);
+			left = writePage(state->buffer, buf);	
+			// vmtreePrintNodeBuffer(state, left, 0, buf);
+
+			/* Buffer key/data record at mid point so do not lose it */
+			if (childNum == mid)
+			{	/* Middle key to promote is this key. */
+				memcpy(state->tempKey, key, state->keySize);
+			}
+			else
+			{
+				ptr =  buf + state->headerSize + state->recordSize * (mid+1);
+				memcpy(state->tempKey, ptr, state->keySize);
+			}
 		
-		/* New split page starts off with original page in buffer. Copy records around as required. */
-		/* Copy records before insert point into front of block from current location in block */
-		if ((childNum-mid) > 0)
-			memcpy(buf + state->headerSize, ptr, state->recordSize*(childNum-mid));		
+			/* New split page starts off with original page in buffer. Copy records around as required. */
+			/* Copy records before insert point into front of block from current location in block */
+			if ((childNum-mid) > 0)
+				memcpy(buf + state->headerSize, ptr, state->recordSize*(childNum-mid));		
 
-		/* Copy record onto page */
-		ptr = buf + state->headerSize + state->recordSize * (childNum-mid);
-		memcpy(ptr, key, state->keySize);
-		memcpy(ptr + state->keySize, data, state->dataSize);
+			/* Copy record onto page */
+			ptr = buf + state->headerSize + state->recordSize * (childNum-mid);
+			memcpy(ptr, key, state->keySize);
+			memcpy(ptr + state->keySize, data, state->dataSize);
 
-		/* Copy records after insert point after value just inserted */
-		memcpy(buf + state->headerSize + state->recordSize * (childNum-mid+1), buf + state->headerSize + state->recordSize * (childNum+1), state->recordSize*(count-childNum-1));	
+			/* Copy records after insert point after value just inserted */
+			memcpy(buf + state->headerSize + state->recordSize * (childNum-mid+1), buf + state->headerSize + state->recordSize * (childNum+1), state->recordSize*(count-childNum-1));	
 
-		VMTREE_SET_COUNT(buf, count-mid);
-		right = writePage(state->buffer, buf);
-		// vmtreePrintNodeBuffer(state, right, 0, buf);
-	}		
+			VMTREE_SET_COUNT(buf, count-mid);
+			VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
+			right = writePage(state->buffer, buf);
+			// vmtreePrintNodeBuffer(state, right, 0, buf);
+		}		
+	}
 
 	/* Recursively add pointer to parent node. */
 	for (l=state->levels-2; l >=0; l--)
@@ -2179,6 +3415,7 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 				}
 				else
 				{	/* Add a mapping for new page location */								
+					state->activePath[l] = pageNum;
 					l--;
 					vmtreeFixMappings(state, prevId, pageNum, l);											
 				}
@@ -2187,14 +3424,18 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 			{	/* Overwrite */
 				pageNum = overWritePage(state->buffer, buf, parent);
 			}
+			/* New rightmost leaf is right node of split */
+			state->activePath[state->levels-1] = right;
 			return 0;
 		}
 
 		/* No space. Split interior node and promote key/pointer pair */
 		// printf("Splitting interior node.\n");
 		state->numNodes++;
+		state->appendPath = 0;
 
-		/* After split, reset previous node index to unassigned. */
+		/* After split, reset previous node index to unassigned. Left node keeps id parent uses for split node so recovery can release its mapping. */
+		splitPrev = vmtreeUpdatePrev(state, buf, parent);
 		VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 
 		childNum = -1;
@@ -2202,7 +3443,32 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 			childNum = vmtreeSearchNode(state, buf, state->tempKey, parent, 1);
  		mid = count/2;
 
-		if (childNum < mid)
+		if (rightmost && childNum == count)
+		{	/* Appending to rightmost node. Keep all but last key in left node and start new right node with promoted key. */
+			vmtreeUpdatePointers(state, buf, 0, count);
+			ptr = buf + state->headerSize + state->keySize * state->maxInteriorRecordsPerPage;
+
+			/* Last key is promoted. Pointer to split child is replaced by left node of split. */
+			memcpy(state->tempData, buf + state->headerSize + state->keySize * (count-1), state->keySize);
+			memcpy(ptr + sizeof(id_t) * count, &left, sizeof(id_t));
+			VMTREE_SET_COUNT(buf, count-1);
+			VMTREE_SET_INTERIOR(buf);
+			VMTREE_SET_PREV(buf, splitPrev);
+			id_t tmpLeft = writePage(state->buffer, buf);
+
+			/* Right node has inserted key with pointers to both nodes of split */
+			memcpy(buf + state->headerSize, state->tempKey, state->keySize);
+			memcpy(ptr, &left, sizeof(id_t));
+			memcpy(ptr + sizeof(id_t), &right, sizeof(id_t));
+			VMTREE_SET_COUNT(buf, 1);
+			VMTREE_SET_INTERIOR(buf);
+			VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
+			right = writePage(state->buffer, buf);
+
+			left = tmpLeft;
+			memcpy(state->tempKey, state->tempData, state->keySize);
+		}
+		else if (childNum < mid)
 		{	/* Insert key/pointer in page with smaller values */
 			/* Update count on page then write */
 			if (count % 2 == 0)
@@ -2236,6 +3502,7 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 			memcpy(ptr, &left, sizeof(id_t));
 			memcpy(ptr + sizeof(id_t), &right, sizeof(id_t));
 
+			VMTREE_SET_PREV(buf, splitPrev);
 			left = writePage(state->buffer, buf);				
 					
 			/* Copy buffered pointer to start of block */			
@@ -2249,6 +3516,7 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 			VMTREE_SET_COUNT(buf, count-mid-1);
 			VMTREE_SET_INTERIOR(buf);
 			// vmtreeUpdatePointers(state, buf, 0, count-mid-1);
+			VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 			right = writePage(state->buffer, buf);			
 
 			/* Keep temporary key (move from temp data) */
@@ -2276,6 +3544,7 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 			id_t tempPtr;
 			memcpy(&tempPtr, buf + state->headerSize + state->keySize * state->maxInteriorRecordsPerPage + sizeof(id_t) * (mid+1), sizeof(id_t));
 			
+			VMTREE_SET_PREV(buf, splitPrev);
 			id_t tmpLeft = writePage(state->buffer, buf);	
 			// vmtreePrintNodeBuffer(state, tmpLeft, 0, buf);
 						
@@ -2308,6 +3577,7 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 			VMTREE_SET_INTERIOR(buf);
 			// vmtreeUpdatePointers(state, buf, 0, count-mid);
 
+			VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 			right = writePage(state->buffer, buf);
 			// vmtreePrintNodeBuffer(state, right, 0, buf);
 
@@ -2338,20 +3608,16 @@ int8_t vmtreePutRecord(vmtreeState *state, void* key, void *data)
 }
 
 /**
-@brief     	Puts a batch of buffered log records into tree.
+@brief     	Puts a batch of buffered log records into leaves of tree.
 			More efficient than using vmtreePutRecord() individually for each record.
 			This version support either:
 			 1) page-level overwrite (assuming file system or hardware support) similar to a regular B+-tree
 			 2) virtual mappings allowing for sequential writes to memory
 @param     	state
                 VMTree algorithm state structure
-@param     	key
-                Key for record
-@param     	data
-                Data for record
 @return		Return 0 if success. Non-zero value if error.
 */
-int8_t vmtreePutBatch(vmtreeState *state)
+int8_t vmtreePutBatchLeaves(vmtreeState *state)
 {	
 	int8_t 	l, mustSearch = 1, mustWrite = 1;
 	void 	*buf, *ptr, *key, *data, *nextkey;	
@@ -2360,8 +3626,10 @@ int8_t vmtreePutBatch(vmtreeState *state)
 	int16_t count;
 	void*   bufferedParentKey = state->tempKey2;
 
+	state->appendPath = 0;
+
 	/* Sort log records */ 
-	in_memory_sort(state->logBuffer, (uint32_t) state->numLogRecords, state->recordSize, state->compareKey, 1);
+	vmtreeLogSort(state);
 
 	for (uint32_t logidx=0; logidx < state->numLogRecords; logidx++)
 	{			
@@ -2414,16 +3682,18 @@ int8_t vmtreePutBatch(vmtreeState *state)
 				state->activePath[l+1] = nextId;
 			}
 			
-			/* Read the leaf node */						
-			/* Note: Use readPageBuffer in buffer 0 to prevent any concurrency issues instead of readPage. */
-			/* Also results in improved buffer performance. */
-			buf = readPageBuffer(state->buffer, nextId, 0);				
+			/* Read the leaf node. Pinned so it is not replaced while records are added. */
+			buf = vmtreePinPage(state, nextId);				
 			if (buf == NULL)
 			{
 				printf("ERROR reading page: %lu\n", nextId);
 				return -1;
 			} 			
 			mustSearch = 0;
+
+			/* Read ahead next leaves that sorted records will be inserted into */
+			if (state->levels > 1)
+				vmtreePrefetchLog(state, state->activePath[state->levels-2], state->levels-2, childNum, logidx+1);
 		}
 		
 		if (logidx == state->numLogRecords-1)
@@ -2473,6 +3743,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 					if (state->levels == 1)
 					{	/* Wrote to root */				
 							state->activePath[0] = writePage(state->buffer, buf);			
+							vmtreeUnpinPage(state, buf);
 					}
 					else
 					{	
@@ -2480,6 +3751,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 						prevId = vmtreeUpdatePrev(state, buf, nextId);			
 
 						pageNum = writePage(state->buffer, buf);
+						vmtreeUnpinPage(state, buf);
 
 						/* Add/update mapping */	
 						l=state->levels-2;	
@@ -2487,20 +3759,23 @@ int8_t vmtreePutBatch(vmtreeState *state)
 					}
 				}
 				else
-				{	/* Overwrite */
+				{	/* Overwrite. Delayed until buffer is replaced if write-back is enabled. */
 					/* Write updated page */	
-					pageNum = overWritePage(state->buffer, buf, nextId);				
+					pageNum = overWritePageDeferred(state->buffer, buf, nextId);				
+					vmtreeUnpinPage(state, buf);
 				}				
 			}
 			continue;
 		}	
 		mustSearch = 1;
+		buf = vmtreeUnpinToBuffer0(state, buf);
 		/* Current leaf page is full. Perform split. */
 		int8_t mid = count/2;
 		id_t left, right;
 		state->numNodes++;
 
-		/* After split, reset previous node index to unused. */
+		/* After split, reset previous node index to unused. Left node keeps id parent uses for split node so recovery can release its mapping. */
+		id_t splitPrev = vmtreeUpdatePrev(state, buf, nextId);
 		VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 		
 		// Invalidate page
@@ -2525,6 +3800,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 			memcpy(ptr, key, state->keySize);
 			memcpy(ptr + state->keySize, data, state->dataSize);
 
+			VMTREE_SET_PREV(buf, splitPrev);
 			left = writePage(state->buffer, buf);	
 			// vmtreePrintNodeBuffer(state, left, 0, buf);
 
@@ -2536,6 +3812,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 			memmove(buf + state->headerSize + state->recordSize, buf + state->headerSize + state->recordSize * (mid+1), state->recordSize*(count-mid));		
 			
 			VMTREE_SET_COUNT(buf, count-mid);
+			VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 			right = writePage(state->buffer, buf);
 			// vmtreePrintNodeBuffer(state, right, 0, buf);
 		}
@@ -2544,6 +3821,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 			/* Update count on page then write */
 			VMTREE_SET_COUNT(buf, mid+1);
 
+			VMTREE_SET_PREV(buf, splitPrev);
 			left = writePage(state->buffer, buf);	
 			// vmtreePrintNodeBuffer(state, left, 0, buf);
 
@@ -2572,6 +3850,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 			memmove(buf + state->headerSize + state->recordSize * (childNum-mid+1), buf + state->headerSize + state->recordSize * (childNum+1), state->recordSize*(count-childNum-1));	
 
 			VMTREE_SET_COUNT(buf, count-mid);
+			VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 			right = writePage(state->buffer, buf);
 			// vmtreePrintNodeBuffer(state, right, 0, buf);
 		}		
@@ -2649,7 +3928,8 @@ int8_t vmtreePutBatch(vmtreeState *state)
 			// printf("Splitting interior node.\n");
 			state->numNodes++;
 
-			/* After split, reset previous node index to unassigned. */
+			/* After split, reset previous node index to unassigned. Left node keeps id parent uses for split node so recovery can release its mapping. */
+			splitPrev = vmtreeUpdatePrev(state, buf, parent);
 			VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 
 			childNum = -1;
@@ -2691,6 +3971,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 				memcpy(ptr, &left, sizeof(id_t));
 				memcpy(ptr + sizeof(id_t), &right, sizeof(id_t));
 
+				VMTREE_SET_PREV(buf, splitPrev);
 				left = writePage(state->buffer, buf);				
 						
 				/* Copy buffered pointer to start of block */			
@@ -2704,6 +3985,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 				VMTREE_SET_COUNT(buf, count-mid-1);
 				VMTREE_SET_INTERIOR(buf);
 				// vmtreeUpdatePointers(state, buf, 0, count-mid-1);
+				VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 				right = writePage(state->buffer, buf);			
 
 				/* Keep temporary key (move from temp data) */
@@ -2731,6 +4013,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 				id_t tempPtr;
 				memcpy(&tempPtr, buf + state->headerSize + state->keySize * state->maxInteriorRecordsPerPage + sizeof(id_t) * (mid+1), sizeof(id_t));
 				
+				VMTREE_SET_PREV(buf, splitPrev);
 				id_t tmpLeft = writePage(state->buffer, buf);	
 				// vmtreePrintNodeBuffer(state, tmpLeft, 0, buf);
 							
@@ -2763,6 +4046,7 @@ int8_t vmtreePutBatch(vmtreeState *state)
 				VMTREE_SET_INTERIOR(buf);
 				// vmtreeUpdatePointers(state, buf, 0, count-mid);
 
+				VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
 				right = writePage(state->buffer, buf);
 				// vmtreePrintNodeBuffer(state, right, 0, buf);
 
@@ -2790,341 +4074,3625 @@ int8_t vmtreePutBatch(vmtreeState *state)
 		state->levels++;
 		
 		// vmtreePrintNodeBuffer(state, state->activePath[0], 0, buf);
-		int8_t i;
-donerec:		
-		i = 0;		
+donerec:
+		;
 	}
 	return 0;
 }
 
 /**
-@brief     	Puts a given key, data pair into structure.
-			Determines algorithm to use based on overwrite flag and if using a log buffer.
+@brief     	Binary searches a sorted run of log buffer records. Log buffer is sorted in runs of walRecordsPerPage records
+			(one per log page). Records are sorted within the run currently filling as they are inserted.
 @param     	state
                 VMTree algorithm state structure
 @param     	key
-                Key for record
-@param     	data
-                Data for record
-@return		Return 0 if success. Non-zero value if error.
+                Key to search for
+@param		start
+				Index of first record in run
+@param		end
+				Index after last record in run
+@param		upper
+				0 to find first record with key >= search key, 1 to find first record with key > search key
+@return		Index of record found. end if no record satisfies search.
 */
-int8_t vmtreePut(vmtreeState *state, void* key, void *data)
-{	
-	if (state->logBuffer != NULL)
-	{			
-		void *ptr;
-		/* Buffer insert in log buffer until full */
-		if (state->numLogRecords >= state->maxLogRecords)
-		{			
-			/* Check for capacity. */	
-			if (!dbbufferEnsureSpace(state->buffer, state->maxLogRecords*2))  // NOTE: This is affected by number of log records if ensuring capacity before processing batch. Effects NOR_OVERWRITE.	
-			{
-				printf("Storage is at capacity. Must delete keys.\n");
-				return -1;
-			}		
-
-			/* Log buffer is full. Sort it then empty it. */			
-			if (state->parameters == OVERWRITE)
-			{				
-				 vmtreePutNorOverwriteBatch(state);
-			}
-			else
-			{				
-				vmtreePutBatch(state);
-			}
-			state->numLogRecords = 0;
-		}
-
-		/* Buffer new record in log */
-		ptr = state->logBuffer+(state->keySize+state->dataSize)*state->numLogRecords;
-		memcpy(ptr, key, state->keySize);
-		memcpy(ptr+state->keySize, data, state->dataSize);
-		state->numLogRecords++;
-		return 0;		
-	}
-
-	/* Check for capacity. */	
-	if (!dbbufferEnsureSpace(state->buffer, 8))
+count_t vmtreeLogSearchRun(vmtreeState *state, void *key, count_t start, count_t end, int8_t upper)
+{
+	while (start < end)
 	{
-		printf("Storage is at capacity. Must delete keys.\n");
-		return -1;
-	}	
+		count_t mid = start + (end - start) / 2;
+		int8_t cmp = state->compareKey(state->logBuffer + state->recordSize * mid, key);
+		if (cmp < 0 || (upper && cmp == 0))
+			start = mid + 1;
+		else
+			end = mid;
+	}
+	return start;
+}
 
-	if (state->parameters == OVERWRITE)
-		return vmtreePutNorOverwrite(state, key, data);
+/**
+@brief     	Returns pointer to buffered message area at end of interior node. Area starts with message count.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing interior node
+*/
+void* vmtreeMsgArea(vmtreeState *state, void *buf)
+{
+	return buf + state->buffer->pageSize - sizeof(count_t) - state->recordSize * state->msgRecords;
+}
 
-	return vmtreePutRecord(state, key, data);
+/**
+@brief     	Returns number of messages buffered in interior node. An unset (erased) count is no messages.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing interior node
+*/
+count_t vmtreeMsgCount(vmtreeState *state, void *buf)
+{
+	count_t count;
+	memcpy(&count, vmtreeMsgArea(state, buf), sizeof(count_t));
+	return count > state->msgRecords ? 0 : count;
 }
 
+/**
+@brief     	Inserts sorted records directly into leaves using vmtreePutBatchLeaves().
+@param     	state
+                VMTree algorithm state structure
+@param     	records
+                Sorted records
+@param		n
+				Number of records
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeMsgInsertLeaves(vmtreeState *state, void *records, count_t n)
+{
+	void	*log = state->logBuffer;
+	count_t num = state->numLogRecords;
+
+	state->logBuffer = records;
+	state->numLogRecords = n;
+	int8_t result = vmtreePutBatchLeaves(state);
+	state->logBuffer = log;
+	state->numLogRecords = num;
+	return result;
+}
 
 /**
-@brief     	Given a key, searches the node for the key.
-			Different search algorithm for overwrite nodes that have different structure and non-sorted keys.
-			If interior node, returns child record number containing next page id to follow.
-			If leaf node, returns if of first record with that key or (<= key).
-			Returns -1 if key is not found.			
+@brief     	Finds the parent of leaves whose subtree contains key.
 @param     	state
                 VMTree algorithm state structure
-@param     	buffer
-                Pointer to in-memory buffer holding node
 @param     	key
-                Key for record
-@param		pageId
-				Page if for page being searched
-@param		range
-				1 if range query so return pointer to first record <= key, 0 if exact query so much return first exact match record
+                Key to search for. NULL for leftmost node.
+@param		upper
+				Returns smallest key larger than all keys in subtree if hasUpper is set
+@param		hasUpper
+				Returns 0 if subtree is rightmost so has no upper bound
+@param		pageNum
+				Returns page id of node
+@return		Returns buffer containing node or NULL if error.
 */
-int32_t vmtreeSearchNodeOverwrite(vmtreeState *state, void *buffer, void* key, id_t pageId, int8_t range)
+void* vmtreeMsgFindNode(vmtreeState *state, void *key, void *upper, int8_t *hasUpper, id_t *pageNum)
 {
-	int8_t compare, interior = VMTREE_IS_INTERIOR(buffer) && state->levels != 1;
+	void 	*buf;
+	id_t 	childNum, nextId = state->activePath[0];
 
-	if (interior)
+	*hasUpper = 0;
+	for (int8_t l=0; ; l++)
 	{
-		unsigned char* bm1 = buffer + state->interiorHeaderSize - state->interiorBitmapSize*2;
-		unsigned char* bm2 = buffer + state->interiorHeaderSize - state->interiorBitmapSize;
-		// bitarrPrint(bm1, state->maxRecordsPerPage);
-		// bitarrPrint(bm2, state->maxRecordsPerPage);
-		int16_t loc = 0;
-		void* minkey = NULL;
-		for (int16_t c=0; c < state->interiorBitmapSize*8 && c < state->maxInteriorRecordsPerPage; c++)
-		{	/* Must be non-free location (0) and still valid (1) */
-			if (bitarrGet(bm1, c) == 0 && bitarrGet(bm2, c) == 1)
-			{	/* Found valid record. */					
-				void* mkey = (void*) (buffer+state->keySize * c + state->interiorHeaderSize);	
-
-				if (state->compareKey(key,mkey) < 0)
-				{	/* Search key is less than this key*/
-					if (minkey == NULL || state->compareKey(mkey, minkey) < 0)
-					{	/* New key is smaller than previous min */
-						minkey = mkey;
-						loc = c;
-					}
+		buf = readPage(state->buffer, nextId);
+		if (buf == NULL)
+			return NULL;
+		if (l == state->levels-2)
+			break;
 
-				}								
-			}
-		}		
-		return loc;
+		childNum = key == NULL ? 0 : vmtreeSearchNode(state, buf, key, nextId, 1);
+		if (childNum < VMTREE_GET_COUNT(buf))
+		{	/* Keep smallest separator seen so far as right most child may have separator larger than parent separator */
+			void *sep = buf + state->headerSize + state->keySize * childNum;
+			if (!*hasUpper || state->compareKey(sep, upper) < 0)
+				memcpy(upper, sep, state->keySize);
+			*hasUpper = 1;
+		}
+		nextId = getChildPageId(state, buf, nextId, l, childNum);
+		if (nextId == -1)
+			return NULL;
 	}
-	else
+	*pageNum = nextId;
+	return buf;
+}
+
+/**
+@brief     	Adds sorted records to messages buffered in interior node and writes node.
+			Messages are kept sorted by key. A message is placed after older messages with the same key.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing interior node
+@param		pageNum
+				Page id of node
+@param     	records
+                Sorted records
+@param		n
+				Number of records. Must fit in node.
+*/
+void vmtreeMsgAdd(vmtreeState *state, void *buf, id_t pageNum, void *records, count_t n)
+{
+	uint8_t rs = state->recordSize;
+	void	*msg = vmtreeMsgArea(state, buf) + sizeof(count_t);
+	count_t count = vmtreeMsgCount(state, buf) + n;
+	int32_t a = count - n - 1, b = n - 1;
+
+	/* Merge from end of area so messages are moved at most once */
+	for (int32_t k = count-1; b >= 0; k--)
 	{
-		unsigned char* bm1 = buffer + state->headerSize - state->bitmapSize*2;
-		unsigned char* bm2 = buffer + state->headerSize - state->bitmapSize;
-		// bitarrPrint(bm1, state->maxRecordsPerPage);
-		// bitarrPrint(bm2, state->maxRecordsPerPage);
-		for (int16_t c=0; c < state->bitmapSize*8 && c < state->maxRecordsPerPage; c++)
-		{	/* Must be non-free location (0) and still valid (1) */
-			if (bitarrGet(bm1, c) == 0 && bitarrGet(bm2, c) == 1)
-			{	/* Found valid record. */					
-				void* mkey = (void*) (buffer+state->keySize * c + state->headerSize);
+		if (a >= 0 && state->compareKey(msg + rs * a, records + rs * b) > 0)
+			memcpy(msg + rs * k, msg + rs * a--, rs);
+		else
+			memcpy(msg + rs * k, records + rs * b--, rs);
+	}
+	memcpy(msg - sizeof(count_t), &count, sizeof(count_t));
+	overWritePageDeferred(state->buffer, buf, pageNum);
+	state->numMsgWrites++;
+}
 
-				compare = state->compareKey(key,mkey);
-				if (compare == 0)
-					return c;				
+/**
+@brief     	Inserts messages buffered in interior node into its leaves.
+			Only messages of the child with the most messages are flushed if the node has space for keys of all leaf splits they may cause.
+			Otherwise, all messages are flushed. Node is written without the flushed messages first so node splits do not copy them.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing interior node
+@param		pageNum
+				Page id of node
+@param		all
+				1 to flush all messages
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeMsgFlushNode(vmtreeState *state, void *buf, id_t pageNum, int8_t all)
+{
+	uint8_t rs = state->recordSize;
+	void	*msg = vmtreeMsgArea(state, buf) + sizeof(count_t);
+	count_t count = vmtreeMsgCount(state, buf), keys = VMTREE_GET_COUNT(buf);
+	count_t c = 0, start = 0, first = 0, num = count;
+
+	if (!all)
+	{	/* Find child with most messages. Messages and separators are both sorted. */
+		num = 0;
+		for (count_t m=0; m <= count; m++)
+		{
+			if (m < count && (c == keys || state->compareKey(msg + rs * m, buf + state->headerSize + state->keySize * c) < 0))
+				continue;
+			if (m - start > num)
+			{
+				first = start;
+				num = m - start;
 			}
-		}		
+			while (m < count && c < keys && state->compareKey(msg + rs * m, buf + state->headerSize + state->keySize * c) >= 0)
+				c++;
+			start = m;
+		}
+
+		/* Each leaf split adds a key to node. A leaf splits at most once for every half leaf of records. */
+		count_t half = (state->maxRecordsPerPage-1)/2;
+		if (half == 0)
+			half = 1;
+		if (keys + 1 + num / half >= state->maxInteriorRecordsPerPage)
+		{
+			first = 0;
+			num = count;
+		}
 	}
-	return 0;
+
+	memcpy(state->msgBuffer, msg + rs * first, rs * num);
+	memmove(msg + rs * first, msg + rs * (first + num), rs * (count - first - num));
+	count -= num;
+	memcpy(msg - sizeof(count_t), &count, sizeof(count_t));
+	overWritePageDeferred(state->buffer, buf, pageNum);
+	state->numMsgFlushes++;
+	return vmtreeMsgInsertLeaves(state, state->msgBuffer, num);
 }
 
 /**
-@brief     	Given a key, searches the node for the key.
-			If interior node, returns child record number containing next page id to follow.
-			If leaf node, returns if of first record with that key or (<= key).
-			Returns -1 if key is not found.			
+@brief     	Searches messages buffered in interior node for key. The most recent message with the key is returned.
 @param     	state
                 VMTree algorithm state structure
-@param     	buffer
-                Pointer to in-memory buffer holding node
+@param     	buf
+                Buffer containing parent of leaves
 @param     	key
                 Key for record
-@param		pageId
-				Page if for page being searched
-@param		range
-				1 if range query so return pointer to first record <= key, 0 if exact query so much return first exact match record
+@param     	data
+                Pre-allocated memory to copy data for record
+@return		Return 0 if found, -1 otherwise.
 */
-int32_t vmtreeSearchNode(vmtreeState *state, void *buffer, void* key, id_t pageId, int8_t range)
+int8_t vmtreeMsgFind(vmtreeState *state, void *buf, void *key, void *data)
 {
-	if (state->parameters == OVERWRITE)
-		return vmtreeSearchNodeOverwrite(state, buffer, key, pageId, range);
+	void	*msg = vmtreeMsgArea(state, buf) + sizeof(count_t);
+	count_t lo = 0, hi = vmtreeMsgCount(state, buf);
 
-	int16_t first, last, middle, count;
-	int8_t compare, interior;
-	void *mkey;
-	
-	count = VMTREE_GET_COUNT(buffer);  
-	interior = VMTREE_IS_INTERIOR(buffer) && state->levels != 1;
-	
-	if (interior)
+	/* Find first message with larger key. Message before it is most recent with key if key matches. */
+	while (lo < hi)
+	{
+		count_t mid = lo + (hi - lo) / 2;
+		if (state->compareKey(msg + state->recordSize * mid, key) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || state->compareKey(msg + state->recordSize * (lo-1), key) != 0)
+		return -1;
+	memcpy(data, msg + state->recordSize * (lo-1) + state->keySize, state->dataSize);
+	return 0;
+}
+
+/**
+@brief     	Removes messages with keys smaller than key from interior node. Node is not written.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing parent of leaves
+@param     	key
+                Smallest key to keep
+@return		Number of messages remaining.
+*/
+count_t vmtreeMsgDrop(vmtreeState *state, void *buf, void *key)
+{
+	void	*msg = vmtreeMsgArea(state, buf) + sizeof(count_t);
+	count_t i = 0, count = vmtreeMsgCount(state, buf);
+
+	while (i < count && state->compareKey(msg + state->recordSize * i, key) < 0)
+		i++;
+	count -= i;
+	memmove(msg, msg + state->recordSize * i, state->recordSize * count);
+	memcpy(msg - sizeof(count_t), &count, sizeof(count_t));
+	return count;
+}
+
+/**
+@brief     	Inserts messages buffered in interior nodes whose subtrees overlap a key range into leaves. Nodes are flushed in key order.
+@param     	state
+                VMTree algorithm state structure
+@param     	minKey
+                Smallest key in range. NULL starts at leftmost node.
+@param     	maxKey
+                Largest key in range. NULL ends at rightmost node.
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeMsgFlush(vmtreeState *state, void *minKey, void *maxKey)
+{
+	void	*buf, *key = minKey;
+	int8_t	hasUpper;
+	id_t	pageNum;
+	count_t count;
+
+	while (state->msgRecords > 0 && state->levels > 1)
+	{
+		buf = vmtreeMsgFindNode(state, key, state->tempKey2, &hasUpper, &pageNum);
+		if (buf == NULL)
+			return -1;
+
+		count = vmtreeMsgCount(state, buf);
+		if (count > 0)
+		{	/* Node may split while flushing. Continue from node with largest key flushed. */
+			if (vmtreeMsgFlushNode(state, buf, pageNum, 1) != 0)
+				return -1;
+			key = state->msgBuffer + state->recordSize * (count-1);
+			continue;
+		}
+		/* Subtree has keys smaller than upper. Next subtree starts at upper. */
+		if (!hasUpper || (maxKey != NULL && state->compareKey(state->tempKey2, maxKey) > 0))
+			break;
+		memcpy(state->msgBuffer, state->tempKey2, state->keySize);
+		key = state->msgBuffer;
+	}
+	return 0;
+}
+
+/**
+@brief     	Puts a batch of buffered log records into tree.
+			More efficient than using vmtreePutRecord() individually for each record.
+			With buffered interior nodes, records are added as messages to the parents of the leaves they belong in.
+			When a node does not have space for its records, its messages are inserted into leaves first.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreePutBatch(vmtreeState *state)
+{
+	void	*buf, *records = state->logBuffer;
+	int8_t	hasUpper;
+	id_t	pageNum;
+	count_t i = 0, j, n = state->numLogRecords;
+
+	if (state->msgRecords == 0)
+		return vmtreePutBatchLeaves(state);
+
+	state->appendPath = 0;
+	vmtreeLogSort(state);
+	while (i < n)
+	{
+		if (state->levels == 1)		/* Root is a leaf */
+			return vmtreeMsgInsertLeaves(state, records + state->recordSize * i, n - i);
+
+		buf = vmtreeMsgFindNode(state, records + state->recordSize * i, state->tempKey2, &hasUpper, &pageNum);
+		if (buf == NULL)
+			return -1;
+		j = hasUpper ? vmtreeLogSearchRun(state, state->tempKey2, i, n, 0) : n;
+
+		if (vmtreeMsgCount(state, buf) + j - i <= state->msgRecords)
+			vmtreeMsgAdd(state, buf, pageNum, records + state->recordSize * i, j - i);
+		else if (vmtreeMsgCount(state, buf) > 0)
+		{	/* Flush older messages and search again as node may have split. Records that do not fit in empty node require all to be flushed. */
+			if (vmtreeMsgFlushNode(state, buf, pageNum, j - i > state->msgRecords) != 0)
+				return -1;
+			continue;
+		}
+		else if (vmtreeMsgInsertLeaves(state, records + state->recordSize * i, j - i) != 0)
+			return -1;
+		i = j;
+	}
+	return 0;
+}
+
+/**
+@brief     	Finds the most recently inserted record with the given key in the log buffer.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key to search for
+@return		Index of record in log buffer or -1 if not found.
+*/
+int32_t vmtreeLogFind(vmtreeState *state, void *key)
+{
+	if (state->logBuffer == NULL || state->numLogRecords == 0)
+		return -1;
+
+	/* Later runs have newer records. Equal keys in a run are in insert order. */
+	count_t run = (state->numLogRecords - 1) / state->walRecordsPerPage;
+	while (1)
+	{
+		count_t start = run * state->walRecordsPerPage;
+		count_t end = start + state->walRecordsPerPage;
+		if (end > state->numLogRecords)
+			end = state->numLogRecords;
+
+		count_t pos = vmtreeLogSearchRun(state, key, start, end, 1);
+		if (pos > start && state->compareKey(state->logBuffer + state->recordSize * (pos-1), key) == 0)
+			return pos-1;
+		if (run == 0)
+			return -1;
+		run--;
+	}
+}
+
+/**
+@brief     	Finds next log buffer record for iterator. Log records are ordered by key then log buffer index.
+			Each sorted run is binary searched for its first record after the last log record returned.
+@param     	state
+                vmTree algorithm state structure
+@param     	it
+                vmTree iterator state structure
+@return		Index of next record in log buffer or -1 if no more records.
+*/
+int32_t vmtreeLogNext(vmtreeState *state, vmtreeIterator *it)
+{
+	int32_t best = -1;
+	count_t runSize = state->walRecordsPerPage;
+	void *last = it->logIndex == -1 ? NULL : state->logBuffer + state->recordSize * it->logIndex;
+
+	for (count_t start=0; start < state->numLogRecords; start += runSize)
+	{
+		count_t end = start + runSize, pos;
+		if (end > state->numLogRecords)
+			end = state->numLogRecords;
+
+		if (last == NULL)
+			pos = it->minKey == NULL ? start : vmtreeLogSearchRun(state, it->minKey, start, end, 0);
+		else if (it->logIndex >= end)
+			pos = vmtreeLogSearchRun(state, last, start, end, 1);		/* Earlier run: equal keys already returned */
+		else if (it->logIndex >= start)
+			pos = it->logIndex + 1;
+		else
+			pos = vmtreeLogSearchRun(state, last, start, end, 0);		/* Later run: equal keys not returned yet */
+
+		if (pos < end && (best == -1 || state->compareKey(state->logBuffer + state->recordSize * pos, state->logBuffer + state->recordSize * best) < 0))
+			best = pos;
+	}
+
+	if (best != -1 && it->maxKey != NULL && state->compareKey(state->logBuffer + state->recordSize * best, it->maxKey) > 0)
+		return -1;	/* Passed maximum range */
+	return best;
+}
+
+/**
+@brief     	Applies retention and checks there is space to insert a full log buffer of records into the tree.
+			If retention is enabled, oldest data is dropped until there is space.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success, -1 if storage is at capacity.
+*/
+int8_t vmtreeLogEnsureSpace(vmtreeState *state)
+{
+	vmtreeApplyRetention(state);
+
+	/* Check for capacity. If retention enabled, drop oldest data until have space. */	
+	while (!dbbufferEnsureSpace(state->buffer, state->maxLogRecords*2))  // NOTE: This is affected by number of log records if ensuring capacity before processing batch. Effects NOR_OVERWRITE.	
+	{
+		if (state->retentionMode == RETAIN_NONE || vmtreeDropOldest(state, NULL) != 0)
+		{
+			printf("Storage is at capacity. Must delete keys.\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+@brief     	Writes log buffer records as a new sorted run. Sorted runs of log buffer are merged so equal keys stay in insert order.
+			Run erase blocks are erased when first written.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success, -1 if sorted runs are not used, there is no space for run, or error.
+*/
+int8_t vmtreeRunWrite(vmtreeState *state)
+{
+	dbbuffer *buffer = state->buffer;
+	vmtreeIterator it;
+	id_t pages = (state->numLogRecords + state->runRecordsPerPage - 1) / state->runRecordsPerPage;
+
+	if (state->runPages == 0 || state->numRuns >= state->maxRuns || state->runNext + pages > state->runPages)
+		return -1;
+
+	it.minKey = NULL;
+	it.maxKey = NULL;
+	it.logIndex = -1;
+	int32_t logIdx = vmtreeLogNext(state, &it);
+
+	for (id_t p=0; p < pages; p++)
+	{
+		id_t pageNum = buffer->runStart + state->runNext + p;
+		if ((state->runNext + p) % buffer->eraseSizeInPages == 0
+			&& buffer->storage->erasePages(buffer->storage, pageNum, pageNum + buffer->eraseSizeInPages - 1) != 0)
+			return -1;
+
+		void *buf = initBufferPage(buffer, 0);
+		count_t count;
+		for (count=0; count < state->runRecordsPerPage && logIdx != -1; count++)
+		{
+			memcpy(buf + VMTREE_RUN_HEADER_SIZE + state->recordSize * count, state->logBuffer + state->recordSize * logIdx, state->recordSize);
+			it.logIndex = logIdx;
+			logIdx = vmtreeLogNext(state, &it);
+		}
+		VMTREE_SET_ID(buf, state->runNext + p);
+		VMTREE_SET_PREV(buf, state->numRuns);
+		VMTREE_SET_COUNT(buf, count);
+		memcpy(state->runFence + state->keySize * (state->runNext + p), buf + VMTREE_RUN_HEADER_SIZE, state->keySize);
+
+		/* Buffer may contain page of a run that was compacted */
+		count_t frame = dbbufferFindFrame(buffer, pageNum);
+		if (frame != 0)
+			dbbufferSetFrame(buffer, frame, 0);
+
+		if (buffer->storage->writePage(buffer->storage, pageNum, buffer->pageSize, buf) != 0)
+		{
+			printf("ERROR: Unable to write run page: %lu\n", pageNum);
+			return -1;
+		}
+		state->numRunWrites++;
+	}
+
+	state->runStart[state->numRuns] = state->runNext;
+	state->runLength[state->numRuns] = pages;
+	state->numRuns++;
+	state->runNext += pages;
+	return 0;
+}
+
+/**
+@brief     	Merges all sorted runs into the tree. Run pages are read in order of their first key and inserted in large batches.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeRunCompact(vmtreeState *state)
+{
+	dbbuffer *buffer = state->buffer;
+	id_t next[VMTREE_MAX_RUNS];
+	int8_t r, best;
+
+	/* Log buffer is used to collect records for each batch. Its records become the newest run. */
+	vmtreeLogApply(state);
+	if (state->numRuns == 0)
+		return 0;
+
+	for (r=0; r < state->numRuns; r++)
+		next[r] = state->runStart[r];
+
+	while (1)
+	{
+		/* Page with smallest first key is read next */
+		best = -1;
+		for (r=0; r < state->numRuns; r++)
+		{
+			if (next[r] < state->runStart[r] + state->runLength[r]
+				&& (best == -1 || state->compareKey(state->runFence + state->keySize * next[r], state->runFence + state->keySize * next[best]) < 0))
+				best = r;
+		}
+
+		if (best != -1 && state->numLogRecords + state->runRecordsPerPage <= state->maxLogRecords)
+		{
+			void *buf = readPage(buffer, buffer->runStart + next[best]);
+			if (buf == NULL)
+				return -1;
+			count_t count = VMTREE_GET_COUNT(buf);
+			memcpy(state->logBuffer + state->recordSize * state->numLogRecords, buf + VMTREE_RUN_HEADER_SIZE, state->recordSize * count);
+			state->numLogRecords += count;
+			dbbufferRecycleFirst(buffer, buffer->runStart + next[best]);
+			next[best]++;
+			continue;
+		}
+		if (state->numLogRecords == 0)
+			break;
+
+		/* Insert records smaller than first key of pages not read yet. Batches cover a small key range so each leaf is updated about once. */
+		vmtreeLogSort(state);
+		count_t total = state->numLogRecords, num = total;
+		if (best != -1)
+			num = vmtreeLogSearchRun(state, state->runFence + state->keySize * next[best], 0, total, 0);
+		if (num == 0)
+			num = total;
+
+		if (vmtreeLogEnsureSpace(state) != 0)
+			return -1;
+		state->numLogRecords = num;
+		if (state->parameters == OVERWRITE)
+			vmtreePutNorOverwriteBatch(state);
+		else
+			vmtreePutBatch(state);
+		memmove(state->logBuffer, state->logBuffer + state->recordSize * num, state->recordSize * (total - num));
+		state->numLogRecords = total - num;
+	}
+
+	state->numRuns = 0;
+	state->runNext = 0;
+	state->numCompactions++;
+	return 0;
+}
+
+/**
+@brief     	Finds the most recently inserted record with the given key in the sorted runs. Newest run is searched first.
+			At most one page is read per run.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key to search for
+@param     	data
+                Pre-allocated memory to copy data for record
+@return		Return 0 if found, -1 if not found or error.
+*/
+int8_t vmtreeRunFind(vmtreeState *state, void *key, void *data)
+{
+	for (int8_t r=state->numRuns-1; r >= 0; r--)
+	{
+		/* Newest record with key is in last page with first key <= key */
+		id_t lo = state->runStart[r], hi = lo + state->runLength[r];
+		while (lo < hi)
+		{
+			id_t mid = lo + (hi - lo) / 2;
+			if (state->compareKey(state->runFence + state->keySize * mid, key) <= 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo == state->runStart[r])
+			continue;
+
+		void *buf = readPageMapped(state->buffer, state->buffer->runStart + lo - 1);
+		if (buf == NULL)
+			return -1;
+		count_t first = 0, last = VMTREE_GET_COUNT(buf);
+		while (first < last)
+		{
+			count_t mid = first + (last - first) / 2;
+			if (state->compareKey(buf + VMTREE_RUN_HEADER_SIZE + state->recordSize * mid, key) <= 0)
+				first = mid + 1;
+			else
+				last = mid;
+		}
+		void *ptr = buf + VMTREE_RUN_HEADER_SIZE + state->recordSize * (first-1);
+		if (first > 0 && state->compareKey(ptr, key) == 0)
+		{
+			memcpy(data, ptr + state->keySize, state->dataSize);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+@brief     	Inserts records in log buffer into tree and empties log buffer.
+			If sorted runs are used, records are written as a run instead and runs are compacted into tree when there is no space for another run.
+@param     	state
+                VMTree algorithm state structure
+*/
+void vmtreeLogApply(vmtreeState *state)
+{
+	if (state->logBuffer == NULL || state->numLogRecords == 0)
+		return;
+
+	if (vmtreeRunWrite(state) != 0)
+	{
+		if (state->parameters == OVERWRITE)
+		{				
+			vmtreePutNorOverwriteBatch(state);
+		}
+		else
+		{				
+			vmtreePutBatch(state);
+		}
+	}
+	state->numLogRecords = 0;
+
+	/* Log records of next batch start at first log buffer page */
+	state->walCommitted = 0;
+	state->walBatch++;
+
+	if (state->numRuns > 0 && (state->numRuns >= state->maxRuns
+		|| state->runNext + (state->maxLogRecords + state->runRecordsPerPage - 1) / state->runRecordsPerPage > state->runPages))
+		vmtreeRunCompact(state);
+}
+
+/**
+@brief     	Writes a log buffer page to the next write-ahead log page. A log page that is rewritten with more records replaces earlier copies.
+			Log erase blocks are erased when first written.
+@param     	state
+                VMTree algorithm state structure
+@param		logPage
+				log buffer page (of walRecordsPerPage records)
+@return		Return 0 if success, -1 if log is full or error.
+*/
+int8_t vmtreeWalWrite(vmtreeState *state, count_t logPage)
+{
+	dbbuffer *buffer = state->buffer;
+	count_t start = logPage * state->walRecordsPerPage;
+	count_t num = state->numLogRecords - start;
+
+	/* Pages from erase block of first log page since checkpoint must be kept */
+	if (state->walNext - (state->walFirst - state->walFirst % buffer->eraseSizeInPages) >= buffer->walPages)
+		return -1;
+
+	id_t pageNum = buffer->walStart + state->walNext % buffer->walPages;
+	if (state->walNext % buffer->eraseSizeInPages == 0
+		&& buffer->storage->erasePages(buffer->storage, pageNum, pageNum + buffer->eraseSizeInPages - 1) != 0)
+		return -1;
+
+	if (num > state->walRecordsPerPage)
+		num = state->walRecordsPerPage;
+	void *buf = initBufferPage(buffer, 0);
+	VMTREE_SET_ID(buf, state->walBatch);
+	VMTREE_SET_PREV(buf, state->checkpointSequence);
+	VMTREE_SET_COUNT(buf, VMTREE_WAL_PAGE + num);
+	memcpy(buf + VMTREE_COUNT_OFFSET + sizeof(count_t), &logPage, sizeof(count_t));
+	memcpy(buf + VMTREE_WAL_HEADER_SIZE, state->logBuffer + state->recordSize * start, state->recordSize * num);
+
+	if (buffer->storage->writePage(buffer->storage, pageNum, buffer->pageSize, buf) != 0)
+	{
+		printf("ERROR: Unable to write log page: %lu\n", pageNum);
+		return -1;
+	}
+	state->walNext++;
+	state->numWalWrites++;
+	state->walCommitted = start + num;
+	if (state->walTime != NULL)
+		state->walLastCommit = state->walTime();
+	return 0;
+}
+
+/**
+@brief     	Writes record just added to log buffer to the write-ahead log as required by commit policy.
+			If the log is full, the log buffer is applied to the tree and a checkpoint restarts the log.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeWalAppend(vmtreeState *state)
+{
+	count_t logPage = (state->numLogRecords-1) / state->walRecordsPerPage;
+
+	if (state->numLogRecords % state->walRecordsPerPage != 0 && state->numLogRecords < state->maxLogRecords)
+	{	/* Log page is not full. Write only if policy commits now. */
+		if (state->walCommit == WAL_COMMIT_PAGE)
+			return 0;
+		if (state->walCommit == WAL_COMMIT_TIME && (state->walTime == NULL || state->walTime() - state->walLastCommit < state->walCommitInterval))
+			return 0;
+	}
+
+	/* Log pages before this one were written when they filled */
+	if (vmtreeWalWrite(state, logPage) != 0)
+		return vmtreeFlush(state);
+	return 0;
+}
+
+/**
+@brief     	Writes records in log buffer not yet in the write-ahead log. Used to commit inserts when the commit policy has not,
+			e.g. from a timer or before sleeping.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success, -1 if no write-ahead log or error.
+*/
+int8_t vmtreeWalCommit(vmtreeState *state)
+{
+	if (state->walPages == 0)
+		return -1;
+	if (state->walCommitted >= state->numLogRecords)
+		return 0;
+	if (vmtreeWalWrite(state, state->walCommitted / state->walRecordsPerPage) != 0)
+		return vmtreeFlush(state);
+	return 0;
+}
+
+/**
+@brief     	Puts a given key, data pair into structure.
+			Determines algorithm to use based on overwrite flag and if using a log buffer.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key for record
+@param     	data
+                Data for record
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreePut(vmtreeState *state, void* key, void *data)
+{	
+	if (state->logBuffer != NULL)
+	{			
+		void *ptr;
+		/* Buffer insert in log buffer until full */
+		if (state->numLogRecords >= state->maxLogRecords)
+		{			
+			if (vmtreeCheckpointEnsureSpace(state, (state->maxLogRecords + state->runPages * state->runRecordsPerPage) * 2) != 0
+				|| vmtreeLogEnsureSpace(state) != 0)
+				return -1;
+
+			/* Log buffer is full. Sort it then empty it. */			
+			vmtreeLogApply(state);
+		}
+
+		/* Buffer new record in log. Insert sorted in current run so lookups can binary search. Earlier runs are not changed. */
+		count_t start = state->numLogRecords - state->numLogRecords % state->walRecordsPerPage;
+		count_t pos = vmtreeLogSearchRun(state, key, start, state->numLogRecords, 1);
+		ptr = state->logBuffer+state->recordSize*pos;
+		memmove(ptr+state->recordSize, ptr, state->recordSize*(state->numLogRecords-pos));
+		memcpy(ptr, key, state->keySize);
+		memcpy(ptr+state->keySize, data, state->dataSize);
+		state->numLogRecords++;
+		state->numRecords++;
+		vmtreeBloomAdd(state, key);
+		if (state->walPages > 0)
+			return vmtreeWalAppend(state);
+		return 0;		
+	}
+
+	vmtreeApplyRetention(state);
+	if (vmtreeCheckpointEnsureSpace(state, 8) != 0)
+		return -1;
+
+	/* Check for capacity. If retention enabled, drop oldest data until have space. */	
+	while (!dbbufferEnsureSpace(state->buffer, 8))
+	{
+		if (state->retentionMode == RETAIN_NONE || vmtreeDropOldest(state, NULL) != 0)
+		{
+			printf("Storage is at capacity. Must delete keys.\n");
+			return -1;
+		}
+	}	
+	state->numRecords++;
+	vmtreeBloomAdd(state, key);
+
+	if (state->parameters == OVERWRITE)
+		return vmtreePutNorOverwrite(state, key, data);
+
+	/* Delta page being built must have space for a leaf section of maximum size */
+	if (state->deltaPages > 0 && state->deltaUsed + VMTREE_DELTA_HEADER_SIZE + state->recordSize * state->maxDeltas > state->buffer->pageSize
+		&& vmtreeDeltaWrite(state) != 0)
+		return -1;
+
+	return vmtreePutRecord(state, key, data);
+}
+
+
+/**
+@brief     	Given a key, searches the node for the key.
+			Different search algorithm for overwrite nodes that have different structure and non-sorted keys.
+			If interior node, returns child record number containing next page id to follow.
+			If leaf node, returns if of first record with that key or (<= key).
+			Returns -1 if key is not found.			
+@param     	state
+                VMTree algorithm state structure
+@param     	buffer
+                Pointer to in-memory buffer holding node
+@param     	key
+                Key for record
+*/
+int32_t vmtreeSearchNodeOverwrite(vmtreeState *state, void *buffer, void* key)
+{
+	int8_t compare, interior = VMTREE_IS_INTERIOR(buffer) && state->levels != 1;
+
+	if (interior)
+	{
+		unsigned char* bm1 = buffer + state->interiorHeaderSize - state->interiorBitmapSize*2;
+		unsigned char* bm2 = buffer + state->interiorHeaderSize - state->interiorBitmapSize;
+		// bitarrPrint(bm1, state->maxRecordsPerPage);
+		// bitarrPrint(bm2, state->maxRecordsPerPage);
+		int16_t loc = 0;
+		void* minkey = NULL;
+		for (int16_t c=0; c < state->interiorBitmapSize*8 && c < state->maxInteriorRecordsPerPage; c++)
+		{	/* Must be non-free location (0) and still valid (1) */
+			if (bitarrGet(bm1, c) == 0 && bitarrGet(bm2, c) == 1)
+			{	/* Found valid record. */					
+				void* mkey = (void*) (buffer+state->keySize * c + state->interiorHeaderSize);	
+
+				if (state->compareKey(key,mkey) < 0)
+				{	/* Search key is less than this key*/
+					if (minkey == NULL || state->compareKey(mkey, minkey) < 0)
+					{	/* New key is smaller than previous min */
+						minkey = mkey;
+						loc = c;
+					}
+
+				}								
+			}
+		}		
+		return loc;
+	}
+	else
+	{
+		unsigned char* bm1 = buffer + state->headerSize - state->bitmapSize*2;
+		unsigned char* bm2 = buffer + state->headerSize - state->bitmapSize;
+		// bitarrPrint(bm1, state->maxRecordsPerPage);
+		// bitarrPrint(bm2, state->maxRecordsPerPage);
+		for (int16_t c=0; c < state->bitmapSize*8 && c < state->maxRecordsPerPage; c++)
+		{	/* Must be non-free location (0) and still valid (1) */
+			if (bitarrGet(bm1, c) == 0 && bitarrGet(bm2, c) == 1)
+			{	/* Found valid record. */					
+				void* mkey = (void*) (buffer+state->keySize * c + state->headerSize);
+
+				compare = state->compareKey(key,mkey);
+				if (compare == 0)
+					return c;				
+			}
+		}		
+	}
+	return -1;
+}
+
+/**
+@brief     	Given a key, searches the node for the key.
+			If interior node, returns child record number containing next page id to follow.
+			If leaf node, returns if of first record with that key or (<= key).
+			Returns -1 if key is not found.			
+@param     	state
+                VMTree algorithm state structure
+@param     	buffer
+                Pointer to in-memory buffer holding node
+@param     	key
+                Key for record
+@param		pageId
+				Page if for page being searched
+@param		range
+				1 if range query so return pointer to first record <= key, 0 if exact query so much return first exact match record
+*/
+int32_t vmtreeSearchNode(vmtreeState *state, void *buffer, void* key, id_t pageId, int8_t range)
+{
+	(void) pageId;		/* Not used by search */
+
+	if (state->parameters == OVERWRITE)
+		return vmtreeSearchNodeOverwrite(state, buffer, key);
+
+	int16_t first, last, middle, count;
+	int8_t compare, interior;
+	void *mkey;
+	
+	count = VMTREE_GET_COUNT(buffer);  
+	interior = VMTREE_IS_INTERIOR(buffer) && state->levels != 1;
+	
+	if (interior)
 	{
 		if (count == 0)	/* Only one child pointer */
 			return 0;
-		if (count == 1)	/* One key and two children pointers */
+		if (count == 1)	/* One key and two children pointers */
+		{
+			mkey = buffer+state->headerSize;   /* Key at index 0 */
+			compare = state->compareKey(key, mkey);
+			if (compare < 0)
+				return 0;
+			return 1;		
+		}
+		
+		first = 0;	
+  		last =  count;
+		if (last > state->maxInteriorRecordsPerPage)
+			last = state->maxInteriorRecordsPerPage;
+  		middle = (first+last)/2;
+		while (first < last) 
+		{			
+			mkey = buffer+state->headerSize+state->keySize*middle;
+			compare = state->compareKey(key,mkey);
+			if (compare > 0)
+				first = middle + 1;
+			else if (compare == 0) 
+			{	last = middle+1; /* Return the child pointer just after */
+				break;
+			}				
+			else
+				last = middle;  /* Note: Not -1 as always want last pointer to be <= key so that will use it if necessary */
+
+			middle = (first + last)/2;
+		}
+		return last;		
+	}
+	else
+	{
+		first = 0;	
+  		last =  count - 1;
+  		middle = (first+last)/2;	
+
+		while (first <= last) 
+		{			
+			mkey = buffer+state->headerSize+state->recordSize*middle;		
+			compare = state->compareKey(mkey, key);
+			
+			if (compare < 0)
+				first = middle + 1;
+			else if (compare == 0) 
+				return middle;							
+			else
+				last = middle - 1;
+
+			middle = (first + last)/2;
+		}
+		if (range)			
+		{	// return middle;
+			if (last == -1)
+				return -1;
+			return middle;
+		}
+		return -1;
+	}
+}
+
+/**
+@brief     	Given a child link, returns the proper physical page id.
+			This method handles the mapping of the active path where the pointer in the
+			node is not actually pointing to the most up to date block.			
+@param     	state
+                VMTree algorithm state structure
+@param		buf
+				Buffer containing node
+@param     	pageId
+                Page id for node
+@param     	level
+                Level of node in tree
+@param		childNum
+				Child pointer index
+@return		Return pageId if success or -1 if not valid.
+*/
+id_t getChildPageId(vmtreeState *state, void *buf, id_t pageId, int8_t level, id_t childNum)
+{		
+	(void) pageId;		/* Not used by mapping lookup */
+	(void) level;
+
+	/* Retrieve page number for child */
+	id_t nextId;
+	memcpy(&nextId, (id_t*) (buf + state->interiorHeaderSize + state->keySize*state->maxInteriorRecordsPerPage + sizeof(id_t)*childNum), sizeof(id_t));
+	if (state->parameters != OVERWRITE)
+	{
+		// if (nextId == 0 && childNum==(VMTREE_GET_COUNT(buf)))	/* Last child which is empty */
+		if (childNum > (VMTREE_GET_COUNT(buf)))	/* Last child which is empty */
+			return -1;
+	}
+
+	/* Perform mapping */	
+	nextId = vmtreeGetMapping(state, nextId);
+	return nextId;
+}
+
+/**
+@brief     	Given a key, returns data associated with key in tree pages. Records in log buffer are not searched.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key for record
+@param     	data
+                Pre-allocated memory to copy data for record
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeGetTree(vmtreeState *state, void* key, void *data)
+{
+	/* Starting at root search for key */
+	int8_t l;
+	void *buf;
+	id_t childNum, nextId = state->activePath[0];	
+
+	for (l=0; l < state->levels-1; l++)
+	{	
+		buf = readPageMapped(state->buffer, nextId);						
+		if (buf == NULL)
+			return -1;
+		/* Messages buffered in parent of leaves are more recent than leaf records */
+		if (l == state->levels-2 && state->msgRecords > 0 && vmtreeMsgFind(state, buf, key, data) == 0)
+			return 0;
+		/* Find the key within the node. Sorted by key. Use binary search. */
+		childNum = vmtreeSearchNode(state, buf, key, nextId, 0);
+		nextId = getChildPageId(state, buf, nextId, l, childNum);			
+		if (nextId == -1)
+			return -1;		
+	}
+
+	/* Search the leaf node and return search result */		
+	buf = readPageMapped(state->buffer, nextId);	
+	if (buf == NULL)
+		return -1;
+
+	
+	nextId = vmtreeSearchNode(state, buf, key, nextId, 0);
+
+	if (nextId != -1)
+	{	/* Key found */
+		if (state->parameters != OVERWRITE)
+			memcpy(data, (void*) (buf+state->headerSize+state->recordSize*nextId+state->keySize), state->dataSize);
+		else
+			memcpy(data, (void*) (buf+state->headerSize+state->dataSize*nextId+state->keySize*state->maxRecordsPerPage), state->dataSize);
+		return 0;
+	}
+	return -1;
+}
+
+/**
+@brief     	Given a key, returns data associated with key.
+			Note: Space for data must be already allocated.
+			Data is copied from database into data buffer.
+			Records in log buffer and then sorted runs not yet inserted into tree are searched first as they are the most recent.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key for record
+@param     	data
+                Pre-allocated memory to copy data for record
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeGet(vmtreeState *state, void* key, void *data)
+{
+	/* Bloom filter avoids reading any pages for most keys not in tree */
+	if (!vmtreeBloomMayContain(state, key))
+		return -1;
+
+	int32_t logIdx = vmtreeLogFind(state, key);
+	if (logIdx != -1)
+	{
+		memcpy(data, state->logBuffer + state->recordSize * logIdx + state->keySize, state->dataSize);
+		return 0;
+	}
+	if (state->numRuns > 0 && vmtreeRunFind(state, key, data) == 0)
+		return 0;
+	return vmtreeGetTree(state, key, data);
+}
+
+/**
+@brief     	Given multiple keys, returns data for each key found.
+			Keys are processed in sorted order. Each leaf touched is read once with a single root-to-leaf traversal,
+			and all keys that fall in the leaf are answered while it is in the buffer.
+@param     	state
+                VMTree algorithm state structure
+@param     	keys
+                Array of n keys to search for
+@param		n
+				Number of keys
+@param     	data
+                Pre-allocated space for n data values. Data for keys[i] is copied to position i.
+@param		found
+				Pre-allocated array of n values. found[i] is set to 1 if keys[i] is found, 0 otherwise.
+@return		Return number of keys found. -1 if error.
+*/
+int32_t vmtreeGetBatch(vmtreeState *state, void *keys, count_t n, void *data, int8_t *found)
+{
+	int8_t 	l, hasUpper;
+	void 	*buf, *key;
+	id_t 	childNum, nextId;
+	count_t i, minIdx, numPending = n;
+	int32_t numFound = 0;
+	void	*upper = state->tempKey;		/* Keys smaller than upper are in current leaf */
+	uint8_t	ks = state->keySize;
+
+	/* Mark all keys as not yet searched. Keys rejected by Bloom filter are not in tree. Keys in log buffer or sorted runs are answered from them. */
+	for (i=0; i < n; i++)
+	{
+		found[i] = -1;
+		if (!vmtreeBloomMayContain(state, keys + ks * i))
+		{
+			found[i] = 0;
+			numPending--;
+			continue;
+		}
+		int32_t logIdx = vmtreeLogFind(state, keys + ks * i);
+		if (logIdx != -1)
+			memcpy(data + state->dataSize * i, state->logBuffer + state->recordSize * logIdx + ks, state->dataSize);
+		else if (state->numRuns == 0 || vmtreeRunFind(state, keys + ks * i, data + state->dataSize * i) != 0)
+			continue;
+		found[i] = 1;
+		numFound++;
+		numPending--;
+	}
+
+	while (numPending > 0)
+	{
+		/* Find smallest key not yet searched. Keys are not copied or sorted to avoid using extra memory. */
+		minIdx = n;
+		for (i=0; i < n; i++)
+		{
+			if (found[i] == -1 && (minIdx == n || state->compareKey(keys + ks * i, keys + ks * minIdx) < 0))
+				minIdx = i;
+		}
+		key = keys + ks * minIdx;
+
+		/* Starting at root search for key. Track upper bound of child subtree. */
+		hasUpper = 0;
+		nextId = state->activePath[0];
+		for (l=0; l < state->levels-1; l++)
+		{	
+			buf = readPageMapped(state->buffer, nextId);						
+			if (buf == NULL)
+				return -1;
+			childNum = vmtreeSearchNode(state, buf, key, nextId, 0);
+			if (state->parameters != OVERWRITE)
+			{	/* Child has keys smaller than separator after its pointer. Last child is bounded by parent. */
+				if (childNum < VMTREE_GET_COUNT(buf))
+				{
+					memcpy(upper, buf + state->headerSize + ks * childNum, ks);
+					hasUpper = 1;
+				}
+			}
+			else
+			{	/* Entry key is upper bound of child */
+				void *mkey = buf + state->interiorHeaderSize + ks * childNum;
+				memcpy(upper, state->compareKey(key, mkey) < 0 ? mkey : key, ks);
+				hasUpper = 1;
+			}
+			nextId = getChildPageId(state, buf, nextId, l, childNum);			
+			if (nextId == -1)
+				return -1;		
+		}
+
+		/* Answer keys in leaf range from messages buffered in parent of leaf */
+		for (i=0; i < n && state->msgRecords > 0 && state->levels > 1; i++)
+		{
+			key = keys + ks * i;
+			if (found[i] != -1 || (i != minIdx && hasUpper && state->compareKey(key, upper) >= 0))
+				continue;
+			if (vmtreeMsgFind(state, buf, key, data + state->dataSize * i) == 0)
+			{
+				found[i] = 1;
+				numFound++;
+				numPending--;
+			}
+		}
+
+		/* Read leaf into buffer 0 so interior nodes on path stay buffered for next traversal. Zero copy reads leaf in place. */
+		buf = state->buffer->zeroCopy ? readPageMapped(state->buffer, nextId) : readPageBuffer(state->buffer, nextId, 0);	
+		if (buf == NULL)
+			return -1;
+
+		/* Search leaf for all keys in its range */
+		for (i=0; i < n; i++)
+		{
+			if (found[i] != -1)
+				continue;
+			key = keys + ks * i;
+			if (i != minIdx && hasUpper && state->compareKey(key, upper) >= 0)
+				continue;
+
+			childNum = vmtreeSearchNode(state, buf, key, nextId, 0);
+			found[i] = 0;
+			if (childNum != -1)
+			{	/* Key found */
+				if (state->parameters != OVERWRITE)
+					memcpy(data + state->dataSize * i, (void*) (buf+state->headerSize+state->recordSize*childNum+ks), state->dataSize);
+				else
+					memcpy(data + state->dataSize * i, (void*) (buf+state->headerSize+state->dataSize*childNum+ks*state->maxRecordsPerPage), state->dataSize);
+				found[i] = 1;
+				numFound++;
+			}
+			numPending--;
+		}
+	}
+	return numFound;
+}
+
+/**
+@brief     	Adds all keys in a subtree to the Bloom filter.
+@param     	state
+                VMTree algorithm state structure
+@param     	pageNum
+                Physical page id of subtree root
+@param		l
+				Level of subtree root (0 is root)
+@return		Return 0 if success, -1 if error.
+*/
+int8_t vmtreeBloomAddSubtree(vmtreeState *state, id_t pageNum, int8_t l)
+{
+	void 	*buf;
+	int16_t c, num;
+
+	/* Read leaves into buffer 0 so interior nodes stay buffered */
+	if (l == state->levels-1)
+		buf = readPageBuffer(state->buffer, pageNum, 0);
+	else
+		buf = readPage(state->buffer, pageNum);
+
+	if (buf == NULL)
+		return -1;
+
+	if (l == state->levels-1)
+	{	/* Leaf node */
+		if (state->parameters != OVERWRITE)
+		{
+			num = VMTREE_GET_COUNT(buf);
+			for (c=0; c < num; c++)
+				vmtreeBloomAdd(state, buf + state->headerSize + state->recordSize * c);
+		}
+		else
+		{	/* Must be non-free location (0) and still valid (1) */
+			unsigned char* bm1 = buf + state->headerSize - state->bitmapSize*2;
+			unsigned char* bm2 = buf + state->headerSize - state->bitmapSize;
+			for (c=0; c < state->maxRecordsPerPage; c++)
+			{
+				if (bitarrGet(bm1, c) == 0 && bitarrGet(bm2, c) == 1)
+					vmtreeBloomAdd(state, buf + state->headerSize + state->keySize * c);
+			}
+		}
+		return 0;
+	}
+
+	/* Messages buffered in parent of leaves */
+	if (l == state->levels-2 && state->msgRecords > 0)
+	{
+		num = vmtreeMsgCount(state, buf);
+		for (c=0; c < num; c++)
+			vmtreeBloomAdd(state, vmtreeMsgArea(state, buf) + sizeof(count_t) + state->recordSize * c);
+	}
+
+	num = state->parameters == OVERWRITE ? state->maxInteriorRecordsPerPage : VMTREE_GET_COUNT(buf) + 1;
+	for (c=0; c < num; c++)
+	{
+		if (state->parameters == OVERWRITE)
+		{
+			unsigned char* bm1 = buf + state->interiorHeaderSize - state->interiorBitmapSize*2;
+			unsigned char* bm2 = buf + state->interiorHeaderSize - state->interiorBitmapSize;
+			if (bitarrGet(bm1, c) == 1 || bitarrGet(bm2, c) == 0)
+				continue;
+		}
+		if (vmtreeBloomAddSubtree(state, getChildPageId(state, buf, pageNum, l, c), l+1) != 0)
+			return -1;
+
+		/* Reading children may have replaced node in buffer */
+		buf = readPage(state->buffer, pageNum);
+		if (buf == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+@brief     	Rebuilds the Bloom filter from the keys in the tree.
+			Use after recovery or to remove deleted keys from the filter.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success, -1 if error.
+*/
+int8_t vmtreeBloomRebuild(vmtreeState *state)
+{
+	if (state->bloomFilter == NULL)
+		return -1;
+
+	memset(state->bloomFilter, 0, state->bloomFilterSize);
+	if (vmtreeBloomAddSubtree(state, state->activePath[0], 0) != 0)
+		return -1;
+
+	/* Records waiting in log buffer */
+	if (state->logBuffer != NULL)
+	{
+		for (count_t i=0; i < state->numLogRecords; i++)
+			vmtreeBloomAdd(state, state->logBuffer + state->recordSize * i);
+	}
+
+	/* Records in sorted runs */
+	for (uint8_t r=0; r < state->numRuns; r++)
+	{
+		for (id_t p=state->runStart[r]; p < state->runStart[r] + state->runLength[r]; p++)
+		{
+			void *buf = readPage(state->buffer, state->buffer->runStart + p);
+			if (buf == NULL)
+				return -1;
+			for (count_t i=0; i < VMTREE_GET_COUNT(buf); i++)
+				vmtreeBloomAdd(state, buf + VMTREE_RUN_HEADER_SIZE + state->recordSize * i);
+		}
+	}
+	return 0;
+}
+
+/**
+@brief     	Reads a page into a given buffer page so that it can be modified.
+			Buffer status is cleared so readPage() does not return the modified copy.
+@param     	state
+                VMTree algorithm state structure
+@param     	pageNum
+                Physical page id (number)
+@param		bufferNum
+				Buffer page to read into
+@return		Returns pointer to buffer page or NULL if error.
+*/
+void* vmtreeReadPageForUpdate(vmtreeState *state, id_t pageNum, count_t bufferNum)
+{
+	dbbufferSetFrame(state->buffer, bufferNum, 0);
+	return readPageBuffer(state->buffer, pageNum, bufferNum);
+}
+
+
+/**
+@brief     	Writes a node changed by a delete whose parent is also being rewritten.
+			Parent pointer is updated directly so no mapping is added for the node.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing node
+@param     	pageNum
+                Current physical page id of node
+@return		Returns physical page id node was written to.
+*/
+id_t vmtreeDeleteWriteChild(vmtreeState *state, void *buf, id_t pageNum)
+{
+	if (state->parameters != VMTREE)
+		return overWritePage(state->buffer, buf, pageNum);
+
+	dbbufferSetFree(state->buffer, pageNum);
+	VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
+	return writePage(state->buffer, buf);
+}
+
+/**
+@brief     	Deletes a key from the tree for VMTREE and BTREE page layouts.
+			Underfull nodes are merged with or borrow records from a sibling.
+			Pages no longer used are marked as free.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key for record
+@return		Return 0 if success. Non-zero value if error or key not found.
+*/
+int8_t vmtreeDeleteRecord(vmtreeState *state, void* key)
+{
+	int8_t 	l;
+	void 	*buf, *parent, *sib, *ptr;
+	id_t  	prevId, pageNum, nextId = state->activePath[0];
+	int32_t childNum;
+	count_t	childIdx[MAX_LEVEL];
+	count_t sibFrame = state->buffer->numPages > 2 ? 2 : 1;
+	uint8_t ks = state->keySize;
+
+	for (l=0; l < state->levels-1; l++)
+	{
+		buf = readPage(state->buffer, nextId);
+		if (buf == NULL)
+		{
+			printf("ERROR reading page: %lu\n", nextId);
+			return -1;
+		}
+
+		childNum = vmtreeSearchNode(state, buf, key, nextId, 1);
+		/* Duplicate keys equal to a separator may also be in the child left of it. Start at leftmost child that may have key. */
+		while (childNum > 0 && state->compareKey(buf + state->headerSize + ks * (childNum-1), key) == 0)
+			childNum--;
+		childIdx[l] = childNum;
+		nextId = getChildPageId(state, buf, nextId, l, childNum);
+		if (nextId == -1)
+			return -1;
+		state->activePath[l+1] = nextId;
+	}
+
+	/* Read the leaf node into buffer 0 as will modify it */
+	buf = vmtreeReadPageForUpdate(state, nextId, 0);
+	if (buf == NULL)
+	{
+		printf("ERROR reading page: %lu\n", nextId);
+		return -1;
+	}
+
+	int16_t count = VMTREE_GET_COUNT(buf);
+	childNum = vmtreeSearchNode(state, buf, key, nextId, 0);
+	while (childNum == -1)
+	{	/* Key not in leaf. If separator right of path equals key, duplicates continue in leaves right of it. */
+		for (l=state->levels-2; l >= 0; l--)
+		{
+			buf = readPage(state->buffer, state->activePath[l]);
+			if (buf == NULL)
+				return -1;
+			if (childIdx[l] < VMTREE_GET_COUNT(buf) && state->compareKey(buf + state->headerSize + ks * childIdx[l], key) == 0)
+				break;
+		}
+		if (l < 0)
+			return -1;		/* Key not found */
+
+		/* Follow next child and then leftmost children to a leaf */
+		childIdx[l]++;
+		for (; l < state->levels-1; l++)
+		{
+			nextId = getChildPageId(state, buf, state->activePath[l], l, childIdx[l]);
+			if (nextId == -1)
+				return -1;
+			state->activePath[l+1] = nextId;
+			if (l+1 < state->levels-1)
+			{
+				buf = readPage(state->buffer, nextId);
+				if (buf == NULL)
+					return -1;
+				childIdx[l+1] = 0;
+			}
+		}
+
+		buf = vmtreeReadPageForUpdate(state, nextId, 0);
+		if (buf == NULL)
+			return -1;
+		count = VMTREE_GET_COUNT(buf);
+		childNum = vmtreeSearchNode(state, buf, key, nextId, 0);
+	}
+
+	/* Remove record by shifting records after it up */
+	ptr = buf + state->headerSize + state->recordSize * childNum;
+	memmove(ptr, ptr + state->recordSize, state->recordSize * (count-childNum-1));
+	count--;
+	VMTREE_SET_COUNT(buf, VMTREE_GET_FLAGS(buf) + count);		/* Keep root flag */
+
+	/* Rebalance underfull nodes from leaf towards root. Node at level l is in buffer 0. */
+	l = state->levels-1;
+	while (l > 0)
+	{
+		int8_t leaf = (l == state->levels-1);
+		if (count >= (leaf ? state->maxRecordsPerPage/2 : state->maxInteriorRecordsPerPage/2))
+			break;
+
+		state->retentionFenceValid = 0;		/* Separators change */
+
+		/* Find a sibling and separator key from parent. Use right sibling unless node is last child. */
+		parent = vmtreeReadPageForUpdate(state, state->activePath[l-1], sibFrame);
+		if (parent == NULL)
+			return -1;
+		int16_t parentCount = VMTREE_GET_COUNT(parent);
+		int16_t sepIdx = childIdx[l-1];
+		int8_t nodeIsLeft = sepIdx < parentCount;
+		if (!nodeIsLeft)
+			sepIdx--;
+		if (sepIdx < 0)
+			break;		/* Parent has no other child. Node stays underfull. */
+		id_t sibId = getChildPageId(state, parent, state->activePath[l-1], l-1, nodeIsLeft ? sepIdx+1 : sepIdx);
+		memcpy(state->tempKey, parent + state->headerSize + ks * sepIdx, ks);
+
+		sib = vmtreeReadPageForUpdate(state, sibId, sibFrame);
+		if (sib == NULL)
+			return -1;
+		int16_t sibCount = VMTREE_GET_COUNT(sib);
+
+		/* Merges do not move buffered messages. Node stays underfull if it or its sibling has messages. */
+		if (l == state->levels-2 && state->msgRecords > 0 && (vmtreeMsgCount(state, buf) > 0 || vmtreeMsgCount(state, sib) > 0))
+			break;
+
+		void 	*left = nodeIsLeft ? buf : sib, *right = nodeIsLeft ? sib : buf;
+		id_t 	leftId = nodeIsLeft ? state->activePath[l] : sibId, rightId = nodeIsLeft ? sibId : state->activePath[l];
+		int16_t leftCount = nodeIsLeft ? count : sibCount, rightCount = nodeIsLeft ? sibCount : count;
+		void 	*leftPtr = left + state->headerSize + ks * state->maxInteriorRecordsPerPage;
+		void 	*rightPtr = right + state->headerSize + ks * state->maxInteriorRecordsPerPage;
+		int8_t	merge;
+
+		if (leaf)
+			merge = leftCount + rightCount <= state->maxRecordsPerPage;
+		else
+			merge = leftCount + rightCount + 1 <= state->maxInteriorRecordsPerPage;
+
+		if (merge)
+		{	/* Append right node to left node */
+			if (leaf)
+			{
+				memcpy(left + state->headerSize + state->recordSize * leftCount, right + state->headerSize, state->recordSize * rightCount);
+				VMTREE_SET_COUNT(left, leftCount + rightCount);
+			}
+			else
+			{	/* Separator key from parent is pulled down between the two nodes */
+				memcpy(left + state->headerSize + ks * leftCount, state->tempKey, ks);
+				memcpy(left + state->headerSize + ks * (leftCount+1), right + state->headerSize, ks * rightCount);
+				memcpy(leftPtr + sizeof(id_t) * (leftCount+1), rightPtr, sizeof(id_t) * (rightCount+1));
+				VMTREE_SET_COUNT(left, leftCount + rightCount + 1);
+				VMTREE_SET_INTERIOR(left);
+			}
+			leftId = vmtreeDeleteWriteChild(state, left, leftId);
+			dbbufferSetFree(state->buffer, rightId);
+			state->numNodes--;
+		}
+		else
+		{	/* Move records from the larger node to the smaller one */
+			if (leaf)
+			{
+				if (leftCount > rightCount)
+				{
+					int16_t k = (leftCount - rightCount) / 2;
+					memmove(right + state->headerSize + state->recordSize * k, right + state->headerSize, state->recordSize * rightCount);
+					memcpy(right + state->headerSize, left + state->headerSize + state->recordSize * (leftCount-k), state->recordSize * k);
+					leftCount -= k;
+					rightCount += k;
+				}
+				else
+				{
+					int16_t k = (rightCount - leftCount) / 2;
+					memcpy(left + state->headerSize + state->recordSize * leftCount, right + state->headerSize, state->recordSize * k);
+					memmove(right + state->headerSize, right + state->headerSize + state->recordSize * k, state->recordSize * (rightCount-k));
+					leftCount += k;
+					rightCount -= k;
+				}
+				/* New separator is smallest key in right node */
+				memcpy(state->tempKey, right + state->headerSize, ks);
+				VMTREE_SET_COUNT(left, leftCount);
+				VMTREE_SET_COUNT(right, rightCount);
+			}
+			else
+			{	/* Keys rotate through the separator in the parent */
+				if (leftCount > rightCount)
+				{
+					int16_t k = (leftCount - rightCount) / 2;
+					memmove(right + state->headerSize + ks * k, right + state->headerSize, ks * rightCount);
+					memcpy(right + state->headerSize + ks * (k-1), state->tempKey, ks);
+					memcpy(right + state->headerSize, left + state->headerSize + ks * (leftCount-k+1), ks * (k-1));
+					memmove(rightPtr + sizeof(id_t) * k, rightPtr, sizeof(id_t) * (rightCount+1));
+					memcpy(rightPtr, leftPtr + sizeof(id_t) * (leftCount-k+1), sizeof(id_t) * k);
+					memcpy(state->tempKey, left + state->headerSize + ks * (leftCount-k), ks);
+					leftCount -= k;
+					rightCount += k;
+				}
+				else
+				{
+					int16_t k = (rightCount - leftCount) / 2;
+					memcpy(left + state->headerSize + ks * leftCount, state->tempKey, ks);
+					memcpy(left + state->headerSize + ks * (leftCount+1), right + state->headerSize, ks * (k-1));
+					memcpy(leftPtr + sizeof(id_t) * (leftCount+1), rightPtr, sizeof(id_t) * k);
+					memcpy(state->tempKey, right + state->headerSize + ks * (k-1), ks);
+					memmove(right + state->headerSize, right + state->headerSize + ks * k, ks * (rightCount-k));
+					memmove(rightPtr, rightPtr + sizeof(id_t) * k, sizeof(id_t) * (rightCount-k+1));
+					leftCount += k;
+					rightCount -= k;
+				}
+				VMTREE_SET_COUNT(left, leftCount);
+				VMTREE_SET_INTERIOR(left);
+				VMTREE_SET_COUNT(right, rightCount);
+				VMTREE_SET_INTERIOR(right);
+			}
+			leftId = vmtreeDeleteWriteChild(state, left, leftId);
+			rightId = vmtreeDeleteWriteChild(state, right, rightId);
+		}
+
+		/* Update parent with new child locations and separator */
+		l--;
+		buf = vmtreeReadPageForUpdate(state, state->activePath[l], 0);
+		if (buf == NULL)
+			return -1;
+		if (state->parameters == VMTREE)
+			vmtreeUpdatePointers(state, buf, 0, parentCount);
+
+		ptr = buf + state->headerSize + ks * state->maxInteriorRecordsPerPage;
+		if (merge)
+		{	/* Remove separator and right pointer */
+			memmove(buf + state->headerSize + ks * sepIdx, buf + state->headerSize + ks * (sepIdx+1), ks * (parentCount-sepIdx-1));
+			memmove(ptr + sizeof(id_t) * (sepIdx+1), ptr + sizeof(id_t) * (sepIdx+2), sizeof(id_t) * (parentCount-sepIdx-1));
+			count = parentCount-1;
+			VMTREE_SET_COUNT(buf, VMTREE_GET_FLAGS(buf) + count);
+		}
+		else
+		{
+			memcpy(buf + state->headerSize + ks * sepIdx, state->tempKey, ks);
+			memcpy(ptr + sizeof(id_t) * (sepIdx+1), &rightId, sizeof(id_t));
+			count = parentCount;
+		}
+		memcpy(ptr + sizeof(id_t) * sepIdx, &leftId, sizeof(id_t));
+	}
+
+	if (l == 0 && state->levels > 1 && count == 0)
+	{	/* Root has only one child. Child becomes the new root. */
+		memcpy(&prevId, buf + state->headerSize + ks * state->maxInteriorRecordsPerPage, sizeof(id_t));
+		nextId = vmtreeGetMapping(state, prevId);
+		if (nextId != prevId)
+			vmtreeDeleteMapping(state, prevId);		/* No parent points to child */
+		dbbufferSetFree(state->buffer, state->activePath[0]);
+		state->levels--;
+		state->numNodes--;
+
+		/* Write child with root header as when a split adds a root */
+		buf = vmtreeReadPageForUpdate(state, nextId, 0);
+		if (buf == NULL)
+			return -1;
+		VMTREE_SET_COUNT(buf, VMTREE_GET_COUNT(buf));
+		VMTREE_SET_ROOT(buf);
+		if (state->parameters != VMTREE)
+		{
+			state->activePath[0] = overWritePage(state->buffer, buf, nextId);
+			return 0;
+		}
+		VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
+		dbbufferSetFree(state->buffer, nextId);
+		state->activePath[0] = writePage(state->buffer, buf);
+		return 0;
+	}
+
+	/* Write last modified node */
+	if (state->parameters != VMTREE)
+	{
+		overWritePage(state->buffer, buf, state->activePath[l]);
+		return 0;
+	}
+
+	dbbufferSetFree(state->buffer, state->activePath[l]);
+	if (l == 0)
+	{	/* Wrote to root */
+		state->activePath[0] = writePage(state->buffer, buf);
+	}
+	else
+	{
+		prevId = vmtreeUpdatePrev(state, buf, state->activePath[l]);
+		pageNum = writePage(state->buffer, buf);
+		vmtreeFixMappings(state, prevId, pageNum, l-1);
+	}
+	return 0;
+}
+
+/**
+@brief     	Writes a compacted and sorted node to a new page for NOR overwrite.
+			Resets bitmaps and free space to 1s.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing node
+@param     	count
+                Number of records (leaf) or entries (interior) in node
+@param     	leaf
+                1 if leaf node, 0 if interior node
+@param     	isRoot
+                1 if node is the root, 0 otherwise
+@return		Returns physical page id node was written to.
+*/
+id_t vmtreeWriteSortedNorOverwrite(vmtreeState *state, void *buf, int16_t count, int8_t leaf, int8_t isRoot)
+{
+	if (leaf)
+	{
+		vmtreeSetCountBitsLeaf(state, buf, count);
+		vmtreeResetBlock(state, buf, count);
+		VMTREE_SET_LEAF(buf);
+	}
+	else
+	{
+		vmtreeSetCountBitsInterior(state, buf, count);
+		vmtreeResetBlockInterior(state, buf, count);
+		if (isRoot)
+			VMTREE_SET_ROOT_NOR(buf);
+		else
+			VMTREE_SET_NOR_INTERIOR(buf);
+	}
+	VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
+	return writePage(state->buffer, buf);
+}
+
+/**
+@brief     	Replaces child entries in a NOR overwrite interior node.
+			Entries pointing to removeLeft and removeRight are invalidated and new entries are added.
+			The last new entry keeps the key of the last removed entry. If there are two new entries,
+			the first one uses state->tempKey as its key.
+			New entries are appended to free space so the page can be overwritten in place if possible.
+			Otherwise node is compacted and sorted and must be written to a new page.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing node as stored
+@param     	removeLeft
+                Child page id of first entry to remove
+@param     	removeRight
+                Child page id of second entry to remove or -1 if none
+@param     	addLeft
+                Child page id for first new entry or -1 if only one new entry
+@param     	addRight
+                Child page id for last new entry
+@param     	count
+                Returns number of valid entries in node
+@return		Returns 1 if node can be overwritten in place, 0 if node was compacted, -1 if error.
+*/
+int8_t vmtreeReplaceInteriorNorOverwrite(vmtreeState *state, void *buf, id_t removeLeft, id_t removeRight, id_t addLeft, id_t addRight, int16_t *count)
+{
+	unsigned char* bm1 = buf + state->interiorHeaderSize - state->interiorBitmapSize*2;
+	unsigned char* bm2 = buf + state->interiorHeaderSize - state->interiorBitmapSize;
+	void 	*keys = buf + state->interiorHeaderSize;
+	void 	*ptrs = keys + state->keySize * state->maxInteriorRecordsPerPage;
+	int16_t c, numFree = 0, numValid = 0, numAdd = addLeft == -1 ? 1 : 2;
+	id_t 	childId, lastRemove = removeRight == -1 ? removeLeft : removeRight;
+	int8_t	found = 0;
+
+	for (c=0; c < state->interiorBitmapSize*8 && c < state->maxInteriorRecordsPerPage; c++)
+	{
+		if (bitarrGet(bm1, c) == 1)
+		{	/* Free locations are all after used locations */
+			numFree++;
+			continue;
+		}
+		if (bitarrGet(bm2, c) == 0)
+			continue;
+
+		memcpy(&childId, ptrs + sizeof(id_t) * c, sizeof(id_t));
+		if (childId == removeLeft || childId == removeRight)
+		{
+			if (childId == lastRemove)
+				memcpy(state->tempKey2, keys + state->keySize * c, state->keySize);
+			bitarrSet(bm2, c, 0);	/* Invalidate entry */
+			found++;
+		}
+		else
+			numValid++;
+	}
+
+	if (found != (removeRight == -1 ? 1 : 2))
+	{
+		printf("ERROR: Child pointer not found in parent.\n");
+		return -1;
+	}
+
+	*count = numValid + numAdd;
+	if (numFree >= numAdd)
+	{	/* Append new entries in free space */
+		for (c=0; c < state->interiorBitmapSize*8 && c < state->maxInteriorRecordsPerPage && numAdd > 0; c++)
+		{
+			if (bitarrGet(bm1, c) == 1)
+			{
+				bitarrSet(bm1, c, 0);
+				if (numAdd == 2)
+				{
+					memcpy(keys + state->keySize * c, state->tempKey, state->keySize);
+					memcpy(ptrs + sizeof(id_t) * c, &addLeft, sizeof(id_t));
+				}
+				else
+				{
+					memcpy(keys + state->keySize * c, state->tempKey2, state->keySize);
+					memcpy(ptrs + sizeof(id_t) * c, &addRight, sizeof(id_t));
+				}
+				numAdd--;
+			}
+		}
+		return 1;
+	}
+
+	/* Not enough free space. Compact node and insert new entries in sorted order. */
+	numValid = vmtreeSortInteriorBlockNorOverwrite(state, buf);
+	for ( ; numAdd > 0; numAdd--)
+	{
+		void *key = numAdd == 2 ? state->tempKey : state->tempKey2;
+		childId = numAdd == 2 ? addLeft : addRight;
+		for (c=0; c < numValid; c++)
+		{
+			if (state->compareKey(key, keys + state->keySize * c) < 0)
+				break;
+		}
+		memmove(keys + state->keySize * (c+1), keys + state->keySize * c, state->keySize * (numValid-c));
+		memmove(ptrs + sizeof(id_t) * (c+1), ptrs + sizeof(id_t) * c, sizeof(id_t) * (numValid-c));
+		memcpy(keys + state->keySize * c, key, state->keySize);
+		memcpy(ptrs + sizeof(id_t) * c, &childId, sizeof(id_t));
+		numValid++;
+	}
+	return 0;
+}
+
+/**
+@brief     	Writes a compacted and sorted node in buffer 0 to a new page for NOR overwrite
+			and updates its parent. Underfull nodes are merged with or borrow records from a sibling.
+			Parent entries are replaced in place if possible, otherwise the parent is compacted
+			and rewritten. This continues towards the root until a node is overwritten in place.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer page 0 containing compacted and sorted node
+@param     	count
+                Number of records (leaf) or entries (interior) in node
+@param     	l
+                Level of node in tree
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeUpdateNodeNorOverwrite(vmtreeState *state, void *buf, int16_t count, int8_t l)
+{
+	void 	*parent, *sib;
+	id_t  	nextId;
+	int16_t c;
+	int8_t	inPlace;
+	count_t sibFrame = state->buffer->numPages > 2 ? 2 : 1;
+	uint8_t ks = state->keySize;
+
+	while (1)
+	{
+		int8_t	leaf = (l == state->levels-1);
+		id_t	leftId, rightId, newLeft = -1, newRight;
+
+		if (l == 0)
+		{
+			dbbufferSetFree(state->buffer, state->activePath[0]);
+			if (!leaf && count == 1)
+			{	/* Root has only one child. Child becomes the new root. */
+				memcpy(&state->activePath[0], buf + state->interiorHeaderSize + ks * state->maxInteriorRecordsPerPage, sizeof(id_t));
+				state->levels--;
+				state->numNodes--;
+			}
+			else
+				state->activePath[0] = vmtreeWriteSortedNorOverwrite(state, buf, count, leaf, !leaf);
+			return 0;
+		}
+
+		if (count >= (leaf ? state->maxRecordsPerPage/2 : (state->maxInteriorRecordsPerPage+1)/2))
+		{	/* Node is not underfull. Write to new page and replace pointer in parent. */
+			leftId = state->activePath[l];
+			rightId = -1;
+			newRight = vmtreeWriteSortedNorOverwrite(state, buf, count, leaf, 0);
+			dbbufferSetFree(state->buffer, leftId);
+		}
+		else
+		{	/* Find a sibling from compacted copy of parent. Use right sibling unless node is last child. */
+			parent = vmtreeReadPageForUpdate(state, state->activePath[l-1], sibFrame);
+			if (parent == NULL)
+				return -1;
+			int16_t parentCount = vmtreeSortInteriorBlockNorOverwrite(state, parent);
+			void	*parentPtr = parent + state->interiorHeaderSize + ks * state->maxInteriorRecordsPerPage;
+			for (c=0; c < parentCount; c++)
+			{
+				memcpy(&nextId, parentPtr + sizeof(id_t) * c, sizeof(id_t));
+				if (nextId == state->activePath[l])
+					break;
+			}
+			int8_t nodeIsLeft = c+1 < parentCount;
+			id_t sibId;
+			memcpy(&sibId, parentPtr + sizeof(id_t) * (nodeIsLeft ? c+1 : c-1), sizeof(id_t));
+
+			sib = vmtreeReadPageForUpdate(state, sibId, sibFrame);
+			if (sib == NULL)
+				return -1;
+			int16_t sibCount = leaf ? vmtreeSortBlockNorOverwrite(state, sib) : vmtreeSortInteriorBlockNorOverwrite(state, sib);
+
+			void 	*left = nodeIsLeft ? buf : sib, *right = nodeIsLeft ? sib : buf;
+			int16_t leftCount = nodeIsLeft ? count : sibCount, rightCount = nodeIsLeft ? sibCount : count;
+			int16_t max = leaf ? state->maxRecordsPerPage : state->maxInteriorRecordsPerPage;
+			/* Leaf and interior nodes store an array of keys followed by an array of data values or pointers */
+			uint8_t	hs = leaf ? state->headerSize : state->interiorHeaderSize;
+			uint8_t	vs = leaf ? state->dataSize : sizeof(id_t);
+			void	*leftVal = left + hs + ks * max, *rightVal = right + hs + ks * max;
+			leftId = nodeIsLeft ? state->activePath[l] : sibId;
+			rightId = nodeIsLeft ? sibId : state->activePath[l];
+
+			if (leftCount + rightCount <= max)
+			{	/* Append right node to left node. Interior entries store their upper bound key so no separator is needed. */
+				memcpy(left + hs + ks * leftCount, right + hs, ks * rightCount);
+				memcpy(leftVal + vs * leftCount, rightVal, vs * rightCount);
+				newRight = vmtreeWriteSortedNorOverwrite(state, left, leftCount + rightCount, leaf, 0);
+				state->numNodes--;
+			}
+			else
+			{	/* Move records from the larger node to the smaller one */
+				if (leftCount > rightCount)
+				{
+					int16_t k = (leftCount - rightCount) / 2;
+					memmove(right + hs + ks * k, right + hs, ks * rightCount);
+					memmove(rightVal + vs * k, rightVal, vs * rightCount);
+					memcpy(right + hs, left + hs + ks * (leftCount-k), ks * k);
+					memcpy(rightVal, leftVal + vs * (leftCount-k), vs * k);
+					leftCount -= k;
+					rightCount += k;
+				}
+				else
+				{
+					int16_t k = (rightCount - leftCount) / 2;
+					memcpy(left + hs + ks * leftCount, right + hs, ks * k);
+					memcpy(leftVal + vs * leftCount, rightVal, vs * k);
+					memmove(right + hs, right + hs + ks * k, ks * (rightCount-k));
+					memmove(rightVal, rightVal + vs * k, vs * (rightCount-k));
+					leftCount += k;
+					rightCount -= k;
+				}
+				/* New separator is smallest key in right leaf or upper bound of last entry in left interior node */
+				if (leaf)
+					memcpy(state->tempKey, right + hs, ks);
+				else
+					memcpy(state->tempKey, left + hs + ks * (leftCount-1), ks);
+				newLeft = vmtreeWriteSortedNorOverwrite(state, left, leftCount, leaf, 0);
+				newRight = vmtreeWriteSortedNorOverwrite(state, right, rightCount, leaf, 0);
+			}
+			dbbufferSetFree(state->buffer, leftId);
+			dbbufferSetFree(state->buffer, rightId);
+		}
+
+		/* Update parent entries */
+		l--;
+		buf = vmtreeReadPageForUpdate(state, state->activePath[l], 0);
+		if (buf == NULL)
+			return -1;
+		inPlace = vmtreeReplaceInteriorNorOverwrite(state, buf, leftId, rightId, newLeft, newRight, &count);
+		if (inPlace == -1)
+			return -1;
+
+		if (inPlace == 1)
+		{
+			if (count >= (l == 0 ? 2 : (state->maxInteriorRecordsPerPage+1)/2))
+			{	/* Only 1s changed to 0s so overwrite in place */
+				overWritePage(state->buffer, buf, state->activePath[l]);
+				return 0;
+			}
+			count = vmtreeSortInteriorBlockNorOverwrite(state, buf);
+		}
+	}
+}
+
+/**
+@brief     	Deletes a key from the tree for NOR overwrite page layout.
+			A record is deleted by clearing its valid bit so the page is overwritten in place.
+			Underfull leaves are compacted and merged with or borrow records from a sibling.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key for record
+@return		Return 0 if success. Non-zero value if error or key not found.
+*/
+int8_t vmtreeDeleteNorOverwrite(vmtreeState *state, void* key)
+{
+	int8_t 	l;
+	void 	*buf;
+	id_t  	nextId = state->activePath[0];
+	int32_t childNum;
+	int16_t c, count = 0;
+
+	for (l=0; l < state->levels-1; l++)
+	{
+		buf = readPage(state->buffer, nextId);
+		if (buf == NULL)
+		{
+			printf("ERROR reading page: %lu\n", nextId);
+			return -1;
+		}
+
+		childNum = vmtreeSearchNode(state, buf, key, nextId, 1);
+		nextId = getChildPageId(state, buf, nextId, l, childNum);
+		if (nextId == -1)
+			return -1;
+		state->activePath[l+1] = nextId;
+	}
+
+	/* Read the leaf node into buffer 0 as will modify it */
+	buf = vmtreeReadPageForUpdate(state, nextId, 0);
+	if (buf == NULL)
+	{
+		printf("ERROR reading page: %lu\n", nextId);
+		return -1;
+	}
+
+	/* Find record and clear its valid bit */
+	unsigned char* bm1 = buf + state->headerSize - state->bitmapSize*2;
+	unsigned char* bm2 = buf + state->headerSize - state->bitmapSize;
+	childNum = -1;
+	for (c=0; c < state->bitmapSize*8 && c < state->maxRecordsPerPage; c++)
+	{
+		if (bitarrGet(bm1, c) == 1)
+			break;
+		if (bitarrGet(bm2, c) == 1)
+		{
+			if (childNum == -1 && state->compareKey(key, buf + state->headerSize + state->keySize * c) == 0)
+			{
+				bitarrSet(bm2, c, 0);
+				childNum = c;
+			}
+			else
+				count++;
+		}
+	}
+	if (childNum == -1)
+		return -1;		/* Key not found */
+
+	if (state->levels == 1 || count >= state->maxRecordsPerPage/2 || !dbbufferEnsureSpace(state->buffer, state->levels*3))
+	{	/* Only 1s changed to 0s so overwrite in place. Underfull leaf is kept if no space to rebalance. */
+		overWritePage(state->buffer, buf, nextId);
+		return 0;
+	}
+
+	/* Leaf is underfull. Compact it and rebalance. */
+	count = vmtreeSortBlockNorOverwrite(state, buf);
+	return vmtreeUpdateNodeNorOverwrite(state, buf, count, state->levels-1);
+}
+
+/**
+@brief     	Deletes all records with the given key from the structure.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key for record
+@return		Return 0 if success. Non-zero value if error or key not found.
+*/
+int8_t vmtreeDelete(vmtreeState *state, void* key)
+{
+	int8_t result = -1;
+
+	state->appendPath = 0;
+
+	/* Records in write-ahead log are inserted again on recovery so apply them and restart log with a checkpoint */
+	if (state->walPages > 0 && state->walNext != state->walFirst)
+		vmtreeFlush(state);
+
+	/* Records in sorted runs are not changed so insert them into tree first */
+	if (state->numRuns > 0)
+		vmtreeRunCompact(state);
+
+	/* Insert buffered messages with key into leaves so they are deleted. Rebalancing keeps other messages in their nodes. */
+	if (vmtreeMsgFlush(state, key, key) != 0)
+		return -1;
+
+	if (state->logBuffer != NULL)
+	{	/* Remove records waiting in log buffer. Move last record into free spot. */
+		for (count_t i=0; i < state->numLogRecords; )
+		{
+			void *ptr = state->logBuffer + state->recordSize * i;
+			if (state->compareKey(ptr, key) == 0)
+			{
+				state->numLogRecords--;
+				if (state->numRecords > 0)
+					state->numRecords--;
+				memcpy(ptr, state->logBuffer + state->recordSize * state->numLogRecords, state->recordSize);
+				result = 0;
+			}
+			else
+				i++;
+		}
+		/* Sort remaining records so every run is sorted again. Records in write-ahead log pages were applied above. */
+		if (result == 0 && state->numLogRecords > 1)
+			in_memory_sort(state->logBuffer, (uint32_t) state->numLogRecords, state->recordSize, state->compareKey, 1);
+	}
+
+	if (state->parameters == OVERWRITE)
+	{
+		while (vmtreeDeleteNorOverwrite(state, key) == 0)
+		{
+			result = 0;
+			if (state->numRecords > 0)		/* Count is estimate after retention drops subtrees */
+				state->numRecords--;
+		}
+	}
+	else
+	{
+		while (1)
+		{
+			if (vmtreeCheckpointEnsureSpace(state, state->levels*3) != 0)
+				return -1;
+
+			/* Copy-on-write requires free pages for nodes modified by each record delete */
+			if (state->parameters == VMTREE && !dbbufferEnsureSpace(state->buffer, state->levels*3))
+			{
+				printf("Storage is at capacity. Cannot delete keys.\n");
+				return -1;
+			}
+			if (vmtreeDeleteRecord(state, key) != 0)
+				break;
+			result = 0;
+			if (state->numRecords > 0)		/* Count is estimate after retention drops subtrees */
+				state->numRecords--;
+		}
+	}
+	return result;
+}
+
+/**
+@brief     	Finds the leftmost child (child with smallest keys) of an interior node.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing interior node
+@param		slot
+				Returns entry index of leftmost child. Its key is the separator (upper bound) of the child.
+@param		childId
+				Returns page id of leftmost child (before mapping)
+@return		Returns number of children of node.
+*/
+int16_t vmtreeLeftmostChild(vmtreeState *state, void *buf, int16_t *slot, id_t *childId)
+{
+	uint8_t ks = state->keySize;
+	void	*ptrs = buf + state->interiorHeaderSize + ks * state->maxInteriorRecordsPerPage;
+
+	if (state->parameters != OVERWRITE)
+	{	/* Keys are sorted so first pointer is leftmost child */
+		*slot = 0;
+		memcpy(childId, ptrs, sizeof(id_t));
+		return VMTREE_GET_COUNT(buf) + 1;
+	}
+
+	/* Entries are not sorted. Leftmost child is valid entry with smallest upper bound key. */
+	unsigned char* bm1 = buf + state->interiorHeaderSize - state->interiorBitmapSize*2;
+	unsigned char* bm2 = buf + state->interiorHeaderSize - state->interiorBitmapSize;
+	int16_t num = 0;
+	*slot = -1;
+	for (int16_t c=0; c < state->maxInteriorRecordsPerPage; c++)
+	{
+		if (bitarrGet(bm1, c) == 0 && bitarrGet(bm2, c) == 1)
+		{
+			num++;
+			if (*slot == -1 || state->compareKey(buf + state->interiorHeaderSize + ks * c, buf + state->interiorHeaderSize + ks * *slot) < 0)
+				*slot = c;
+		}
+	}
+	if (*slot != -1)
+		memcpy(childId, ptrs + sizeof(id_t) * *slot, sizeof(id_t));
+	return num;
+}
+
+/**
+@brief     	Frees all pages of a subtree. Interior nodes are read to find their children but leaves are never read.
+@param     	state
+                VMTree algorithm state structure
+@param     	pageNum
+                Physical page id of subtree root
+@param		l
+				Level of subtree root (0 is root)
+@return		Returns number of pages freed.
+*/
+id_t vmtreeFreeSubtree(vmtreeState *state, id_t pageNum, int8_t l)
+{
+	id_t numFreed = 1;
+
+	if (l < state->levels-1)
+	{
+		void *buf = readPage(state->buffer, pageNum);
+		if (buf != NULL)
+		{
+			int16_t num = state->parameters == OVERWRITE ? state->maxInteriorRecordsPerPage : VMTREE_GET_COUNT(buf) + 1;
+			for (int16_t c=0; c < num; c++)
+			{
+				if (state->parameters == OVERWRITE)
+				{	/* Must be non-free location (0) and still valid (1) */
+					unsigned char* bm1 = buf + state->interiorHeaderSize - state->interiorBitmapSize*2;
+					unsigned char* bm2 = buf + state->interiorHeaderSize - state->interiorBitmapSize;
+					if (bitarrGet(bm1, c) == 1 || bitarrGet(bm2, c) == 0)
+						continue;
+				}
+				id_t childId;
+				memcpy(&childId, buf + state->interiorHeaderSize + state->keySize * state->maxInteriorRecordsPerPage + sizeof(id_t) * c, sizeof(id_t));
+				numFreed += vmtreeFreeSubtree(state, vmtreeGetMapping(state, childId), l+1);
+				vmtreeDeleteMapping(state, childId);
+
+				/* Reading interior children may have replaced node in buffer */
+				if (l+1 < state->levels-1)
+				{
+					buf = readPage(state->buffer, pageNum);
+					if (buf == NULL)
+						break;
+				}
+			}
+		}
+	}
+	dbbufferSetFree(state->buffer, pageNum);
+	return numFreed;
+}
+
+/**
+@brief     	Drops the oldest records by detaching the leftmost subtree of a node on the leftmost path.
+			Pages of the subtree are marked free without reading any leaves.
+			If minKey is NULL, removes the leftmost child of the highest node that has more than two children (or the root).
+			Otherwise, removes the largest such subtree that only contains keys smaller than minKey.
+@param     	state
+                VMTree algorithm state structure
+@param     	minKey
+                Smallest key to retain or NULL to drop oldest subtree regardless of key
+@return		Return 0 if subtree dropped, -1 if nothing to drop or error.
+*/
+int8_t vmtreeDropOldest(vmtreeState *state, void *minKey)
+{
+	void 	*buf;
+	int8_t	l, d = -1;
+	int16_t	slot, num;
+	id_t 	childId, nextId = state->activePath[0], numFreed;
+	id_t	path[MAX_LEVEL];
+	count_t numMsg = 0;
+
+	if (state->levels == 1)
+		return -1;
+
+	/* Select node on leftmost path to remove leftmost child from */
+	for (l=0; l < state->levels-1; l++)
+	{
+		path[l] = nextId;
+		buf = readPage(state->buffer, nextId);
+		if (buf == NULL)
+			return -1;
+		num = vmtreeLeftmostChild(state, buf, &slot, &childId);
+		if (slot == -1)
+			return -1;
+
+		/* Node other than root must keep at least two children. All keys in child are smaller than its separator. */
+		if ((num > 2 || (l == 0 && minKey != NULL))
+			&& (minKey == NULL || state->compareKey(buf + state->interiorHeaderSize + state->keySize * slot, minKey) <= 0))
+		{
+			d = l;
+			break;
+		}
+		nextId = vmtreeGetMapping(state, childId);
+	}
+
+	if (d == -1)
+	{
+		if (minKey != NULL)
+			return -1;
+		d = 0;		/* Every node on path has two children. Drop left half of tree. */
+	}
+
+	/* Active path becomes leftmost path only when a subtree is dropped */
+	memcpy(state->activePath, path, sizeof(id_t) * (d+1));
+	state->appendPath = 0;
+	state->retentionFenceValid = 0;
+
+	buf = vmtreeReadPageForUpdate(state, state->activePath[d], 0);
+	if (buf == NULL)
+		return -1;
+	num = vmtreeLeftmostChild(state, buf, &slot, &childId);
+
+	/* Buffered messages with keys in dropped leaf are dropped with it */
+	if (d == state->levels-2 && state->msgRecords > 0)
+		numMsg = vmtreeMsgDrop(state, buf, buf + state->interiorHeaderSize + state->keySize * slot);
+
+	numFreed = vmtreeFreeSubtree(state, vmtreeGetMapping(state, childId), d+1);
+	vmtreeDeleteMapping(state, childId);
+
+	/* Remove child entry from node */
+	if (state->parameters == OVERWRITE)
+	{
+		bitarrSet(buf + state->interiorHeaderSize - state->interiorBitmapSize, slot, 0);
+	}
+	else
+	{
+		count_t count = VMTREE_GET_COUNT(buf);
+		void	*ptrs = buf + state->interiorHeaderSize + state->keySize * state->maxInteriorRecordsPerPage;
+		memmove(buf + state->interiorHeaderSize, buf + state->interiorHeaderSize + state->keySize, state->keySize * (count-1));
+		memmove(ptrs, ptrs + sizeof(id_t), sizeof(id_t) * count);
+		VMTREE_SET_COUNT(buf, VMTREE_GET_FLAGS(buf) + count - 1);
+	}
+
+	if (d == 0 && num == 2)
+	{	/* Root has only one child. Child becomes the new root. */
+		if (numMsg > 0)		/* Messages of old root are inserted into new root leaf below */
+			memcpy(state->msgBuffer, vmtreeMsgArea(state, buf) + sizeof(count_t), state->recordSize * numMsg);
+		vmtreeLeftmostChild(state, buf, &slot, &childId);
+		dbbufferSetFree(state->buffer, state->activePath[0]);
+		state->activePath[0] = vmtreeGetMapping(state, childId);
+		vmtreeDeleteMapping(state, childId);
+		state->levels--;
+		numFreed++;
+	}
+	else if (state->parameters != VMTREE)
+	{
+		overWritePage(state->buffer, buf, state->activePath[d]);
+	}
+	else
+	{	/* Copy-on-write node. Freed subtree pages guarantee space. */
+		dbbufferSetFree(state->buffer, state->activePath[d]);
+		if (d == 0)
+			state->activePath[0] = writePage(state->buffer, buf);
+		else
+		{
+			id_t prevId = vmtreeUpdatePrev(state, buf, state->activePath[d]);
+			id_t newId = writePage(state->buffer, buf);
+			vmtreeFixMappings(state, prevId, newId, d-1);
+		}
+	}
+
+	/* Record count is estimated from fraction of nodes dropped */
+	uint64_t numDropped = (uint64_t) state->numRecords * numFreed / state->numNodes;
+	state->numRecords = numDropped < state->numRecords ? state->numRecords - numDropped : 0;
+	state->numNodes = numFreed < state->numNodes ? state->numNodes - numFreed : 1;
+
+	if (state->levels == 1 && numMsg > 0)
+		return vmtreeMsgInsertLeaves(state, state->msgBuffer, numMsg);
+	return 0;
+}
+
+/**
+@brief     	Returns 1 if vmtreeDropOldest() may drop a subtree for state->retentionMinKey, 0 if it cannot.
+			The smallest separator of a leftmost child that may be dropped is kept in state->retentionFence
+			so the leftmost path is only searched again after nodes are added or removed.
+@param     	state
+                VMTree algorithm state structure
+*/
+int8_t vmtreeRetentionCanDrop(vmtreeState *state)
+{
+	void 	*buf;
+	int16_t	slot, num;
+	id_t 	childId, nextId = state->activePath[0];
+
+	if (state->retentionFence == NULL)
+		return 1;
+
+	if (state->retentionFenceValid == 0 || state->retentionFenceNodes != state->numNodes)
+	{
+		state->retentionFenceValid = -1;
+		state->retentionFenceNodes = state->numNodes;
+		for (int8_t l=0; l < state->levels-1; l++)
+		{
+			buf = readPage(state->buffer, nextId);
+			if (buf == NULL)
+			{
+				state->retentionFenceValid = 0;
+				return 0;
+			}
+			num = vmtreeLeftmostChild(state, buf, &slot, &childId);
+			if (slot == -1)
+				break;
+
+			/* Same condition as vmtreeDropOldest(). All keys in child are smaller than its separator. */
+			void *sep = buf + state->interiorHeaderSize + state->keySize * slot;
+			if ((num > 2 || l == 0) && (state->retentionFenceValid != 1 || state->compareKey(sep, state->retentionFence) < 0))
+			{
+				memcpy(state->retentionFence, sep, state->keySize);
+				state->retentionFenceValid = 1;
+			}
+			nextId = vmtreeGetMapping(state, childId);
+		}
+	}
+	return state->retentionFenceValid == 1 && state->compareKey(state->retentionFence, state->retentionMinKey) <= 0;
+}
+
+/**
+@brief     	Drops oldest subtrees until the tree satisfies the retention limit (state->retentionMode).
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if tree is within limit, -1 if the limit cannot be satisfied.
+*/
+int8_t vmtreeApplyRetention(vmtreeState *state)
+{
+	while (1)
+	{
+		switch (state->retentionMode)
+		{
+			case RETAIN_MAX_RECORDS:
+				if (state->numRecords <= state->retentionLimit)
+					return 0;
+				break;
+			case RETAIN_MAX_PAGES:
+				if (state->numNodes <= state->retentionLimit)
+					return 0;
+				break;
+			case RETAIN_MIN_KEY:
+				if (state->retentionMinKey == NULL || !vmtreeRetentionCanDrop(state))
+					return 0;
+				if (vmtreeDropOldest(state, state->retentionMinKey) != 0)
+				{	/* Separators changed without adding or removing nodes (e.g. delete redistribution). Search path again next time. */
+					state->retentionFenceValid = 0;
+					return 0;
+				}
+				continue;
+			default:
+				return 0;
+		}
+		if (vmtreeDropOldest(state, NULL) != 0)
+			return -1;
+	}
+}
+
+/**
+@brief     	Returns maximum number of records (leaf) or children (interior) a bulk loaded node holds.
+			Only leaves are filled to state->fillFactor percent.
+@param     	state
+                VMTree algorithm state structure
+@param     	level
+                Level of node (0 is leaf level)
+*/
+count_t vmtreeBulkLoadCapacity(vmtreeState *state, uint8_t level)
+{
+	if (level > 0)
+	{	/* Interior nodes are rarely updated so are always fully packed */
+		if (state->parameters == OVERWRITE)
+			return state->maxInteriorRecordsPerPage;		/* One (key, pointer) entry per child */
+		return state->maxInteriorRecordsPerPage+1;			/* N keys and N+1 pointers */
+	}
+
+	uint32_t cap = (uint32_t) state->maxRecordsPerPage * state->fillFactor / 100;
+	if (cap > state->maxRecordsPerPage)
+		cap = state->maxRecordsPerPage;
+	if (cap < 1)
+		cap = 1;
+	return cap;
+}
+
+/**
+@brief     	Sets header of node being built at given level.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer containing node
+@param     	level
+                Level of node (0 is leaf level)
+@param     	count
+                Records (leaf) or children (interior) in node
+@param     	isRoot
+                1 if node is the root of the tree, 0 otherwise
+*/
+void vmtreeBulkLoadSetHeader(vmtreeState *state, void *buf, uint8_t level, count_t count, int8_t isRoot)
+{
+	VMTREE_SET_PREV(buf, PREV_ID_CONSTANT);
+	if (level == 0)
+	{
+		if (state->parameters == OVERWRITE)
+		{
+			vmtreeSetCountBitsLeaf(state, buf, count);
+			VMTREE_SET_LEAF(buf);
+		}
+		else
+			VMTREE_SET_COUNT(buf, count);
+	}
+	else if (state->parameters == OVERWRITE)
+	{
+		vmtreeSetCountBitsInterior(state, buf, count);
+		if (isRoot)
+			VMTREE_SET_ROOT_NOR(buf);
+		else
+			VMTREE_SET_NOR_INTERIOR(buf);
+	}
+	else
+	{	/* Interior node stores one less key than child pointers */
+		VMTREE_SET_COUNT(buf, count-1);
+		if (isRoot)
+			VMTREE_SET_ROOT(buf);
+		else
+			VMTREE_SET_INTERIOR(buf);
+	}
+}
+
+/**
+@brief     	Returns buffer holding node being built at given level.
+			Levels without their own buffer page share the next page. A partly built node of another level
+			in the shared page is saved to storage and a saved node of this level is read back.
+@param     	state
+                VMTree algorithm state structure
+@param     	bl
+                Bulk load state
+@param     	level
+                Level of node (0 is leaf level)
+@param     	init
+                1 to start a new empty node, 0 to continue node being built
+@return		Return buffer containing node or NULL if error.
+*/
+void* vmtreeBulkLoadNode(vmtreeState *state, vmtreeBulkLoadState *bl, uint8_t level, int8_t init)
+{
+	dbbuffer *buffer = state->buffer;
+
+	if (level < bl->resident)
+		return init ? initBufferPage(buffer, level) : buffer->buffer + buffer->pageSize * level;
+
+	void *buf = buffer->buffer + buffer->pageSize * bl->resident;
+	if (bl->sharedLevel != level)
+	{
+		if (bl->sharedLevel != 0)
+		{	/* Node is saved as an interior node so recovery replays it like any node that is not in the tree */
+			vmtreeBulkLoadSetHeader(state, buf, bl->sharedLevel, bl->numChildren[bl->sharedLevel], 0);
+			if (!dbbufferEnsureSpace(buffer, 1))
+			{
+				printf("Storage is at capacity. Must delete keys.\n");
+				return NULL;
+			}
+			bl->savedPage[bl->sharedLevel] = writePage(buffer, buf);
+		}
+		bl->sharedLevel = level;
+
+		if (bl->savedPage[level] != EMPTY_MAPPING)
+		{	/* Saved copy is not needed once node is in buffer */
+			if (readPageBuffer(buffer, bl->savedPage[level], bl->resident) == NULL)
+				return NULL;
+			dbbufferSetFrame(buffer, bl->resident, 0);
+			dbbufferSetFree(buffer, bl->savedPage[level]);
+			bl->savedPage[level] = EMPTY_MAPPING;
+		}
+	}
+	return init ? initBufferPage(buffer, bl->resident) : buf;
+}
+
+/**
+@brief     	Writes node being built at given level and links it into its parent (if parent exists).
+@param     	state
+                VMTree algorithm state structure
+@param     	bl
+                Bulk load state
+@param     	level
+                Level of node (0 is leaf level)
+@param     	isRoot
+                1 if node is the root of the tree, 0 otherwise
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeBulkLoadWriteNode(vmtreeState *state, vmtreeBulkLoadState *bl, uint8_t level, int8_t isRoot)
+{
+	void *buf = vmtreeBulkLoadNode(state, bl, level, 0);
+	if (buf == NULL)
+		return -1;
+	vmtreeBulkLoadSetHeader(state, buf, level, bl->numChildren[level], isRoot);
+
+	if (!dbbufferEnsureSpace(state->buffer, 1))
+	{
+		printf("Storage is at capacity. Must delete keys.\n");
+		return -1;
+	}
+
+	id_t pageNum = writePage(state->buffer, buf);
+	bl->lastPageId[level] = pageNum;
+	bl->numWritten[level]++;
+	state->numNodes++;
+	if (bl->sharedLevel == level)
+		bl->sharedLevel = 0;		/* Shared page is free */
+
+	if (level+1 < bl->levels)
+	{	/* Fill in pointer to this node in parent. Its key was added when node was started. */
+		void *parent = vmtreeBulkLoadNode(state, bl, level+1, 0);
+		if (parent == NULL)
+			return -1;
+		memcpy(parent + state->interiorHeaderSize + state->keySize * state->maxInteriorRecordsPerPage + sizeof(id_t) * (bl->numChildren[level+1]-1), &pageNum, sizeof(id_t));
+	}
+	return 0;
+}
+
+/**
+@brief     	Starts a new node at given level whose smallest key is key.
+			Adds key as separator in parent, writing full parents and creating a new root level as required.
+@param     	state
+                VMTree algorithm state structure
+@param     	bl
+                Bulk load state
+@param     	level
+                Level of node (0 is leaf level)
+@param     	key
+                Smallest key in the new node
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeBulkLoadStartNode(vmtreeState *state, vmtreeBulkLoadState *bl, uint8_t level, void *key)
+{
+	void *parent;
+
+	if (bl->numWritten[level] > 0)
+	{	/* Not first node on this level. Must add key to parent. */
+		uint8_t parentLevel = level+1;
+
+		if (parentLevel == bl->levels)
+		{	/* Create new level above with previous node as first child */
+			if (parentLevel >= MAX_LEVEL)
+			{
+				printf("ERROR: Bulk load tree exceeds %d levels.\n", MAX_LEVEL);
+				return -1;
+			}
+			if (parentLevel == bl->resident)
+			{	/* No buffer page left. Top buffer page is shared by its level and all levels above. */
+				bl->resident--;
+				bl->sharedLevel = bl->resident;
+			}
+			bl->savedPage[parentLevel] = EMPTY_MAPPING;
+			parent = vmtreeBulkLoadNode(state, bl, parentLevel, 1);
+			if (parent == NULL)
+				return -1;
+			memcpy(parent + state->interiorHeaderSize + state->keySize * state->maxInteriorRecordsPerPage, &(bl->lastPageId[level]), sizeof(id_t));
+			bl->numChildren[parentLevel] = 1;
+			bl->numWritten[parentLevel] = 0;
+			bl->levels++;
+		}
+		else if (bl->numChildren[parentLevel] >= vmtreeBulkLoadCapacity(state, parentLevel))
+		{	/* Parent is full and all its children are written. Write it and start a new one. */
+			if (vmtreeBulkLoadWriteNode(state, bl, parentLevel, 0) != 0)
+				return -1;
+			if (vmtreeBulkLoadStartNode(state, bl, parentLevel, key) != 0)
+				return -1;
+			bl->numChildren[parentLevel] = 1;
+			goto initnode;
+		}
+
+		/* Key separates previous child and this one. Pointer is filled in when this node is written. */
+		/* For OVERWRITE, key is the upper bound of previous entry and the last entry keeps the all 1s maximum key. */
+		parent = vmtreeBulkLoadNode(state, bl, parentLevel, 0);
+		if (parent == NULL)
+			return -1;
+		memcpy(parent + state->interiorHeaderSize + state->keySize * (bl->numChildren[parentLevel]-1), key, state->keySize);
+		bl->numChildren[parentLevel]++;
+	}
+
+initnode:
+	if (vmtreeBulkLoadNode(state, bl, level, 1) == NULL)
+		return -1;
+	bl->numChildren[level] = 0;
+	return 0;
+}
+
+/**
+@brief     	Builds the tree bottom-up from a stream of records sorted by key.
+			Tree must be empty. Leaves are packed to state->fillFactor percent and
+			written sequentially with one in-progress node per level held in buffer page
+			of the same index. If the tree has more levels than the buffer has pages, the
+			levels from the last buffer page up share it and a partly built node of one of these
+			levels is saved to storage while another is in the page. No mappings are created.
+@param     	state
+                VMTree algorithm state structure
+@param     	it
+                Record iterator returning records in sorted key order
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeBulkLoad(vmtreeState *state, recordIteratorState *it)
+{
+	vmtreeBulkLoadState bl;
+	void *buf, *key = state->tempKey, *data = state->tempData;
+	uint32_t recId;
+	count_t leafCap = vmtreeBulkLoadCapacity(state, 0);
+
+	/* Verify tree is empty */
+	buf = readPage(state->buffer, state->activePath[0]);
+	if (buf == NULL)
+		return -1;
+	if (state->levels != 1 || (state->logBuffer != NULL && state->numLogRecords > 0) || state->numRuns > 0
+		|| (state->parameters != OVERWRITE && VMTREE_GET_COUNT(buf) != 0)
+		|| (state->parameters == OVERWRITE && bitarrGet(buf + state->headerSize - state->bitmapSize*2, 0) == 0))
+	{
+		printf("ERROR: Bulk load requires an empty tree.\n");
+		return -1;
+	}
+
+	if (state->buffer->numPages < 2)
+	{
+		printf("ERROR: Bulk load requires at least 2 buffer pages.\n");
+		return -1;
+	}
+
+	bl.levels = 0;
+	bl.resident = state->buffer->numPages;
+	bl.sharedLevel = 0;
+	bl.numWritten[0] = 0;
+	bl.numChildren[0] = 0;
+
+	while (it->next(it, key, data, &recId) == 0)
+	{
+		if (bl.levels == 0)
+		{	/* First record. Empty root created during init is no longer used. Start first leaf. */
+			dbbufferSetFree(state->buffer, state->activePath[0]);
+			state->numNodes = 0;
+			bl.levels = 1;
+			initBufferPage(state->buffer, 0);
+		}
+		else
+		{
+			if (state->compareKey(key, state->tempKey2) < 0)
+			{
+				printf("ERROR: Bulk load records are not in sorted order.\n");
+				return -1;
+			}
+
+			if (bl.numChildren[0] >= leafCap)
+			{	/* Leaf is full */
+				if (vmtreeBulkLoadWriteNode(state, &bl, 0, 0) != 0)
+					return -1;
+				if (vmtreeBulkLoadStartNode(state, &bl, 0, key) != 0)
+					return -1;
+			}
+		}
+
+		/* Append record to leaf */
+		buf = state->buffer->buffer;
+		if (state->parameters == OVERWRITE)
+		{
+			memcpy(buf + state->headerSize + state->keySize * bl.numChildren[0], key, state->keySize);
+			memcpy(buf + state->headerSize + state->keySize * state->maxRecordsPerPage + state->dataSize * bl.numChildren[0], data, state->dataSize);
+		}
+		else
+		{
+			memcpy(buf + state->headerSize + state->recordSize * bl.numChildren[0], key, state->keySize);
+			memcpy(buf + state->headerSize + state->recordSize * bl.numChildren[0] + state->keySize, data, state->dataSize);
+		}
+		bl.numChildren[0]++;
+		state->numRecords++;
+		vmtreeBloomAdd(state, key);
+		memcpy(state->tempKey2, key, state->keySize);
+	}
+
+	if (bl.levels == 0)
+		return 0;		/* No records. Keep empty root. */
+
+	/* Write last node at each level from the bottom up. Top node is the root. */
+	for (uint8_t l=0; l < bl.levels; l++)
+	{
+		if (vmtreeBulkLoadWriteNode(state, &bl, l, l == bl.levels-1) != 0)
+			return -1;
+	}
+
+	state->levels = bl.levels;
+	state->activePath[0] = bl.lastPageId[bl.levels-1];
+	state->appendPath = 0;
+	return 0;
+}
+
+/**
+@brief     	Flushes output buffer and writes a checkpoint if checkpoints are enabled. Sorted runs are compacted into the tree.
+@param     	state
+                VMTree algorithm state structure
+*/
+int8_t vmtreeFlush(vmtreeState *state)
+{	
+	if (vmtreeCheckpointEnsureSpace(state, (state->maxLogRecords + state->runPages * state->runRecordsPerPage) * 2) != 0)
+		return -1;
+	vmtreeLogApply(state);
+	vmtreeRunCompact(state);
+	vmtreeDeltaMergeAll(state);
+
+	/* Write pages held in buffer by write-back */
+	dbbufferFlush(state->buffer);
+
+	if (state->buffer->checkpointPages > 0)
+		return vmtreeCheckpoint(state);
+	return 0;
+}
+
+/**
+@brief     	Copies bytes between memory and a checkpoint slot through buffer page 0.
+			Checkpoint pages are read when first reached and written when filled.
+@param     	state
+                VMTree algorithm state structure
+@param		pageNum
+				physical page id of first page of checkpoint slot
+@param		pos
+				byte offset in checkpoint. Advanced by number of bytes copied.
+@param		data
+				memory to copy from (write) or to (read). NULL if bytes read are only added to checksum.
+@param		len
+				number of bytes to copy
+@param		write
+				1 to write to storage, 0 to read
+@param		checksum
+				FNV-1a hash updated with bytes copied (NULL if not hashed)
+@return		Return 0 if success, -1 if error.
+*/
+int8_t vmtreeCheckpointCopy(vmtreeState *state, id_t pageNum, id_t *pos, void *data, id_t len, int8_t write, uint32_t *checksum)
+{
+	dbbuffer *buffer = state->buffer;
+	uint8_t *page = (uint8_t*) buffer->buffer;
+	uint8_t *ptr = (uint8_t*) data;
+
+	while (len > 0)
+	{
+		count_t offset = *pos % buffer->pageSize;
+		count_t num = buffer->pageSize - offset;
+		id_t loc = *pos / buffer->pageSize;
+		if (num > len)
+			num = len;
+		if (loc >= buffer->checkpointPages)
+			return -1;
+
+		if (!write && offset == 0)
+		{
+			if (buffer->storage->readPage(buffer->storage, pageNum + loc, buffer->pageSize, page) != 0)
+				return -1;
+			buffer->numReads++;
+		}
+		if (write)
+			memcpy(page + offset, ptr, num);
+		else if (ptr != NULL)
+			memcpy(ptr, page + offset, num);
+
+		if (checksum != NULL)
+		{
+			for (count_t i=0; i < num; i++)
+			{
+				*checksum ^= page[offset+i];
+				*checksum *= 16777619u;
+			}
+		}
+
+		if (ptr != NULL)
+			ptr += num;
+		*pos += num;
+		len -= num;
+
+		if (write && *pos % buffer->pageSize == 0)
+		{	/* Page is full */
+			if (buffer->storage->writePage(buffer->storage, pageNum + loc, buffer->pageSize, page) != 0)
+				return -1;
+			buffer->numWrites++;
+		}
+	}
+	return 0;
+}
+
+/**
+@brief     	Writes, verifies, or loads a checkpoint slot. Checkpoint is the header followed by the mapping table,
+			mapping page information, free space bitmap, FTL directory and physical free space, and a checksum of all previous bytes.
+@param     	state
+                VMTree algorithm state structure
+@param		pageNum
+				physical page id of first page of checkpoint slot
+@param		header
+				checkpoint header to write or header read
+@param		mode
+				0 to verify checksum and read header only, 1 to verify and load state, 2 to write
+@return		Return 0 if success, -1 if error or checkpoint is not valid.
+*/
+int8_t vmtreeCheckpointStream(vmtreeState *state, id_t pageNum, vmtreeCheckpointHeader *header, int8_t mode)
+{
+	dbbuffer *buffer = state->buffer;
+	int8_t write = (mode == 2);
+	id_t pos = 0;
+	uint32_t checksum = 2166136261u, stored;
+
+	void *data[] = {header, state->mappingBuffer, state->spillPages, state->spillLive, state->spillSummary,
+					buffer->freePages, buffer->ftlDirectory, buffer->ftlFreePhysical};
+	id_t size[] = {sizeof(vmtreeCheckpointHeader), state->mappingBuffer != NULL ? (id_t) state->maxMappings * 2 * state->mappingIdSize : 0,
+					sizeof(state->spillPages), sizeof(state->spillLive), sizeof(state->spillSummary), buffer->storage->size/8+1,
+					buffer->ftlCachePages > 0 ? sizeof(id_t)*buffer->ftlNumTablePages : 0, buffer->ftlCachePages > 0 ? buffer->ftlEndPhysicalPage/8+1 : 0};
+
+	for (uint8_t i=0; i < sizeof(size)/sizeof(id_t); i++)
+	{
+		if (vmtreeCheckpointCopy(state, pageNum, &pos, (mode != 0 || i == 0) ? data[i] : NULL, size[i], write, &checksum) != 0)
+			return -1;
+
+		/* Checkpoint must be for a tree with same configuration */
+		if (i == 0 && !write && (header->magic != VMTREE_CHECKPOINT_MAGIC || header->parameters != state->parameters
+			|| header->endDataPage != buffer->endDataPage || header->maxMappings != state->maxMappings || header->mappingIdSize != state->mappingIdSize
+			|| header->msgRecords != state->msgRecords))
+			return -1;
+	}
+
+	stored = checksum;
+	if (vmtreeCheckpointCopy(state, pageNum, &pos, &stored, sizeof(uint32_t), write, NULL) != 0)
+		return -1;
+
+	if (write)
+	{	/* Write last partially filled page */
+		if (pos % buffer->pageSize != 0)
+		{
+			if (buffer->storage->writePage(buffer->storage, pageNum + pos / buffer->pageSize, buffer->pageSize, buffer->buffer) != 0)
+				return -1;
+			buffer->numWrites++;
+		}
+		return 0;
+	}
+	return stored == checksum ? 0 : -1;
+}
+
+/**
+@brief     	Writes a checkpoint of tree state, mapping table, and free space to storage.
+			Pages updated in buffer are written first. Records in log buffer are not included (use vmtreeFlush()).
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success, -1 if checkpoints are not enabled or error.
+*/
+int8_t vmtreeCheckpoint(vmtreeState *state)
+{
+	dbbuffer *buffer = state->buffer;
+	vmtreeCheckpointHeader header;
+
+	if (buffer->checkpointPages == 0)
+		return -1;
+
+	/* Write-ahead log restarts after checkpoint so its records must be in tree */
+	if (state->walPages > 0)
+		vmtreeRunCompact(state);
+
+	/* Delta records are not recovered so leaves are written with them */
+	vmtreeDeltaMergeAll(state);
+
+	/* Checkpoint describes storage so pages held in buffer (and FTL table pages) must be written */
+	dbbufferFlush(buffer);
+
+	memset(&header, 0, sizeof(vmtreeCheckpointHeader));
+	header.magic = VMTREE_CHECKPOINT_MAGIC;
+	header.sequence = state->checkpointSequence+1;
+	header.parameters = state->parameters;
+	header.levels = state->levels;
+	header.mappingIdSize = state->mappingIdSize;
+	header.numSpillPages = state->numSpillPages;
+	header.maxMappings = state->maxMappings;
+	header.numMappings = state->numMappings;
+	header.msgRecords = state->msgRecords;
+	header.endDataPage = buffer->endDataPage;
+	header.root = state->activePath[0];
+	header.nextPageId = buffer->nextPageId;
+	header.nextPageWriteId = buffer->nextPageWriteId;
+	header.erasedStartPage = buffer->erasedStartPage;
+	header.erasedEndPage = buffer->erasedEndPage;
+	header.numNodes = state->numNodes;
+	header.numRecords = state->numRecords;
+	header.ftlNextPhysicalPage = buffer->ftlNextPhysicalPage;
+	header.walFirst = state->walNext;
+
+	/* FTL physical pages released since previous checkpoint are free in this one */
+	dbbufferFtlReuseReleased(buffer);
+
+	/* Alternate slots so the previous checkpoint is valid until this one is complete */
+	id_t pageNum = buffer->checkpointStart + (header.sequence % 2) * buffer->checkpointPages;
+	initBufferPage(buffer, 0);
+	if (buffer->storage->erasePages(buffer->storage, pageNum, pageNum + buffer->checkpointPages - 1) != 0
+		|| vmtreeCheckpointStream(state, pageNum, &header, 2) != 0)
+	{
+		printf("ERROR: Unable to write checkpoint: %lu\n", header.sequence);
+		return -1;
+	}
+	buffer->storage->flush(buffer->storage);
+	state->checkpointSequence = header.sequence;
+	state->checkpointPageWriteId = header.nextPageWriteId;
+	state->walFirst = state->walNext;
+	return 0;
+}
+
+/**
+@brief     	Writes a checkpoint if writing the given number of pages could reach pages written after the last checkpoint.
+			Recovery replays those pages so the writer must not wrap around to them. Space for the pages written by the
+			next checkpoint is also reserved.
+@param     	state
+                VMTree algorithm state structure
+@param		pages
+				Number of pages that may be written before the next check
+@return		Return 0 if success, -1 if error writing checkpoint.
+*/
+int8_t vmtreeCheckpointEnsureSpace(vmtreeState *state, id_t pages)
+{
+	dbbuffer *buffer = state->buffer;
+
+	/* FTL does not replay pages. Physical pages released after the checkpoint are not reused until the next one. */
+	if (buffer->checkpointPages == 0 || buffer->ftlCachePages > 0)
+		return 0;
+
+	/* Checkpoint writes pages held by write-back. With a write-ahead log, log buffer and sorted runs are inserted first. */
+	pages += buffer->maxDirtyPages;
+	if (state->walPages > 0)
+		pages += (state->maxLogRecords + state->runPages * state->runRecordsPerPage) * 2;
+
+	/* Writer must not erase the block containing the first page written after the checkpoint */
+	id_t size = buffer->endDataPage+1, num = 0;
+	id_t first = (state->checkpointPageWriteId+1) % size, page = buffer->nextPageWriteId;
+	for (id_t n=(buffer->nextPageWriteId + size - state->checkpointPageWriteId) % size; n < size - first % buffer->eraseSizeInPages; n++)
+	{
+		page = page >= buffer->endDataPage ? 0 : page+1;
+		if (dbbufferIsFree(buffer, page) && vmtreeGetMapping(state, page) == page && ++num >= pages)
+			return 0;
+	}
+	return vmtreeCheckpoint(state);
+}
+
+/**
+@brief     	Returns number of levels in tree with given interior root by following leftmost children.
+			Interior nodes other than the root are flagged so the leaf level is found without knowing the height.
+@param     	state
+                VMTree algorithm state structure
+@param		pageNum
+				physical page id of root
+*/
+uint8_t vmtreeRecoverLevels(vmtreeState *state, id_t pageNum)
+{
+	uint8_t levels = 1;
+	int16_t slot;
+	id_t childId;
+	void *buf = readPage(state->buffer, pageNum);
+
+	while (buf != NULL && levels < MAX_LEVEL)
+	{
+		if (levels > 1 && VMTREE_GET_FLAGS(buf) != 10000)
+			break;		/* Leaf */
+		if (vmtreeLeftmostChild(state, buf, &slot, &childId) == 0 || slot == -1)
+			break;
+		levels++;
+		buf = readPage(state->buffer, vmtreeGetMapping(state, childId));
+	}
+	return levels;
+}
+
+/**
+@brief     	Marks mappings and mapping page entries for child pointers of interior nodes in a subtree.
+@param     	state
+                VMTree algorithm state structure
+@param		pageNum
+				physical page id of interior node
+@param		level
+				level of node (0 is root)
+@param		marks
+				bit per mapping table slot set if a node points to the mapping
+@param		spillMarks
+				bit per mapping page entry set if a node points to the mapping
+*/
+void vmtreeRecoverMark(vmtreeState *state, id_t pageNum, uint8_t level, bitarr marks, uint64_t *spillMarks)
+{
+	id_t child;
+	int8_t slot;
+	count_t entry;
+
+	for (count_t c=0; c <= state->maxInteriorRecordsPerPage; c++)
+	{	/* Node is read for each child as reading subtree may replace it in buffer */
+		void *buf = readPage(state->buffer, pageNum);
+		if (buf == NULL || c > VMTREE_GET_COUNT(buf))
+			return;
+		memcpy(&child, buf + state->interiorHeaderSize + state->keySize * state->maxInteriorRecordsPerPage + sizeof(id_t)*c, sizeof(id_t));
+
+		int16_t loc = vmtreeGetMappingIndex(state, child);
+		if (loc != -1)
+			bitarrSet(marks, loc, 1);
+		else if (state->numSpillPages > 0 && vmtreeSpillFind(state, child, &slot, &entry) == 0)
+			spillMarks[slot] |= (uint64_t) 1 << entry;
+
+		if (level+2 < state->levels)
+			vmtreeRecoverMark(state, vmtreeGetMapping(state, child), level+1, marks, spillMarks);
+	}
+}
+
+/**
+@brief     	Removes mappings that no interior node points to. Replay cannot see every mapping the writer removed
+			(e.g. mapping of a node that was split) so these are found by reading the interior nodes of the tree.
+			Uses the erase block buffer for a bit per mapping table slot.
+@param     	state
+                VMTree algorithm state structure
+*/
+void vmtreeRecoverSweep(vmtreeState *state)
+{
+	dbbuffer *buffer = state->buffer;
+	bitarr marks = buffer->blockBuffer;
+	uint64_t spillMarks[MAX_SPILL_PAGES];
+
+	if (state->levels < 2 || (id_t) buffer->eraseSizeInPages * buffer->pageSize * 8 < state->maxMappings)
+		return;
+
+	memset(marks, 0, (state->maxMappings+7)/8);
+	memset(spillMarks, 0, sizeof(spillMarks));
+	vmtreeRecoverMark(state, state->activePath[0], 0, marks, spillMarks);
+
+	/* Delete unmarked mappings. Mappings after deleted slot move back one slot (as in vmtreeDeleteMappingIndex()) along with their marks. */
+	for (int16_t i=0; i < state->maxMappings; )
+	{
+		if (vmtreeMappingGet(state, i, 0) == EMPTY_MAPPING || bitarrGet(marks, i))
 		{
-			mkey = buffer+state->headerSize;   /* Key at index 0 */
-			compare = state->compareKey(key, mkey);
-			if (compare < 0)
-				return 0;
-			return 1;		
+			i++;
+			continue;
 		}
-		
-		first = 0;	
-  		last =  count;
-		if (last > state->maxInteriorRecordsPerPage)
-			last = state->maxInteriorRecordsPerPage;
-  		middle = (first+last)/2;
-		while (first < last) 
-		{			
-			mkey = buffer+state->headerSize+state->keySize*middle;
-			compare = state->compareKey(key,mkey);
-			if (compare > 0)
-				first = middle + 1;
-			else if (compare == 0) 
-			{	last = middle+1; /* Return the child pointer just after */
-				break;
-			}				
-			else
-				last = middle;  /* Note: Not -1 as always want last pointer to be <= key so that will use it if necessary */
+		int16_t loc = i, next = (i+1) % state->maxMappings;
+		while (next != i && vmtreeMappingGet(state, next, 0) != EMPTY_MAPPING && vmtreeMappingDistance(state, next) > 0)
+		{
+			vmtreeMappingCopy(state, loc, next);
+			bitarrSet(marks, loc, bitarrGet(marks, next));
+			loc = next;
+			next = (next+1) % state->maxMappings;
+		}
+		vmtreeMappingSet(state, loc, 0, EMPTY_MAPPING);
+		state->numMappings--;
+	}
+
+	for (int8_t s=0; s < MAX_SPILL_PAGES; s++)
+	{
+		if (state->spillPages[s] == EMPTY_MAPPING)
+			continue;
+		state->spillLive[s] &= spillMarks[s];
+		if (state->spillLive[s] == 0)
+		{
+			dbbufferSetFree(buffer, state->spillPages[s]);
+			if (state->spillBufferPage == state->spillPages[s])
+				state->spillBufferPage = EMPTY_MAPPING;
+			state->spillPages[s] = EMPTY_MAPPING;
+			state->numSpillPages--;
+		}
+	}
+}
+
+/**
+@brief     	Replays a mapping page written after the checkpoint. Its mappings were moved from the mapping table
+			or from the mapping page it was merged with, so they are removed from there and the page is added as a mapping page.
+@param     	state
+                VMTree algorithm state structure
+@param		pageNum
+				physical page id of mapping page
+@param		buf
+				buffer containing mapping page
+@param		pending
+				mappings that did not fit in mapping table during replay (previous and current page id)
+@param		numPending
+				number of pending mappings
+*/
+void vmtreeReplayMappingPage(vmtreeState *state, id_t pageNum, void *buf, id_t pending[][2], uint8_t *numPending)
+{
+	id_t prev, curr;
+	int8_t slot, merged = -1;
+	count_t entry;
+	uint64_t replaced = 0;
+
+	if (state->spillBuffer == NULL)
+		return;		/* Mappings remain in mapping table */
+
+	for (count_t e=0; e < VMTREE_GET_COUNT(buf); e++)
+	{
+		memcpy(&prev, buf + VMTREE_COUNT_OFFSET + sizeof(count_t) + e * 2 * sizeof(id_t), sizeof(id_t));
+		memcpy(&curr, buf + VMTREE_COUNT_OFFSET + sizeof(count_t) + e * 2 * sizeof(id_t) + sizeof(id_t), sizeof(id_t));
+		int16_t loc = vmtreeGetMappingIndex(state, prev);
+		uint8_t p;
+		for (p=0; p < *numPending && pending[p][0] != prev; p++);
+
+		if (p < *numPending && pending[p][1] == curr)
+		{	/* Pending mapping was added then spilled */
+			(*numPending)--;
+			pending[p][0] = pending[*numPending][0];
+			pending[p][1] = pending[*numPending][1];
+			continue;
+		}
+
+		if (p < *numPending)
+			replaced |= (uint64_t) 1 << e;		/* Writer replaces mapping with pending mapping after spilling */
+
+		if (loc != -1)
+			vmtreeDeleteMappingIndex(state, loc);
+		else if (state->numSpillPages > 0 && vmtreeSpillFind(state, prev, &slot, &entry) == 0)
+		{
+			merged = slot;
+			vmtreeSpillDelete(state, prev);
+		}
+	}
+
+	if (merged != -1 && state->spillPages[merged] != EMPTY_MAPPING)
+	{	/* Writer freed the merged page. Its remaining mappings were no longer used. */
+		dbbufferSetFree(state->buffer, state->spillPages[merged]);
+		if (state->spillBufferPage == state->spillPages[merged])
+			state->spillBufferPage = EMPTY_MAPPING;
+		state->spillPages[merged] = EMPTY_MAPPING;
+		state->numSpillPages--;
+	}
+
+	for (slot=0; slot < MAX_SPILL_PAGES && state->spillPages[slot] != EMPTY_MAPPING; slot++);
+	if (slot == MAX_SPILL_PAGES)
+	{
+		printf("ERROR: No slot for mapping page: %lu\n", pageNum);
+		return;
+	}
+	memcpy(state->spillBuffer, buf, state->buffer->pageSize);
+	vmtreeSpillAddPage(state, slot, pageNum);
+
+	state->spillLive[slot] &= ~replaced;
+	if (state->spillLive[slot] == 0)
+	{
+		dbbufferSetFree(state->buffer, pageNum);
+		state->spillBufferPage = EMPTY_MAPPING;
+		state->spillPages[slot] = EMPTY_MAPPING;
+		state->numSpillPages--;
+	}
+}
+
+/**
+@brief     	Adds mapping for a node replayed after the checkpoint. Mappings that do not fit are kept pending
+			until a replayed mapping page makes space or a replayed parent points to the node directly.
+@param     	state
+                VMTree algorithm state structure
+@param		prevPage
+				previous physical page index
+@param		currPage
+				current physical page index
+@param		pending
+				mappings that did not fit in mapping table during replay (previous and current page id)
+@param		numPending
+				number of pending mappings
+*/
+void vmtreeReplayMapping(vmtreeState *state, id_t prevPage, id_t currPage, id_t pending[][2], uint8_t *numPending)
+{
+	id_t old = vmtreeGetMapping(state, prevPage);
+	uint8_t p;
+
+	for (p=0; p < *numPending && pending[p][0] != prevPage; p++);
+	if (p < *numPending)
+	{
+		old = pending[p][1];
+		(*numPending)--;
+		pending[p][0] = pending[*numPending][0];
+		pending[p][1] = pending[*numPending][1];
+	}
+
+	/* Previous copy of node was freed when node was written */
+	if (old != currPage)
+		dbbufferSetFree(state->buffer, old);
+
+	if (vmtreeAddMapping(state, prevPage, currPage) == 0)
+		return;
+	if (*numPending >= 2*MAX_LEVEL)
+	{
+		printf("ERROR: Too many pending mappings during recovery.\n");
+		return;
+	}
+	pending[*numPending][0] = prevPage;
+	pending[*numPending][1] = currPage;
+	(*numPending)++;
+}
+
+/**
+@brief     	Removes mappings in mapping pages on storage whose current page is a child of a replayed interior node.
+			Writer removes these mappings when the node is written pointing to the child directly.
+@param     	state
+                VMTree algorithm state structure
+@param		buf
+				buffer containing interior node
+*/
+void vmtreeReplaySpillChildren(vmtreeState *state, void *buf)
+{
+	void *ptrs = buf + state->interiorHeaderSize + state->keySize * state->maxInteriorRecordsPerPage;
+	id_t curr, child;
+
+	for (int8_t s=0; s < MAX_SPILL_PAGES; s++)
+	{
+		if (state->spillPages[s] == EMPTY_MAPPING)
+			continue;
+
+		if (state->spillBufferPage != state->spillPages[s])
+		{
+			if (state->buffer->storage->readPage(state->buffer->storage, state->spillPages[s], state->buffer->pageSize, state->spillBuffer) != 0)
+			{
+				printf("ERROR reading mapping page: %lu\n", state->spillPages[s]);
+				state->spillBufferPage = EMPTY_MAPPING;
+				continue;
+			}
+			state->buffer->numReads++;
+			state->spillBufferPage = state->spillPages[s];
+		}
+
+		for (count_t e=0; e < VMTREE_GET_COUNT(state->spillBuffer); e++)
+		{
+			if (((state->spillLive[s] >> e) & 1) == 0)
+				continue;
+			memcpy(&curr, vmtreeSpillEntry(state, e) + sizeof(id_t), sizeof(id_t));
+			for (count_t c=0; c <= VMTREE_GET_COUNT(buf) && c <= state->maxInteriorRecordsPerPage; c++)
+			{
+				memcpy(&child, ptrs + sizeof(id_t)*c, sizeof(id_t));
+				if (child == curr)
+				{
+					state->spillLive[s] &= ~((uint64_t) 1 << e);
+					break;
+				}
+			}
+		}
+
+		if (state->spillLive[s] == 0)
+		{	/* All mappings drained */
+			dbbufferSetFree(state->buffer, state->spillPages[s]);
+			state->spillBufferPage = EMPTY_MAPPING;
+			state->spillPages[s] = EMPTY_MAPPING;
+			state->numSpillPages--;
+		}
+	}
+}
+
+/**
+@brief     	Replays pages written after the checkpoint. Pages are written in page id order starting after the
+			checkpoint write location, so the scan ends at the first page the writer would have used that does not have the next page id.
+			Replayed pages are marked valid. For VMTREE, replayed nodes free their previous copy and add mappings, replayed
+			interior nodes remove mappings that they make unnecessary, and replayed mapping pages move mappings out of the table.
+@param     	state
+                VMTree algorithm state structure
+@param		num
+				Returns number of pages replayed
+@return		Return 0 if success, -1 if the writer wrapped around and overwrote pages written after the checkpoint.
+*/
+int8_t vmtreeReplay(vmtreeState *state, id_t *num)
+{
+	dbbuffer *buffer = state->buffer;
+	void *buf = buffer->buffer;
+	id_t pageNum = buffer->nextPageWriteId, lastPage = buffer->nextPageWriteId, prev, child, id;
+	id_t pending[2*MAX_LEVEL][2];
+	uint8_t numPending = 0, newRoot = 0;
+
+	/* Pages erased before the checkpoint contain erased data or pages written after the checkpoint */
+	id_t size = buffer->endDataPage+1;
+	id_t erased = (buffer->erasedEndPage + size - buffer->nextPageWriteId) % size;
+
+	*num = 0;
+	for (id_t n=0; n <= buffer->endDataPage; n++)
+	{
+		pageNum = pageNum >= buffer->endDataPage ? 0 : pageNum+1;
+		if (buffer->storage->readPage(buffer->storage, pageNum, buffer->pageSize, buf) != 0)
+			break;
+		buffer->numReads++;
 
-			middle = (first + last)/2;
+		id = VMTREE_GET_ID(buf);
+		if (id != buffer->nextPageId)
+		{
+			if (n < erased && id > buffer->nextPageId && id != (id_t) -1)
+			{	/* Page was written after the page expected here so checkpoint tree may have been overwritten */
+				printf("ERROR: Page: %lu  Id: %lu  Expected: %lu. Storage was written around since checkpoint.\n", pageNum, id, buffer->nextPageId);
+				return -1;
+			}
+			if (dbbufferIsFree(buffer, pageNum) && vmtreeGetMapping(state, pageNum) == pageNum)
+				break;		/* Writer would have written next page here */
+			continue;
 		}
-		return last;		
-	}
-	else
-	{
-		first = 0;	
-  		last =  count - 1;
-  		middle = (first+last)/2;	
 
-		while (first <= last) 
-		{			
-			mkey = buffer+state->headerSize+state->recordSize*middle;		
-			compare = state->compareKey(mkey, key);
-			
-			if (compare < 0)
-				first = middle + 1;
-			else if (compare == 0) 
-				return middle;							
-			else
-				last = middle - 1;
+		dbbufferSetValid(buffer, pageNum);
+		buffer->nextPageId++;
+		lastPage = pageNum;
+		(*num)++;
 
-			middle = (first + last)/2;
+		count_t flags = VMTREE_GET_FLAGS(buf);
+		prev = VMTREE_GET_PREV(buf);
+		if (flags >= VMTREE_MAPPING_PAGE)
+		{
+			vmtreeReplayMappingPage(state, pageNum, buf, pending, &numPending);
 		}
-		if (range)			
-		{	// return middle;
-			if (last == -1)
-				return -1;
-			return middle;
+		else if (flags >= 20000)
+		{	/* Root. Previous copy is freed unless updated in place. */
+			if (state->parameters == VMTREE && state->activePath[0] != pageNum)
+				dbbufferSetFree(buffer, state->activePath[0]);
+			state->activePath[0] = pageNum;
+			if (prev == PREV_ID_CONSTANT || state->parameters != VMTREE)
+			{	/* New root above split nodes. Other variants update root in place so only write a new root on split. */
+				newRoot = 1;
+				if (state->levels < 2)
+					state->levels = 2;
+			}
 		}
-		return -1;
+		else if (state->parameters == VMTREE && prev < PREV_ID_CONSTANT)
+		{
+			vmtreeReplayMapping(state, prev, pageNum, pending, &numPending);
+		}
+
+		if (state->parameters == VMTREE && (flags == 10000 || (flags == 20000 && state->levels > 1)))
+		{	/* Mappings to a child that interior node points to directly are no longer needed */
+			void *ptrs = buf + state->interiorHeaderSize + state->keySize * state->maxInteriorRecordsPerPage;
+			for (count_t c=0; c <= VMTREE_GET_COUNT(buf) && c <= state->maxInteriorRecordsPerPage; c++)
+			{
+				memcpy(&child, ptrs + sizeof(id_t)*c, sizeof(id_t));
+				for (int16_t i=0; i < state->maxMappings; i++)
+				{
+					if (vmtreeMappingGet(state, i, 0) != EMPTY_MAPPING && vmtreeMappingGet(state, i, 1) == child)
+					{
+						vmtreeDeleteMappingIndex(state, i);
+						break;
+					}
+				}
+				for (uint8_t p=0; p < numPending; p++)
+				{
+					if (pending[p][1] == child)
+					{	/* Writer replaced any spilled mapping when the mapping was added */
+						vmtreeSpillDelete(state, pending[p][0]);
+						numPending--;
+						pending[p][0] = pending[numPending][0];
+						pending[p][1] = pending[numPending][1];
+						break;
+					}
+				}
+			}
+			if (state->numSpillPages > 0)
+				vmtreeReplaySpillChildren(state, buf);
+		}
+
+		/* Retry mappings that did not fit */
+		for (uint8_t p=0; p < numPending; )
+		{
+			if (vmtreeAddMapping(state, pending[p][0], pending[p][1]) == 0)
+			{
+				numPending--;
+				pending[p][0] = pending[numPending][0];
+				pending[p][1] = pending[numPending][1];
+			}
+			else
+				p++;
+		}
+	}
+
+	if (*num == 0)
+		return 0;
+
+	/* Writer erased blocks ahead of pages it wrote */
+	if ((lastPage + size - buffer->nextPageWriteId) % size > (buffer->erasedEndPage + size - buffer->nextPageWriteId) % size)
+	{
+		buffer->erasedStartPage = lastPage / buffer->eraseSizeInPages * buffer->eraseSizeInPages;
+		buffer->erasedEndPage = buffer->erasedStartPage + buffer->eraseSizeInPages - 1;
+	}
+	buffer->nextPageWriteId = lastPage;
+
+	/* Mappings still pending are spilled now that writing after the last replayed page is safe */
+	for (uint8_t p=0; p < numPending; p++)
+	{
+		if (vmtreeAddMapping(state, pending[p][0], pending[p][1]) != 0
+			&& (vmtreeSpillMappings(state, pending[p][0]) != 0 || vmtreeAddMapping(state, pending[p][0], pending[p][1]) != 0))
+			printf("ERROR: Unable to recover mapping: %lu -> %lu\n", pending[p][0], pending[p][1]);
 	}
+
+	if (newRoot)
+		state->levels = vmtreeRecoverLevels(state, state->activePath[0]);
+	if (state->parameters == VMTREE && state->numMappings + state->numSpillPages > 0)
+		vmtreeRecoverSweep(state);
+	return 0;
 }
 
 /**
-@brief     	Given a child link, returns the proper physical page id.
-			This method handles the mapping of the active path where the pointer in the
-			node is not actually pointing to the most up to date block.			
+@brief     	Inserts log buffer records recovered from write-ahead log into tree. Records already in tree with same data
+			were inserted before failure and are skipped.
 @param     	state
                 VMTree algorithm state structure
-@param		buf
-				Buffer containing node
-@param     	pageId
-                Page id for node
-@param     	level
-                Level of node in tree
-@param		childNum
-				Child pointer index
-@return		Return pageId if success or -1 if not valid.
+@return		Number of records inserted.
 */
-id_t getChildPageId(vmtreeState *state, void *buf, id_t pageId, int8_t level, id_t childNum)
-{		
-	/* Retrieve page number for child */
-	id_t nextId;
-	memcpy(&nextId, (id_t*) (buf + state->interiorHeaderSize + state->keySize*state->maxInteriorRecordsPerPage + sizeof(id_t)*childNum), sizeof(id_t));
-	if (state->parameters != OVERWRITE)
+id_t vmtreeRecoverLogBatch(vmtreeState *state)
+{
+	for (count_t i=0; i < state->numLogRecords; )
 	{
-		// if (nextId == 0 && childNum==(VMTREE_GET_COUNT(buf)))	/* Last child which is empty */
-		if (childNum > (VMTREE_GET_COUNT(buf)))	/* Last child which is empty */
-			return -1;
+		void *ptr = state->logBuffer + state->recordSize * i;
+		if (vmtreeGetTree(state, ptr, state->tempData) == 0 && memcmp(state->tempData, ptr + state->keySize, state->dataSize) == 0)
+		{	/* Log buffer is unsorted so move last record into free spot */
+			state->numLogRecords--;
+			memcpy(ptr, state->logBuffer + state->recordSize * state->numLogRecords, state->recordSize);
+		}
+		else
+			i++;
 	}
 
-	/* Perform mapping */	
-	nextId = vmtreeGetMapping(state, nextId);
-	return nextId;
+	id_t num = state->numLogRecords;
+	for (count_t i=0; i < state->numLogRecords; i++)
+		vmtreeBloomAdd(state, state->logBuffer + state->recordSize * i);
+	state->numRecords += num;
+	vmtreeLogApply(state);
+	return num;
 }
 
 /**
-@brief     	Given a key, returns data associated with key.
-			Note: Space for data must be already allocated.
-			Data is copied from database into data buffer.
+@brief     	Inserts records of write-ahead log pages written after the checkpoint loaded by vmtreeRecover().
+			Call after vmtreeRecover() once compareKey is set. Log pages are read in order. A log page replaces earlier copies
+			of the same log buffer page and a new batch number means the previous batch was being inserted into the tree.
+			A checkpoint is written after inserting the records so the log restarts.
 @param     	state
                 VMTree algorithm state structure
-@param     	key
-                Key for record
-@param     	data
-                Pre-allocated memory to copy data for record
-@return		Return 0 if success. Non-zero value if error.
+@return		Number of records inserted.
 */
-int8_t vmtreeGet(vmtreeState *state, void* key, void *data)
+id_t vmtreeRecoverLog(vmtreeState *state)
 {
-	/* Starting at root search for key */
-	int8_t l;
-	void *buf;
-	id_t childNum, nextId = state->activePath[0];	
+	dbbuffer *buffer = state->buffer;
+	id_t num = 0, batch = 0;
+	count_t logPage, count;
+	int8_t found = 0;
 
-	for (l=0; l < state->levels-1; l++)
-	{	
-		buf = readPage(state->buffer, nextId);						
-		if (buf == NULL)
-			return -1;
-		/* Find the key within the node. Sorted by key. Use binary search. */
-		childNum = vmtreeSearchNode(state, buf, key, nextId, 0);
-		nextId = getChildPageId(state, buf, nextId, l, childNum);			
-		if (nextId == -1)
-			return -1;		
-	}
+	if (state->walPages == 0)
+		return 0;
 
-	/* Search the leaf node and return search result */		
-	buf = readPage(state->buffer, nextId);	
-	if (buf == NULL)
-		return -1;
+	state->numLogRecords = 0;
+	for (state->walNext = state->walFirst; state->walNext - (state->walFirst - state->walFirst % buffer->eraseSizeInPages) < buffer->walPages; state->walNext++)
+	{
+		void *buf = initBufferPage(buffer, 0);
+		if (buffer->storage->readPage(buffer->storage, buffer->walStart + state->walNext % buffer->walPages, buffer->pageSize, buf) != 0)
+			break;
+		buffer->numReads++;
+
+		count = VMTREE_GET_COUNT(buf);
+		memcpy(&logPage, buf + VMTREE_COUNT_OFFSET + sizeof(count_t), sizeof(count_t));
+		if (VMTREE_GET_FLAGS(buf) != VMTREE_WAL_PAGE || VMTREE_GET_PREV(buf) != state->checkpointSequence
+			|| count > state->walRecordsPerPage || (id_t) logPage * state->walRecordsPerPage + count > state->maxLogRecords)
+			break;		/* Not written after checkpoint */
+
+		if (found && VMTREE_GET_ID(buf) != batch)
+		{	/* Inserting batch uses buffer page so log page is read again */
+			num += vmtreeRecoverLogBatch(state);
+			found = 0;
+			state->walNext--;
+			continue;
+		}
+		found = 1;
+		batch = VMTREE_GET_ID(buf);
 
-	
-	nextId = vmtreeSearchNode(state, buf, key, nextId, 0);
+		memcpy(state->logBuffer + state->recordSize * logPage * state->walRecordsPerPage, buf + VMTREE_WAL_HEADER_SIZE, state->recordSize * count);
+		state->numLogRecords = logPage * state->walRecordsPerPage + count;
+	}
+	if (found)
+		num += vmtreeRecoverLogBatch(state);
+	state->walBatch = batch+1;
+	state->walCommitted = 0;
 
-	if (nextId != -1)
-	{	/* Key found */
-		if (state->parameters != OVERWRITE)
-			memcpy(data, (void*) (buf+state->headerSize+state->recordSize*nextId+state->keySize), state->dataSize);
-		else
-			memcpy(data, (void*) (buf+state->headerSize+state->dataSize*nextId+state->keySize*state->maxRecordsPerPage), state->dataSize);
-		return 0;
+	/* Page after last log page may be partially written so log continues in next erase block after a checkpoint */
+	if (num > 0 || state->walNext % buffer->eraseSizeInPages != 0)
+	{
+		state->walNext = (state->walNext + buffer->eraseSizeInPages - 1) / buffer->eraseSizeInPages * buffer->eraseSizeInPages;
+		vmtreeFlush(state);
 	}
-	return -1;
+	printf("Recovered log records: %lu\n", num);
+	return num;
 }
 
 /**
-@brief     	Flushes output buffer.
+@brief     	Initialize a VMTree structure from the last checkpoint on storage.
+			Pages written after the checkpoint are replayed in page id order. State is configured as for vmtreeInit().
+			If there is no valid checkpoint, a new empty tree is created.
 @param     	state
                 VMTree algorithm state structure
+@return		Return 0 if tree was recovered, -1 if a new tree was created.
 */
-int8_t vmtreeFlush(vmtreeState *state)
-{	
-	if (state->logBuffer != NULL)
-	{			
-		if (state->parameters == OVERWRITE)
-		{				
-			vmtreePutNorOverwriteBatch(state);
-		}
-		else
-		{				
-			vmtreePutBatch(state);
+int8_t vmtreeRecover(vmtreeState *state)
+{
+	dbbuffer *buffer = state->buffer;
+	vmtreeCheckpointHeader header;
+	int8_t slot = -1;
+	id_t sequence = 0;
+
+	vmtreeSetup(state, 1);
+
+	/* Find valid checkpoint with highest sequence number */
+	for (int8_t s=0; s < 2 && buffer->checkpointPages > 0; s++)
+	{
+		if (vmtreeCheckpointStream(state, buffer->checkpointStart + s*buffer->checkpointPages, &header, 0) == 0
+			&& (slot == -1 || header.sequence > sequence))
+		{
+			slot = s;
+			sequence = header.sequence;
 		}
-		state->numLogRecords = 0;
 	}
+
+	if (slot == -1 || vmtreeCheckpointStream(state, buffer->checkpointStart + slot*buffer->checkpointPages, &header, 1) != 0)
+	{
+		printf("No valid checkpoint. Creating new tree.\n");
+		dbbufferFormat(buffer);
+		vmtreeFormat(state);
+		return -1;
+	}
+
+	state->checkpointSequence = header.sequence;
+	state->levels = header.levels;
+	state->activePath[0] = header.root;
+	state->numMappings = header.numMappings;
+	state->numSpillPages = header.numSpillPages;
+	state->numNodes = header.numNodes;
+	state->numRecords = header.numRecords;
+	buffer->nextPageId = header.nextPageId;
+	buffer->nextPageWriteId = header.nextPageWriteId;
+	buffer->erasedStartPage = header.erasedStartPage;
+	buffer->erasedEndPage = header.erasedEndPage;
+	buffer->ftlNextPhysicalPage = header.ftlNextPhysicalPage;
+	state->walFirst = header.walFirst;
+	state->walNext = header.walFirst;
+
+	state->checkpointPageWriteId = header.nextPageWriteId;
+
+	/* FTL table pages written after checkpoint are not in checkpoint directory so only checkpoint state is recovered */
+	id_t num = 0;
+	if (buffer->ftlCachePages == 0 && vmtreeReplay(state, &num) != 0)
+	{	/* Tree loaded from checkpoint and replayed pages are discarded */
+		printf("Pages written after checkpoint were overwritten. Creating new tree.\n");
+		state->levels = 1;
+		state->numNodes = 1;
+		state->numRecords = 0;
+		state->numMappings = 0;
+		for (int16_t i=0; i < state->maxMappings; i++)
+			vmtreeMappingSet(state, i, 0, EMPTY_MAPPING);
+		state->numSpillPages = 0;
+		state->spillBufferPage = EMPTY_MAPPING;
+		for (int8_t i=0; i < MAX_SPILL_PAGES; i++)
+			state->spillPages[i] = EMPTY_MAPPING;
+		dbbufferFormat(buffer);
+		vmtreeFormat(state);
+		return -1;
+	}
+	printf("Recovered checkpoint: %lu  Root: %lu  Levels: %d  Pages replayed: %lu\n", header.sequence, state->activePath[0], state->levels, num);
+
+	if (state->bloomFilter != NULL)
+		vmtreeBloomRebuild(state);
 	return 0;
 }
 
 
+/**
+@brief     	Reads ahead the leaves after the current leaf of an iterator.
+@param     	state
+                VMTree algorithm state structure
+@param     	it
+                VMTree iterator state structure
+*/
+void vmtreeIteratorPrefetch(vmtreeState *state, vmtreeIterator *it)
+{
+	int8_t l = state->levels-1;
+	if (state->buffer->prefetchPages == 0 || state->buffer->zeroCopy || l == 0 || it->currentBuffer == NULL)
+		return;
+
+	/* Leaf is pinned so reading ahead does not replace it */
+	void *buf = dbbufferPinPage(state->buffer, it->activeIteratorPath[l]);
+	if (buf == NULL)
+		return;
+	it->currentBuffer = buf;
+	vmtreePrefetchChildren(state, it->activeIteratorPath[l-1], l-1, it->lastIterRec[l-1], it->maxKey);
+	dbbufferUnpinPage(state->buffer, buf);
+}
+
 /**
 @brief     	Initialize iterator on VMTree structure.
 @param     	state
@@ -3140,11 +7708,33 @@ void vmtreeInitIterator(vmtreeState *state, vmtreeIterator *it)
 	void *buf;	
 	id_t childNum, nextId = state->activePath[0];
 	it->currentBuffer = NULL;
+	it->logIndex = -1;
+	it->treeDone = 0;
+
+	/* Iterator only merges leaves with log buffer and sorted runs. Insert buffered messages in key range into leaves. Root may change. */
+	vmtreeMsgFlush(state, it->minKey, it->maxKey);
+	nextId = state->activePath[0];
+
+	/* Start each sorted run at last page with first key smaller than minimum key */
+	for (uint8_t r=0; r < state->numRuns; r++)
+	{
+		id_t lo = state->runStart[r], hi = lo + state->runLength[r];
+		while (it->minKey != NULL && lo < hi)
+		{
+			id_t mid = lo + (hi - lo) / 2;
+			if (state->compareKey(state->runFence + state->keySize * mid, it->minKey) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		it->runPage[r] = lo > state->runStart[r] ? lo - 1 : lo;
+		it->runRec[r] = 0;
+	}
 
 	for (l=0; l < state->levels-1; l++)
 	{		
 		it->activeIteratorPath[l] = nextId;		
-		buf = readPage(state->buffer, nextId);		
+		buf = readPageMapped(state->buffer, nextId);		
 
 		/* Find the key within the node. Sorted by key. Use binary search. */
 		childNum = vmtreeSearchNode(state, buf, it->minKey, nextId, 1);
@@ -3157,15 +7747,18 @@ void vmtreeInitIterator(vmtreeState *state, vmtreeIterator *it)
 
 	/* Search the leaf node and return search result */
 	it->activeIteratorPath[l] = nextId;	
-	buf = readPage(state->buffer, nextId);
+	buf = readPageMapped(state->buffer, nextId);
 	it->currentBuffer = buf;
 	childNum = vmtreeSearchNode(state, buf, it->minKey, nextId, 1);		
+	if (childNum == -1)
+		childNum = 0;		/* All keys in leaf are larger than search key */
 	it->lastIterRec[l] = childNum;
+	vmtreeIteratorPrefetch(state, it);
 }
 
 
 /**
-@brief     	Requests next key, data pair from iterator.
+@brief     	Requests next key, data pair in tree pages from iterator.
 @param     	state
                 vmTree algorithm state structure
 @param     	it
@@ -3174,8 +7767,9 @@ void vmtreeInitIterator(vmtreeState *state, vmtreeIterator *it)
                 Key for record (pointer returned)
 @param     	data
                 Data for record (pointer returned)
+@return		Return 1 if record returned, 0 if no more records.
 */
-int8_t vmtreeNext(vmtreeState *state, vmtreeIterator *it, void **key, void **data)
+int8_t vmtreeNextTree(vmtreeState *state, vmtreeIterator *it, void **key, void **data)
 {	
 	void *buf = it->currentBuffer;
 	int8_t l=state->levels-1;
@@ -3185,19 +7779,29 @@ int8_t vmtreeNext(vmtreeState *state, vmtreeIterator *it, void **key, void **dat
 	if (buf == NULL)
 		return 0;
 
+	/* Sorted run pages read since last call may have replaced leaf in buffer */
+	if (state->numRuns > 0)
+	{
+		buf = readPageMapped(state->buffer, it->activeIteratorPath[l]);
+		if (buf == NULL)
+			return 0;
+		it->currentBuffer = buf;
+	}
+
 	/* Iterate until find a record that matches search criteria */
 	while (1)
 	{	
 		if (it->lastIterRec[l] >= VMTREE_GET_COUNT(buf))
 		{	/* Read next page */						
 			it->lastIterRec[l] = 0;
+			dbbufferRecycleFirst(state->buffer, it->activeIteratorPath[l]);	/* Scan is finished with leaf */
 
 			while (1)
 			{
 				/* Advance to next page. Requires examining active path. */
 				for (l=state->levels-2; l >= 0; l--)
 				{	
-					buf = readPage(state->buffer, it->activeIteratorPath[l]);
+					buf = readPageMapped(state->buffer, it->activeIteratorPath[l]);
 					if (buf == NULL)
 						return 0;						
 
@@ -3222,11 +7826,13 @@ int8_t vmtreeNext(vmtreeState *state, vmtreeIterator *it, void **key, void **dat
 						return 0;	
 					
 					it->activeIteratorPath[l+1] = nextPage;
-					buf = readPage(state->buffer, nextPage);
+					buf = readPageMapped(state->buffer, nextPage);
 					if (buf == NULL)
 						return 0;	
 				}
 				it->currentBuffer = buf;
+				vmtreeIteratorPrefetch(state, it);
+				buf = it->currentBuffer;
 
 				/* TODO: Check timestamps, min/max, and bitmap to see if query range overlaps with range of records	stored in block */
 				/* If not read next block */
@@ -3249,6 +7855,121 @@ int8_t vmtreeNext(vmtreeState *state, vmtreeIterator *it, void **key, void **dat
 	}
 }
 
+/**
+@brief     	Returns next record of a sorted run for iterator without advancing past it.
+@param     	state
+                vmTree algorithm state structure
+@param     	it
+                vmTree iterator state structure
+@param		r
+				Sorted run
+@return		Pointer to record in buffer or NULL if no more records in run.
+*/
+void* vmtreeRunCurrent(vmtreeState *state, vmtreeIterator *it, uint8_t r)
+{
+	id_t end = state->runStart[r] + state->runLength[r];
+
+	while (it->runPage[r] < end)
+	{
+		void *buf = readPageMapped(state->buffer, state->buffer->runStart + it->runPage[r]);
+		if (buf == NULL)
+			return NULL;
+		if (it->runRec[r] >= VMTREE_GET_COUNT(buf))
+		{
+			it->runPage[r]++;
+			it->runRec[r] = 0;
+			continue;
+		}
+
+		void *ptr = buf + VMTREE_RUN_HEADER_SIZE + state->recordSize * it->runRec[r];
+		if (it->minKey != NULL && state->compareKey(ptr, it->minKey) < 0)
+		{
+			it->runRec[r]++;
+			continue;
+		}
+		if (it->maxKey != NULL && state->compareKey(ptr, it->maxKey) > 0)
+		{	/* Passed maximum range */
+			it->runPage[r] = end;
+			return NULL;
+		}
+		return ptr;
+	}
+	return NULL;
+}
+
+/**
+@brief     	Requests next key, data pair from iterator.
+			Records in log buffer and sorted runs not yet inserted into tree are merged with tree records in key order.
+			Equal keys are returned oldest first.
+@param     	state
+                vmTree algorithm state structure
+@param     	it
+                vmTree iterator state structure
+@param     	key
+                Key for record (pointer returned)
+@param     	data
+                Data for record (pointer returned)
+@return		Return 1 if record returned, 0 if no more records.
+*/
+int8_t vmtreeNext(vmtreeState *state, vmtreeIterator *it, void **key, void **data)
+{
+	if ((state->logBuffer == NULL || state->numLogRecords == 0) && state->numRuns == 0)
+		return vmtreeNextTree(state, it, key, data);
+
+	/* Smallest key in runs is copied as reading other pages may replace its buffer */
+	void *best = NULL;
+	uint8_t r, bestRun = state->numRuns;
+	for (r=0; r < state->numRuns; r++)
+	{
+		void *ptr = vmtreeRunCurrent(state, it, r);
+		if (ptr != NULL && (best == NULL || state->compareKey(ptr, best) < 0))
+		{
+			memcpy(state->tempKey, ptr, state->keySize);
+			best = state->tempKey;
+			bestRun = r;
+		}
+	}
+
+	int32_t logIdx = -1;
+	if (state->logBuffer != NULL && state->numLogRecords > 0)
+		logIdx = vmtreeLogNext(state, it);
+	if (logIdx != -1 && (best == NULL || state->compareKey(state->logBuffer + state->recordSize * logIdx, best) < 0))
+	{
+		best = state->logBuffer + state->recordSize * logIdx;
+		bestRun = state->numRuns;
+	}
+
+	if (!it->treeDone)
+	{
+		if (vmtreeNextTree(state, it, key, data))
+		{
+			if (best == NULL || state->compareKey(*key, best) <= 0)
+				return 1;
+			/* Buffered record is smaller. Tree record is returned again on next call. */
+			it->lastIterRec[state->levels-1]--;
+		}
+		else
+			it->treeDone = 1;
+	}
+
+	if (best == NULL)
+		return 0;
+	if (bestRun == state->numRuns)
+	{
+		it->logIndex = logIdx;
+		*key = best;
+	}
+	else
+	{
+		*key = vmtreeRunCurrent(state, it, bestRun);
+		if (*key == NULL)
+			return 0;
+		it->runRec[bestRun]++;
+	}
+	*data = *key + state->keySize;
+	return 1;
+}
+
 
 /**
 @brief     	Given a physical page number, returns 0 if valid, -1 if no longer used.
@@ -3344,6 +8065,13 @@ int8_t vmtreeIsValid(void *statePtr, id_t pageNum, id_t *parentId, void **parent
 int8_t vmtreeMovePage(void *state, id_t prev, id_t curr, void *buf)
 {
 	// vmtreePrintNodeBuffer(state, prev, 0, buf);
+	((vmtreeState*) state)->appendPath = 0;		/* Cached path may contain moved page */
+
+	/* Page in buffer includes its delta records */
+	int16_t i = vmtreeDeltaFind(state, prev);
+	if (i >= 0)
+		vmtreeDeltaRemove(state, i);
+
 	/* Update the mapping. */
 	if (VMTREE_IS_INTERIOR(buf))
 	{
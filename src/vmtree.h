@@ -49,6 +49,9 @@ extern "C" {
 
 #include "dbbuffer.h"
 
+/* Record iterator used by bulk load. Defined in testIterators/recordIterator.h. */
+struct recordIteratorState;
+
 /* Define type for page ids (physical and logical). */
 typedef uint32_t id_t;
 
@@ -65,6 +68,7 @@ typedef uint16_t count_t;
 #define VMTREE_SET_ID(x,y)  	*((id_t *) (x)) = y
 #define VMTREE_SET_PREV(x,y)  	*((id_t *) (x+sizeof(id_t))) = y
 #define VMTREE_SET_COUNT(x,y)  	*((count_t *) (x+VMTREE_COUNT_OFFSET)) = y
+#define VMTREE_GET_FLAGS(x)  	(*((count_t *) (x+VMTREE_COUNT_OFFSET)) / 10000 * 10000)
 #define VMTREE_INC_COUNT(x)  	*((count_t *) (x+VMTREE_COUNT_OFFSET)) = *((count_t *) (x+VMTREE_COUNT_OFFSET))+1
 
 /* Using count field above 10000 for interior node and 20000 for root node */
@@ -80,11 +84,6 @@ typedef uint16_t count_t;
 
 #define PREV_ID_CONSTANT		10000000
 
-/**
- * Used for double hashing on mapping table
-*/
-#define HASH_TABLE_PRIME 		7
-
 /* VMTREE implements virtual mappings and sequential writes to avoid update-in-place. */
 #define VMTREE					0
 
@@ -95,25 +94,72 @@ typedef uint16_t count_t;
 /* OVERWRITE has different page structure to avoid changing bytes already written. Records not in sorted order. */
 #define OVERWRITE				2
 
-#define MAPPING_SIZE			4
+/* FTL implements update-in-place semantics on raw NAND. Nodes have logical page ids that never change. */
+/* dbbuffer writes each update to a new physical page and changes only the page's entry in a flash-resident indirection table. */
+#define FTL						3
 
-#if MAPPING_SIZE == 8
+/* Retention modes. When limit is exceeded or storage is full, oldest (leftmost) subtrees are dropped. */
+#define RETAIN_NONE				0
+#define RETAIN_MAX_RECORDS		1		/* Keep at most retentionLimit records */
+#define RETAIN_MAX_PAGES		2		/* Keep at most retentionLimit pages (nodes) */
+#define RETAIN_MIN_KEY			3		/* Drop subtrees with all keys smaller than retentionMinKey */
 
-#define EMPTY_MAPPING			200000000
+/* Mapping table entries store previous and current page ids packed in mappingIdSize bytes each.
+   Id size is selected by vmtreeInit() from storage size so the table holds as many mappings as possible:
+   2 bytes for up to 65,534 pages, 3 bytes for up to 16,777,214 pages, otherwise 4 bytes. All bits set marks an empty slot. */
+#define EMPTY_MAPPING			UINT32_MAX
 
-typedef struct {
-	id_t prevPage;								/* Previous page index */
-	id_t currPage;								/* Current page index */
-} vmtreemapping;
-#else
+/* Mappings that do not fit in mapping table are spilled to mapping pages on storage (if spillBuffer is allocated). */
+#define MAX_SPILL_PAGES			4		/* Maximum number of mapping pages on storage */
+#define MAX_SPILL_ENTRIES		64		/* Maximum number of mappings per mapping page */
+#define SPILL_SUMMARY_SIZE		64		/* Size in bytes of in-memory Bloom filter of previous page ids of each mapping page */
+#define VMTREE_MAPPING_PAGE		30000	/* Count flag identifying a mapping page. Count is number of mappings plus this value. */
+
+/* Write-ahead log of log buffer records. A log buffer page is written to the log when it fills or when committed by the commit policy. */
+#define WAL_COMMIT_PAGE			0		/* Write log page when it is full */
+#define WAL_COMMIT_RECORD		1		/* Write log page after every insert */
+#define WAL_COMMIT_TIME			2		/* Write log page on insert if walCommitInterval has passed since last log write */
+#define VMTREE_WAL_PAGE			40000	/* Count flag identifying a log page. Count is number of records plus this value. */
+#define VMTREE_WAL_HEADER_SIZE	12		/* Log page header: 4 byte batch, 4 byte checkpoint sequence, 2 byte count, 2 byte log buffer page */
+
+#define VMTREE_MAX_RUNS			8		/* Maximum number of sorted runs of log buffer records */
+#define VMTREE_RUN_HEADER_SIZE	10		/* Run page header: 4 byte page in run area, 4 byte run, 2 byte count */
+
+/* Delta pages store small updates of many leaves. A leaf page with delta records is not rewritten and its records are merged with the delta records when read. */
+#define VMTREE_DELTA_PAGE		50000	/* Count flag identifying a delta page. Count is number of leaf sections plus this value. */
+#define VMTREE_DELTA_HEADER_SIZE 6		/* Delta page leaf section header: 4 byte leaf page id, 2 byte count of delta records */
 
-#define EMPTY_MAPPING			65535
+/* Checkpoints are written alternately to two slots at end of storage. Recovery loads the valid slot with highest sequence number. */
+#define VMTREE_CHECKPOINT_MAGIC	0x564D4350
 
 typedef struct {
-	uint16_t prevPage;							/* Previous page index */
-	uint16_t currPage;							/* Current page index */	
-} vmtreemapping;
-#endif
+	uint32_t magic;								/* VMTREE_CHECKPOINT_MAGIC */
+	id_t	sequence;							/* Incremented on each checkpoint. Slot is sequence number mod 2. */
+	uint8_t parameters;							/* Tree variant. Must match on recovery. */
+	uint8_t levels;								/* Number of levels in tree */
+	uint8_t	mappingIdSize;						/* Mapping table page id size. Must match on recovery. */
+	uint8_t	numSpillPages;						/* Number of mapping pages in use */
+	count_t maxMappings;						/* Mapping table slots. Must match on recovery. */
+	count_t numMappings;						/* Number of mappings in mapping table */
+	count_t	msgRecords;							/* Buffered messages per interior node. Must match on recovery. */
+	id_t	endDataPage;						/* Last data page. Must match on recovery. */
+	id_t	root;								/* Physical page id of root */
+	id_t	nextPageId;							/* Next logical page id to write */
+	id_t	nextPageWriteId;					/* Physical page id of last page written */
+	id_t	erasedStartPage;					/* First page of last erased block */
+	id_t	erasedEndPage;						/* Last page erased */
+	id_t	numNodes;							/* Total number of nodes in tree */
+	id_t	numRecords;							/* Number of records in tree */
+	id_t	ftlNextPhysicalPage;				/* FTL: next physical page to check for writing */
+	id_t	walFirst;							/* Number of first log page written after checkpoint */
+} vmtreeCheckpointHeader;
+
+typedef struct {
+	id_t	pageNum;							/* Physical page id of leaf */
+	id_t	pageId;								/* Logical page id of leaf when first delta record was stored. Delta records are discarded if leaf was rewritten. */
+	id_t	deltaPage;							/* Number of delta page containing all delta records of leaf */
+	count_t	count;								/* Number of delta records */
+} vmtreeDeltaEntry;
 
 typedef struct {			
 	uint8_t parameters;    						/* Parameter flags */
@@ -139,18 +185,78 @@ typedef struct {
 	id_t	mappingBufferSize;					/* Size of mapping buffer in bytes */
 	count_t numMappings;						/* Number of mappings */
 	count_t maxMappings;						/* Maximum number of mappings */
+	uint8_t	mappingIdSize;						/* Size of page id in mapping table in bytes (calculated during init()) */
 	id_t	numNodes;							/* Total number of nodes in tree */
 	id_t 	nodeSplitId;						/* Physical page id of node currently splitting during write. */
 	id_t	numMappingCompare;					/* Number of mapping comparisons */
 	id_t	numMappingWrite;					/* Number of writes trigger due to no space in mapping table */
-	int8_t	maxTries;							/* Max number of probes for mapping hash table */
+	int8_t	maxTries;							/* Max number of probes for mapping hash table. Mappings are stored less than this many slots past their home slot. */
 	id_t	savedMappingPrev;					/* Save a mapping during parent overflow fixing. Previous page id*/
 	id_t	savedMappingCurr;					/* Save a mapping during parent overflow fixing. Current page id*/
+	void*	spillBuffer;						/* Page buffer for mapping pages. Overflowing mappings are spilled to storage instead of rewriting path (optional, NULL if not used) */
+	id_t	spillBufferPage;					/* Mapping page currently in spillBuffer. EMPTY_MAPPING if none. */
+	uint8_t	numSpillPages;						/* Number of mapping pages in use */
+	id_t	spillPages[MAX_SPILL_PAGES];		/* Physical page id of each mapping page. EMPTY_MAPPING if not used. */
+	uint64_t spillLive[MAX_SPILL_PAGES];		/* Bit set for each mapping in mapping page that is still active */
+	uint8_t	spillSummary[MAX_SPILL_PAGES][SPILL_SUMMARY_SIZE];	/* Bloom filter of previous page ids stored in each mapping page */
+	id_t	numMappingSpill;					/* Number of mapping pages written */
 	void*	logBuffer;							/* Log buffer stores inserts to perform in batch */
 	id_t	logBufferSize;						/* Size of log buffer in bytes */
 	count_t maxLogRecords;						/* Maximum records stored in log buffer */
 	count_t numLogRecords;						/* Number of records currently stored in log buffer */
 	count_t currLogRecord;						/* Current log record index in log buffer */
+	uint8_t	fillFactor;							/* Percentage of each page filled by bulk load (set after init, default 100) */
+	id_t	numRecords;							/* Number of records in tree (estimated after retention drops subtrees) */
+	uint8_t	retentionMode;						/* Retention mode (set after init, default RETAIN_NONE) */
+	id_t	retentionLimit;						/* Maximum records or pages for RETAIN_MAX_RECORDS and RETAIN_MAX_PAGES */
+	void*	retentionMinKey;					/* Smallest key to retain for RETAIN_MIN_KEY. Key value may be advanced at any time. */
+	void*	retentionFence;						/* Buffer of keySize bytes for RETAIN_MIN_KEY (set after init). Caches smallest separator that allows a drop. NULL searches leftmost path on every insert. */
+	int8_t	retentionFenceValid;				/* 1 if retentionFence is current, -1 if nothing can be dropped, 0 if leftmost path must be searched */
+	id_t	retentionFenceNodes;				/* Node count when retentionFence was found. Nodes added or removed may change leftmost path. */
+	int8_t	appendPath;							/* 1 if activePath is path to rightmost leaf. Allows appending increasing keys without search. */
+	void*	bloomFilter;						/* Bloom filter on keys to avoid searching for keys not in tree (optional, NULL if not used) */
+	id_t	bloomFilterSize;					/* Size of Bloom filter in bytes */
+	uint8_t	bloomNumHashes;						/* Number of hash functions used by Bloom filter (set after init, default 3) */
+	int8_t	useCheckpoint;						/* 1 to reserve storage for checkpoints used by vmtreeRecover() (set before init) */
+	id_t	checkpointSequence;					/* Sequence number of last checkpoint written */
+	id_t	checkpointPageWriteId;				/* Physical page id of last page written before last checkpoint. Later pages are replayed by recovery. */
+	id_t	walPages;							/* Pages reserved for write-ahead log of log buffer (set before init). 0 if not used. Requires log buffer and checkpoints. */
+	uint8_t	walCommit;							/* Write-ahead log commit policy (set after init, default WAL_COMMIT_PAGE) */
+	uint32_t walCommitInterval;					/* Time between log writes for WAL_COMMIT_TIME in units of walTime() */
+	uint32_t (*walTime)(void);					/* Function returning current time for WAL_COMMIT_TIME (set after init) */
+	uint32_t walLastCommit;						/* Time of last log write */
+	count_t	walRecordsPerPage;					/* Log buffer records stored in a log page. Log buffer is sorted in runs of this size. */
+	count_t	walCommitted;						/* Number of log buffer records written to log */
+	id_t	walBatch;							/* Batch number of records in log buffer. Incremented when log buffer is applied to tree. */
+	id_t	walFirst;							/* Number of first log page after last checkpoint. Log page number modulo log pages is location in log. */
+	id_t	walNext;							/* Number of next log page to write */
+	id_t	numWalWrites;						/* Number of log pages written */
+	id_t	runPages;							/* Pages for sorted runs of log buffer records (set before init). 0 if not used. Requires log buffer. */
+	void*	runFence;							/* First key of each run page. Allocated by user with space for runPages keys. */
+	uint8_t	maxRuns;							/* Sorted runs written before they are compacted into tree (set before init). At most VMTREE_MAX_RUNS. */
+	uint8_t	numRuns;							/* Number of sorted runs. Run 0 is the oldest. */
+	id_t	runStart[VMTREE_MAX_RUNS];			/* First page of each run relative to start of run pages */
+	id_t	runLength[VMTREE_MAX_RUNS];			/* Number of pages in each run */
+	id_t	runNext;							/* Next run page to write relative to start of run pages */
+	count_t	runRecordsPerPage;					/* Records stored in a run page */
+	id_t	numRunWrites;						/* Number of run pages written */
+	id_t	numCompactions;						/* Number of times sorted runs were compacted into tree */
+	count_t	msgRecords;							/* Insert messages buffered in each parent of leaves (set before init). 0 if not used. BTREE or FTL only. Requires log buffer. */
+	void*	msgBuffer;							/* Messages of a node being flushed to leaves. Allocated by user with space for msgRecords records. */
+	id_t	numMsgWrites;						/* Number of interior node writes that buffered messages */
+	id_t	numMsgFlushes;						/* Number of times messages of a node were flushed to leaves */
+	id_t	deltaPages;							/* Pages for delta records of leaves (set before init). 0 if not used. VMTREE only. Not used with checkpoints. */
+	count_t	maxDeltas;							/* Delta records of a leaf before it is consolidated by writing it (set before init) */
+	void*	deltaBuffer;						/* Delta page being built and last delta page read. Allocated by user with space for two pages. */
+	vmtreeDeltaEntry* deltaIndex;				/* Leaves with delta records sorted by physical page id. Allocated by user with space for deltaLeaves entries. */
+	count_t	deltaLeaves;						/* Maximum number of leaves with delta records (set before init) */
+	count_t	numDeltaLeaves;						/* Number of leaves with delta records */
+	count_t	deltaUsed;							/* Bytes used in delta page being built */
+	id_t	deltaNext;							/* Number of delta page being built. Number modulo delta pages is location in delta pages. */
+	id_t	deltaReadPage;						/* Number of delta page in second page of delta buffer. EMPTY_MAPPING if none. */
+	id_t	numDeltaRecords;					/* Number of records stored as delta records instead of writing leaf */
+	id_t	numDeltaWrites;						/* Number of delta pages written */
+	id_t	numDeltaMerges;						/* Number of leaves written to release delta pages for reuse */
 } vmtreeState;
 
 typedef struct {
@@ -159,8 +265,22 @@ typedef struct {
 	void*	minKey;								/* Minimum search key (inclusive) */
 	void*	maxKey;    							/* Maximum search key (inclusive) */
 	void*   currentBuffer;						/* Current buffer used by iterator */
+	int32_t	logIndex;							/* Log buffer index of last log record returned. -1 if none. */
+	int8_t	treeDone;							/* 1 if all tree records have been returned */
+	id_t	runPage[VMTREE_MAX_RUNS];			/* Next run page of each sorted run. Past end of run if no more records. */
+	count_t	runRec[VMTREE_MAX_RUNS];			/* Next record in run page of each sorted run */
 } vmtreeIterator;
 
+typedef struct {
+	uint8_t	levels;								/* Number of levels built so far (leaves are level 0) */
+	count_t	numChildren[MAX_LEVEL];				/* Records (leaf) or children (interior) in node being built at each level */
+	id_t	numWritten[MAX_LEVEL];				/* Number of nodes written at each level */
+	id_t	lastPageId[MAX_LEVEL];				/* Physical page id of last node written at each level */
+	uint8_t	resident;							/* Levels with node in buffer page of same index. Higher levels share buffer page resident. */
+	uint8_t	sharedLevel;						/* Level of node in shared buffer page. 0 if none. */
+	id_t	savedPage[MAX_LEVEL];				/* Physical page id of partly built node saved while shared page is used by another level. EMPTY_MAPPING if none. */
+} vmtreeBulkLoadState;
+
 /**
 @brief     	Initialize a VMTree structure.
 @param     	state
@@ -168,6 +288,48 @@ typedef struct {
 */
 void vmtreeInit(vmtreeState *state);
 
+/**
+@brief     	Initialize a VMTree structure from the last checkpoint on storage.
+			Pages written after the checkpoint are replayed in page id order. State is configured as for vmtreeInit().
+			If there is no valid checkpoint, a new empty tree is created.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if tree was recovered, -1 if a new tree was created because there is no valid checkpoint
+			or pages written after the checkpoint were overwritten.
+*/
+int8_t vmtreeRecover(vmtreeState *state);
+
+/**
+@brief     	Inserts records of write-ahead log pages written after the checkpoint loaded by vmtreeRecover().
+			Call after vmtreeRecover() once compareKey is set. Records already in tree with same data are skipped.
+@param     	state
+                VMTree algorithm state structure
+@return		Number of records inserted.
+*/
+id_t vmtreeRecoverLog(vmtreeState *state);
+
+/**
+@brief     	Writes a checkpoint of tree state, mapping table, and free space to storage.
+			Pages updated in buffer are written first. Records in log buffer and sorted runs are not included (use vmtreeFlush())
+			unless a write-ahead log is used. Then they are applied to the tree first so the log restarts empty.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success, -1 if checkpoints are not enabled or error.
+*/
+int8_t vmtreeCheckpoint(vmtreeState *state);
+
+/**
+@brief     	Writes a checkpoint if writing the given number of pages could reach pages written after the last checkpoint.
+			Recovery replays those pages so the writer must not wrap around to them. Space for the pages written by the
+			next checkpoint is also reserved.
+@param     	state
+                VMTree algorithm state structure
+@param		pages
+				Number of pages that may be written before the next check
+@return		Return 0 if success, -1 if error writing checkpoint.
+*/
+int8_t vmtreeCheckpointEnsureSpace(vmtreeState *state, id_t pages);
+
 /**
 @brief     	Puts a given key, data pair into structure.
 @param     	state
@@ -184,6 +346,7 @@ int8_t vmtreePut(vmtreeState *state, void* key, void *data);
 @brief     	Given a key, returns data associated with key.
 			Note: Space for data must be already allocated.
 			Data is copied from database into data buffer.
+			Records in log buffer not yet inserted into tree are searched first.
 @param     	state
                 VMTree algorithm state structure
 @param     	key
@@ -194,6 +357,53 @@ int8_t vmtreePut(vmtreeState *state, void* key, void *data);
 */
 int8_t vmtreeGet(vmtreeState *state, void* key, void *data);
 
+/**
+@brief     	Given multiple keys, returns data for each key found.
+			Each leaf touched is read once and answers all keys in its range.
+@param     	state
+                VMTree algorithm state structure
+@param     	keys
+                Array of n keys to search for
+@param		n
+				Number of keys
+@param     	data
+                Pre-allocated space for n data values. Data for keys[i] is copied to position i.
+@param		found
+				Pre-allocated array of n values. found[i] is set to 1 if keys[i] is found, 0 otherwise.
+@return		Return number of keys found. -1 if error.
+*/
+int32_t vmtreeGetBatch(vmtreeState *state, void *keys, count_t n, void *data, int8_t *found);
+
+/**
+@brief     	Deletes all records with the given key from the structure.
+			Underfull nodes are merged with or borrow records from a sibling
+			and pages no longer used are marked free for reuse.
+@param     	state
+                VMTree algorithm state structure
+@param     	key
+                Key for record
+@return		Return 0 if success. Non-zero value if error or key not found.
+*/
+int8_t vmtreeDelete(vmtreeState *state, void* key);
+
+/**
+@brief     	Drops oldest subtrees until the tree satisfies the retention limit (state->retentionMode).
+			Called automatically on insert. Call after advancing state->retentionMinKey to reclaim space immediately.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if tree is within limit, -1 if the limit cannot be satisfied.
+*/
+int8_t vmtreeApplyRetention(vmtreeState *state);
+
+/**
+@brief     	Rebuilds the Bloom filter from the keys in the tree.
+			Use after recovery or to remove deleted keys from the filter.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success, -1 if error.
+*/
+int8_t vmtreeBloomRebuild(vmtreeState *state);
+
 /**
 @brief     	Initialize iterator on vmTree structure.
 @param     	state
@@ -205,6 +415,8 @@ void vmtreeInitIterator(vmtreeState *state, vmtreeIterator *it);
 
 /**
 @brief     	Requests next key, data pair from iterator.
+			Records in log buffer not yet inserted into tree are merged in key order.
+			Records must not be inserted or deleted while iterating.
 @param     	state
                 VMTree algorithm state structure
 @param     	it
@@ -213,16 +425,78 @@ void vmtreeInitIterator(vmtreeState *state, vmtreeIterator *it);
                 Key for record (pointer returned)
 @param     	data
                 Data for record (pointer returned)
+@return		Return 1 if record returned, 0 if no more records.
 */
 int8_t vmtreeNext(vmtreeState *state, vmtreeIterator *it, void **key, void **data);
 
 /**
-@brief     	Flushes output buffer.
+@brief     	Builds the tree bottom-up from a stream of records sorted by key.
+			Tree must be empty. Leaves are packed to state->fillFactor percent and
+			written sequentially with one in-progress node per level held in buffer page
+			of the same index. If the tree has more levels than the buffer has pages, the
+			levels from the last buffer page up share it and a partly built node of one of these
+			levels is saved to storage while another is in the page. No mappings are created.
+@param     	state
+                VMTree algorithm state structure
+@param     	it
+                Record iterator returning records in sorted key order
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeBulkLoad(vmtreeState *state, struct recordIteratorState *it);
+
+/**
+@brief     	Flushes output buffer and writes any dirty buffer pages to storage. Writes a checkpoint if checkpoints are enabled.
+			Sorted runs are compacted into the tree.
 @param     	state
                 VMTree algorithm state structure
 */
 int8_t vmtreeFlush(vmtreeState *state);
 
+/**
+@brief     	Inserts records in log buffer into tree and empties log buffer.
+			If sorted runs are used, records are written as a run instead and runs are compacted into tree when there is no space for another run.
+@param     	state
+                VMTree algorithm state structure
+*/
+void vmtreeLogApply(vmtreeState *state);
+
+/**
+@brief     	Merges all sorted runs into the tree. Run pages are read in order of their first key and inserted in large batches.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeRunCompact(vmtreeState *state);
+
+/**
+@brief     	Inserts messages buffered in interior nodes whose subtrees overlap a key range into leaves. Nodes are flushed in key order.
+@param     	state
+                VMTree algorithm state structure
+@param     	minKey
+                Smallest key in range. NULL starts at leftmost node.
+@param     	maxKey
+                Largest key in range. NULL ends at rightmost node.
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeMsgFlush(vmtreeState *state, void *minKey, void *maxKey);
+
+/**
+@brief     	Writes every leaf that has delta records so delta records are included in leaf pages and delta pages are empty.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeDeltaMergeAll(vmtreeState *state);
+
+/**
+@brief     	Writes records in log buffer not yet in the write-ahead log. Used to commit inserts when the commit policy has not,
+			e.g. from a timer or before sleeping.
+@param     	state
+                VMTree algorithm state structure
+@return		Return 0 if success, -1 if no write-ahead log or error.
+*/
+int8_t vmtreeWalCommit(vmtreeState *state);
+
 /**
 @brief     	Prints VMTree structure to standard output.
 @param     	state
@@ -318,6 +592,17 @@ int8_t vmtreeIsValid(void *statePtr, id_t pageNum, id_t *parentId, void **parent
 */
 int8_t vmtreeMovePage(void *state, id_t prev, id_t curr, void *buf);
 
+/**
+@brief     	Informs the VMTree that the buffer read a page from storage. Delta records of a leaf are added to the page.
+@param     	state
+                VMTree algorithm state structure
+@param		pageNum
+				Physical page number
+@param		buf
+				Buffer containing the page
+*/
+void vmtreeDeltaLoad(void *state, id_t pageNum, void *buf);
+
 /**
 @brief     	Gets a page mapping or returns current page number if no mapping.
 @param     	state
@@ -367,6 +652,41 @@ id_t vmtreeUpdatePrev(vmtreeState *state, void *buf, id_t currId);
 */
 void vmtreeSetCountBitsInterior(vmtreeState* state, void *buf, int16_t count);
 
+/**
+@brief     	Writes a compacted and sorted node in buffer 0 to a new page for NOR overwrite
+			and updates its parent. Underfull nodes are merged with or borrow records from a sibling.
+@param     	state
+                VMTree algorithm state structure
+@param     	buf
+                Buffer page 0 containing compacted and sorted node
+@param     	count
+                Number of records (leaf) or entries (interior) in node
+@param     	l
+                Level of node in tree
+@return		Return 0 if success. Non-zero value if error.
+*/
+int8_t vmtreeUpdateNodeNorOverwrite(vmtreeState *state, void *buf, int16_t count, int8_t l);
+
+/**
+@brief     	Drops the oldest records by detaching the leftmost subtree of a node on the leftmost path.
+			Pages of the subtree are marked free without reading any leaves.
+@param     	state
+                VMTree algorithm state structure
+@param     	minKey
+                Smallest key to retain or NULL to drop oldest subtree regardless of key
+@return		Return 0 if subtree dropped, -1 if nothing to drop or error.
+*/
+int8_t vmtreeDropOldest(vmtreeState *state, void *minKey);
+
+/**
+@brief     	Returns 1 if vmtreeDropOldest() may drop a subtree for state->retentionMinKey, 0 if it cannot.
+			The smallest separator of a leftmost child that may be dropped is kept in state->retentionFence
+			so the leftmost path is only searched again after nodes are added or removed.
+@param     	state
+                VMTree algorithm state structure
+*/
+int8_t vmtreeRetentionCanDrop(vmtreeState *state);
+
 /**
 @brief     	Compares two values by bytes. 
 @param     	a